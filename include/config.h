@@ -31,11 +31,35 @@
 
 #define ETHERNET_MAX_TRANSPORT_UNIT 1500 // 以太网最大传输单元
 
+#ifndef NET_LOG_LEVEL
+#define NET_LOG_LEVEL 3 // 编译进去的跟踪级别：0 不记录，1 ERROR，2 WARN，3 INFO，4 DEBUG（每个段都记录），见 trace.h
+#endif
+#define NET_TRACE_FILE "net.trace" // main 的跟踪文件，崩溃后用 trace_decode 工具解码
+// #define NET_LATENCY              // 记录每个包经过各层的时延直方图，见 latency.h；不定义时跟踪点整个编译掉
+
+#define NET_SHARDS 1 // 协议栈分片（工作线程）数，大于 1 时 main 以多核分片模式运行，见 shard.h
+
 #define ARP_TIMEOUT_SEC (60 * 5) // arp 表过期时间
 #define ARP_MIN_INTERVAL 1       // 向相同地址发送 arp 请求的最小间隔
 
 #define IP_DEFALUT_TTL 64 // IP 默认 TTL
 
+#define TCP_DEFAULT_MSS 536                             // 对端未通告 MSS 时使用的默认值（RFC 1122）
+#define TCP_MAX_MSS (ETHERNET_MAX_TRANSPORT_UNIT - 40) // 单个 TCP 段的最大负载，MTU 减去 IP 与 TCP 首部，保证不触发 IP 分片
+#define TCP_RX_BUF_SIZE (1 << 16)                       // 每个连接的接收缓存大小，必须是 2 的幂
+#define TCP_TX_BUF_SIZE (1 << 16)                       // 每个连接的发送缓存大小，必须是 2 的幂
+#define TCP_TX_REFS 32                                  // 每个连接发送队列的描述符数，即 tx_buf 数据和引用的外部内存最多交替这么多段
+#define TCP_DELACK_MS 40                                // 延迟 ACK 的最长等待时间（毫秒）
+#define TCP_DELACK_SEGS 2                               // 累计收到这么多个数据段后立即 ACK
+#define TCP_TIMER_TICK_MS 10                            // tcp_poll 扫描定时器的最小间隔（毫秒）
+#define TCP_SYN_BACKLOG 128                             // 半连接（SYN_RCVD）数量上限，超过后改用 SYN cookie
+#define TCP_SYN_RCVD_TIMEOUT_MS 5000                    // 半连接等待最后一个 ACK 的时间（毫秒）
+#define TCP_ACCEPT_BACKLOG 128                          // 默认的 accept 队列长度
+#define TCP_ACCEPT_BACKLOG_MAX 4096                     // accept 队列长度上限
+#define TCP_MSL_SEC 30                                  // 报文段最大生存时间，TIME_WAIT 持续 2MSL
+#define TCP_TW_MAX 4096                                 // TIME_WAIT 表容量，满了之后关闭的连接不再进入 TIME_WAIT
+#define TCP_TW_WHEEL_SLOTS 64                           // TIME_WAIT 时间轮的槽数，每槽 1 秒，必须大于 2MSL 的秒数
+
 #define BUF_MAX_LEN (2 * UINT16_MAX + UINT8_MAX) // buf 最大长度
 
 #define MAP_MAX_LEN (16 * BUF_MAX_LEN) // map 最大长度
@@ -0,0 +1,50 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tcp.h"
+
+/*
+ * 协作式有栈协程：每个连接一个协程，处理程序可以写成顺序的阻塞风格，
+ * coro_read 没有数据、coro_write 发送缓存满时挂起当前协程，回到协议栈的主循环，
+ * TCP 事件到达后由 coro_run 恢复它，不会在里面重入 net_poll，也不会让其他连接等待。
+ *
+ * 协程和协议栈运行在同一个线程里，用 ucontext 切换，不需要加锁；
+ * 主循环每次 net_poll 之后调用 coro_run，接受新连接、为每个连接启动协程、恢复就绪的协程。
+ * 处理程序返回时关闭连接，协程的栈留在池中给下一个连接复用。
+ * 协程栈的大小固定为 CORO_STACK_SIZE，处理程序不能在栈上放太大的数组，也不能递归太深。
+ *
+ * Windows 上没有 ucontext，这个模块只在 POSIX 上编译。
+ */
+
+#define CORO_STACK_SIZE (64 * 1024) // 每个协程的栈大小
+#define CORO_MAX 4096               // 同时存在的协程数，达到上限时新连接留在 accept 队列中
+#define CORO_LISTEN_MAX 8           // 最多的监听端口数
+#define CORO_ECLOSED -1             // 连接已关闭或被复位
+
+typedef struct coro coro_t;
+typedef struct coro_sched coro_sched_t;
+typedef void (*coro_fn_t)(coro_t *co, void *arg); // 连接的处理程序，在协程里运行，返回时关闭连接
+
+typedef struct coro_stat // 协程的计数
+{
+    size_t spawned;  // 启动的协程数
+    size_t live;     // 还没结束的协程数
+    size_t pooled;   // 池中可以复用的栈数
+    size_t switches; // 切换进协程的次数
+    size_t waits;    // 因为没有数据或发送缓存满而挂起的次数
+} coro_stat_t;
+
+int coro_init(void);
+int coro_listen(uint16_t port, coro_fn_t fn, void *arg);
+void coro_run(void);
+void coro_free(void);
+void coro_get_stat(coro_stat_t *stat);
+
+// 以下只能在协程里调用
+int64_t coro_read(coro_t *co, void *data, size_t len);
+int64_t coro_write(coro_t *co, const void *data, size_t len);
+tcp_connect_t *coro_connect(coro_t *co);
+
+#endif
@@ -10,4 +10,39 @@ int driver_open();
 int driver_recv(buf_t *buf);
 int driver_send(buf_t *buf);
 void driver_close();
+
+struct net_driver // 协议栈实例自己的驱动，如分片模式下与分发线程之间的环；net_stack()->dev 为 NULL 时使用上面链接进来的驱动
+{
+    int (*open)(void);
+    int (*recv)(buf_t *buf);
+    int (*send)(buf_t *buf);
+    void (*close)(void);
+};
+
+static inline int net_driver_open()
+{
+    const net_driver_t *dev = net_stack()->dev;
+    return dev ? dev->open() : driver_open();
+}
+
+static inline int net_driver_recv(buf_t *buf)
+{
+    const net_driver_t *dev = net_stack()->dev;
+    return dev ? dev->recv(buf) : driver_recv(buf);
+}
+
+static inline int net_driver_send(buf_t *buf)
+{
+    const net_driver_t *dev = net_stack()->dev;
+    return dev ? dev->send(buf) : driver_send(buf);
+}
+
+static inline void net_driver_close()
+{
+    const net_driver_t *dev = net_stack()->dev;
+    if (dev)
+        dev->close();
+    else
+        driver_close();
+}
 #endif
\ No newline at end of file
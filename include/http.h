@@ -2,10 +2,35 @@
 #define HTTP_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define XHTTP_DOC_DIR "../htmldocs"
+#define HTTP_KEEPALIVE_TIMEOUT_MS 5000 // 持久连接空闲多久后关闭（毫秒）
+#define HTTP_KEEPALIVE_MAX 100         // 一个持久连接最多处理的请求数
+#define HTTP_CACHE_MAX_FILES 256           // 文件缓存最多缓存的文件数
+#define HTTP_CACHE_MAX_BYTES (64 << 20)    // 文件缓存占用内存的上限
+#define HTTP_CACHE_FILE_MAX (4 << 20)      // 超过这个大小的文件不缓存，每次从磁盘流式发送
+#define HTTP_CACHE_CHECK_MS 1000           // 缓存的文件每隔多久用 stat 检查一次是否被修改（毫秒）
+#define HTTP_CACHE_PATH_MAX 128            // 缓存键（请求路径）的最大长度
+#define HTTP_COMPRESS_MIN 128              // 小于这个大小的文本文件不生成压缩版本
+
+typedef struct http_stat // HTTP 服务器的计数
+{
+    size_t connections;   // 接受的连接数
+    size_t requests;      // 处理的请求数
+    size_t reused;        // 在已有连接上处理的请求数（第二个及以后的请求）
+    size_t pipelined;     // 上一个响应发完时已经在 rx_buf 中排队的请求数
+    size_t idle_timeouts; // 空闲超时关闭的连接数
+    size_t not_found;     // 404 响应数
+    size_t not_modified;  // 条件请求命中、只回报头的 304 响应数
+    size_t partial;       // Range 请求的 206 响应数
+    size_t bad_requests;  // 格式错误或不支持而关闭的请求数
+    size_t bytes_sent;    // 响应的字节数，包括报头
+} http_stat_t;
 
 int http_server_open(uint16_t port);
+void http_server_fini(void);
 void http_server_run(void);
+void http_get_stat(http_stat_t *stat);
 
 #endif
@@ -0,0 +1,61 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "http.h"
+
+typedef enum http_encoding // 缓存的文件可能有的几种编码
+{
+    HTTP_ENCODING_IDENTITY, // 原始内容，总是存在
+    HTTP_ENCODING_GZIP,     // 定义了 HTTP_GZIP 时，加载文本类文件时用 zlib 预先压缩
+    HTTP_ENCODING_BR,       // 定义了 HTTP_BROTLI 时，加载文本类文件时用 brotli 预先压缩
+    HTTP_ENCODING_NUM,
+} http_encoding_t;
+
+typedef struct http_variant // 文件的一种编码，内容和响应头都在加载时准备好
+{
+    uint8_t *data;         // 内容，为 NULL 表示没有这种编码
+    size_t size;           // 内容大小
+    const char *encoding;  // Content-Encoding 的值，原始内容为 NULL
+    char etag[40];         // 带引号的 ETag，由大小、修改时间和编码生成，每种编码各不相同
+    char header[320];      // 预先生成的 Content-Type、Content-Length、Content-Encoding、Vary、ETag、Last-Modified 报头
+    size_t header_len;
+} http_variant_t;
+
+typedef struct http_file // 缓存的一个文件，各种编码的内容和不随请求变化的响应头都预先准备好
+{
+    http_variant_t variants[HTTP_ENCODING_NUM]; // 下标为 http_encoding_t
+    time_t mtime;           // 加载时文件的修改时间
+    uint64_t checked;       // 上次用 stat 检查的时间（time_ms）
+    const char *mime;       // Content-Type
+    uint8_t vary;           // 有压缩版本，响应要带 Vary: Accept-Encoding
+    char last_modified[32]; // Last-Modified，HTTP 日期格式
+    uint32_t refs;          // 引用计数，缓存表本身持有一个，正在发送的响应各持有一个
+    uint8_t stale;          // 已从缓存表中移除，引用计数归零时释放
+} http_file_t;
+
+typedef struct http_cache_stat // 文件缓存的计数
+{
+    size_t lookups;      // 查找次数
+    size_t hits;         // 在内存中找到且不需要重新加载的次数
+    size_t misses;       // 需要从磁盘加载（包括首次加载和修改后重新加载）的次数
+    size_t revalidations; // 用 stat 检查修改时间的次数
+    size_t reloads;      // 检查后发现文件被修改而重新加载的次数
+    size_t uncached;     // 文件过大或缓存已满，只能从磁盘流式发送的次数
+    size_t files;        // 缓存的文件数
+    size_t bytes;        // 缓存的文件内容占用的字节数，包括压缩版本
+    size_t compressed;   // 加载时生成的压缩版本数
+    size_t compressed_saved; // 压缩版本比原始内容节省的字节数之和
+} http_cache_stat_t;
+
+int http_cache_init(void);
+void http_cache_fini(void);
+http_file_t *http_cache_get(const char *path, size_t path_len);
+void http_cache_put(http_file_t *file);
+const http_variant_t *http_cache_variant(const http_file_t *file, unsigned accept);
+const char *http_mime_type(const char *path, size_t path_len);
+void http_cache_get_stat(http_cache_stat_t *stat);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define HTTP_MAX_HEADERS 32 // 最多保存的请求头数，超过的部分只解析不保存
+#define HTTP_ACCEPT_GZIP 0x1 // Accept-Encoding 允许 gzip
+#define HTTP_ACCEPT_BR 0x2   // Accept-Encoding 允许 br
+
+typedef enum http_method
+{
+    HTTP_METHOD_OTHER,
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+} http_method_t;
+
+typedef struct http_str // 指向原始数据中的一段，不以 '\0' 结尾
+{
+    const char *p;
+    size_t len;
+} http_str_t;
+
+typedef struct http_header
+{
+    http_str_t name;
+    http_str_t value;
+} http_header_t;
+
+typedef struct http_request // 解析结果，所有字符串都直接指向传入的数据，不做拷贝
+{
+    http_method_t method;
+    http_str_t method_str;
+    http_str_t path;
+    uint8_t version_minor;   // HTTP/1.x 中的 x
+    uint8_t keep_alive;      // 按版本和 Connection 头判断是否保持连接
+    uint8_t has_body_length; // 带有 Content-Length
+    size_t content_length;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    size_t num_headers;
+    size_t header_len; // 请求行加请求头的总长度，包括结尾的空行
+} http_request_t;
+
+typedef struct http_parser // 增量解析的状态：已经扫描过、确认不含请求头结尾的字节数
+{
+    size_t scanned;
+} http_parser_t;
+
+void http_parser_init(http_parser_t *parser);
+int http_parse_request(http_parser_t *parser, const char *data, size_t len, http_request_t *req);
+const http_str_t *http_request_header(const http_request_t *req, const char *name);
+int http_parse_date(http_str_t s, time_t *t);
+int http_parse_range(http_str_t s, size_t size, size_t *first, size_t *last);
+int http_etag_match(http_str_t list, const char *etag);
+unsigned http_parse_accept_encoding(http_str_t s);
+
+#endif
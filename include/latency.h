@@ -0,0 +1,170 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "config.h"
+
+/*
+ * 每个包经过各层的时延：驱动收上来一帧时记下 TSC 时间戳，之后在 ethernet_in、net_in、ip_in、
+ * udp_in / tcp_in、进入应用的处理程序和 driver_send 处各取一次 TSC，把“从驱动收上来到这里”的纳秒数
+ * 记进这一处的直方图。相邻两处的分位数之差就是中间那一层花的时间。
+ *
+ * 直方图是 HDR 式的对数线性分桶：小于 LATENCY_SUB_BUCKETS 纳秒的每纳秒一个桶，
+ * 之后每个 2 的幂区间再等分成 LATENCY_SUB_BUCKETS 个桶，相对误差不超过 1 / LATENCY_SUB_BUCKETS。
+ * 直方图放在协议栈实例的计数 stats_t 里，和计数器一样只由运行实例的线程写，stats_snapshot 时一起加起来。
+ *
+ * 只有定义了 NET_LATENCY（见 config.h）才编译进去；没有定义时跟踪点展开为空，stats_t 里也没有直方图。
+ * 一帧处理完之前发出的帧（如回的 ACK、应答）算在 driver_send 里，定时器等其他原因发出的帧不计。
+ */
+
+/* 跟踪点列表：X(编号, 名字)，按包经过的顺序排列 */
+#define LATENCY_STAGES(X)                                                               \
+    X(ETHERNET_IN, "ethernet_in")   /* 进入以太网层 */                                  \
+    X(NET_IN, "net_in")             /* 交给上层协议，以太网到 IP、IP 到传输层各一次 */  \
+    X(IP_IN, "ip_in")               /* 进入 IP 层 */                                    \
+    X(UDP_IN, "udp_in")             /* 进入 UDP */                                      \
+    X(TCP_IN, "tcp_in")             /* 进入 TCP */                                      \
+    X(HANDLER, "handler")           /* 调用应用的处理程序，每次调用一次 */              \
+    X(DRIVER_SEND, "driver_send")   /* 处理这一帧时发出的每一帧 */
+
+typedef enum latency_stage
+{
+#define LATENCY_STAGE_ID(id, name) LATENCY_##id,
+    LATENCY_STAGES(LATENCY_STAGE_ID)
+#undef LATENCY_STAGE_ID
+    LATENCY_MAX,
+} latency_stage_t;
+
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 40                                                        // 记录的最大时延 2^40 纳秒（约 18 分钟），更大的记在最后一个桶
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS) // 直方图的桶数
+
+typedef struct latency_hist // 一个跟踪点的直方图，只由运行协议栈实例的线程写
+{
+    _Atomic uint64_t sum; // 时延之和（纳秒），算平均值用
+    _Atomic uint64_t bucket[LATENCY_BUCKETS];
+} latency_hist_t;
+
+typedef struct latency_snap // 某一时刻的直方图
+{
+    uint64_t sum;
+    uint64_t bucket[LATENCY_BUCKETS];
+} latency_snap_t;
+
+/**
+ * @brief 纳秒数对应的桶：小于 LATENCY_SUB_BUCKETS 时就是它本身，
+ *        否则取最高位之下的 LATENCY_SUB_BITS 位作为区间内的编号
+ *
+ * @param ns 时延
+ * @return int 桶的编号
+ */
+static inline int latency_index(uint64_t ns)
+{
+    if (ns < LATENCY_SUB_BUCKETS)
+        return (int)ns;
+    if (ns >> LATENCY_MAX_BITS)
+        return LATENCY_BUCKETS - 1;
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    return (shift << LATENCY_SUB_BITS) + (int)(ns >> shift);
+}
+
+/**
+ * @brief 桶里最小的纳秒数，latency_index 的反函数
+ *
+ * @param index 桶的编号
+ * @return uint64_t 纳秒数
+ */
+static inline uint64_t latency_value(int index)
+{
+    if (index < LATENCY_SUB_BUCKETS)
+        return (uint64_t)index;
+    int shift = (index >> LATENCY_SUB_BITS) - 1;
+    return (uint64_t)((index & (LATENCY_SUB_BUCKETS - 1)) | LATENCY_SUB_BUCKETS) << shift;
+}
+
+void latency_diff(latency_snap_t *snap, const latency_snap_t *base);
+uint64_t latency_count(const latency_snap_t *snap);
+uint64_t latency_percentile(const latency_snap_t *snap, double p);
+size_t latency_dump(const latency_snap_t snap[LATENCY_MAX], char *buf, size_t size);
+
+#ifdef NET_LATENCY
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+extern uint64_t latency_tsc_mult; // 每个 TSC 周期的纳秒数乘 2^latency_tsc_shift，小于 2^32，latency_calibrate 时测出
+extern int latency_tsc_shift;     // 不超过 32，TSC 越慢（每周期的纳秒数越大）越小
+
+/**
+ * @brief 读时间戳计数器。x86 上是 rdtsc，aarch64 上是虚拟计数器，其他平台退回到单调时钟的纳秒数
+ *
+ * @return uint64_t 计数
+ */
+static inline uint64_t latency_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t tsc;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(tsc));
+    return tsc;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief 把 TSC 周期数换成纳秒，即 ticks * mult >> shift，把 ticks 分成高低两个 32 位相乘。
+ *        mult 小于 2^32，低半部分的乘积不会溢出；高半部分的结果就是纳秒数的高位部分，
+ *        不论 TSC 是 GHz 级的 rdtsc 还是几十 MHz 的 aarch64 计数器，都要几百年才会溢出
+ *
+ * @param ticks 周期数
+ * @return uint64_t 纳秒数
+ */
+static inline uint64_t latency_ns(uint64_t ticks)
+{
+    return (((ticks >> 32) * latency_tsc_mult) << (32 - latency_tsc_shift)) +
+           (((ticks & 0xffffffff) * latency_tsc_mult) >> latency_tsc_shift);
+}
+
+/**
+ * @brief 记录一次时延。只有一个线程写，和 stats_add 一样读出再写回
+ *
+ * @param hist 直方图
+ * @param ns 时延（纳秒）
+ */
+static inline void latency_record(latency_hist_t *hist, uint64_t ns)
+{
+    _Atomic uint64_t *b = &hist->bucket[latency_index(ns)];
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&hist->sum, atomic_load_explicit(&hist->sum, memory_order_relaxed) + ns, memory_order_relaxed);
+}
+
+void latency_calibrate(void);
+
+/* 驱动收上来一帧时开始计时，这一帧处理完后停止，停止后的跟踪点不记录 */
+#define LATENCY_BEGIN() (net_stack()->rx_tsc = latency_tsc())
+#define LATENCY_END() (net_stack()->rx_tsc = 0)
+
+/* 跟踪点：记录当前帧从驱动收上来到这里的时延，用法：LATENCY_MARK(IP_IN) */
+#define LATENCY_MARK(stage)                                                                            \
+    do                                                                                                 \
+    {                                                                                                  \
+        net_stack_t *stack_ = net_stack();                                                             \
+        if (stack_->rx_tsc)                                                                            \
+            latency_record(&stack_->stats.latency[LATENCY_##stage], latency_ns(latency_tsc() - stack_->rx_tsc)); \
+    } while (0)
+#else
+#define LATENCY_BEGIN() ((void)0)
+#define LATENCY_END() ((void)0)
+#define LATENCY_MARK(stage) ((void)0)
+#endif
+
+#endif
@@ -6,6 +6,8 @@
 #include "utils.h"
 #include "map.h"
 #include "buf.h"
+#include "stats.h"
+#include "trace.h"
 
 typedef enum net_protocol
 {
@@ -17,16 +19,61 @@ typedef enum net_protocol
 } net_protocol_t;
 
 typedef void (*net_handler_t)(buf_t *buf, uint8_t *src);
+typedef void (*net_fini_t)(void); // 一层的释放函数，释放这一层在当前协议栈实例上分配的内存
 
 #define NET_MAC_LEN 6 // mac 地址长度
 #define NET_IP_LEN 4  // ip 地址长度
+#define NET_FINI_MAX 8 // 每个实例最多登记的释放函数数
 
-extern uint8_t net_if_mac[NET_MAC_LEN];
-extern uint8_t net_if_ip[NET_IP_LEN];
-extern buf_t rxbuf, txbuf; // 一个 buf 足够单线程使用
+typedef struct tcp_layer tcp_layer_t;
+typedef struct http_server http_server_t;
+typedef struct http_cache http_cache_t;
+typedef struct net_driver net_driver_t;
+typedef struct sock_layer sock_layer_t;
+typedef struct coro_sched coro_sched_t;
 
+typedef struct net_stack // 一个协议栈实例（一块网卡）的全部状态，不同实例之间互不影响
+{
+    uint8_t if_mac[NET_MAC_LEN]; // 网卡 MAC 地址
+    uint8_t if_ip[NET_IP_LEN];   // 网卡 IP 地址
+    buf_t rxbuf, txbuf;          // 网卡接收和发送缓冲区，一个实例只在一个线程里使用，一个 buf 足够
+    map_t net_table;             // 协议表 <协议号，处理程序>
+    map_t arp_table;             // arp 地址转换表 <ip,mac>
+    map_t arp_buf;               // 等待 arp 应答的数据包 <ip,buf_t>
+    map_t udp_table;             // udp 端口表 <端口号，处理程序>
+    uint16_t ip_id;              // IP 分组标识计数器
+    tcp_layer_t *tcp;            // tcp 的连接表、TIME_WAIT 表和计数，tcp_init 时分配
+    http_server_t *http;         // http 服务器的连接和计数，http_server_open 时分配
+    http_cache_t *http_cache;    // http 服务器的文件缓存，http_cache_init 时分配
+    sock_layer_t *sock;          // 跨线程套接字接口的命令环和套接字表，sock_init 时分配
+    coro_sched_t *coro;          // 协程调度器，coro_init 时分配
+    const net_driver_t *dev;     // 实例自己的驱动，为 NULL 时使用链接进来的 driver_*
+    void *driver;                // 驱动的私有数据，如 pcap 句柄
+    trace_ring_t *trace;         // 跟踪环，第一次 TRACE 时领取
+    net_fini_t fini[NET_FINI_MAX]; // 各层登记的释放函数，net_stack_destroy 时按登记的相反顺序调用
+    int fini_count;
+    stats_t stats;               // 各层的计数，只由运行这个实例的线程写
+#ifdef NET_LATENCY
+    uint64_t rx_tsc;             // 正在处理的帧从驱动收上来时的 TSC，没有在处理的帧时为 0，见 latency.h
+#endif
+} net_stack_t;
+
+/* 当前线程正在使用的协议栈实例，各层通过 net_stack() 取得状态。
+    主线程默认使用一个静态实例；其他线程要先 net_stack_bind 自己的实例。
+*/
+extern _Thread_local net_stack_t *net_stack_current;
+
+static inline net_stack_t *net_stack(void)
+{
+    return net_stack_current;
+}
+
+net_stack_t *net_stack_create(const uint8_t *mac, const uint8_t *ip);
+void net_stack_destroy(net_stack_t *stack);
+void net_stack_bind(net_stack_t *stack);
 int net_init();
 void net_poll();
 int net_in(buf_t *buf, uint16_t protocol, uint8_t *src);
 void net_add_protocol(uint16_t protocol, net_handler_t handler);
+void net_add_fini(net_fini_t fini);
 #endif
\ No newline at end of file
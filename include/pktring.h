@@ -0,0 +1,82 @@
+#ifndef PKTRING_H
+#define PKTRING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "config.h"
+
+/*
+ * 线程之间传递数据包用的无锁环和包池。
+ *
+ * 环里放的是指针（包句柄），不拷贝包的内容；入队、出队都按批进行，一次原子操作搬一批。
+ * 生产者用 release 发布写位置，消费者用 acquire 读取，保证看到写位置时槽里的句柄和包的内容都已经写好；
+ * 消费者用 release 归还读位置，生产者用 acquire 读取，保证槽被覆盖之前消费者已经读完。
+ * 生产者和消费者各自的字段放在不同的缓存行上，并各自缓存对方的位置，只有缓存的值不够用时才去读对方的缓存行。
+ *
+ * 一个环要么只用 pktring_sp_enqueue（单生产者），要么只用 pktring_mp_enqueue（多生产者），
+ * 出队只能有一个消费者。
+ */
+
+#define PKTRING_CACHE_LINE 64
+#define PKT_DATA_MAX (ETHERNET_MAX_TRANSPORT_UNIT + 14) // 包的最大长度：一个以太网帧
+#define PKT_FREE_BATCH 32                               // pkt_free 每次放回包池的最大批量
+
+typedef struct pktring
+{
+    // 生产者的缓存行
+    _Atomic uint32_t tail;    // 已经发布的写位置，消费者只能读到这里
+    _Atomic uint32_t reserve; // 多生产者已经占用的写位置，占用之后写好槽再按顺序推进 tail
+    uint32_t head_cache;      // 单生产者缓存的读位置
+    uint8_t pad0[PKTRING_CACHE_LINE - 3 * sizeof(uint32_t)];
+    // 消费者的缓存行
+    _Atomic uint32_t head; // 读位置，只由消费者推进
+    uint32_t tail_cache;   // 消费者缓存的写位置
+    uint8_t pad1[PKTRING_CACHE_LINE - 2 * sizeof(uint32_t)];
+    // 初始化之后只读
+    uint32_t mask; // 容量减 1，容量是 2 的幂
+    void **slots;
+} pktring_t;
+
+typedef struct pktpool pktpool_t;
+
+typedef struct pkt // 一个包，由包池分配，可以被多个持有者共享
+{
+    pktpool_t *pool;      // 所属的包池
+    _Atomic uint32_t refs; // 持有者个数，最后一个 pkt_free 时回到包池
+    uint16_t len;         // 数据长度
+    uint16_t port;        // 使用者自定义，如发出这个包的分片号
+    uint8_t data[PKT_DATA_MAX];
+} pkt_t;
+
+struct pktpool // 包池：包只能由所有者线程分配，任何线程都可以放回
+{
+    pktring_t free; // 空闲的包，多生产者单消费者
+    pkt_t *pkts;
+    uint32_t count;
+};
+
+int pktring_init(pktring_t *ring, uint32_t size);
+void pktring_free(pktring_t *ring);
+unsigned pktring_sp_enqueue(pktring_t *ring, void *const *objs, unsigned n);
+unsigned pktring_mp_enqueue(pktring_t *ring, void *const *objs, unsigned n);
+unsigned pktring_sc_dequeue(pktring_t *ring, void **objs, unsigned n);
+
+pktpool_t *pktpool_create(uint32_t count);
+void pktpool_destroy(pktpool_t *pool);
+unsigned pkt_alloc(pktpool_t *pool, pkt_t **pkts, unsigned n);
+void pkt_free(pkt_t **pkts, unsigned n);
+
+// 环中的句柄数，其他线程同时在操作时是近似值
+static inline uint32_t pktring_count(pktring_t *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) - atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+// 再增加 n 个持有者，调用者必须已经持有这个包
+static inline void pkt_ref(pkt_t *pkt, uint32_t n)
+{
+    atomic_fetch_add_explicit(&pkt->refs, n, memory_order_relaxed);
+}
+
+#endif
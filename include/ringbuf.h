@@ -0,0 +1,39 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct ringbuf_iov // 环形缓冲区中的一段连续内存
+{
+    uint8_t *base; // 起始地址
+    size_t len;    // 长度
+} ringbuf_iov_t;
+
+typedef struct ringbuf // 字节流环形缓冲区，容量为 2 的幂，读写都不需要搬移数据
+{
+    uint8_t *data; // 堆上分配的存储空间
+    uint32_t size; // 容量，2 的幂
+    uint32_t head; // 读位置，自由增长，用 size - 1 取模
+    uint32_t tail; // 写位置，自由增长，tail - head 即为数据量
+} ringbuf_t;
+
+int ringbuf_init(ringbuf_t *rb, uint32_t size);
+void ringbuf_free(ringbuf_t *rb);
+size_t ringbuf_write(ringbuf_t *rb, const void *data, size_t len);
+size_t ringbuf_read(ringbuf_t *rb, void *data, size_t len);
+int ringbuf_peek(ringbuf_t *rb, size_t offset, size_t len, ringbuf_iov_t iov[2]);
+void ringbuf_consume(ringbuf_t *rb, size_t len);
+
+// 缓冲区中的数据量
+static inline uint32_t ringbuf_len(const ringbuf_t *rb)
+{
+    return rb->tail - rb->head;
+}
+// 缓冲区的剩余空间
+static inline uint32_t ringbuf_space(const ringbuf_t *rb)
+{
+    return rb->size - (rb->tail - rb->head);
+}
+
+#endif
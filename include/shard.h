@@ -0,0 +1,50 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "net.h"
+
+/*
+ * 多核分片模式：N 个工作线程各自运行一个完整的协议栈实例（分片），有自己的 TCP 连接表、UDP 端口表和收发缓冲区，
+ * 分片之间不共享任何可写状态。调用 shard_poll 的线程是分发线程，独占真正的网卡驱动：
+ * 收到的帧按 IPv4 四元组的 Toeplitz 哈希（与网卡 RSS 相同的算法和默认密钥）经间接表选出分片，
+ * 拷进包池的包里，把句柄成批放进这个分片的单生产者单消费者环；分片发出的帧也放在包里，
+ * 经所有分片共用的多生产者单消费者环交给分发线程，再交给驱动发送。包环和包池见 pktring.h。
+ *
+ * 同一条流的帧总是落在同一个分片上，所以 TCP 不需要跨分片同步。
+ * ARP 帧的句柄交给所有分片，各分片的 ARP 表各自学习，只读查询不需要加锁；对本机的 ARP 请求只由 0 号分片应答。
+ * 不能按四元组哈希的 IPv4 帧（分片、ICMP 等）按源、目的地址哈希，其余的帧交给 0 号分片。
+ */
+
+#define SHARD_MAX 8            // 最多的分片数
+#define SHARD_RING_SLOTS 1024  // 每个分片的接收环能排队的帧数和发送包数，必须是 2 的幂
+#define SHARD_RETA_SIZE 128    // RSS 间接表的项数，与常见网卡一致
+#define SHARD_POLL_BATCH 64    // shard_poll 一次最多从驱动收的帧数
+#define SHARD_WORKER_BATCH 32  // 分片每调用一次应用的 run 之前最多处理的帧数
+
+typedef struct shard_app // 在每个分片的线程里运行的应用
+{
+    int (*init)(int shard, void *arg);  // 分片的协议栈 net_init 之后调用，如 http_server_open；失败返回 -1
+    void (*run)(int shard, void *arg);  // 每处理一批帧后调用，如 http_server_run，可以为 NULL
+    void (*fini)(int shard, void *arg); // 分片退出、协议栈释放之前调用，可以在这里读取分片的计数，可以为 NULL
+} shard_app_t;
+
+typedef struct shard_stat // 一个分片的计数
+{
+    size_t rx_frames; // 分发给这个分片的帧数
+    size_t rx_stalls; // 接收环满、分发线程等待的次数
+    size_t tx_frames; // 这个分片发出的帧数
+    size_t tx_stalls; // 发送包用完、分片等待的次数
+    size_t arp_drops; // 非 0 号分片重复的 ARP 应答，由分发线程丢弃
+} shard_stat_t;
+
+int shard_start(int n, const shard_app_t *app, void *arg);
+int shard_poll(void);
+void shard_stop(void);
+int shard_count(void);
+int shard_select(const uint8_t *frame, size_t len);
+void shard_get_stat(int shard, shard_stat_t *stat);
+uint32_t shard_toeplitz(const uint8_t *input, size_t len);
+
+#endif
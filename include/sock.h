@@ -0,0 +1,108 @@
+#ifndef SOCK_H
+#define SOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "net.h"
+#include "pktring.h"
+
+/*
+ * 跨线程的消息式套接字接口。
+ *
+ * 协议栈仍然只在自己的线程里运行（net_poll），其他线程上的应用不直接调用 tcp_* / udp_*，
+ * 而是把命令（sock_cmd_t）放进协议栈的命令环（多生产者单消费者），协议栈线程在 net_poll 之后调用 sock_poll 取出执行，
+ * 完成后把同一个命令放进提交它的应用上下文的完成队列（单生产者单消费者）。
+ * 接收和 accept 没有数据或连接时命令挂在套接字上，事件到达时再完成；发送缓存满时发送命令等 TCP_CONN_WRITABLE 继续写。
+ * 套接字表只由协议栈线程访问，应用线程只访问自己的上下文和命令，两边都不需要加锁。
+ * 套接字层接管它打开的端口，同一个端口不能再直接用 tcp_listen / udp_open 注册。
+ *
+ * 命令的内存和其中的数据缓冲区属于应用，从提交到完成之间不能修改或释放。
+ * 等待中的 RECV / RECVFROM 的缓冲区会投递给 TCP / UDP，之后到达的数据直接拷进应用的内存，不经过协议栈的接收缓存。
+ * 应用可以用 sock_register_buffers 登记一组长期有效的缓冲区，SEND_FIXED 从中发送时 TCP 只引用、不拷贝，
+ * 数据被对端确认之后命令才完成，在此之前缓冲区不能修改。
+ * 每个应用线程用自己的 sock_ctx_t；sock_submit / sock_reap 是异步接口，一次可以提交、收割一批；
+ * sock_listen、sock_recv 等同步接口提交一个命令并等它完成，不能和同一个上下文上未完成的异步命令混用。
+ */
+
+#define SOCK_MAX 1024            // 一个协议栈实例上的套接字数
+#define SOCK_CMD_RING 1024       // 协议栈的命令环容量，必须是 2 的幂
+#define SOCK_CQ_DEPTH 1024       // 每个应用上下文的完成队列容量，也是它最多未完成的命令数，必须是 2 的幂
+#define SOCK_BOUND_MAX 16        // 最多同时打开的监听端口和 UDP 端口数
+#define SOCK_UDP_QUEUE (1 << 16) // 每个 UDP 套接字排队等待接收的数据报字节数，必须是 2 的幂，满了之后丢弃
+#define SOCK_POLL_BATCH 64       // sock_poll 一次最多取出的命令数
+#define SOCK_BUFS_MAX 64         // 每个上下文最多登记的缓冲区数
+
+#define SOCK_EBADF -1   // 套接字不存在或类型不对
+#define SOCK_EINVAL -2  // 参数错误
+#define SOCK_ENOMEM -3  // 套接字或内存用完
+#define SOCK_ECLOSED -4 // 连接已关闭或被复位，或者套接字被关闭时命令还挂着
+#define SOCK_EBUSY -5   // 端口已被占用，或同步调用时上下文上还有未完成的命令
+
+typedef enum sock_op
+{
+    SOCK_OP_LISTEN,     // 在 port 上监听 TCP，结果为套接字号
+    SOCK_OP_UDP_OPEN,   // 打开 UDP 端口 port，结果为套接字号
+    SOCK_OP_ACCEPT,     // 从监听套接字取一个新连接，结果为连接的套接字号，ip / port 为对端地址
+    SOCK_OP_SEND,       // 在连接上发送 data 的 len 字节，全部写进发送缓存后完成，结果为字节数
+    SOCK_OP_RECV,       // 在连接上接收最多 len 字节到 data，有数据时完成，结果为字节数，0 表示对端已关闭
+    SOCK_OP_SENDTO,     // 从 UDP 套接字向 ip:port 发送一个数据报，结果为字节数
+    SOCK_OP_RECVFROM,   // 从 UDP 套接字接收一个数据报，超出 len 的部分截掉，ip / port 为来源
+    SOCK_OP_CLOSE,      // 关闭套接字，挂在它上面的命令以 SOCK_ECLOSED 完成，结果为 0
+    SOCK_OP_SEND_FIXED, // 从登记的 buf_index 号缓冲区中发送 data 的 len 字节，不拷贝，对端确认之后完成，结果为字节数
+} sock_op_t;
+
+typedef struct sock_buf // 登记的缓冲区
+{
+    uint8_t *base;
+    size_t len;
+} sock_buf_t;
+
+typedef struct sock_ctx sock_ctx_t;
+
+typedef struct sock_cmd // 一个命令，完成后原样出现在完成队列里
+{
+    sock_op_t op;
+    int fd;                 // 套接字号
+    uint8_t *data;          // 收发的数据
+    size_t len;             // 数据长度或缓冲区大小
+    uint8_t ip[NET_IP_LEN]; // 对端地址
+    uint16_t port;          // 本地端口（LISTEN / UDP_OPEN）或对端端口
+    uint16_t buf_index;     // SEND_FIXED 使用的登记缓冲区
+    int64_t result;         // 结果，负数为 SOCK_E* 错误码
+    void *user;             // 应用的私有数据
+    // 以下由 sock_submit 和协议栈使用
+    sock_ctx_t *ctx;
+    size_t done;           // 发送命令已经写进发送缓存的字节数，或投递的接收缓冲区已经收到的字节数
+    struct sock_cmd *next; // 挂在套接字上时的队列
+} sock_cmd_t;
+
+struct sock_ctx // 一个应用线程在一个协议栈实例上的上下文
+{
+    net_stack_t *stack;
+    pktring_t cq;      // 完成队列，协议栈生产，应用消费
+    uint32_t inflight; // 已提交还没收割的命令数，只由应用线程读写
+    sock_buf_t bufs[SOCK_BUFS_MAX]; // 登记的缓冲区，协议栈执行 SEND_FIXED 时读取
+    unsigned nbufs;
+};
+
+int sock_init(void);
+void sock_poll(void);
+void sock_free(void);
+
+sock_ctx_t *sock_ctx_create(net_stack_t *stack);
+void sock_ctx_destroy(sock_ctx_t *ctx);
+unsigned sock_submit(sock_ctx_t *ctx, sock_cmd_t *const *cmds, unsigned n);
+unsigned sock_reap(sock_ctx_t *ctx, sock_cmd_t **cmds, unsigned n);
+int sock_register_buffers(sock_ctx_t *ctx, const sock_buf_t *bufs, unsigned n);
+
+int sock_listen(sock_ctx_t *ctx, uint16_t port);
+int sock_udp_open(sock_ctx_t *ctx, uint16_t port);
+int sock_accept(sock_ctx_t *ctx, int fd, uint8_t *ip, uint16_t *port);
+int64_t sock_send(sock_ctx_t *ctx, int fd, const void *data, size_t len);
+int64_t sock_send_fixed(sock_ctx_t *ctx, int fd, uint16_t buf_index, const void *data, size_t len);
+int64_t sock_recv(sock_ctx_t *ctx, int fd, void *data, size_t len);
+int64_t sock_sendto(sock_ctx_t *ctx, int fd, const void *data, size_t len, const uint8_t *ip, uint16_t port);
+int64_t sock_recvfrom(sock_ctx_t *ctx, int fd, void *data, size_t len, uint8_t *ip, uint16_t *port);
+int sock_close(sock_ctx_t *ctx, int fd);
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "latency.h"
+
+/*
+ * 协议栈的计数：每层每种原因一个计数器，丢包的地方都要计数，不再悄悄返回。
+ *
+ * 计数器放在协议栈实例 net_stack_t 里，一个实例只在一个线程里运行，写计数器的只有这个线程，
+ * 所以计数不需要原子加，只用 relaxed 的读和写，别的线程随时可以读到不撕裂的值；
+ * 计数器前后各填充一个缓存行，分片模式下每个分片（核）的计数不会和别的数据共享缓存行。
+ * 读的时候 stats_snapshot 把所有实例的计数加起来，已经释放的实例的计数也保留在总数里。
+ *
+ * 计数器的名字和 /proc/net/snmp 一样按层分组，stats_dump 输出的格式也与它相同：
+ * 每层两行，第一行是计数器名，第二行是对应的值。
+ * 定义了 NET_LATENCY 时，每个包经过各层的时延直方图（见 latency.h）也放在这里，随计数一起读。
+ */
+
+#define STATS_CACHE_LINE 64
+#define STATS_STACK_MAX 64 // 同时登记的协议栈实例数，超出的实例只能用 stats_stack_snapshot 单独读
+
+/* 计数器列表：X(编号, 层, 名字)，同一层的计数器要放在一起 */
+#define STATS_LIST(X)                                                                   \
+    X(ETH_IN_FRAMES, "Eth", "InFrames")             /* 收到的帧 */                      \
+    X(ETH_IN_TRUNCATED, "Eth", "InTruncated")       /* 比以太网首部还短的帧 */          \
+    X(ETH_IN_UNKNOWN_PROTOS, "Eth", "InUnknownProtos") /* 没有注册的上层协议 */         \
+    X(ETH_OUT_FRAMES, "Eth", "OutFrames")           /* 发出的帧 */                      \
+    X(ARP_IN_PACKETS, "Arp", "InPackets")           /* 收到的 ARP 包 */                 \
+    X(ARP_IN_TRUNCATED, "Arp", "InTruncated")       /* 比 ARP 包短 */                   \
+    X(ARP_IN_HDR_ERRORS, "Arp", "InHdrErrors")      /* 硬件类型、协议类型、地址长度或操作码不对 */ \
+    X(ARP_IN_REQUESTS, "Arp", "InRequests")         /* 收到的请求 */                    \
+    X(ARP_IN_REPLIES, "Arp", "InReplies")           /* 收到的应答 */                    \
+    X(ARP_OUT_REQUESTS, "Arp", "OutRequests")       /* 发出的请求 */                    \
+    X(ARP_OUT_REPLIES, "Arp", "OutReplies")         /* 发出的应答 */                    \
+    X(ARP_QUEUE_DROPS, "Arp", "QueueDrops")         /* 等待 ARP 应答时 arp_buf 里已有包而丢弃的包 */ \
+    X(IP_IN_RECEIVES, "Ip", "InReceives")           /* 收到的 IP 分组 */                \
+    X(IP_IN_TRUNCATED, "Ip", "InTruncated")         /* 比首部或总长度字段短 */          \
+    X(IP_IN_HDR_ERRORS, "Ip", "InHdrErrors")        /* 不是 IPv4 */                     \
+    X(IP_IN_CSUM_ERRORS, "Ip", "InCsumErrors")      /* 首部校验和错 */                  \
+    X(IP_IN_ADDR_ERRORS, "Ip", "InAddrErrors")      /* 目的地址不是本机 */              \
+    X(IP_IN_UNKNOWN_PROTOS, "Ip", "InUnknownProtos") /* 不支持的上层协议，回协议不可达 */ \
+    X(IP_IN_DELIVERS, "Ip", "InDelivers")           /* 交给上层的分组 */                \
+    X(IP_OUT_REQUESTS, "Ip", "OutRequests")         /* 上层交下来要发送的分组 */        \
+    X(IP_FRAG_CREATES, "Ip", "FragCreates")         /* 分片发送时产生的分片 */          \
+    X(ICMP_IN_MSGS, "Icmp", "InMsgs")               /* 收到的 ICMP 报文 */              \
+    X(ICMP_IN_ERRORS, "Icmp", "InErrors")           /* 比 ICMP 首部短 */                \
+    X(ICMP_IN_ECHOS, "Icmp", "InEchos")             /* 收到的回显请求 */                \
+    X(ICMP_OUT_ECHO_REPS, "Icmp", "OutEchoReps")    /* 发出的回显应答 */                \
+    X(ICMP_OUT_DEST_UNREACHS, "Icmp", "OutDestUnreachs") /* 发出的不可达 */             \
+    X(UDP_IN_DATAGRAMS, "Udp", "InDatagrams")       /* 交给端口处理程序的数据报 */      \
+    X(UDP_IN_ERRORS, "Udp", "InErrors")             /* 比首部或长度字段短 */            \
+    X(UDP_IN_CSUM_ERRORS, "Udp", "InCsumErrors")    /* 校验和错 */                      \
+    X(UDP_NO_PORTS, "Udp", "NoPorts")               /* 端口上没有处理程序 */            \
+    X(UDP_RCVBUF_ERRORS, "Udp", "RcvbufErrors")     /* 套接字的数据报队列满而丢弃 */    \
+    X(UDP_OUT_DATAGRAMS, "Udp", "OutDatagrams")     /* 发出的数据报 */                  \
+    X(TCP_IN_SEGS, "Tcp", "InSegs")                 /* 收到的段 */                      \
+    X(TCP_IN_ERRS, "Tcp", "InErrs")                 /* 比首部短或首部长度不对 */      \
+    X(TCP_IN_CSUM_ERRORS, "Tcp", "InCsumErrors")    /* 校验和错 */                      \
+    X(TCP_OUT_SEGS, "Tcp", "OutSegs")               /* 发出的段，包括重传和 RST */      \
+    X(TCP_OUT_RSTS, "Tcp", "OutRsts")               /* 发出的 RST */                    \
+    X(TCP_PASSIVE_OPENS, "Tcp", "PassiveOpens")     /* 建立的连接 */                    \
+    X(TCP_LISTEN_OVERFLOWS, "Tcp", "ListenOverflows") /* accept 队列满而复位的连接 */   \
+    X(TCP_TABLE_DROPS, "Tcp", "TableDrops")         /* 连接表满而丢弃的段（SYN 改用 cookie 回复，不算） */
+
+typedef enum stats_id
+{
+#define STATS_ID(id, layer, name) STATS_##id,
+    STATS_LIST(STATS_ID)
+#undef STATS_ID
+    STATS_MAX,
+} stats_id_t;
+
+typedef struct stats // 一个协议栈实例的计数器，只由运行这个实例的线程写
+{
+    uint8_t pad0[STATS_CACHE_LINE];
+    _Atomic uint64_t counter[STATS_MAX];
+#ifdef NET_LATENCY
+    latency_hist_t latency[LATENCY_MAX]; // 各跟踪点的时延直方图
+#endif
+    uint8_t pad1[STATS_CACHE_LINE];
+} stats_t;
+
+typedef struct stats_snapshot // 某一时刻的计数
+{
+    uint64_t counter[STATS_MAX];
+#ifdef NET_LATENCY
+    latency_snap_t latency[LATENCY_MAX];
+#endif
+} stats_snapshot_t;
+
+/**
+ * @brief 计数器加 n。只有一个线程写，读出再写回就够了，不需要带 lock 前缀的原子加
+ *
+ * @param stats 计数器
+ * @param id 编号
+ * @param n 增量
+ */
+static inline void stats_add(stats_t *stats, stats_id_t id, uint64_t n)
+{
+    _Atomic uint64_t *c = &stats->counter[id];
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/* 当前协议栈实例的计数器加 1，用法：STATS_INC(IP_IN_CSUM_ERRORS) */
+#define STATS_INC(id) stats_add(&net_stack()->stats, STATS_##id, 1)
+#define STATS_ADD(id, n) stats_add(&net_stack()->stats, STATS_##id, (n))
+
+struct net_stack;
+void stats_register(struct net_stack *stack);
+void stats_unregister(struct net_stack *stack);
+void stats_stack_snapshot(const struct net_stack *stack, stats_snapshot_t *snap);
+void stats_snapshot(stats_snapshot_t *snap);
+const char *stats_name(stats_id_t id);
+size_t stats_dump(const stats_snapshot_t *snap, char *buf, size_t size);
+
+#endif
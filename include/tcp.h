@@ -2,6 +2,7 @@
 #define TCP_H
 
 #include "net.h"
+#include "ringbuf.h"
 
 #pragma pack(1)
 
@@ -48,11 +49,16 @@ typedef struct tcp_peso_hdr
 
 #pragma pack()
 
+#define TCP_OPT_END 0     // 选项表结束
+#define TCP_OPT_NOP 1     // 无操作，用于选项对齐
+#define TCP_OPT_MSS 2     // 最大报文段长度，只出现在 SYN 中
+#define TCP_OPT_MSS_LEN 4 // MSS 选项长度
+
 typedef enum tcp_state
 {
     // 不使用状态 TCP_CLOSED,
     TCP_LISTEN = 0, /* 初始化的状态，没有分配缓存。处于这个状态时 tcp_connect_t 其他字段全是无效的
-                        其他状态rx_buf、tx_buf都在堆上动态分配了缓存，因此释放时要调用释放函数。
+                        SYN_RCVD 也不分配缓存；握手完成后 rx_buf、tx_buf 这两个环形缓冲区才在堆上动态分配，因此释放时要调用释放函数。
                     */
     TCP_SYN_SEND,
     TCP_SYN_RCVD,
@@ -72,6 +78,16 @@ typedef struct tcp_key
     uint16_t dst_port;
 } tcp_key_t;
 
+typedef void (*tcp_release_t)(void *arg, int acked); // 应用层借给 TCP 的内存不再使用时的回调，acked 为 0 表示连接释放时数据还没被全部确认
+
+typedef struct tcp_txref // 发送队列中的一段数据：tx_buf 中的字节，或应用层借给 TCP 的只读内存
+{
+    const uint8_t *data;   // 外部内存中尚未确认部分的起始地址，为 NULL 表示这段数据在 tx_buf 中
+    uint32_t len;          // 尚未确认的字节数
+    tcp_release_t release; // 外部内存全部被确认或连接释放时调用，可以为 NULL
+    void *arg;             // release 的参数
+} tcp_txref_t;
+
 typedef struct tcp_connect
 {
     tcp_state_t state;
@@ -79,13 +95,68 @@ typedef struct tcp_connect
     uint8_t ip[NET_IP_LEN];
     uint32_t unack_seq, next_seq; // tx_buf 中前 [next_seq - unack_seq] 字节已经发送，unack_seq 未确认的起始序号，next_seq 下一发送序号
     uint32_t ack;
-    uint16_t remote_mss;
+    uint16_t remote_mss; // 对端通告的 MSS，已限制在 TCP_MAX_MSS 以内，用于切分发送的数据
     uint16_t remote_win;
     void *handler;
-    buf_t *rx_buf; // 接收缓存
-    buf_t *tx_buf; // 发送缓存
+    ringbuf_t rx_buf;      // 接收缓存，环形缓冲区
+    ringbuf_t tx_buf;      // 发送缓存，环形缓冲区，只存放拷贝写入的数据
+    tcp_txref_t *tx_refs;  // 发送队列，按序记录 tx_buf 中的数据和引用的外部内存，容量 TCP_TX_REFS，队头对应 unack_seq
+    uint16_t tx_ref_head;  // 发送队列的队头位置
+    uint16_t tx_ref_count; // 发送队列中的描述符数
+    uint32_t tx_len;       // 发送队列中尚未确认的总字节数
+    uint8_t ack_pending;   // 已收到但还没有确认的数据段数
+    uint64_t ack_deadline; // 延迟 ACK 的截止时间（time_ms），ack_pending 为 0 时无效
+    uint32_t acks_delayed; // 延迟合并或捎带在数据上而省掉的纯 ACK 数
+    uint8_t nodelay;       // 关闭 Nagle 算法，小段写入立即发送
+    uint8_t cork;          // 只发送满 MSS 的段，直到取消 cork 或 flush
+    uint32_t segs_out;     // 发出的数据段数，用于统计每个响应的包数
+    uint64_t syn_deadline; // SYN_RCVD 状态的超时时间（time_ms），到期仍未完成握手则删除
+    uint8_t accepted;      // 已经被 tcp_accept 取走
+    uint8_t fin_pending;   // 应用层已关闭，FIN 排在 tx_buf 中未发完的数据之后
+    uint8_t *rx_post;      // 应用层投递的接收缓冲区，rx_buf 为空时新到的数据直接拷进这里，为 NULL 表示没有投递
+    uint32_t rx_post_len;  // 投递的缓冲区大小
+    uint32_t rx_post_done; // 已经直接收进投递缓冲区的字节数
+    void *arg;             // 应用层的私有数据，TCP 不使用
 } tcp_connect_t;
 
+typedef struct tcp_timewait // TIME_WAIT 状态的精简记录，只保留四元组和序号，不带任何缓存
+{
+    tcp_key_t key;       // [IP, 对端端口, 本端端口]
+    uint32_t snd_nxt;    // 本端下一发送序号，重发 ACK 时使用
+    uint32_t rcv_nxt;    // 期望的对端序号，用于识别重传的 FIN 和判断能否复用
+    uint16_t expire;     // 到期时的时间轮刻度（秒）
+    uint16_t hash_next;  // 哈希链中的下一项，空闲时为空闲链表中的下一项
+    uint16_t wheel_next; // 时间轮同一槽中的下一项
+} tcp_timewait_t;
+
+typedef struct tcp_stat // TCP 的资源占用与握手计数
+{
+    size_t connects;            // connect_table 中的连接数
+    size_t half_open;           // 其中处于 SYN_RCVD 的半连接数
+    size_t timewait;            // TIME_WAIT 记录数
+    size_t bytes;               // 连接记录、TIME_WAIT 记录和收发缓存占用的字节数
+    size_t syn_recv;            // 收到的 SYN 数
+    size_t syncookies_sent;     // 以 SYN cookie 回复、没有保存状态的 SYN 数
+    size_t syncookies_ok;       // 凭合法 cookie 建立的连接数
+    size_t syncookies_failed;   // cookie 校验失败的 ACK 数
+    size_t syn_rcvd_timeout;    // 超时被删除的半连接数
+    size_t established;         // 完成握手的连接总数
+    size_t timewait_overflow;   // TIME_WAIT 表满而直接关闭的连接数
+    size_t accept_overflow;     // accept 队列满而被复位的连接数
+    size_t tx_copied;           // tcp_connect_write 拷贝进 tx_buf 的字节数
+    size_t tx_referenced;       // tcp_connect_write_ref 以引用方式排队、没有拷贝进 tx_buf 的字节数
+    size_t rx_direct;           // 直接收进应用层投递的缓冲区、没有经过 rx_buf 的字节数
+} tcp_stat_t;
+
+typedef struct tcp_listen_stat // 一个监听端口的 accept 队列状态
+{
+    size_t backlog;  // 队列容量，为 0 表示不排队
+    size_t pending;  // 排队等待 accept 的连接数
+    size_t queued;   // 累计排进队列的连接数
+    size_t accepted; // 累计被 accept 取走的连接数
+    size_t overflow; // 队列满而被复位的连接数
+} tcp_listen_stat_t;
+
 static const tcp_connect_t CONNECT_LISTEN = {
     .state = TCP_LISTEN,
 };
@@ -94,20 +165,38 @@ typedef enum connect_state
 {
     // 刚刚建立连接
     TCP_CONN_CONNECTED,
-    // 收到数据
+    // 收到数据，或者对端关闭（连接不再是 ESTABLISHED，剩下的数据读完即 EOF）
     TCP_CONN_DATA_RECV,
     // 关闭连接
     TCP_CONN_CLOSED,
+    // 对端确认了数据，tx_buf 有了新的空间
+    TCP_CONN_WRITABLE,
 } connect_state_t;
 
 typedef void (*tcp_handler_t)(tcp_connect_t *conect, connect_state_t state);
 
 void tcp_init();
+void tcp_fini();
 int tcp_open(uint16_t port, tcp_handler_t handler);
+int tcp_listen(uint16_t port, tcp_handler_t handler, size_t backlog);
+tcp_connect_t *tcp_accept(uint16_t port);
+size_t tcp_accept_batch(uint16_t port, tcp_connect_t **connects, size_t max);
+int tcp_listen_stat(uint16_t port, tcp_listen_stat_t *stat);
 void tcp_close(uint16_t port);
 void tcp_connect_close(tcp_connect_t *connect);
+int tcp_connect_sendable(tcp_connect_t *connect);
 size_t tcp_connect_write(tcp_connect_t *connect, const uint8_t *data, size_t len);
+size_t tcp_connect_write_ref(tcp_connect_t *connect, const uint8_t *data, size_t len, tcp_release_t release, void *arg);
 size_t tcp_connect_read(tcp_connect_t *connect, uint8_t *data, size_t len);
+int tcp_connect_post_recv(tcp_connect_t *connect, uint8_t *data, size_t len);
+size_t tcp_connect_unpost_recv(tcp_connect_t *connect);
+int tcp_connect_peek(tcp_connect_t *connect, size_t offset, size_t len, ringbuf_iov_t iov[2]);
+void tcp_connect_consume(tcp_connect_t *connect, size_t len);
+void tcp_connect_flush(tcp_connect_t *connect);
+void tcp_connect_cork(tcp_connect_t *connect, int on);
+void tcp_connect_set_nodelay(tcp_connect_t *connect, int on);
 void tcp_in(buf_t *buf, uint8_t *src_ip);
+void tcp_poll();
+void tcp_get_stat(tcp_stat_t *stat);
 
 #endif
@@ -0,0 +1,123 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+/*
+ * 二进制跟踪环：热路径上不再 printf，只把（时间戳，事件号，几个整数参数）写进环里，
+ * 格式化留给读的一方（trace_decode，或者事后用 trace_decode 工具读跟踪文件）。
+ *
+ * 每个协议栈实例第一次记录时从跟踪区里领一个环，只有运行这个实例的线程写它，
+ * 写完一条记录后 release 地推进 head，不需要锁，也不需要原子加；环满了就覆盖最旧的记录。
+ * 跟踪区可以映射到一个文件上（trace_init 传路径），进程崩溃后文件里仍是最后的记录，
+ * 用 trace_decode 工具解码。传 NULL 时只在内存里，由进程自己 trace_decode。
+ *
+ * 级别在编译时决定：事件的级别高于 config.h 的 NET_LOG_LEVEL 时，TRACE 展开后被编译器整个删掉。
+ * 默认级别是 INFO，每个段都记录的 DEBUG 事件不编译进去。
+ */
+
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_ERROR 1
+#define TRACE_LEVEL_WARN 2
+#define TRACE_LEVEL_INFO 3
+#define TRACE_LEVEL_DEBUG 4
+
+#define TRACE_MAGIC 0x43525458 // "XTRC"
+#define TRACE_VERSION 1
+#define TRACE_RINGS 32        // 跟踪区里的环数，同时记录的协议栈实例超过这么多时，多出来的不记录
+#define TRACE_RING_SIZE 4096  // 每个环的记录数，必须是 2 的幂
+#define TRACE_ARGS 5          // 每条记录的参数个数
+#define TRACE_CACHE_LINE 64
+
+/* 事件列表：X(名字, 级别, 格式)。
+    格式里 %u 和 %x 依次取一个参数，%s 把剩下的参数当作最多 4 * 剩余个数 个字符（见 TRACE_TEXT）。
+    只能在末尾添加新事件，已经写出的跟踪文件按编号解码。
+*/
+#define TRACE_EVENTS(X)                                                                \
+    X(TCP_PANIC, ERROR, "tcp panic at line %u")                                        \
+    X(TCP_LISTEN, INFO, "tcp listen on port %u, backlog %u")                           \
+    X(TCP_IN, DEBUG, "tcp in %u -> %u seq %u ack %u flags %x")                         \
+    X(TCP_OUT, DEBUG, "tcp out %u -> %u seq %u len %u flags %x")                       \
+    X(TCP_RESET, WARN, "tcp reset %u -> %u seq %u")                                    \
+    X(HTTP_CONNECTED, INFO, "http connected from port %u")                             \
+    X(HTTP_REQUEST, INFO, "http request from port %u: %s")                             \
+    X(HTTP_BAD_REQUEST, WARN, "http bad request from port %u")                         \
+    X(HTTP_CLOSE, INFO, "http closes port %u")                                         \
+    X(HTTP_PEER_CLOSED, INFO, "http peer closed port %u")
+
+typedef enum trace_event
+{
+#define TRACE_EVENT_ID(name, level, fmt) TRACE_##name,
+    TRACE_EVENTS(TRACE_EVENT_ID)
+#undef TRACE_EVENT_ID
+    TRACE_MAX,
+} trace_event_t;
+
+enum // 每个事件的级别，TRACE 用它在编译时决定要不要记录
+{
+#define TRACE_EVENT_LEVEL(name, level, fmt) TRACE_LEVEL_OF_##name = TRACE_LEVEL_##level,
+    TRACE_EVENTS(TRACE_EVENT_LEVEL)
+#undef TRACE_EVENT_LEVEL
+};
+
+typedef struct trace_rec // 一条记录，32 字节
+{
+    uint64_t ts;              // trace_init 之后的纳秒数
+    uint16_t event;           // trace_event_t
+    uint16_t reserved;
+    uint32_t arg[TRACE_ARGS];
+} trace_rec_t;
+
+typedef struct trace_ring // 一个协议栈实例的环，只由运行它的线程写
+{
+    _Atomic uint64_t head; // 写过的记录数，第 i 条在 rec[i % TRACE_RING_SIZE]
+    uint8_t pad[TRACE_CACHE_LINE - sizeof(uint64_t)];
+    trace_rec_t rec[TRACE_RING_SIZE];
+} trace_ring_t;
+
+typedef struct trace_area // 跟踪区，也是跟踪文件的格式
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rings;          // TRACE_RINGS
+    uint32_t ring_size;      // TRACE_RING_SIZE
+    uint32_t events;         // TRACE_MAX，解码时用来认出比工具新的事件
+    _Atomic uint32_t used;   // 正在使用的环，按位表示
+    int64_t start_sec;       // trace_init 时的墙上时间（秒）
+    uint64_t start_ns;       // trace_init 时的单调时钟（纳秒），记录的时间戳从这里算起
+    uint8_t pad[TRACE_CACHE_LINE - 4 * 6 - 8 * 2];
+    trace_ring_t ring[TRACE_RINGS];
+} trace_area_t;
+
+int trace_init(const char *path);
+void trace_close(void);
+void trace_emit(trace_ring_t **ring, trace_event_t event, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4);
+void trace_emit_text(trace_ring_t **ring, trace_event_t event, uint32_t a0, const char *text, size_t len);
+void trace_release(trace_ring_t *ring);
+int trace_format(const trace_rec_t *rec, char *buf, size_t size);
+size_t trace_decode(const trace_area_t *area, size_t size, FILE *out);
+const trace_area_t *trace_map_file(const char *path, size_t *size);
+
+/* 记录一个事件，参数最多 TRACE_ARGS 个，写在调用处的协议栈实例 net_stack() 的环里：
+    TRACE(TCP_RESET, remote_port, local_port, seq);
+*/
+#define TRACE(event, ...) TRACE_ARGS_(event, __VA_ARGS__, 0, 0, 0, 0, 0)
+#define TRACE_ARGS_(event, a0, a1, a2, a3, a4, ...)                                                    \
+    do                                                                                                 \
+    {                                                                                                  \
+        if (TRACE_LEVEL_OF_##event <= NET_LOG_LEVEL)                                                   \
+            trace_emit(&net_stack()->trace, TRACE_##event, (a0), (a1), (a2), (a3), (a4));              \
+    } while (0)
+
+/* 记录一个带文本的事件：一个整数参数加最多 4 * (TRACE_ARGS - 1) 个字符，多出的截掉 */
+#define TRACE_TEXT(event, a0, text, len)                                                               \
+    do                                                                                                 \
+    {                                                                                                  \
+        if (TRACE_LEVEL_OF_##event <= NET_LOG_LEVEL)                                                   \
+            trace_emit_text(&net_stack()->trace, TRACE_##event, (a0), (text), (len));                  \
+    } while (0)
+
+#endif
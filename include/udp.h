@@ -23,11 +23,13 @@ typedef struct udp_peso_hdr
 #pragma pack()
 
 typedef void (*udp_handler_t)(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port);
+typedef void (*udp_port_handler_t)(uint16_t port, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port); // 同一个处理程序服务多个端口时用，port 为本地端口
 
 void udp_init();
 void udp_in(buf_t *buf, uint8_t *src_ip);
 void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port);
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port);
 int udp_open(uint16_t port, udp_handler_t handler);
+int udp_open_port(uint16_t port, udp_port_handler_t handler);
 void udp_close(uint16_t port);
 #endif
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include <time.h>
 
 uint16_t checksum16(uint16_t *data, size_t len);
+uint32_t checksum_add(uint32_t sum, const void *data, size_t len);
+uint32_t checksum_add_at(uint32_t sum, size_t offset, const void *data, size_t len);
+uint16_t checksum_fold(uint32_t sum);
 
 #define constswap16(x) ((((x)&0xFF) << 8) | (((x) >> 8) & 0xFF)) // 为 16 位数据交换大小端
 // 为 16 位数据交换大小端
@@ -29,6 +32,8 @@ static inline uint32_t min32(uint32_t a, uint32_t b)
 char *iptos(uint8_t *ip);
 char *mactos(uint8_t *mac);
 char *timetos(time_t timestamp);
+void str_append(char *buf, size_t size, size_t *len, const char *fmt, ...);
+uint64_t time_ms();
 uint8_t ip_prefix_match(uint8_t *ipa, uint8_t *ipb);
 
 #endif
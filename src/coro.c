@@ -0,0 +1,345 @@
+#ifndef _WIN32
+#include <stdlib.h>
+#include <ucontext.h>
+#include "coro.h"
+#include "tcp.h"
+#include "ringbuf.h"
+
+struct coro
+{
+    ucontext_t ctx;
+    uint8_t *stack;
+    coro_fn_t fn;
+    void *arg;
+    tcp_connect_t *tcp;        // 连接被释放后为 NULL
+    uint8_t *rest;             // 连接被释放时 rx_buf 中还没读走的数据
+    size_t rest_len, rest_off;
+    uint8_t ready;             // 已在就绪队列中
+    uint8_t done;              // 处理程序已经返回
+    struct coro *next;         // 就绪队列或池中的下一个
+};
+
+typedef struct coro_listener
+{
+    uint16_t port;
+    coro_fn_t fn;
+    void *arg;
+} coro_listener_t;
+
+struct coro_sched // 一个协议栈实例上的协程调度器，放在 net_stack()->coro
+{
+    ucontext_t main;      // coro_run 的上下文，协程挂起或结束时回到这里
+    coro_t *current;      // 正在运行的协程
+    coro_t *ready_head, *ready_tail;
+    coro_t *pool;         // 结束的协程，栈留着复用
+    coro_listener_t listeners[CORO_LISTEN_MAX];
+    size_t listener_count;
+    coro_stat_t counter;
+};
+
+static inline coro_sched_t *coro_sched()
+{
+    return net_stack()->coro;
+}
+
+/**
+ * @brief 把协程排进就绪队列的末尾，先就绪的先运行
+ *
+ * @param sched 调度器
+ * @param co 协程
+ */
+static void coro_ready(coro_sched_t *sched, coro_t *co)
+{
+    if (co->ready)
+        return;
+    co->ready = 1;
+    co->next = NULL;
+    if (sched->ready_tail)
+        sched->ready_tail->next = co;
+    else
+        sched->ready_head = co;
+    sched->ready_tail = co;
+}
+
+/**
+ * @brief 挂起当前协程，回到 coro_run，直到连接上有事件
+ *
+ * @param co 当前协程
+ */
+static void coro_wait(coro_t *co)
+{
+    coro_sched_t *sched = coro_sched();
+    sched->counter.waits++;
+    swapcontext(&co->ctx, &sched->main);
+}
+
+/**
+ * @brief 协程的入口，makecontext 只能传 int 参数，协程从调度器的 current 取得
+ *
+ */
+static void coro_entry(void)
+{
+    coro_sched_t *sched = coro_sched();
+    coro_t *co = sched->current;
+    co->fn(co, co->arg);
+    co->done = 1;
+    swapcontext(&co->ctx, &sched->main); // 不会再被恢复
+}
+
+/**
+ * @brief TCP 事件回调，只把协程排进就绪队列，由 coro_run 恢复
+ *
+ * @param tcp 连接
+ * @param state 事件
+ */
+static void coro_tcp_handler(tcp_connect_t *tcp, connect_state_t state)
+{
+    coro_sched_t *sched = coro_sched();
+    coro_t *co = tcp->arg;
+    if (state == TCP_CONN_CONNECTED || co == NULL) // 新连接在 accept 队列中，由 coro_run 取走
+        return;
+    if (state == TCP_CONN_CLOSED) // 连接马上会被释放，把没读走的数据留下来，读完即 EOF
+    {
+        size_t len = ringbuf_len(&tcp->rx_buf);
+        if (len && (co->rest = malloc(len)) != NULL)
+        {
+            ringbuf_read(&tcp->rx_buf, co->rest, len);
+            co->rest_len = len;
+        }
+        co->tcp = NULL;
+        tcp->arg = NULL;
+    }
+    coro_ready(sched, co);
+}
+
+/**
+ * @brief 为新连接启动一个协程，优先复用池中的栈
+ *
+ * @param sched 调度器
+ * @param listener 连接所在的监听端口
+ * @param tcp 连接
+ * @return int 成功为 0，失败为 -1
+ */
+static int coro_spawn(coro_sched_t *sched, coro_listener_t *listener, tcp_connect_t *tcp)
+{
+    coro_t *co = sched->pool;
+    if (co)
+    {
+        sched->pool = co->next;
+        sched->counter.pooled--;
+    }
+    else
+    {
+        co = calloc(1, sizeof(coro_t));
+        if (co == NULL)
+            return -1;
+        co->stack = malloc(CORO_STACK_SIZE);
+        if (co->stack == NULL)
+        {
+            free(co);
+            return -1;
+        }
+    }
+    getcontext(&co->ctx);
+    co->ctx.uc_stack.ss_sp = co->stack;
+    co->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
+    co->ctx.uc_link = NULL;
+    makecontext(&co->ctx, coro_entry, 0);
+    co->fn = listener->fn;
+    co->arg = listener->arg;
+    co->tcp = tcp;
+    co->rest = NULL;
+    co->rest_len = co->rest_off = 0;
+    co->ready = co->done = 0;
+    tcp->arg = co;
+    sched->counter.spawned++;
+    sched->counter.live++;
+    coro_ready(sched, co);
+    return 0;
+}
+
+/**
+ * @brief 处理程序返回后关闭连接，协程放回池中
+ *
+ * @param sched 调度器
+ * @param co 协程
+ */
+static void coro_retire(coro_sched_t *sched, coro_t *co)
+{
+    if (co->tcp)
+    {
+        co->tcp->arg = NULL;
+        tcp_connect_close(co->tcp);
+        co->tcp = NULL;
+    }
+    free(co->rest);
+    co->rest = NULL;
+    co->next = sched->pool;
+    sched->pool = co;
+    sched->counter.live--;
+    sched->counter.pooled++;
+}
+
+/**
+ * @brief 在当前线程的协议栈实例上启用协程调度器，在 net_init 之后调用
+ *
+ * @return int 成功为 0，失败为 -1
+ */
+int coro_init(void)
+{
+    net_stack_t *stack = net_stack();
+    if (stack->coro == NULL && (stack->coro = calloc(1, sizeof(coro_sched_t))) == NULL)
+        return -1;
+    net_add_fini(coro_free);
+    return 0;
+}
+
+/**
+ * @brief 在 port 上监听，每个连接启动一个运行 fn 的协程
+ *
+ * @param port 端口
+ * @param fn 处理程序
+ * @param arg fn 的参数
+ * @return int 成功为 0，失败为 -1
+ */
+int coro_listen(uint16_t port, coro_fn_t fn, void *arg)
+{
+    coro_sched_t *sched = coro_sched();
+    if (sched == NULL || fn == NULL || sched->listener_count == CORO_LISTEN_MAX)
+        return -1;
+    if (tcp_listen(port, coro_tcp_handler, TCP_ACCEPT_BACKLOG) != 0)
+        return -1;
+    sched->listeners[sched->listener_count++] = (coro_listener_t){.port = port, .fn = fn, .arg = arg};
+    return 0;
+}
+
+/**
+ * @brief 接受新连接并启动协程，再依次恢复就绪的协程，直到它们都挂起或结束
+ *
+ * 在协议栈线程上 net_poll 之后调用。协程里的读写不会触发 TCP 事件回调，这一轮不会产生新的就绪协程。
+ */
+void coro_run(void)
+{
+    coro_sched_t *sched = coro_sched();
+
+    // 1 为 accept 队列中的连接启动协程
+    for (size_t i = 0; i < sched->listener_count; i++)
+    {
+        coro_listener_t *listener = &sched->listeners[i];
+        tcp_connect_t *tcp;
+        while (sched->counter.live < CORO_MAX && (tcp = tcp_accept(listener->port)) != NULL)
+        {
+            if (coro_spawn(sched, listener, tcp) != 0)
+                tcp_connect_close(tcp);
+        }
+    }
+
+    // 2 恢复就绪的协程
+    while (sched->ready_head)
+    {
+        coro_t *co = sched->ready_head;
+        sched->ready_head = co->next;
+        if (sched->ready_head == NULL)
+            sched->ready_tail = NULL;
+        co->ready = 0;
+        sched->current = co;
+        sched->counter.switches++;
+        swapcontext(&sched->main, &co->ctx);
+        sched->current = NULL;
+        if (co->done)
+            coro_retire(sched, co);
+    }
+}
+
+/**
+ * @brief 释放池中的协程和调度器，由 net_stack_destroy 调用，也可以提前调用。还没结束的协程的栈不能释放，由调用者保证它们都已结束
+ *
+ */
+void coro_free(void)
+{
+    net_stack_t *stack = net_stack();
+    coro_sched_t *sched = stack->coro;
+    if (sched == NULL)
+        return;
+    while (sched->pool)
+    {
+        coro_t *co = sched->pool;
+        sched->pool = co->next;
+        free(co->stack);
+        free(co);
+    }
+    free(sched);
+    stack->coro = NULL;
+}
+
+/**
+ * @brief 取得协程的计数
+ *
+ * @param stat 出口参数
+ */
+void coro_get_stat(coro_stat_t *stat)
+{
+    *stat = coro_sched()->counter;
+}
+
+/**
+ * @brief 读最多 len 字节，没有数据时挂起当前协程
+ *
+ * @param co 当前协程
+ * @param data 缓冲区
+ * @param len 缓冲区大小
+ * @return int64_t 字节数，0 表示对端已关闭
+ */
+int64_t coro_read(coro_t *co, void *data, size_t len)
+{
+    while (1)
+    {
+        if (co->rest_off < co->rest_len)
+        {
+            size_t size = co->rest_len - co->rest_off;
+            size = size < len ? size : len;
+            memcpy(data, co->rest + co->rest_off, size);
+            co->rest_off += size;
+            return size;
+        }
+        if (co->tcp && ringbuf_len(&co->tcp->rx_buf))
+            return tcp_connect_read(co->tcp, data, len);
+        if (co->tcp == NULL || co->tcp->state != TCP_ESTABLISHED)
+            return 0;
+        coro_wait(co);
+    }
+}
+
+/**
+ * @brief 把 len 字节全部写进发送缓存，缓存满时挂起当前协程，等对端确认后继续
+ *
+ * @param co 当前协程
+ * @param data 数据
+ * @param len 字节数
+ * @return int64_t 字节数，连接已关闭时为 CORO_ECLOSED
+ */
+int64_t coro_write(coro_t *co, const void *data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        if (co->tcp == NULL || !tcp_connect_sendable(co->tcp)) // 对端发了 FIN 之后仍可以回复
+            return CORO_ECLOSED;
+        done += tcp_connect_write(co->tcp, (const uint8_t *)data + done, len - done);
+        if (done < len)
+            coro_wait(co);
+    }
+    return done;
+}
+
+/**
+ * @brief 协程的连接，可以用来调用 tcp_connect_set_nodelay 等，连接被释放后为 NULL
+ *
+ * @param co 当前协程
+ * @return tcp_connect_t*
+ */
+tcp_connect_t *coro_connect(coro_t *co)
+{
+    return co->tcp;
+}
+#endif
@@ -28,7 +28,6 @@ BOOL LoadNpcapDlls()
 }
 #endif
 
-pcap_t *pcap;
 char pcap_errbuf[PCAP_ERRBUF_SIZE];
 
 /**
@@ -82,7 +81,7 @@ int driver_find(uint8_t *ip, char *if_name, uint8_t *mask)
         ;
     if (max_match == 32)
     {
-        fprintf(stderr, "Error, interface %s have the same ip %s with me.\n", d->name, iptos(net_if_ip));
+        fprintf(stderr, "Error, interface %s have the same ip %s with me.\n", d->name, iptos(net_stack()->if_ip));
         return -1;
     }
     for (a = d->addresses; a; a = a->next)
@@ -111,18 +110,20 @@ int driver_open()
 
     char if_name[PCAP_BUF_SIZE];
     uint32_t mask;
-    if (driver_find(net_if_ip, if_name, (uint8_t *)&mask) < 0)
+    if (driver_find(net_stack()->if_ip, if_name, (uint8_t *)&mask) < 0)
     {
         fprintf(stderr, "Error in driver find.\n");
         return -1;
     }
-    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_if_ip));
+    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_stack()->if_ip));
 
+    pcap_t *pcap; // 每个协议栈实例打开自己的网卡，句柄放在 net_stack()->driver
     if ((pcap = pcap_open_live(if_name, 65536, 1, 10, pcap_errbuf)) == NULL) // 混杂模式打开网卡
     {
         fprintf(stderr, "Error in pcap_open_live.\n%s.\n", pcap_errbuf);
         return -1;
     }
+    net_stack()->driver = pcap;
     if (pcap_setnonblock(pcap, 1, pcap_errbuf) < 0) // 设置非阻塞模式
     {
         fprintf(stderr, "Error in pcap_setnonblock. %s.\n", pcap_errbuf);
@@ -130,7 +131,7 @@ int driver_open()
     }
     char filter_exp[PCAP_BUF_SIZE];
     struct bpf_program fp;
-    uint8_t mac_addr[6] = NET_IF_MAC;
+    uint8_t *mac_addr = net_stack()->if_mac;
     sprintf(filter_exp, // 过滤数据包
             "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
             mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
@@ -155,6 +156,7 @@ int driver_open()
  */
 int driver_recv(buf_t *buf)
 {
+    pcap_t *pcap = net_stack()->driver;
     struct pcap_pkthdr *pkt_hdr;
     const uint8_t *pkt_data;
     int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
@@ -177,6 +179,7 @@ int driver_recv(buf_t *buf)
  */
 int driver_send(buf_t *buf)
 {
+    pcap_t *pcap = net_stack()->driver;
     if (pcap_sendpacket(pcap, buf->data, buf->len) == -1)
     {
         fprintf(stderr, "Error in driver_send.\n%s.\n", pcap_geterr(pcap));
@@ -191,5 +194,6 @@ int driver_send(buf_t *buf)
  */
 void driver_close()
 {
-    pcap_close(pcap);
+    pcap_close(net_stack()->driver);
+    net_stack()->driver = NULL;
 }
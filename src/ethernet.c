@@ -14,8 +14,11 @@ void ethernet_in(buf_t *buf)
 
     // Step1
     // 判断数据长度，如果数据长度小于以太网头部长度，则认为数据包不完整，丢弃不处理
+    LATENCY_MARK(ETHERNET_IN);
+    STATS_INC(ETH_IN_FRAMES);
     if (buf->len < sizeof(ether_hdr_t))
     {
+        STATS_INC(ETH_IN_TRUNCATED);
         return;
     }
 
@@ -39,7 +42,10 @@ void ethernet_in(buf_t *buf)
 
     // Step3
     // 调用 net_in() 函数向上层传递数据包
-    net_in(buf, protocol, mac);
+    if (net_in(buf, protocol, mac) != 0)
+    {
+        STATS_INC(ETH_IN_UNKNOWN_PROTOS);
+    }
 }
 /**
  * @brief 处理一个要发送的数据包
@@ -73,9 +79,9 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
 
     // Step4
     // 填写源 MAC 地址，即本机的 MAC 地址
-    memcpy(hdr->src, net_if_mac, NET_MAC_LEN);
-    // 大写的 NET_IF_MAC 不能用，用小写的 net_if_mac
-    // 大写的是字面量，小写的是地址，memcpy 要填地址
+    memcpy(hdr->src, net_stack()->if_mac, NET_MAC_LEN);
+    // 大写的 NET_IF_MAC 不能用，用当前协议栈实例的 if_mac
+    // 大写的是字面量，只是默认实例的初始值，memcpy 要填地址
 
     // Step5
     // 填写协议类型 protocol
@@ -83,7 +89,9 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
 
     // Step6
     // 调用驱动层封装好的 driver_send() 发送函数，将添加了以太网包头的数据帧发送到驱动层
-    driver_send(buf);
+    STATS_INC(ETH_OUT_FRAMES);
+    LATENCY_MARK(DRIVER_SEND);
+    net_driver_send(buf);
 }
 /**
  * @brief 初始化以太网协议
@@ -91,7 +99,7 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
  */
 void ethernet_init()
 {
-    buf_init(&rxbuf, ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t));
+    buf_init(&net_stack()->rxbuf, ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t));
 }
 
 /**
@@ -100,6 +108,10 @@ void ethernet_init()
  */
 void ethernet_poll()
 {
-    if (driver_recv(&rxbuf) > 0)
-        ethernet_in(&rxbuf);
+    if (net_driver_recv(&net_stack()->rxbuf) > 0)
+    {
+        LATENCY_BEGIN();
+        ethernet_in(&net_stack()->rxbuf);
+        LATENCY_END();
+    }
 }
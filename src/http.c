@@ -1,172 +1,558 @@
 #include "http.h"
+#include "http_parser.h"
+#include "http_cache.h"
 #include "tcp.h"
 #include "net.h"
+#include "utils.h"
 #include "assert.h"
 #include "string.h"
+#include <stdlib.h>
 
-#define TCP_FIFO_SIZE 40
+#define HTTP_REQUEST_MAX 1024 // 请求头的最大长度
+#define HTTP_OUT_SIZE 1024    // 每个连接等待写入 tx_buf 的数据缓存大小
 
-typedef struct http_fifo
+typedef enum http_state
 {
-    tcp_connect_t *buffer[TCP_FIFO_SIZE];
-    uint8_t front, tail, count;
-} http_fifo_t;
+    HTTP_READ_REQUEST,  // 读取请求头，直到空行；持久连接在这个状态下等待下一个请求
+    HTTP_SEND_RESPONSE, // 流式发送响应，tx_buf 满时等待 TCP_CONN_WRITABLE
+} http_state_t;
 
-static http_fifo_t http_fifo_v;
+typedef struct http_conn // 每个连接的状态机，挂在 tcp_connect_t 的 arg 上
+{
+    tcp_connect_t *tcp;
+    http_state_t state;
+    uint8_t ready;               // 有可读或可写事件，等待 http_server_run 处理
+    uint8_t keep_alive;          // 当前响应发完后保持连接
+    uint8_t version_minor;       // 响应的 HTTP/1.x 版本，与请求相同，但不超过 1
+    size_t requests;             // 这个连接上已经处理的请求数
+    size_t body_left;            // 还需要丢弃的请求体字节数
+    uint64_t idle_deadline;      // 等待请求时的超时时间（time_ms）
+    http_file_t *cached;         // 报头发完后要发送的缓存文件，持有一个引用，排进发送队列后交给 TCP
+    const uint8_t *body;         // 要发送的缓存内容：选中的编码版本，Range 请求时只是其中一段
+    size_t body_len;
+    FILE *file;                  // 没有缓存、正在从磁盘流式发送的文件
+    http_parser_t parser;        // 请求头的增量解析状态
+    char rx[HTTP_REQUEST_MAX];   // 请求头在 rx_buf 中回绕时，拷贝到这里再解析
+    char out[HTTP_OUT_SIZE];     // 还没写进 tx_buf 的数据
+    size_t out_len, out_off;
+    struct http_conn *prev, *next;
+} http_conn_t;
+
+struct http_server // 一个协议栈实例上的 HTTP 服务器，放在 net_stack()->http
+{
+    uint16_t port;
+    http_conn_t *conns; // 所有正在处理的连接
+    http_stat_t counter;
+};
+
+/**
+ * @brief 当前协议栈实例的 HTTP 服务器
+ *
+ * @return http_server_t*
+ */
+static inline http_server_t *http_server()
+{
+    return net_stack()->http;
+}
 
-static void http_fifo_init(http_fifo_t *fifo)
+/**
+ * @brief 发送队列中的缓存文件被对端全部确认或连接被释放后，TCP 调用这个函数释放引用
+ *
+ * @param arg http_file_t *
+ * @param acked 没有用到，两种情况都只是放掉引用
+ */
+static void http_file_release(void *arg, int acked)
 {
-    fifo->count = 0;
-    fifo->front = 0;
-    fifo->tail = 0;
+    http_cache_put(arg);
 }
 
-static int http_fifo_in(http_fifo_t *fifo, tcp_connect_t *tcp)
+static http_conn_t *http_conn_new(tcp_connect_t *tcp)
 {
-    if (fifo->count >= TCP_FIFO_SIZE)
+    http_server_t *http = http_server();
+    http_conn_t *conn = calloc(1, sizeof(http_conn_t));
+    if (conn == NULL)
     {
-        return -1;
+        return NULL;
     }
-    fifo->buffer[fifo->front] = tcp;
-    fifo->front++;
-    if (fifo->front >= TCP_FIFO_SIZE)
+    conn->tcp = tcp;
+    conn->state = HTTP_READ_REQUEST;
+    http_parser_init(&conn->parser);
+    conn->idle_deadline = time_ms() + HTTP_KEEPALIVE_TIMEOUT_MS;
+    conn->ready = 1; // 请求可能在 accept 之前就已经到达
+    conn->next = http->conns;
+    if (http->conns)
     {
-        fifo->front = 0;
+        http->conns->prev = conn;
     }
-    fifo->count++;
-    return 0;
+    http->conns = conn;
+    tcp->arg = conn;
+    http->counter.connections++;
+    return conn;
 }
 
-static tcp_connect_t *http_fifo_out(http_fifo_t *fifo)
+static void http_conn_free(http_conn_t *conn)
 {
-    if (fifo->count == 0)
+    http_server_t *http = http_server();
+    if (conn->cached)
     {
-        return NULL;
+        http_cache_put(conn->cached);
+    }
+    if (conn->file)
+    {
+        fclose(conn->file);
+    }
+    if (conn->tcp)
+    {
+        conn->tcp->arg = NULL;
+    }
+    if (conn->prev)
+    {
+        conn->prev->next = conn->next;
     }
-    tcp_connect_t *tcp = fifo->buffer[fifo->tail];
-    fifo->tail++;
-    if (fifo->tail >= TCP_FIFO_SIZE)
+    else
+    {
+        http->conns = conn->next;
+    }
+    if (conn->next)
     {
-        fifo->tail = 0;
+        conn->next->prev = conn->prev;
     }
-    fifo->count--;
-    return tcp;
+    free(conn);
 }
 
-static size_t get_line(tcp_connect_t *tcp, char *buf, size_t size)
+static void close_http(http_conn_t *conn)
 {
-    size_t i = 0;
-    while (i < size)
-    {
-        char c;
-        if (tcp_connect_read(tcp, (uint8_t *)&c, 1) > 0)
-        {
-            if (c == '\n')
-            {
-                break;
-            }
-            if (c != '\n' && c != '\r')
-            {
-                buf[i] = c;
-                i++;
-            }
-        }
-        net_poll();
-    }
-    buf[i] = '\0';
-    return i;
+    tcp_connect_t *tcp = conn->tcp;
+    TRACE(HTTP_CLOSE, tcp->remote_port);
+    http_conn_free(conn);
+    tcp_connect_close(tcp);
 }
 
-static size_t http_send(tcp_connect_t *tcp, const char *buf, size_t size)
+/**
+ * @brief 准备只有报头和一段短正文的响应，如 404
+ *
+ * @param conn
+ * @param status 状态行中的状态码和原因短语
+ * @param body 正文
+ * @param head_only HEAD 请求，不发送正文
+ */
+static void http_simple_response(http_conn_t *conn, const char *status, const char *body, int head_only)
 {
-    size_t send = 0;
-    while (send < size)
-    {
-        send += tcp_connect_write(tcp, (const uint8_t *)buf + send, size - send);
-        net_poll();
-    }
-    return send;
+    conn->out_len = snprintf(conn->out, sizeof(conn->out),
+                             "HTTP/1.%d %s\r\n"
+                             "Sever: \r\n"
+                             "Content-Type: text/html\r\n"
+                             "Content-Length: %zu\r\n"
+                             "Connection: %s\r\n\r\n"
+                             "%s",
+                             conn->version_minor, status, strlen(body),
+                             conn->keep_alive ? "keep-alive" : "close",
+                             head_only ? "" : body);
 }
 
-static void close_http(tcp_connect_t *tcp)
+/**
+ * @brief 比较 s 和以 '\0' 结尾的 c 是否完全相同
+ */
+static int http_str_eq(http_str_t s, const char *c)
 {
-    tcp_connect_close(tcp);
-    printf("http closed.\n");
+    return s.len == strlen(c) && !memcmp(s.p, c, s.len);
 }
 
-static void send_file(tcp_connect_t *tcp, const char *url)
+/**
+ * @brief 用缓存的文件准备响应，按条件请求和 Range 决定返回 304、416、206 还是完整的 200
+ *
+ * 先按 Accept-Encoding 选出要发送的版本，条件请求和 Range 都针对这个版本。
+ * ETag 和 Last-Modified 是加载时算好的，判断条件不需要访问磁盘；206 的正文直接引用缓存中的一段。
+ *
+ * @param conn conn->cached 为要发送的文件
+ * @param req
+ * @param head_only HEAD 请求，不发送正文
+ */
+static void http_cached_response(http_conn_t *conn, const http_request_t *req, int head_only)
 {
-    FILE *file;
-    // const char* content_type = "text/html";
-    char file_path[255];
-    char tx_buffer[1024];
+    http_server_t *http = http_server();
+    http_file_t *file = conn->cached;
+    const http_str_t *ae = http_request_header(req, "accept-encoding");
+    const http_variant_t *v = http_cache_variant(file, ae ? http_parse_accept_encoding(*ae) : 0);
+    const char *connection = conn->keep_alive ? "keep-alive" : "close";
+    const http_str_t *inm = http_request_header(req, "if-none-match");
+    const http_str_t *ims = http_request_header(req, "if-modified-since");
+    const http_str_t *range = http_request_header(req, "range");
+    const http_str_t *if_range = http_request_header(req, "if-range");
+    time_t since;
+    size_t first = 0, last = 0;
+    int partial = -1;
+
+    // 1 带了 If-None-Match 就只看它，否则看 If-Modified-Since，客户端的副本仍然有效时回 304，不带正文
+    if (inm ? http_etag_match(*inm, v->etag)
+            : (ims && http_parse_date(*ims, &since) == 0 && file->mtime <= since))
+    {
+        http->counter.not_modified++;
+        conn->out_len = snprintf(conn->out, sizeof(conn->out),
+                                 "HTTP/1.%d 304 Not Modified\r\n"
+                                 "Sever: \r\n"
+                                 "%s"
+                                 "ETag: %s\r\n"
+                                 "Last-Modified: %s\r\n"
+                                 "Connection: %s\r\n\r\n",
+                                 conn->version_minor, file->vary ? "Vary: Accept-Encoding\r\n" : "",
+                                 v->etag, file->last_modified, connection);
+        http_cache_put(file);
+        conn->cached = NULL;
+        return;
+    }
+
+    // 2 Range 只对 GET 有效；带 If-Range 时，只有它与当前文件的 ETag 或 Last-Modified 一致才返回部分内容
+    if (range && req->method == HTTP_METHOD_GET &&
+        (if_range == NULL || http_str_eq(*if_range, v->etag) || http_str_eq(*if_range, file->last_modified)))
+    {
+        partial = http_parse_range(*range, v->size, &first, &last);
+    }
+    if (partial == 0)
+    {
+        conn->out_len = snprintf(conn->out, sizeof(conn->out),
+                                 "HTTP/1.%d 416 Range Not Satisfiable\r\n"
+                                 "Sever: \r\n"
+                                 "Content-Range: bytes */%zu\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "Connection: %s\r\n\r\n",
+                                 conn->version_minor, v->size, connection);
+        http_cache_put(file);
+        conn->cached = NULL;
+        return;
+    }
+
+    // 3 206 的报头需要按区间生成，200 直接使用加载时生成的报头
+    if (partial == 1)
+    {
+        http->counter.partial++;
+        conn->body = v->data + first;
+        conn->body_len = last - first + 1;
+        conn->out_len = snprintf(conn->out, sizeof(conn->out),
+                                 "HTTP/1.%d 206 Partial Content\r\n"
+                                 "Sever: \r\n"
+                                 "Content-Type: %s\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Content-Range: bytes %zu-%zu/%zu\r\n"
+                                 "%s%s%s"
+                                 "%s"
+                                 "ETag: %s\r\n"
+                                 "Last-Modified: %s\r\n",
+                                 conn->version_minor, file->mime, conn->body_len, first, last, v->size,
+                                 v->encoding ? "Content-Encoding: " : "", v->encoding ? v->encoding : "", v->encoding ? "\r\n" : "",
+                                 file->vary ? "Vary: Accept-Encoding\r\n" : "",
+                                 v->etag, file->last_modified);
+    }
+    else
+    {
+        conn->body = v->data;
+        conn->body_len = v->size;
+        conn->out_len = snprintf(conn->out, sizeof(conn->out), "HTTP/1.%d 200 OK\r\nSever: \r\n", conn->version_minor);
+        memcpy(conn->out + conn->out_len, v->header, v->header_len);
+        conn->out_len += v->header_len;
+    }
+    conn->out_len += snprintf(conn->out + conn->out_len, sizeof(conn->out) - conn->out_len,
+                              "Connection: %s\r\n\r\n", connection);
+    if (head_only)
+    {
+        http_cache_put(file);
+        conn->cached = NULL;
+    }
+}
+
+static void send_file(http_conn_t *conn, const http_request_t *req)
+{
+    http_server_t *http = http_server();
+    http_str_t url = req->path;
+    int head_only = req->method == HTTP_METHOD_HEAD;
+    char path[HTTP_CACHE_PATH_MAX];
+    char file_path[sizeof(XHTTP_DOC_DIR) + HTTP_CACHE_PATH_MAX];
 
     /*
     解析 url 路径，查看是否是 XHTTP_DOC_DIR 目录下的文件
     如果不是，则发送 404 NOT FOUND
-    如果是，则用 HTTP/1.0 协议发送
+    如果是，则按请求的版本用 HTTP/1.0 或 HTTP/1.1 发送，用 Content-Length 标出正文长度，
+    这样持久连接上的下一个响应紧跟在正文后面，客户端也能分得开
 
     注意，本实验的 WEB 服务器网页存放在 XHTTP_DOC_DIR 目录中
+    文件优先从缓存中取，报头的大部分是加载时预先生成的，条件请求和 Range 也只对缓存的文件处理；
+    过大的文件从磁盘流式发送，总是返回完整的 200
+    数据由 http_send_response 随 tx_buf 的空间写出
     */
 
-    // TODO
-    // 根据 url 获取指定的文件
-    // 查看 include/http.h: XHTTP_DOC_DIR : "../htmldocs"
-    sprintf(file_path, "%s%s", XHTTP_DOC_DIR, url);
-
-    if (strcmp(url, "/") == 0)
+    // 去掉查询串，"/" 对应 index.html，不允许用 ".." 访问 XHTTP_DOC_DIR 之外的文件
+    const char *query = memchr(url.p, '?', url.len);
+    if (query)
     {
-        strcat(file_path, "index.html");
+        url.len = query - url.p;
     }
+    int len = snprintf(path, sizeof(path), "%.*s%s", (int)url.len, url.p,
+                       (url.len && url.p[url.len - 1] == '/') ? "index.html" : "");
 
-    printf("file_path: %s\n", file_path);
+    // cork 住连接，让报头和文件开头合并在同一个段里，发送完毕再一次性 push
+    tcp_connect_cork(conn->tcp, 1);
 
-    // 若文件不存在，发送 HTTP ERROR 404
-    file = fopen(file_path, "rb");
-    if (file == NULL)
+    if (len > 0 && len < (int)sizeof(path) && path[0] == '/' && strstr(path, "..") == NULL)
     {
-        perror("file unexist");
-        sprintf(tx_buffer, "HTTP/1.0 404 Not Found\r\n"
-                           "Sever: \r\n"
-                           "Content-Type: text/html\r\n\r\n");
+        conn->cached = http_cache_get(path, len);
+        if (conn->cached == NULL)
+        {
+            snprintf(file_path, sizeof(file_path), "%s%s", XHTTP_DOC_DIR, path);
+            conn->file = fopen(file_path, "rb");
+        }
+    }
 
-        http_send(tcp, tx_buffer, strlen(tx_buffer));
+    // 若文件不存在，发送 HTTP ERROR 404
+    if (conn->cached == NULL && conn->file == NULL)
+    {
+        http->counter.not_found++;
+        http_simple_response(conn, "404 Not Found", "<h1>404 Not Found</h1>", head_only);
         return;
     }
 
-    // 如果是，则用 HTTP/1.0 协议发送
     // 准备 HTTP 报头
-    sprintf(tx_buffer, "HTTP/1.0 200 OK\r\n"
-                       "Sever: \r\n"
-                       "Content-Type: text/html\r\n\r\n");
+    if (conn->cached)
+    {
+        http_cached_response(conn, req, head_only);
+        return;
+    }
+    fseek(conn->file, 0, SEEK_END);
+    long size = ftell(conn->file);
+    fseek(conn->file, 0, SEEK_SET);
+    conn->out_len = snprintf(conn->out, sizeof(conn->out),
+                             "HTTP/1.%d 200 OK\r\n"
+                             "Sever: \r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %ld\r\n"
+                             "Connection: %s\r\n\r\n",
+                             conn->version_minor, http_mime_type(path, len), size,
+                             conn->keep_alive ? "keep-alive" : "close");
+    if (head_only)
+    {
+        fclose(conn->file);
+        conn->file = NULL;
+    }
+}
+
+/**
+ * @brief 把响应写进 tx_buf，写满就返回，等待 TCP_CONN_WRITABLE 事件后继续
+ *
+ * @param conn
+ * @return int 响应发完、可以处理下一个请求为 1，等待可写为 0，连接已关闭为 -1
+ */
+static int http_send_response(http_conn_t *conn)
+{
+    http_server_t *http = http_server();
+    while (1)
+    {
+        // 1 先把 out 中剩余的数据写进 tx_buf，写不完说明 tx_buf 满了
+        if (conn->out_off < conn->out_len)
+        {
+            size_t size = tcp_connect_write(conn->tcp, (const uint8_t *)conn->out + conn->out_off, conn->out_len - conn->out_off);
+            conn->out_off += size;
+            http->counter.bytes_sent += size;
+            if (conn->out_off < conn->out_len)
+            {
+                return 0;
+            }
+        }
+
+        // 2 out 写完了，缓存的文件以引用方式排进发送队列，连同引用计数一起交给 TCP，
+        // 段直接从缓存的内存中组装，对端确认后由 http_file_release 释放
+        if (conn->cached)
+        {
+            size_t size = conn->body_len;
+            if (size > 0 && tcp_connect_write_ref(conn->tcp, conn->body, size, http_file_release, conn->cached) == 0)
+            {
+                return 0;
+            }
+            if (size == 0)
+            {
+                http_cache_put(conn->cached);
+            }
+            http->counter.bytes_sent += size;
+            conn->cached = NULL;
+        }
 
-    http_send(tcp, tx_buffer, strlen(tx_buffer));
+        // 3 没有缓存的文件，从磁盘读下一块
+        if (conn->file)
+        {
+            conn->out_len = fread(conn->out, sizeof(char), sizeof(conn->out), conn->file);
+            conn->out_off = 0;
+            if (conn->out_len > 0)
+            {
+                continue;
+            }
+            fclose(conn->file);
+            conn->file = NULL;
+        }
+        break;
+    }
+    conn->out_len = conn->out_off = 0;
 
-    // 读取文件并发送
-    memset(tx_buffer, 0, sizeof(tx_buffer));
-    while (fread(tx_buffer, sizeof(char), sizeof(tx_buffer), file) > 0)
+    // 4 响应发送完毕，不保持连接则调用 close_http 关掉连接，剩余数据会在 FIN 之前发出
+    if (!conn->keep_alive)
     {
-        http_send(tcp, tx_buffer, sizeof(tx_buffer));
-        memset(tx_buffer, 0, sizeof(tx_buffer));
+        close_http(conn);
+        return -1;
     }
 
-    // 发送完毕后关闭文件
-    fclose(file);
+    // 5 保持连接，回到等待请求的状态。rx_buf 中已经有流水线请求时先不取消 cork，
+    // 让下一个响应的报头接在这个响应的尾巴后面
+    ringbuf_iov_t iov[2];
+    if (tcp_connect_peek(conn->tcp, 0, 1, iov) > 0)
+    {
+        http->counter.pipelined++;
+    }
+    else
+    {
+        tcp_connect_cork(conn->tcp, 0);
+    }
+    conn->state = HTTP_READ_REQUEST;
+    http_parser_init(&conn->parser);
+    conn->idle_deadline = time_ms() + HTTP_KEEPALIVE_TIMEOUT_MS;
+    return 1;
+}
+
+/**
+ * @brief 解析 rx_buf 中的请求头，收到空行后准备响应
+ *
+ * 请求头直接在 rx_buf 中解析，不拷贝；只有在环形缓冲区中回绕成两段时，才拷贝到 conn->rx。
+ *
+ * @param conn
+ * @return int 请求已解析、响应已准备好为 1，等待更多数据为 0，连接已关闭为 -1
+ */
+static int http_read_request(http_conn_t *conn)
+{
+    http_server_t *http = http_server();
+    // 1 丢弃上一个请求的请求体
+    ringbuf_iov_t iov[2];
+    while (conn->body_left)
+    {
+        int n = tcp_connect_peek(conn->tcp, 0, conn->body_left, iov);
+        if (n == 0)
+        {
+            return 0;
+        }
+        size_t size = iov[0].len + (n == 2 ? iov[1].len : 0);
+        tcp_connect_consume(conn->tcp, size);
+        conn->body_left -= size;
+    }
+
+    // 2 查看 rx_buf 中已有的数据，没有收到完整的请求头就等待下一次可读事件
+    int n = tcp_connect_peek(conn->tcp, 0, HTTP_REQUEST_MAX, iov);
+    if (n == 0)
+    {
+        return 0;
+    }
+    const char *data = (const char *)iov[0].base;
+    size_t len = iov[0].len;
+    if (n == 2)
+    {
+        memcpy(conn->rx, iov[0].base, iov[0].len);
+        memcpy(conn->rx + iov[0].len, iov[1].base, iov[1].len);
+        data = conn->rx;
+        len += iov[1].len;
+    }
+
+    http_request_t req;
+    int header_len = http_parse_request(&conn->parser, data, len, &req);
+    if (header_len == 0)
+    {
+        if (len == HTTP_REQUEST_MAX) // 请求头过长
+        {
+            http->counter.bad_requests++;
+            close_http(conn);
+            return -1;
+        }
+        return 0;
+    }
+
+    // 3 检查是否是合法的 GET / HEAD 请求
+    // 如果不是，则调用 close_http 关闭 tcp；请求体不是用 Content-Length 标出长度的也无法处理
+    if (header_len < 0 ||
+        (req.method != HTTP_METHOD_GET && req.method != HTTP_METHOD_HEAD) ||
+        (!req.has_body_length && http_request_header(&req, "transfer-encoding") != NULL))
+    {
+        TRACE(HTTP_BAD_REQUEST, conn->tcp->remote_port);
+        http->counter.bad_requests++;
+        close_http(conn);
+        return -1;
+    }
+    TRACE_TEXT(HTTP_REQUEST, conn->tcp->remote_port, req.path.p, req.path.len);
+
+    // 4 决定响应之后是否保持连接
+    conn->requests++;
+    http->counter.requests++;
+    if (conn->requests > 1)
+    {
+        http->counter.reused++;
+    }
+    conn->version_minor = req.version_minor > 1 ? 1 : req.version_minor; // 响应最高用 HTTP/1.1，不照搬请求里更高的版本
+    conn->keep_alive = req.keep_alive && conn->requests < HTTP_KEEPALIVE_MAX;
+
+    // 5 找到请求的文件，调用 send_file 准备发送，然后从 rx_buf 中取走请求头，请求体随后丢弃
+    send_file(conn, &req);
+    tcp_connect_consume(conn->tcp, header_len);
+    conn->body_left = req.content_length;
+    conn->state = HTTP_SEND_RESPONSE;
+    return 1;
+}
+
+/**
+ * @brief 推进连接的状态机，直到需要等待事件
+ *
+ * 持久连接上流水线发来的多个请求会在这里依次处理，响应按请求的顺序写进 tx_buf。
+ * 对端已经发了 FIN（CLOSE_WAIT）时，回复完 rx_buf 中完整的请求后关闭连接。
+ *
+ * @param conn
+ */
+static void http_conn_run(http_conn_t *conn)
+{
+    while (1)
+    {
+        if (conn->state == HTTP_READ_REQUEST)
+        {
+            int ret = http_read_request(conn);
+            if (ret == 0 && conn->tcp->state == TCP_CLOSE_WAIT) // 对端已发 FIN，缓存里的请求都已回复，不会再有新的请求
+            {
+                close_http(conn);
+            }
+            if (ret <= 0)
+            {
+                return;
+            }
+        }
+        if (http_send_response(conn) <= 0)
+        {
+            return;
+        }
+    }
 }
 
 static void http_handler(tcp_connect_t *tcp, connect_state_t state)
 {
-    if (state == TCP_CONN_CONNECTED)
+    http_conn_t *conn = tcp->arg;
+    if (state == TCP_CONN_CONNECTED) // 连接已经在 accept 队列中，由 http_server_run 取走
     {
-        http_fifo_in(&http_fifo_v, tcp);
-        printf("http conntected.\n");
+        TRACE(HTTP_CONNECTED, tcp->remote_port);
     }
-    else if (state == TCP_CONN_DATA_RECV)
+    else if (state == TCP_CONN_DATA_RECV || state == TCP_CONN_WRITABLE)
     {
+        if (conn)
+        {
+            conn->ready = 1;
+        }
     }
     else if (state == TCP_CONN_CLOSED)
     {
-        printf("http closed.\n");
+        if (conn) // 对端关闭或复位，连接马上会被释放
+        {
+            conn->tcp = NULL;
+            tcp->arg = NULL;
+            http_conn_free(conn);
+        }
+        TRACE(HTTP_PEER_CLOSED, tcp->remote_port);
     }
     else
     {
@@ -177,64 +563,71 @@ static void http_handler(tcp_connect_t *tcp, connect_state_t state)
 // 在端口上创建服务器。
 int http_server_open(uint16_t port)
 {
-    if (!tcp_open(port, http_handler))
+    net_stack_t *stack = net_stack();
+    if (stack->http == NULL && (stack->http = calloc(1, sizeof(http_server_t))) == NULL)
     {
         return -1;
     }
-    http_fifo_init(&http_fifo_v);
+    if (http_cache_init() != 0 || tcp_listen(port, http_handler, TCP_ACCEPT_BACKLOG) != 0)
+    {
+        return -1;
+    }
+    stack->http->port = port;
+    net_add_fini(http_server_fini);
     return 0;
 }
 
-// 从 FIFO 取出请求并处理。新的 HTTP 请求时会发送到 FIFO 中等待处理。
-void http_server_run(void)
+// 释放所有连接的状态机，由 net_stack_destroy 调用。TCP 连接留给 tcp_fini 释放。
+void http_server_fini(void)
 {
-    tcp_connect_t *tcp;
-    char rx_buffer[1024];
-
-    while ((tcp = http_fifo_out(&http_fifo_v)) != NULL)
+    http_server_t *http = http_server();
+    while (http->conns)
     {
-        char *c = rx_buffer;
+        http_conn_free(http->conns);
+    }
+}
 
-        // 1 调用 get_line 向 rx_buffer 中写入一行数据，
-        // 如果没有数据，则调用 close_http 关闭 tcp，并继续循环
-        // TODO
-        if (get_line(tcp, c, sizeof(rx_buffer)) == 0)
+// 从 accept 队列取出新连接，再推进所有有事件的连接的状态机，不会阻塞在任何一个连接上。
+// 等待请求超过 HTTP_KEEPALIVE_TIMEOUT_MS 的持久连接会被关闭。
+void http_server_run(void)
+{
+    http_server_t *http = http_server();
+    tcp_connect_t *batch[TCP_ACCEPT_BACKLOG];
+    size_t n = tcp_accept_batch(http->port, batch, TCP_ACCEPT_BACKLOG);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (http_conn_new(batch[i]) == NULL)
         {
-            perror("get_line() = 0");
-            close_http(tcp);
-            continue;
+            tcp_connect_close(batch[i]);
         }
+    }
 
-        printf("rx_buffer: %s\n", rx_buffer);
-        // 如：
-        // "GET / HTTP1.1"
-        // "GET /index.html HTTP/1.1"
-        // "GET /page1.html HTTP/1.1"
-
-        char *token = strtok(rx_buffer, " ");
-        printf("token(GET): %s\n", token);
-
-        // 2 检查是否有 GET 请求
-        // 如果没有，则调用 close_http 关闭 tcp，并继续循环
-        // TODO
-        if (memcmp(token, "GET", 3) != 0)
+    uint64_t now = time_ms();
+    http_conn_t *next;
+    for (http_conn_t *conn = http->conns; conn; conn = next)
+    {
+        next = conn->next; // 处理过程中 conn 可能被释放
+        if (!conn->ready)
         {
-            perror("No GET");
-            close_http(tcp);
+            if (conn->state == HTTP_READ_REQUEST && now >= conn->idle_deadline)
+            {
+                http->counter.idle_timeouts++;
+                close_http(conn);
+            }
             continue;
         }
-
-        // 3 解析 GET 请求的路径，注意跳过空格，找到 GET 请求的文件，调用 send_file 发送文件
-        // TODO
-        token = strtok(NULL, " ");
-        printf("token(url_path): %s\n", token);
-
-        send_file(tcp, token);
-
-        // 4 调用 close_http 关掉连接
-        // TODO
-        close_http(tcp);
-
-        printf("!! final close\n");
+        conn->ready = 0;
+        http_conn_run(conn); // 对端发了 FIN 时仍回复和 FIN 一起到达的请求，回复完再关闭
     }
 }
+
+/**
+ * @brief 获取 HTTP 服务器的计数
+ *
+ * @param stat 出口参数
+ */
+void http_get_stat(http_stat_t *stat)
+{
+    http_server_t *http = http_server();
+    *stat = http->counter;
+}
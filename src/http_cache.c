@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "http_cache.h"
+#include "http_parser.h"
+#include "map.h"
+#include "net.h"
+#include "utils.h"
+#ifdef HTTP_GZIP
+#include <zlib.h>
+#endif
+#ifdef HTTP_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/* 文件缓存：KEY 为请求路径（补零到 HTTP_CACHE_PATH_MAX 字节），VALUE 为 http_file_t *。
+    命中且在 HTTP_CACHE_CHECK_MS 之内检查过的文件直接从内存发送，不产生任何系统调用；
+    超过这个间隔就 stat 一次，修改时间或大小变了就重新加载。
+    用轮询修改时间而不是 inotify，是为了在 Windows（Npcap）下同样可用。
+    文本类文件在加载时顺带生成 gzip / brotli 压缩版本，请求路径上只按 Accept-Encoding 挑选，从不压缩。
+*/
+struct http_cache // 一个协议栈实例的文件缓存，放在 net_stack()->http_cache
+{
+    map_t table;
+    http_cache_stat_t counter;
+};
+
+typedef struct mime_entry
+{
+    const char *ext;
+    const char *type;
+    uint8_t compressible; // 文本类内容，值得预先压缩；图片本身已经压缩过
+} mime_entry_t;
+
+static const mime_entry_t mime_table[] = {
+    {"html", "text/html", 1},
+    {"htm", "text/html", 1},
+    {"css", "text/css", 1},
+    {"js", "application/javascript", 1},
+    {"json", "application/json", 1},
+    {"txt", "text/plain", 1},
+    {"jpg", "image/jpeg", 0},
+    {"jpeg", "image/jpeg", 0},
+    {"png", "image/png", 0},
+    {"gif", "image/gif", 0},
+    {"svg", "image/svg+xml", 1},
+    {"ico", "image/x-icon", 0},
+};
+
+/**
+ * @brief 当前协议栈实例的文件缓存
+ *
+ * @return http_cache_t*
+ */
+static inline http_cache_t *http_cache()
+{
+    return net_stack()->http_cache;
+}
+
+/**
+ * @brief 初始化当前协议栈实例的文件缓存
+ *
+ * @return int 成功为 0，内存不足为 -1
+ */
+int http_cache_init(void)
+{
+    net_stack_t *stack = net_stack();
+    if (stack->http_cache == NULL && (stack->http_cache = malloc(sizeof(http_cache_t))) == NULL)
+        return -1;
+    http_cache_t *cache = stack->http_cache;
+    map_init(&cache->table, HTTP_CACHE_PATH_MAX, sizeof(http_file_t *), HTTP_CACHE_MAX_FILES, 0, NULL);
+    memset(&cache->counter, 0, sizeof(cache->counter));
+    net_add_fini(http_cache_fini);
+    return 0;
+}
+
+static void http_cache_put_fn(void *key, void *value, time_t *timestamp)
+{
+    http_cache_put(*(http_file_t **)value);
+}
+
+/**
+ * @brief 放掉缓存表对所有文件的引用，由 net_stack_destroy 调用。
+ *        还排在 TCP 发送队列里的文件等 TCP 释放连接时再释放
+ *
+ */
+void http_cache_fini(void)
+{
+    http_cache_t *cache = http_cache();
+    map_foreach(&cache->table, http_cache_put_fn);
+    map_init(&cache->table, HTTP_CACHE_PATH_MAX, sizeof(http_file_t *), HTTP_CACHE_MAX_FILES, 0, NULL);
+}
+
+/**
+ * @brief 根据扩展名查找 MIME 表
+ *
+ * @param path 请求路径
+ * @param path_len 路径长度
+ * @return const mime_entry_t* 不认识的扩展名为 NULL
+ */
+static const mime_entry_t *http_mime_find(const char *path, size_t path_len)
+{
+    size_t i = path_len;
+    while (i > 0 && path[i - 1] != '.' && path[i - 1] != '/')
+        i--;
+    if (i == 0 || path[i - 1] != '.')
+        return NULL;
+    const char *ext = path + i;
+    size_t ext_len = path_len - i;
+    for (size_t j = 0; j < sizeof(mime_table) / sizeof(mime_table[0]); j++)
+    {
+        if (strlen(mime_table[j].ext) != ext_len)
+            continue;
+        size_t k = 0;
+        while (k < ext_len && (ext[k] | 0x20) == mime_table[j].ext[k])
+            k++;
+        if (k == ext_len)
+            return &mime_table[j];
+    }
+    return NULL;
+}
+
+/**
+ * @brief 根据扩展名得到 Content-Type
+ *
+ * @param path 请求路径
+ * @param path_len 路径长度
+ * @return const char* MIME 类型，不认识的扩展名为 application/octet-stream
+ */
+const char *http_mime_type(const char *path, size_t path_len)
+{
+    const mime_entry_t *mime = http_mime_find(path, path_len);
+    return mime ? mime->type : "application/octet-stream";
+}
+
+/**
+ * @brief 按 Accept-Encoding 选出要发送的版本，客户端能接受的里面挑最小的
+ *
+ * @param file
+ * @param accept http_parse_accept_encoding 的结果
+ * @return const http_variant_t* 没有可用的压缩版本时为原始内容
+ */
+const http_variant_t *http_cache_variant(const http_file_t *file, unsigned accept)
+{
+    const http_variant_t *best = &file->variants[HTTP_ENCODING_IDENTITY];
+    const http_variant_t *gz = &file->variants[HTTP_ENCODING_GZIP];
+    const http_variant_t *br = &file->variants[HTTP_ENCODING_BR];
+    if ((accept & HTTP_ACCEPT_GZIP) && gz->data && gz->size < best->size)
+        best = gz;
+    if ((accept & HTTP_ACCEPT_BR) && br->data && br->size < best->size)
+        best = br;
+    return best;
+}
+
+/**
+ * @brief 释放一个文件的引用，缓存表和所有响应都不再使用时释放内存
+ *
+ * @param file
+ */
+void http_cache_put(http_file_t *file)
+{
+    if (--file->refs == 0)
+    {
+        for (int i = 0; i < HTTP_ENCODING_NUM; i++)
+            free(file->variants[i].data);
+        free(file);
+    }
+}
+
+/**
+ * @brief 文件的所有版本占用的字节数
+ *
+ * @param file
+ * @return size_t
+ */
+static size_t http_file_bytes(const http_file_t *file)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < HTTP_ENCODING_NUM; i++)
+        bytes += file->variants[i].size;
+    return bytes;
+}
+
+/**
+ * @brief 把文件从缓存表中移除，正在发送它的响应不受影响
+ *
+ * @param key 缓存键
+ * @param file
+ */
+static void http_cache_remove(const char *key, http_file_t *file)
+{
+    http_cache_t *cache = http_cache();
+    file->stale = 1;
+    cache->counter.files--;
+    cache->counter.bytes -= http_file_bytes(file);
+    map_delete(&cache->table, key);
+    http_cache_put(file);
+}
+
+/**
+ * @brief 生成 gzip 压缩版本
+ *
+ * @param data 原始内容
+ * @param size 原始大小
+ * @param out_size 出口参数，压缩后的大小
+ * @return uint8_t* 压缩后的内容，失败为 NULL
+ */
+static uint8_t *http_gzip(const uint8_t *data, size_t size, size_t *out_size)
+{
+#ifdef HTTP_GZIP
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) // 15 + 16 表示 gzip 格式
+        return NULL;
+    size_t bound = deflateBound(&zs, size);
+    uint8_t *out = malloc(bound);
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = size;
+    zs.next_out = out;
+    zs.avail_out = bound;
+    if (out == NULL || deflate(&zs, Z_FINISH) != Z_STREAM_END)
+    {
+        deflateEnd(&zs);
+        free(out);
+        return NULL;
+    }
+    *out_size = zs.total_out;
+    deflateEnd(&zs);
+    return out;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief 生成 brotli 压缩版本
+ *
+ * @param data 原始内容
+ * @param size 原始大小
+ * @param out_size 出口参数，压缩后的大小
+ * @return uint8_t* 压缩后的内容，失败为 NULL
+ */
+static uint8_t *http_brotli(const uint8_t *data, size_t size, size_t *out_size)
+{
+#ifdef HTTP_BROTLI
+    size_t bound = BrotliEncoderMaxCompressedSize(size);
+    uint8_t *out = bound ? malloc(bound) : NULL;
+    *out_size = bound;
+    if (out == NULL || !BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                              size, data, out_size, out))
+    {
+        free(out);
+        return NULL;
+    }
+    return out;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief 填好一个版本的 ETag 和响应头
+ *
+ * @param file mime、last_modified、vary 已经填好
+ * @param v
+ * @param suffix 加在 ETag 里区分编码的后缀，原始内容为空串
+ */
+static void http_variant_header(const http_file_t *file, http_variant_t *v, const char *suffix)
+{
+    snprintf(v->etag, sizeof(v->etag), "\"%zx-%llx%s\"", file->variants[0].size, (unsigned long long)file->mtime, suffix);
+    v->header_len = snprintf(v->header, sizeof(v->header),
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %zu\r\n"
+                             "%s%s%s"
+                             "%s"
+                             "ETag: %s\r\n"
+                             "Last-Modified: %s\r\n",
+                             file->mime, v->size,
+                             v->encoding ? "Content-Encoding: " : "", v->encoding ? v->encoding : "", v->encoding ? "\r\n" : "",
+                             file->vary ? "Vary: Accept-Encoding\r\n" : "",
+                             v->etag, file->last_modified);
+}
+
+/**
+ * @brief 从磁盘加载文件，生成压缩版本和不随请求变化的响应头
+ *
+ * 压缩只在这里做一次，比原始内容小不到 1/8 的压缩版本直接丢掉。
+ *
+ * @param file_path 磁盘路径
+ * @param path 请求路径，用于判断 MIME 类型
+ * @param path_len 请求路径长度
+ * @param st 文件的 stat 结果
+ * @return http_file_t* 引用计数为 1，失败为 NULL
+ */
+static http_file_t *http_cache_load(const char *file_path, const char *path, size_t path_len, const struct stat *st)
+{
+    http_cache_t *cache = http_cache();
+    FILE *fp = fopen(file_path, "rb");
+    if (fp == NULL)
+        return NULL;
+    http_file_t *file = calloc(1, sizeof(http_file_t));
+    uint8_t *data = malloc(st->st_size ? st->st_size : 1);
+    if (file == NULL || data == NULL || fread(data, 1, st->st_size, fp) != (size_t)st->st_size)
+    {
+        fclose(fp);
+        free(file);
+        free(data);
+        return NULL;
+    }
+    fclose(fp);
+
+    const mime_entry_t *mime = http_mime_find(path, path_len);
+    http_variant_t *identity = &file->variants[HTTP_ENCODING_IDENTITY];
+    identity->data = data;
+    identity->size = st->st_size;
+    file->mtime = st->st_mtime;
+    file->checked = time_ms();
+    file->mime = mime ? mime->type : "application/octet-stream";
+    file->refs = 1;
+    struct tm mtime; // 分片线程同时加载缓存，不能用 gmtime 共享的静态结果
+#ifdef _WIN32
+    gmtime_s(&mtime, &file->mtime);
+#else
+    gmtime_r(&file->mtime, &mtime);
+#endif
+    strftime(file->last_modified, sizeof(file->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &mtime);
+
+    // 1 文本类文件预先压缩，只保留确实变小了的版本
+    if (mime && mime->compressible && identity->size >= HTTP_COMPRESS_MIN)
+    {
+        http_variant_t *gz = &file->variants[HTTP_ENCODING_GZIP];
+        http_variant_t *br = &file->variants[HTTP_ENCODING_BR];
+        gz->data = http_gzip(data, identity->size, &gz->size);
+        br->data = http_brotli(data, identity->size, &br->size);
+        for (http_variant_t *v = gz; v <= br; v++)
+        {
+            if (v->data && v->size > identity->size - identity->size / 8)
+            {
+                free(v->data);
+                v->data = NULL;
+            }
+            if (v->data == NULL)
+            {
+                v->size = 0;
+                continue;
+            }
+            file->vary = 1;
+            cache->counter.compressed++;
+            cache->counter.compressed_saved += identity->size - v->size;
+        }
+        gz->encoding = "gzip";
+        br->encoding = "br";
+    }
+
+    // 2 每个版本各自的 ETag 和响应头
+    http_variant_header(file, identity, "");
+    if (file->variants[HTTP_ENCODING_GZIP].data)
+        http_variant_header(file, &file->variants[HTTP_ENCODING_GZIP], "-gz");
+    if (file->variants[HTTP_ENCODING_BR].data)
+        http_variant_header(file, &file->variants[HTTP_ENCODING_BR], "-br");
+    return file;
+}
+
+/**
+ * @brief 获取缓存的文件，不在缓存中或已被修改时从磁盘加载
+ *
+ * 返回的文件已增加引用，用完后调用 http_cache_put 释放。
+ * 文件不存在、过大或缓存已满时返回 NULL，调用者可以自行从磁盘读取。
+ *
+ * @param path 请求路径，以 '/' 开头，不含查询串
+ * @param path_len 路径长度
+ * @return http_file_t* 文件，失败为 NULL
+ */
+http_file_t *http_cache_get(const char *path, size_t path_len)
+{
+    http_cache_t *cache = http_cache();
+    char key[HTTP_CACHE_PATH_MAX] = {0};
+    char file_path[sizeof(XHTTP_DOC_DIR) + HTTP_CACHE_PATH_MAX];
+    struct stat st;
+    if (path_len >= HTTP_CACHE_PATH_MAX)
+        return NULL;
+    memcpy(key, path, path_len);
+    cache->counter.lookups++;
+
+    // 1 在缓存中，且最近检查过，直接返回
+    uint64_t now = time_ms();
+    http_file_t **slot = map_get(&cache->table, key);
+    http_file_t *file = slot ? *slot : NULL;
+    if (file && now - file->checked < HTTP_CACHE_CHECK_MS)
+    {
+        cache->counter.hits++;
+        file->refs++;
+        return file;
+    }
+
+    // 2 不在缓存中，或者需要重新检查修改时间
+    snprintf(file_path, sizeof(file_path), "%s%s", XHTTP_DOC_DIR, key);
+    int exists = stat(file_path, &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+    if (file)
+    {
+        cache->counter.revalidations++;
+        if (exists && st.st_mtime == file->mtime && (size_t)st.st_size == file->variants[HTTP_ENCODING_IDENTITY].size)
+        {
+            cache->counter.hits++;
+            file->checked = now;
+            file->refs++;
+            return file;
+        }
+        cache->counter.reloads++;
+        http_cache_remove(key, file);
+    }
+    if (!exists)
+        return NULL;
+
+    // 3 从磁盘加载，放进缓存
+    cache->counter.misses++;
+    if (st.st_size > HTTP_CACHE_FILE_MAX ||
+        cache->counter.bytes + st.st_size > HTTP_CACHE_MAX_BYTES ||
+        map_size(&cache->table) == HTTP_CACHE_MAX_FILES)
+    {
+        cache->counter.uncached++;
+        return NULL;
+    }
+    file = http_cache_load(file_path, key, path_len, &st);
+    if (file == NULL || map_set(&cache->table, key, &file) != 0)
+    {
+        if (file)
+            http_cache_put(file);
+        return NULL;
+    }
+    cache->counter.files++;
+    cache->counter.bytes += http_file_bytes(file);
+    file->refs++;
+    return file;
+}
+
+/**
+ * @brief 获取文件缓存的计数
+ *
+ * @param stat 出口参数
+ */
+void http_cache_get_stat(http_cache_stat_t *stat)
+{
+    http_cache_t *cache = http_cache();
+    *stat = cache->counter;
+}
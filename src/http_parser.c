@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "http_parser.h"
+
+/**
+ * @brief 初始化解析器，开始解析一个新请求
+ *
+ * @param parser
+ */
+void http_parser_init(http_parser_t *parser)
+{
+    parser->scanned = 0;
+}
+
+/**
+ * @brief 不区分大小写比较 a 和以 '\0' 结尾的 b
+ *
+ * @return int 相同为 1
+ */
+static int http_str_ieq(http_str_t a, const char *b)
+{
+    size_t len = strlen(b);
+    if (a.len != len)
+        return 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        char c = a.p[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != b[i])
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief 去掉首尾的空格和制表符
+ */
+static http_str_t http_str_trim(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    return (http_str_t){p, end - p};
+}
+
+/**
+ * @brief 查找请求头的结尾（空行），只扫描上次没扫描过的部分
+ *
+ * 用 memchr 整块查找 '\n'，libc 的实现是按字（或 SIMD）比较的，比逐字节判断快得多。
+ *
+ * @param parser
+ * @param data
+ * @param len
+ * @return size_t 请求头总长度，没有找到为 0
+ */
+static size_t http_find_header_end(http_parser_t *parser, const char *data, size_t len)
+{
+    const char *p = data + parser->scanned;
+    const char *end = data + len;
+    while (p < end)
+    {
+        const char *lf = memchr(p, '\n', end - p);
+        if (lf == NULL)
+            break;
+        // "\n\n" 或 "\n\r\n" 表示空行
+        if (lf + 1 < end && lf[1] == '\n')
+            return lf + 2 - data;
+        if (lf + 2 < end && lf[1] == '\r' && lf[2] == '\n')
+            return lf + 3 - data;
+        if (lf + 2 >= end) // 空行可能还没收全，下次从这个 '\n' 开始
+        {
+            parser->scanned = lf - data;
+            return 0;
+        }
+        p = lf + 1;
+    }
+    parser->scanned = len;
+    return 0;
+}
+
+/**
+ * @brief 解析请求行
+ *
+ * @return int 成功为 0，格式错误为 -1
+ */
+static int http_parse_request_line(const char *p, const char *end, http_request_t *req)
+{
+    const char *sp = memchr(p, ' ', end - p);
+    if (sp == NULL || sp == p)
+        return -1;
+    req->method_str = (http_str_t){p, sp - p};
+    if (req->method_str.len == 3 && !memcmp(p, "GET", 3))
+        req->method = HTTP_METHOD_GET;
+    else if (req->method_str.len == 4 && !memcmp(p, "HEAD", 4))
+        req->method = HTTP_METHOD_HEAD;
+    else if (req->method_str.len == 4 && !memcmp(p, "POST", 4))
+        req->method = HTTP_METHOD_POST;
+    else
+        req->method = HTTP_METHOD_OTHER;
+
+    p = sp + 1;
+    sp = memchr(p, ' ', end - p);
+    if (sp == NULL) // HTTP/0.9 风格的 "GET /"，按 1.0 处理
+    {
+        req->path = http_str_trim(p, end);
+        req->version_minor = 0;
+        return req->path.len ? 0 : -1;
+    }
+    req->path = (http_str_t){p, sp - p};
+    http_str_t version = http_str_trim(sp + 1, end);
+    if (version.len != 8 || memcmp(version.p, "HTTP/1.", 7) || version.p[7] < '0' || version.p[7] > '9')
+        return -1;
+    req->version_minor = version.p[7] - '0';
+    return req->path.len ? 0 : -1;
+}
+
+/**
+ * @brief 增量解析一个 HTTP/1.x 请求头
+ *
+ * 每次收到新数据后用同一个 parser 和完整的数据（从请求开头算起）再调用一次，
+ * 已经扫描过的部分不会重复扫描。解析结果中的字符串都直接指向 data，不做拷贝，
+ * 因此在使用完 req 之前 data 不能被修改或释放。
+ *
+ * @param parser 增量解析的状态
+ * @param data 从请求开头算起的全部已收到数据
+ * @param len 数据长度
+ * @param req 出口参数
+ * @return int 请求头完整时返回请求头长度，还需要更多数据时为 0，格式错误为 -1
+ */
+int http_parse_request(http_parser_t *parser, const char *data, size_t len, http_request_t *req)
+{
+    // 1 查找请求头结尾，没找到就等待更多数据
+    size_t header_len = http_find_header_end(parser, data, len);
+    if (header_len == 0)
+        return 0;
+
+    memset(req, 0, sizeof(http_request_t));
+    req->header_len = header_len;
+    const char *p = data;
+    const char *end = data + header_len;
+
+    // 2 跳过请求之前多余的空行，再解析请求行
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+    const char *lf = memchr(p, '\n', end - p);
+    if (lf == NULL)
+        return -1;
+    const char *line_end = (lf > p && lf[-1] == '\r') ? lf - 1 : lf;
+    if (http_parse_request_line(p, line_end, req) != 0)
+        return -1;
+    int connection_close = 0, connection_keep_alive = 0;
+
+    // 3 逐行解析请求头，直到空行
+    for (p = lf + 1; p < end; p = lf + 1)
+    {
+        lf = memchr(p, '\n', end - p);
+        line_end = (lf > p && lf[-1] == '\r') ? lf - 1 : lf;
+        if (line_end == p) // 空行，请求头结束
+            break;
+        const char *colon = memchr(p, ':', line_end - p);
+        if (colon == NULL || colon == p)
+            return -1;
+        http_header_t header = {{p, colon - p}, http_str_trim(colon + 1, line_end)};
+
+        if (http_str_ieq(header.name, "content-length"))
+        {
+            size_t n = 0;
+            if (header.value.len == 0)
+                return -1;
+            for (size_t i = 0; i < header.value.len; i++)
+            {
+                if (header.value.p[i] < '0' || header.value.p[i] > '9')
+                    return -1;
+                size_t digit = header.value.p[i] - '0';
+                if (n > (SIZE_MAX - digit) / 10) // 溢出后会回绕成一个小的长度，请求体就切错了
+                    return -1;
+                n = n * 10 + digit;
+            }
+            if (req->has_body_length && req->content_length != n) // 重复的 Content-Length 只接受相同的值
+                return -1;
+            req->content_length = n;
+            req->has_body_length = 1;
+        }
+        else if (http_str_ieq(header.name, "connection"))
+        {
+            connection_close |= http_str_ieq(header.value, "close");
+            connection_keep_alive |= http_str_ieq(header.value, "keep-alive");
+        }
+
+        if (req->num_headers < HTTP_MAX_HEADERS)
+            req->headers[req->num_headers++] = header;
+    }
+
+    // 4 HTTP/1.1 默认保持连接，HTTP/1.0 需要显式的 keep-alive
+    // 响应最高用 HTTP/1.1，更高的次版本号按 1.1 决定默认是否保持连接
+    uint8_t minor = req->version_minor > 1 ? 1 : req->version_minor;
+    req->keep_alive = minor == 1 ? !connection_close : connection_keep_alive;
+    return header_len;
+}
+
+/**
+ * @brief 按名字查找请求头，不区分大小写
+ *
+ * @param req
+ * @param name 小写的请求头名字
+ * @return const http_str_t* 请求头的值，没有找到为 NULL
+ */
+const http_str_t *http_request_header(const http_request_t *req, const char *name)
+{
+    for (size_t i = 0; i < req->num_headers; i++)
+    {
+        if (http_str_ieq(req->headers[i].name, name))
+            return &req->headers[i].value;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 解析一个十进制数，不允许溢出
+ *
+ * @param p 起始位置
+ * @param end 结束位置
+ * @param n 出口参数
+ * @return const char* 数字之后的位置，没有数字或溢出为 NULL
+ */
+static const char *http_parse_size(const char *p, const char *end, size_t *n)
+{
+    const char *start = p;
+    *n = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        if (*n > (SIZE_MAX - 9) / 10)
+            return NULL;
+        *n = *n * 10 + (*p - '0');
+    }
+    return p == start ? NULL : p;
+}
+
+/**
+ * @brief 解析 IMF-fixdate 格式的 HTTP 日期，如 "Sun, 06 Nov 1994 08:49:37 GMT"
+ *
+ * 浏览器在 If-Modified-Since 中原样带回服务器给的 Last-Modified，都是这种格式；
+ * 过时的 RFC 850 和 asctime 格式不支持，调用者按日期无效处理，即忽略这个请求头。
+ *
+ * @param s 日期字符串
+ * @param t 出口参数，UTC 时间
+ * @return int 成功为 0，格式不对为 -1
+ */
+int http_parse_date(http_str_t s, time_t *t)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char buf[32], mon[4];
+    int day, year, hour, min, sec, n = 0;
+    if (s.len != 29)
+        return -1;
+    memcpy(buf, s.p, s.len);
+    buf[s.len] = '\0';
+    if (sscanf(buf, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT%n", &day, mon, &year, &hour, &min, &sec, &n) != 6 || n != 29)
+        return -1;
+    const char *m = strstr(months, mon);
+    if (m == NULL || (m - months) % 3 != 0 || day < 1 || day > 31 || year < 1970 || hour > 23 || min > 59 || sec > 60)
+        return -1;
+
+    // 公历日期换算成 1970-01-01 以来的天数，不依赖 timegm（Windows 下没有）
+    int month = (m - months) / 3 + 1;
+    long y = year - (month <= 2);
+    long era = y / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = era * 146097 + doe - 719468;
+    *t = (time_t)days * 86400 + hour * 3600 + min * 60 + sec;
+    return 0;
+}
+
+/**
+ * @brief 解析只含一个区间的 Range 请求头，如 "bytes=0-499"、"bytes=500-"、"bytes=-500"
+ *
+ * 多个区间的请求需要 multipart/byteranges 响应，这里不支持，按格式不支持处理，
+ * 此时忽略 Range、返回完整的文件也是符合协议的。
+ *
+ * @param s Range 请求头的值
+ * @param size 文件大小
+ * @param first 出口参数，区间第一个字节
+ * @param last 出口参数，区间最后一个字节（闭区间）
+ * @return int 成功为 1，区间不可满足（应返回 416）为 0，格式不支持为 -1
+ */
+int http_parse_range(http_str_t s, size_t size, size_t *first, size_t *last)
+{
+    const char *p = s.p;
+    const char *end = s.p + s.len;
+    if (s.len < 6 || !http_str_ieq((http_str_t){p, 6}, "bytes="))
+        return -1;
+    p += 6;
+    if (memchr(p, ',', end - p))
+        return -1;
+
+    size_t a, b;
+    if (p < end && *p == '-') // 后缀区间：最后 b 个字节
+    {
+        if ((p = http_parse_size(p + 1, end, &b)) == NULL || p != end)
+            return -1;
+        if (b == 0 || size == 0)
+            return 0;
+        *first = b < size ? size - b : 0;
+        *last = size - 1;
+        return 1;
+    }
+    if ((p = http_parse_size(p, end, &a)) == NULL || p == end || *p++ != '-')
+        return -1;
+    b = SIZE_MAX;
+    if (p != end && ((p = http_parse_size(p, end, &b)) == NULL || p != end))
+        return -1;
+    if (b < a)
+        return -1;
+    if (a >= size)
+        return 0;
+    *first = a;
+    *last = b < size ? b : size - 1;
+    return 1;
+}
+
+/**
+ * @brief 判断 If-None-Match 的实体标签列表中是否有与 etag 相同的
+ *
+ * 按弱比较，忽略 W/ 前缀，"*" 匹配任何存在的文件。
+ *
+ * @param list 请求头的值，逗号分隔
+ * @param etag 带引号的强 ETag
+ * @return int 匹配为 1
+ */
+int http_etag_match(http_str_t list, const char *etag)
+{
+    size_t etag_len = strlen(etag);
+    const char *p = list.p;
+    const char *end = list.p + list.len;
+    while (p < end)
+    {
+        const char *comma = memchr(p, ',', end - p);
+        http_str_t tag = http_str_trim(p, comma ? comma : end);
+        if (tag.len == 1 && tag.p[0] == '*')
+            return 1;
+        if (tag.len > 2 && tag.p[0] == 'W' && tag.p[1] == '/')
+        {
+            tag.p += 2;
+            tag.len -= 2;
+        }
+        if (tag.len == etag_len && !memcmp(tag.p, etag, etag_len))
+            return 1;
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+/**
+ * @brief 解析 Accept-Encoding，得到客户端能接受的压缩编码
+ *
+ * q=0 表示明确拒绝；"*" 代表没有单独列出的所有编码。不关心 q 值的大小，
+ * 能接受的编码里选哪个由调用者按压缩后的大小决定。
+ *
+ * @param s 请求头的值
+ * @return unsigned HTTP_ACCEPT_GZIP、HTTP_ACCEPT_BR 的组合
+ */
+unsigned http_parse_accept_encoding(http_str_t s)
+{
+    unsigned allowed = 0, listed = 0, star = 0;
+    const char *p = s.p;
+    const char *end = s.p + s.len;
+    while (p < end)
+    {
+        const char *comma = memchr(p, ',', end - p);
+        const char *item_end = comma ? comma : end;
+        const char *semi = memchr(p, ';', item_end - p);
+        http_str_t coding = http_str_trim(p, semi ? semi : item_end);
+        int refused = 0;
+        if (semi)
+        {
+            http_str_t q = http_str_trim(semi + 1, item_end);
+            if (q.len >= 3 && (q.p[0] | 0x20) == 'q' && q.p[1] == '=' && q.p[2] == '0')
+            {
+                refused = 1;
+                for (size_t i = 3; i < q.len; i++)
+                    refused &= q.p[i] == '.' || q.p[i] == '0';
+            }
+        }
+        unsigned bit = 0;
+        if (http_str_ieq(coding, "gzip") || http_str_ieq(coding, "x-gzip"))
+            bit = HTTP_ACCEPT_GZIP;
+        else if (http_str_ieq(coding, "br"))
+            bit = HTTP_ACCEPT_BR;
+        else if (http_str_ieq(coding, "*"))
+            star = refused ? 0 : HTTP_ACCEPT_GZIP | HTTP_ACCEPT_BR;
+        listed |= bit;
+        if (!refused)
+            allowed |= bit;
+        p = comma ? comma + 1 : end;
+    }
+    return allowed | (star & ~listed);
+}
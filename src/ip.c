@@ -26,20 +26,26 @@ void ip_in(buf_t *buf, uint8_t *src_mac)
     uint16_t total_len16 = swap16(hdr->total_len16);
 
     // S2 常规检查
+    LATENCY_MARK(IP_IN);
+    STATS_INC(IP_IN_RECEIVES);
     if (buf->len < sizeof(ip_hdr_t)) // 如果数据包的长度小于 IP 头部长度，丢弃不处理。
     {
+        STATS_INC(IP_IN_TRUNCATED);
         return; // 还有一种写法是 IP_HDR_LEN_PER_BYTE * hdr->hdr_len
     }
     if (hdr->version != IP_VERSION_4) // IP 头部的版本号是否为 IPv4: 0100，也即 4
     {
+        STATS_INC(IP_IN_HDR_ERRORS);
         return;
     }
     if (total_len16 > buf->len) // 总长度字段小于或等于收到的包的长度，因为包中可能有 padding
     {
+        STATS_INC(IP_IN_TRUNCATED);
         return;
     }
-    if (memcmp(hdr->dst_ip, net_if_ip, NET_IP_LEN) != 0) // 对比目的 IP 地址是否为本机的 IP 地址，如果不是，则丢弃不处理。
+    if (memcmp(hdr->dst_ip, net_stack()->if_ip, NET_IP_LEN) != 0) // 对比目的 IP 地址是否为本机的 IP 地址，如果不是，则丢弃不处理。
     {
+        STATS_INC(IP_IN_ADDR_ERRORS);
         return;
     }
 
@@ -49,13 +55,14 @@ void ip_in(buf_t *buf, uint8_t *src_mac)
     uint16_t re_checksum16 = checksum16((uint16_t *)hdr, sizeof(ip_hdr_t)); // 然后调用 checksum16 函数来计算头部校验和
     if (hdr_checksum16 != re_checksum16)                                    // 如果与 IP 头部的首部校验和字段不一致，丢弃不处理
     {
+        STATS_INC(IP_IN_CSUM_ERRORS);
         return;
     }
     hdr->hdr_checksum16 = hdr_checksum16; // 如果一致，则再将该头部校验和字段恢复成原来的值。
 
     // S4 去 padding
     // 如果接收到的数据包的长度大于 IP 头部的总长度字段，则说明该数据包有填充字段，可调用 buf_remove_padding() 函数去除填充字段。
-    int padding_len = buf->len - hdr->total_len16; // 能到这一步就是一定大于等于 0 了
+    int padding_len = buf->len - total_len16; // 能到这一步就是一定大于等于 0 了
     if (padding_len > 0)
     {
         buf_remove_padding(buf, padding_len);
@@ -71,10 +78,13 @@ void ip_in(buf_t *buf, uint8_t *src_mac)
         // 调用 buf_remove_header() 函数去掉 IP 报头。
         buf_remove_header(buf, sizeof(ip_hdr_t));
 
+        STATS_INC(IP_IN_DELIVERS);
         net_in(buf, protocol, src_ip);
         return;
     }
 
+    STATS_INC(IP_IN_UNKNOWN_PROTOS);
+
     // 这里不要去掉报头！
     icmp_unreachable(buf, src_ip, ICMP_CODE_PROTOCOL_UNREACH);
     // 必做任务只要求做到 UDP，TCP 不需要做，所以在做 IP/ICMP 自测时，当收到 TCP 报文可以当作不能处理，需回送一个 ICMP 协议不可达报文。
@@ -111,7 +121,7 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     hdr->ttl = IP_DEFALUT_TTL;
     hdr->protocol = protocol;
     memcpy(hdr->dst_ip, ip, NET_IP_LEN);
-    memcpy(hdr->src_ip, net_if_ip, NET_IP_LEN);
+    memcpy(hdr->src_ip, net_stack()->if_ip, NET_IP_LEN);
 
     // Step3
     // 先把 IP 头部的首部校验和字段填 0，再调用 checksum16 函数计算校验和，然后把计算出来的校验和填入首部校验和字段。
@@ -139,9 +149,19 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
     // 但在该实验中目前最大负载长就是 1500 - 20 = 1480，就是 8 的倍数，所以不这么写也不会出错。
     int fragment_len = (ETHERNET_MAX_TRANSPORT_UNIT - sizeof(ip_hdr_t)) / 8 * 8;
 
-    buf_t ip_buf;      // 用于承载 IP 数据的数据包，不能用指针，因为需要从 buf 复制过来数据进行处理
-    static int id = 0; // IP 协议利用一个计数器，每产生 IP 分组（而非分片）计数器加 1，作为该 IP 分组的标识。很不巧，ip_fragment_out 的参数用的是 int
+    static _Thread_local buf_t ip_buf; // 用于承载 IP 数据的数据包，不能用指针，因为需要从 buf 复制过来数据进行处理；
+                                       // 有 128 KB，不放在栈上，否则在协程的 64 KB 栈里调用会越界
+    int id = net_stack()->ip_id++; // IP 协议利用一个计数器，每产生 IP 分组（而非分片）计数器加 1，作为该 IP 分组的标识。很不巧，ip_fragment_out 的参数用的是 int
     int i = 0;         // 分片数标记
+    STATS_INC(IP_OUT_REQUESTS);
+
+    // S1.1 不需要分片时直接在 buf 前面加 IP 首部发送，不再拷贝一份。
+    // TCP 已经按 MSS 切好段，正常情况下都走这条路。
+    if (buf->len <= fragment_len)
+    {
+        ip_fragment_out(buf, ip, protocol, id, 0, 0);
+        return;
+    }
 
     // S2 如果超过 IP 协议最大负载包长，则需要分片发送
     // 下面循环中发送的数据包分片不包含最后一片，最后一个分片放到 S3 和小于最大负载包长的数据包一起处理。
@@ -150,6 +170,7 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
         buf_init(&ip_buf, fragment_len);                                 // 首先调用 buf_init() 初始化一个 ip_buf
         memcpy(ip_buf.data, buf->data, fragment_len);                    // 抽出一个最大负载的长度的数据
         ip_fragment_out(&ip_buf, ip, protocol, id, i * fragment_len, 1); // 调用 ip_fragment_out() 函数发送出去
+        STATS_INC(IP_FRAG_CREATES);
         buf_remove_header(buf, fragment_len);                            // 剔除已发送部分
         i++;
     }
@@ -159,10 +180,8 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
     buf_init(&ip_buf, buf->len);
     memcpy(ip_buf.data, buf->data, buf->len); // 最后一个分片，大小就等于该分片大小；单独的一片也是一样
     ip_fragment_out(&ip_buf, ip, protocol, id, i * fragment_len, 0);
+    STATS_INC(IP_FRAG_CREATES);
     // 最后一个分片，片偏移是 i * fragment_len；单独的一片的片偏移也可以表示为 i * fragment_len，因为如果不经历分片，则 i = 0，也是一样的效果
-
-    // S4 最后 id 增 1
-    id++;
 }
 
 /**
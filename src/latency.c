@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <sched.h>
+#include <time.h>
+#include "latency.h"
+#include "utils.h"
+
+#define LATENCY_CALIBRATE_NS 10000000 // 校准 TSC 时对照单调时钟的时长
+
+static const char *const latency_names[LATENCY_MAX] = {
+#define LATENCY_STAGE_NAME(id, name) name,
+    LATENCY_STAGES(LATENCY_STAGE_NAME)
+#undef LATENCY_STAGE_NAME
+};
+
+#ifdef NET_LATENCY
+uint64_t latency_tsc_mult = 1ull << 31; // 没有校准时按每周期 1 纳秒
+int latency_tsc_shift = 31;
+
+static uint64_t latency_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 对照单调时钟测出 TSC 的频率，net_init 时调用，每个进程只测一次。
+ *        假定 TSC 频率恒定（现代 x86 的 constant_tsc），不随变频改变
+ *
+ */
+void latency_calibrate(void)
+{
+    static atomic_int state; // 0 没测，1 正在测，2 测好了
+    int expected = 0;
+    if (!atomic_compare_exchange_strong(&state, &expected, 1))
+    {
+        while (atomic_load(&state) != 2) // 别的分片线程正在测
+            sched_yield();
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+    uint64_t start = latency_clock_ns(), now;
+    uint64_t tsc = latency_tsc();
+    while ((now = latency_clock_ns()) - start < LATENCY_CALIBRATE_NS)
+        ;
+    uint64_t ticks = latency_tsc() - tsc;
+    if (ticks)
+    {
+        // 取 mult 小于 2^32 时最大的 shift，每周期超过 1 纳秒的慢计数器（如 aarch64 上 24 MHz 的 cntvct_el0）shift 小一些
+        int shift = 32;
+        while (shift > 0 && ((now - start) << shift) / ticks >= 1ull << 32)
+            shift--;
+        latency_tsc_mult = ((now - start) << shift) / ticks;
+        latency_tsc_shift = shift;
+    }
+#endif
+    atomic_store(&state, 2);
+}
+#endif
+
+/**
+ * @brief 从直方图里减去较早的一次快照，得到这段时间内的直方图
+ *
+ * @param snap 较晚的快照，结果写回这里
+ * @param base 较早的快照
+ */
+void latency_diff(latency_snap_t *snap, const latency_snap_t *base)
+{
+    snap->sum -= base->sum;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        snap->bucket[i] -= base->bucket[i];
+}
+
+/**
+ * @brief 直方图里的记录数
+ *
+ * @param snap 直方图
+ * @return uint64_t 记录数
+ */
+uint64_t latency_count(const latency_snap_t *snap)
+{
+    uint64_t count = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        count += snap->bucket[i];
+    return count;
+}
+
+/**
+ * @brief 分位数
+ *
+ * @param snap 直方图
+ * @param p 百分比，如 99.9；100 为最大值
+ * @return uint64_t 所在桶的最小纳秒数，没有记录时为 0
+ */
+uint64_t latency_percentile(const latency_snap_t *snap, double p)
+{
+    uint64_t count = latency_count(snap);
+    if (count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(count * p / 100.0 + 0.5); // 第 rank 个记录，从 1 数起
+    rank = rank < 1 ? 1 : rank > count ? count : rank;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += snap->bucket[i];
+        if (seen >= rank)
+            return latency_value(i);
+    }
+    return latency_value(LATENCY_BUCKETS - 1);
+}
+
+/**
+ * @brief 输出各跟踪点的时延分布，每个跟踪点一行：记录数、平均值、p50、p90、p99、p99.9 和最大值（纳秒）
+ *
+ * @param snap 各跟踪点的直方图，下标是 latency_stage_t
+ * @param buf 输出缓冲区，结果以 '\0' 结尾，放不下时截断
+ * @param size 缓冲区大小
+ * @return size_t 完整输出需要的长度，不含 '\0'
+ */
+size_t latency_dump(const latency_snap_t snap[LATENCY_MAX], char *buf, size_t size)
+{
+    size_t len = 0;
+    if (size)
+        buf[0] = '\0';
+    str_append(buf, size, &len, "%-12s %10s %9s %9s %9s %9s %9s %9s  (ns since the frame left the driver)\n",
+               "Latency", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int i = 0; i < LATENCY_MAX; i++)
+    {
+        uint64_t count = latency_count(&snap[i]);
+        str_append(buf, size, &len, "%-12s %10llu %9llu %9llu %9llu %9llu %9llu %9llu\n", latency_names[i],
+                   (unsigned long long)count, (unsigned long long)(count ? snap[i].sum / count : 0),
+                   (unsigned long long)latency_percentile(&snap[i], 50),
+                   (unsigned long long)latency_percentile(&snap[i], 90),
+                   (unsigned long long)latency_percentile(&snap[i], 99),
+                   (unsigned long long)latency_percentile(&snap[i], 99.9),
+                   (unsigned long long)latency_percentile(&snap[i], 100));
+    }
+    return len;
+}
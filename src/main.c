@@ -3,6 +3,7 @@
 #include "tcp.h"
 #include "http.h"
 #include "driver.h"
+#include "shard.h"
 #include "time.h"
 
 #pragma GCC diagnostic push
@@ -23,6 +24,8 @@ void udp_handler(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port)
 #ifdef TCP
 void tcp_handler(tcp_connect_t *connect, connect_state_t state)
 {
+    if (state != TCP_CONN_DATA_RECV)
+        return;
     uint8_t buf[512];
     size_t len = tcp_connect_read(connect, buf, sizeof(buf) - 1);
     buf[len] = 0;
@@ -30,11 +33,82 @@ void tcp_handler(tcp_connect_t *connect, connect_state_t state)
            iptos(connect->ip), connect->remote_port, len);
     printf("%s\n", buf);
     tcp_connect_write(connect, buf, len);
+    if (connect->state == TCP_CLOSE_WAIT && ringbuf_len(&connect->rx_buf) == 0) // 对端已关闭，回完数据后关闭
+        tcp_connect_close(connect);
+}
+#endif
+
+#define STATS_PRINT_SEC 10 // 每隔这么久打印一次各层的计数
+
+/**
+ * @brief 距上次打印超过 STATS_PRINT_SEC 秒时，按 /proc/net/snmp 的格式打印所有实例的计数之和
+ *
+ */
+void stats_print()
+{
+    static time_t last;
+    time_t now = time(NULL);
+    if (now - last < STATS_PRINT_SEC)
+        return;
+    last = now;
+    stats_snapshot_t snap;
+    char dump[4096];
+    stats_snapshot(&snap);
+    stats_dump(&snap, dump, sizeof(dump));
+    printf("%s", dump);
+#ifdef NET_LATENCY
+    latency_dump(snap.latency, dump, sizeof(dump));
+    printf("%s", dump);
+#endif
+}
+
+#if NET_SHARDS > 1
+// 每个分片打开同样的端口，连接按四元组哈希落在其中一个分片上
+int shard_init(int shard, void *arg)
+{
+#ifdef UDP
+    udp_open(60000, udp_handler);
+#endif
+#ifdef TCP
+    tcp_open(61000, tcp_handler);
+#endif
+#ifdef HTTP
+    if (http_server_open(62000) != 0)
+        return -1;
+#endif
+    return 0;
+}
+
+void shard_run(int shard, void *arg)
+{
+#ifdef HTTP
+    http_server_run();
+#endif
 }
 #endif
 
 int main(int argc, char const *argv[])
 {
+    if (trace_init(NET_TRACE_FILE) != 0)
+        printf("trace file %s unavailable, tracing disabled.\n", NET_TRACE_FILE);
+#if NET_SHARDS > 1
+    static const shard_app_t app = {.init = shard_init, .run = shard_run};
+    if (shard_start(NET_SHARDS, &app, NULL) != 0)
+    {
+        printf("shard start failed.");
+        return -1;
+    }
+    while (1)
+    {
+        // 主线程只负责分发，协议处理在分片线程里
+        stats_print();
+        if (shard_poll() == 0)
+        {
+            struct timespec sleepTime = {0, 1000000};
+            nanosleep(&sleepTime, NULL);
+        }
+    }
+#endif
 
     if (net_init() != 0)
     {
@@ -57,6 +131,7 @@ int main(int argc, char const *argv[])
 #ifdef HTTP
         http_server_run();
 #endif
+        stats_print();
         // 节约用电
         struct timespec sleepTime = {0, 1000000};
         nanosleep(&sleepTime, NULL);
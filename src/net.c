@@ -8,37 +8,79 @@
 #include "tcp.h"
 
 /**
- * @brief 协议表 <协议号，处理程序>的容器
+ * @brief 默认的协议栈实例，使用 config.h 中的网卡地址
  *
  */
-map_t net_table;
+static net_stack_t net_default_stack = {.if_mac = NET_IF_MAC, .if_ip = NET_IF_IP};
 
 /**
- * @brief 网卡 MAC 地址
+ * @brief 当前线程使用的协议栈实例
  *
  */
-uint8_t net_if_mac[NET_MAC_LEN] = NET_IF_MAC;
+_Thread_local net_stack_t *net_stack_current = &net_default_stack;
 
 /**
- * @brief 网卡 IP 地址
+ * @brief 创建一个协议栈实例，之后在要运行它的线程里 net_stack_bind 并 net_init
  *
+ * @param mac 网卡 MAC 地址
+ * @param ip 网卡 IP 地址
+ * @return net_stack_t* 失败为 NULL
  */
-uint8_t net_if_ip[NET_IP_LEN] = NET_IF_IP;
+net_stack_t *net_stack_create(const uint8_t *mac, const uint8_t *ip)
+{
+    net_stack_t *stack = calloc(1, sizeof(net_stack_t));
+    if (stack == NULL)
+        return NULL;
+    memcpy(stack->if_mac, mac, NET_MAC_LEN);
+    memcpy(stack->if_ip, ip, NET_IP_LEN);
+    return stack;
+}
+
+/**
+ * @brief 释放一个协议栈实例，调用前先 driver_close
+ *
+ * 先按登记的相反顺序调用各层的释放函数，上层先于下层释放：HTTP 的连接先放掉缓存文件的引用，
+ * TCP 最后释放连接时还给上层的内存都还在。协议表和 arp 表的数据放在 map_t 里，随实例一起释放。
+ *
+ * @param stack 协议栈实例，不能是默认实例
+ */
+void net_stack_destroy(net_stack_t *stack)
+{
+    net_stack_t *prev = net_stack_current;
+    net_stack_current = stack; // 释放函数通过 net_stack() 找到自己的状态
+    while (stack->fini_count > 0)
+        stack->fini[--stack->fini_count]();
+    net_stack_current = prev == stack ? &net_default_stack : prev;
+    stats_unregister(stack);
+    trace_release(stack->trace);
+    free(stack->tcp);
+    free(stack->http);
+    free(stack->http_cache);
+    free(stack);
+}
 
 /**
- * @brief 网卡接收和发送缓冲区
+ * @brief 让当前线程使用 stack，之后的 net_init / net_poll 等都作用于它
  *
+ * @param stack 协议栈实例
  */
-buf_t rxbuf, txbuf; // 一个 buf 足够单线程使用
+void net_stack_bind(net_stack_t *stack)
+{
+    net_stack_current = stack;
+}
 
 /**
- * @brief 初始化协议栈
+ * @brief 初始化当前线程的协议栈实例
  *
  */
 int net_init()
 {
-    map_init(&net_table, sizeof(uint16_t), sizeof(net_handler_t), 0, 0, NULL);
-    if (driver_open() == -1)
+    map_init(&net_stack()->net_table, sizeof(uint16_t), sizeof(net_handler_t), 0, 0, NULL);
+    stats_register(net_stack());
+#ifdef NET_LATENCY
+    latency_calibrate();
+#endif
+    if (net_driver_open() == -1)
         return -1;
 #ifdef ETHERNET
     ethernet_init();
@@ -69,7 +111,22 @@ int net_init()
  */
 void net_add_protocol(uint16_t protocol, net_handler_t handler)
 {
-    map_set(&net_table, &protocol, &handler);
+    map_set(&net_stack()->net_table, &protocol, &handler);
+}
+
+/**
+ * @brief 为当前协议栈实例登记一层的释放函数，net_stack_destroy 时调用。重复登记没有影响
+ *
+ * @param fini 释放函数
+ */
+void net_add_fini(net_fini_t fini)
+{
+    net_stack_t *stack = net_stack();
+    for (int i = 0; i < stack->fini_count; i++)
+        if (stack->fini[i] == fini)
+            return;
+    if (stack->fini_count < NET_FINI_MAX)
+        stack->fini[stack->fini_count++] = fini;
 }
 
 /**
@@ -82,7 +139,8 @@ void net_add_protocol(uint16_t protocol, net_handler_t handler)
  */
 int net_in(buf_t *buf, uint16_t protocol, uint8_t *src)
 {
-    net_handler_t *handler = map_get(&net_table, &protocol);
+    LATENCY_MARK(NET_IN);
+    net_handler_t *handler = map_get(&net_stack()->net_table, &protocol);
     if (handler)
     {
         (*handler)(buf, src);
@@ -100,4 +158,7 @@ void net_poll()
 #ifdef ETHERNET
     ethernet_poll();
 #endif
+#ifdef TCP
+    tcp_poll();
+#endif
 }
\ No newline at end of file
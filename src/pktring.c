@@ -0,0 +1,216 @@
+#include <string.h>
+#include <sched.h>
+#include "pktring.h"
+
+/**
+ * @brief 初始化环并分配槽
+ *
+ * @param ring 要初始化的环
+ * @param size 容量，必须是 2 的幂
+ * @return int 成功为 0，失败为 -1
+ */
+int pktring_init(pktring_t *ring, uint32_t size)
+{
+    if (size == 0 || (size & (size - 1)) != 0)
+        return -1;
+    memset(ring, 0, sizeof(pktring_t));
+    ring->slots = malloc(size * sizeof(void *));
+    if (ring->slots == NULL)
+        return -1;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->reserve, 0);
+    return 0;
+}
+
+/**
+ * @brief 释放环的槽，环中剩下的句柄由调用者处理
+ *
+ * @param ring 要释放的环
+ */
+void pktring_free(pktring_t *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * @brief 单生产者入队一批句柄，放不下的部分留给调用者
+ *
+ * @param ring 环
+ * @param objs 句柄数组
+ * @param n 句柄数
+ * @return unsigned 实际入队的个数
+ */
+unsigned pktring_sp_enqueue(pktring_t *ring, void *const *objs, unsigned n)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t space = ring->mask + 1 - (tail - ring->head_cache);
+    if (space < n) // 缓存的读位置不够用时才读消费者的缓存行
+    {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        space = ring->mask + 1 - (tail - ring->head_cache);
+    }
+    if (n > space)
+        n = space;
+    for (unsigned i = 0; i < n; i++)
+        ring->slots[(tail + i) & ring->mask] = objs[i];
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+/**
+ * @brief 多生产者入队一批句柄，放不下的部分留给调用者
+ *
+ * 先用 CAS 在 reserve 上占用一段槽，写好之后等排在前面的生产者都发布完，再把 tail 推进到自己的末尾，
+ * 这样消费者看到的 tail 之前的槽都已经写好。
+ *
+ * @param ring 环
+ * @param objs 句柄数组
+ * @param n 句柄数
+ * @return unsigned 实际入队的个数
+ */
+unsigned pktring_mp_enqueue(pktring_t *ring, void *const *objs, unsigned n)
+{
+    // 1 占用槽
+    uint32_t start = atomic_load_explicit(&ring->reserve, memory_order_relaxed);
+    uint32_t end;
+    unsigned count;
+    do
+    {
+        uint32_t space = ring->mask + 1 - (start - atomic_load_explicit(&ring->head, memory_order_acquire));
+        count = n < space ? n : space;
+        if (count == 0)
+            return 0;
+        end = start + count;
+    } while (!atomic_compare_exchange_weak_explicit(&ring->reserve, &start, end, memory_order_relaxed, memory_order_relaxed));
+
+    // 2 写槽
+    for (unsigned i = 0; i < count; i++)
+        ring->slots[(start + i) & ring->mask] = objs[i];
+
+    // 3 按占用的顺序发布，前面的生产者被抢占时让出 CPU 等它
+    while (atomic_load_explicit(&ring->tail, memory_order_relaxed) != start)
+        sched_yield();
+    atomic_store_explicit(&ring->tail, end, memory_order_release);
+    return count;
+}
+
+/**
+ * @brief 单消费者出队一批句柄
+ *
+ * @param ring 环
+ * @param objs 出口参数，句柄数组
+ * @param n 最多出队的个数
+ * @return unsigned 实际出队的个数
+ */
+unsigned pktring_sc_dequeue(pktring_t *ring, void **objs, unsigned n)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t avail = ring->tail_cache - head;
+    if (avail < n) // 缓存的写位置不够用时才读生产者的缓存行
+    {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        avail = ring->tail_cache - head;
+    }
+    if (n > avail)
+        n = avail;
+    for (unsigned i = 0; i < n; i++)
+        objs[i] = ring->slots[(head + i) & ring->mask];
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+/**
+ * @brief 创建一个包池。之后只能有一个线程（所有者）pkt_alloc，可以不是创建它的线程
+ *
+ * @param count 包数
+ * @return pktpool_t* 失败为 NULL
+ */
+pktpool_t *pktpool_create(uint32_t count)
+{
+    uint32_t size = 1;
+    while (size < count)
+        size <<= 1;
+    pktpool_t *pool = calloc(1, sizeof(pktpool_t));
+    if (pool == NULL)
+        return NULL;
+    pool->pkts = malloc(count * sizeof(pkt_t));
+    if (pool->pkts == NULL || pktring_init(&pool->free, size) != 0)
+    {
+        free(pool->pkts);
+        free(pool);
+        return NULL;
+    }
+    pool->count = count;
+    for (uint32_t i = 0; i < count; i++) // 容量不小于包数，入队不会失败
+    {
+        pkt_t *pkt = &pool->pkts[i];
+        pkt->pool = pool;
+        atomic_init(&pkt->refs, 0);
+        pktring_mp_enqueue(&pool->free, (void *const *)&pkt, 1);
+    }
+    return pool;
+}
+
+/**
+ * @brief 释放包池，所有的包都必须已经放回
+ *
+ * @param pool 包池
+ */
+void pktpool_destroy(pktpool_t *pool)
+{
+    if (pool == NULL)
+        return;
+    pktring_free(&pool->free);
+    free(pool->pkts);
+    free(pool);
+}
+
+/**
+ * @brief 从包池分配一批包，只能由所有者线程调用
+ *
+ * @param pool 包池
+ * @param pkts 出口参数，分配到的包，持有者个数为 1，长度为 0
+ * @param n 最多分配的个数
+ * @return unsigned 实际分配的个数，包池空了时可能少于 n
+ */
+unsigned pkt_alloc(pktpool_t *pool, pkt_t **pkts, unsigned n)
+{
+    n = pktring_sc_dequeue(&pool->free, (void **)pkts, n);
+    for (unsigned i = 0; i < n; i++)
+    {
+        atomic_store_explicit(&pkts[i]->refs, 1, memory_order_relaxed);
+        pkts[i]->len = 0;
+    }
+    return n;
+}
+
+/**
+ * @brief 放弃一批包的持有，最后一个持有者把包放回它所属的包池，可以在任何线程调用
+ *
+ * @param pkts 包
+ * @param n 包数
+ */
+void pkt_free(pkt_t **pkts, unsigned n)
+{
+    pkt_t *batch[PKT_FREE_BATCH];
+    unsigned count = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        pkt_t *pkt = pkts[i];
+        // 唯一的持有者不需要原子减，其他持有者已经放手，不会再改 refs
+        if (atomic_load_explicit(&pkt->refs, memory_order_acquire) != 1 &&
+            atomic_fetch_sub_explicit(&pkt->refs, 1, memory_order_acq_rel) != 1)
+            continue;
+        if (count && (batch[0]->pool != pkt->pool || count == PKT_FREE_BATCH)) // 连续属于同一个包池的一起放回
+        {
+            pktring_mp_enqueue(&batch[0]->pool->free, (void *const *)batch, count);
+            count = 0;
+        }
+        batch[count++] = pkt;
+    }
+    if (count)
+        pktring_mp_enqueue(&batch[0]->pool->free, (void *const *)batch, count);
+}
@@ -0,0 +1,127 @@
+#include <string.h>
+#include "ringbuf.h"
+
+/**
+ * @brief 初始化环形缓冲区并分配存储空间
+ *
+ * @param rb 要初始化的缓冲区
+ * @param size 容量，必须是 2 的幂
+ * @return int 成功为 0，失败为 -1
+ */
+int ringbuf_init(ringbuf_t *rb, uint32_t size)
+{
+    if (size == 0 || (size & (size - 1)) != 0)
+        return -1;
+    rb->data = malloc(size);
+    if (rb->data == NULL)
+        return -1;
+    rb->size = size;
+    rb->head = 0;
+    rb->tail = 0;
+    return 0;
+}
+
+/**
+ * @brief 释放环形缓冲区的存储空间
+ *
+ * @param rb 要释放的缓冲区
+ */
+void ringbuf_free(ringbuf_t *rb)
+{
+    free(rb->data);
+    rb->data = NULL;
+    rb->size = 0;
+    rb->head = 0;
+    rb->tail = 0;
+}
+
+/**
+ * @brief 取出从读位置偏移 offset 开始、长度为 len 的数据所在的内存段，不移动读位置
+ *
+ * 数据跨越缓冲区末尾时分为两段，调用者可以直接读取这些内存，不需要拷贝。
+ *
+ * @param rb 缓冲区
+ * @param offset 相对读位置的偏移
+ * @param len 长度，超出已有数据的部分会被截掉
+ * @param iov 出口参数，最多两段
+ * @return int 段数，0 到 2
+ */
+int ringbuf_peek(ringbuf_t *rb, size_t offset, size_t len, ringbuf_iov_t iov[2])
+{
+    uint32_t used = ringbuf_len(rb);
+    if (offset >= used)
+        return 0;
+    if (len > used - offset)
+        len = used - offset;
+    if (len == 0)
+        return 0;
+    uint32_t pos = (rb->head + offset) & (rb->size - 1);
+    size_t first = rb->size - pos; // 到缓冲区末尾的长度
+    iov[0].base = rb->data + pos;
+    if (len <= first)
+    {
+        iov[0].len = len;
+        return 1;
+    }
+    iov[0].len = first;
+    iov[1].base = rb->data;
+    iov[1].len = len - first;
+    return 2;
+}
+
+/**
+ * @brief 丢弃读位置开始的 len 字节数据
+ *
+ * @param rb 缓冲区
+ * @param len 长度，超过数据量时全部丢弃
+ */
+void ringbuf_consume(ringbuf_t *rb, size_t len)
+{
+    uint32_t used = ringbuf_len(rb);
+    rb->head += len < used ? len : used;
+}
+
+/**
+ * @brief 写入数据，空间不足时只写入能容纳的部分
+ *
+ * @param rb 缓冲区
+ * @param data 要写入的数据
+ * @param len 数据长度
+ * @return size_t 实际写入的字节数
+ */
+size_t ringbuf_write(ringbuf_t *rb, const void *data, size_t len)
+{
+    uint32_t space = ringbuf_space(rb);
+    if (len > space)
+        len = space;
+    uint32_t pos = rb->tail & (rb->size - 1);
+    size_t first = rb->size - pos;
+    if (first > len)
+        first = len;
+    memcpy(rb->data + pos, data, first);
+    memcpy(rb->data, (const uint8_t *)data + first, len - first);
+    rb->tail += len;
+    return len;
+}
+
+/**
+ * @brief 读出数据并移动读位置
+ *
+ * @param rb 缓冲区
+ * @param data 读出数据的存放位置
+ * @param len 最多读出的长度
+ * @return size_t 实际读出的字节数
+ */
+size_t ringbuf_read(ringbuf_t *rb, void *data, size_t len)
+{
+    ringbuf_iov_t iov[2];
+    int n = ringbuf_peek(rb, 0, len, iov);
+    size_t size = 0;
+    for (int i = 0; i < n; i++)
+    {
+        memcpy((uint8_t *)data + size, iov[i].base, iov[i].len);
+        size += iov[i].len;
+    }
+    rb->head += size;
+    return size;
+}
@@ -0,0 +1,469 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "shard.h"
+#include "pktring.h"
+#include "driver.h"
+#include "ethernet.h"
+#include "arp.h"
+#include "ip.h"
+
+typedef struct shard
+{
+    int id;
+    pthread_t thread;
+    int running;        // 线程已经创建
+    net_stack_t *stack; // 分片的协议栈实例，由分片线程 net_init 和释放
+    shard_stat_t *stat; // rx_* 只由分发线程写，其余只由分片线程写
+    pktring_t rx;       // 分发线程 -> 分片，单生产者
+
+    // 以下只由分发线程使用
+    pkt_t *stage[SHARD_POLL_BATCH]; // 这一轮分给这个分片、还没有入队的包
+    unsigned staged;
+
+    // 以下只由分片线程使用
+    pkt_t *rx_cache[SHARD_WORKER_BATCH]; // 一次出队的一批包，依次交给协议栈，全部交完再一起放回
+    unsigned rx_cached, rx_next;
+    pktpool_t *tx_pool;                  // 发送用的包，分片分配，分发线程发完放回
+    pkt_t *tx_stage[SHARD_WORKER_BATCH]; // 攒够一批或一轮处理完再入队
+    unsigned tx_staged;
+} shard_t;
+
+typedef struct shard_set // 分发线程的状态，一个进程只有一个分发线程
+{
+    int n;
+    shard_t *shard[SHARD_MAX];
+    shard_stat_t stat[SHARD_MAX]; // 分片的计数，shard_stop 之后保留到下一次 shard_start
+    uint8_t reta[SHARD_RETA_SIZE]; // RSS 间接表：哈希值的低位 -> 分片号
+    const shard_app_t *app;
+    void *arg;
+    _Atomic int ready;  // net_init 和 app->init 成功的分片数
+    _Atomic int failed; // 启动失败的分片数
+    _Atomic int stop;
+    pktpool_t *rx_pool;               // 收到的帧放在这里的包里交给分片，分发线程分配，分片放回
+    pkt_t *rx_spare[SHARD_POLL_BATCH]; // 已经分配、还没用上的包
+    unsigned spares;
+    pktring_t tx;                      // 所有分片 -> 分发线程，多生产者
+    buf_t rxbuf, txbuf;
+} shard_set_t;
+
+static shard_set_t shards;
+
+/**
+ * @brief 微软 RSS 规范中的默认 40 字节密钥，多数网卡出厂使用这个密钥
+ *
+ */
+static const uint8_t shard_rss_key[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+
+/**
+ * @brief Toeplitz 哈希：输入的每个为 1 的位，把密钥从该位开始的 32 位异或进结果
+ *
+ * @param input 按网络字节序排列的源 IP、目的 IP、源端口、目的端口（或只有两个地址）
+ * @param len 输入长度，不超过 36 字节
+ * @return uint32_t 哈希值
+ */
+uint32_t shard_toeplitz(const uint8_t *input, size_t len)
+{
+    uint32_t hash = 0;
+    uint32_t window = (uint32_t)shard_rss_key[0] << 24 | shard_rss_key[1] << 16 | shard_rss_key[2] << 8 | shard_rss_key[3];
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t next = i + 4 < sizeof(shard_rss_key) ? shard_rss_key[i + 4] : 0;
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            if (input[i] >> bit & 1)
+                hash ^= window;
+            window = window << 1 | (next >> bit & 1);
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief 为收到的一帧选择分片
+ *
+ * TCP 和 UDP 按四元组哈希；IP 分片没有端口，和其他 IPv4 帧一样只按两个地址哈希。
+ * TCP 按 MSS 分段，不会产生 IP 分片，所以同一个连接的帧总在同一个分片上。
+ *
+ * @param frame 以太网帧
+ * @param len 帧长度
+ * @return int 分片号，ARP 帧要复制给所有分片，返回 -1
+ */
+int shard_select(const uint8_t *frame, size_t len)
+{
+    if (len < sizeof(ether_hdr_t))
+        return 0;
+    const ether_hdr_t *eth = (const ether_hdr_t *)frame;
+    uint16_t protocol = swap16(eth->protocol16);
+    if (protocol == NET_PROTOCOL_ARP)
+        return -1;
+    if (protocol != NET_PROTOCOL_IP || len < sizeof(ether_hdr_t) + sizeof(ip_hdr_t))
+        return 0;
+
+    const ip_hdr_t *ip = (const ip_hdr_t *)(eth + 1);
+    size_t hdr_len = ip->hdr_len * IP_HDR_LEN_PER_BYTE;
+    uint8_t input[2 * NET_IP_LEN + 4];
+    size_t input_len = 2 * NET_IP_LEN;
+    memcpy(input, ip->src_ip, NET_IP_LEN);
+    memcpy(input + NET_IP_LEN, ip->dst_ip, NET_IP_LEN);
+    int fragment = swap16(ip->flags_fragment16) & (IP_MORE_FRAGMENT | 0x1FFF);
+    if (!fragment && (ip->protocol == NET_PROTOCOL_TCP || ip->protocol == NET_PROTOCOL_UDP) &&
+        len >= sizeof(ether_hdr_t) + hdr_len + 4)
+    {
+        memcpy(input + input_len, (const uint8_t *)ip + hdr_len, 4); // 源端口和目的端口
+        input_len += 4;
+    }
+    return shards.reta[shard_toeplitz(input, input_len) & (SHARD_RETA_SIZE - 1)];
+}
+
+/* 分片协议栈的驱动：收发都走与分发线程之间的包环，分片由 net_stack()->driver 给出 */
+static int shard_dev_open(void)
+{
+    return 0;
+}
+
+static int shard_dev_recv(buf_t *buf)
+{
+    shard_t *shard = net_stack()->driver;
+    if (shard->rx_next == shard->rx_cached) // 这一批交完了，放回包池，再出队一批
+    {
+        pkt_free(shard->rx_cache, shard->rx_cached);
+        shard->rx_cached = pktring_sc_dequeue(&shard->rx, (void **)shard->rx_cache, SHARD_WORKER_BATCH);
+        shard->rx_next = 0;
+        if (shard->rx_cached == 0)
+            return 0;
+    }
+    pkt_t *pkt = shard->rx_cache[shard->rx_next++];
+    buf_init(buf, pkt->len);
+    memcpy(buf->data, pkt->data, pkt->len);
+    return buf->len;
+}
+
+/**
+ * @brief 把攒下的发送包交给分发线程。发送环的容量不小于所有分片的发送包数，入队不会失败
+ *
+ */
+static void shard_tx_flush(shard_t *shard)
+{
+    if (shard->tx_staged == 0)
+        return;
+    pktring_mp_enqueue(&shards.tx, (void *const *)shard->tx_stage, shard->tx_staged);
+    shard->tx_staged = 0;
+}
+
+static int shard_dev_send(buf_t *buf)
+{
+    shard_t *shard = net_stack()->driver;
+    pkt_t *pkt;
+    if (buf->len > PKT_DATA_MAX)
+        return -1;
+    while (pkt_alloc(shard->tx_pool, &pkt, 1) == 0) // 发送包用完时等分发线程发出去再放回，不丢帧
+    {
+        shard_tx_flush(shard);
+        if (atomic_load(&shards.stop))
+            return -1;
+        shard->stat->tx_stalls++;
+        sched_yield();
+    }
+    pkt->len = buf->len;
+    pkt->port = shard->id;
+    memcpy(pkt->data, buf->data, buf->len);
+    shard->tx_stage[shard->tx_staged++] = pkt;
+    if (shard->tx_staged == SHARD_WORKER_BATCH)
+        shard_tx_flush(shard);
+    shard->stat->tx_frames++;
+    return 0;
+}
+
+static void shard_dev_close(void)
+{
+    shard_t *shard = net_stack()->driver;
+    shard_tx_flush(shard);
+    pkt_free(shard->rx_cache, shard->rx_cached);
+    shard->rx_cached = shard->rx_next = 0;
+    net_stack()->driver = NULL;
+}
+
+static const net_driver_t shard_dev = {
+    .open = shard_dev_open,
+    .recv = shard_dev_recv,
+    .send = shard_dev_send,
+    .close = shard_dev_close,
+};
+
+/**
+ * @brief 分片线程：初始化自己的协议栈，然后交替处理一批帧和运行应用，直到 shard_stop
+ *
+ * @param arg shard_t
+ */
+static void *shard_main(void *arg)
+{
+    shard_t *shard = arg;
+    const shard_app_t *app = shards.app;
+    net_stack_bind(shard->stack);
+    int ok = net_init() == 0 && (app->init == NULL || app->init(shard->id, shards.arg) == 0);
+    shard_tx_flush(shard);
+    atomic_fetch_add(ok ? &shards.ready : &shards.failed, 1);
+    while (ok && !atomic_load(&shards.stop))
+    {
+        int busy = shard->rx_next < shard->rx_cached || pktring_count(&shard->rx) > 0;
+        for (int i = 0; i < SHARD_WORKER_BATCH && (i == 0 || shard->rx_next < shard->rx_cached); i++)
+            net_poll(); // 没有帧时也要调用一次，让 tcp_poll 处理定时器
+        if (app->run)
+            app->run(shard->id, shards.arg);
+        shard_tx_flush(shard);
+        if (!busy)
+            sched_yield();
+    }
+    if (ok && app->fini)
+        app->fini(shard->id, shards.arg);
+    net_driver_close();
+    net_stack_destroy(shard->stack);
+    return NULL;
+}
+
+/**
+ * @brief 把攒给各分片的包成批入队，放不下的留到下一轮
+ *
+ * @return int 全部入队为 0，还有分片的接收环满为 -1
+ */
+static int shard_dispatch()
+{
+    int blocked = 0;
+    for (int i = 0; i < shards.n; i++)
+    {
+        shard_t *shard = shards.shard[i];
+        if (shard->staged == 0)
+            continue;
+        unsigned n = pktring_sp_enqueue(&shard->rx, (void *const *)shard->stage, shard->staged);
+        shard->stat->rx_frames += n;
+        shard->staged -= n;
+        if (shard->staged)
+        {
+            memmove(shard->stage, shard->stage + n, shard->staged * sizeof(pkt_t *));
+            shard->stat->rx_stalls++;
+            blocked = 1;
+        }
+    }
+    return blocked ? -1 : 0;
+}
+
+/**
+ * @brief 分片发出的帧是否应该丢弃：每个分片都收到了同一个 ARP 请求，只有 0 号分片的应答和无回报 ARP 发出去
+ *
+ */
+static int shard_tx_filter(const pkt_t *pkt)
+{
+    if (pkt->port == 0 || pkt->len < sizeof(ether_hdr_t) + sizeof(arp_pkt_t))
+        return 0;
+    const ether_hdr_t *eth = (const ether_hdr_t *)pkt->data;
+    if (swap16(eth->protocol16) != NET_PROTOCOL_ARP)
+        return 0;
+    const arp_pkt_t *arp = (const arp_pkt_t *)(eth + 1);
+    return swap16(arp->opcode16) == ARP_REPLY || !memcmp(arp->target_ip, arp->sender_ip, NET_IP_LEN);
+}
+
+/**
+ * @brief 启动 n 个分片，调用线程成为分发线程，之后要不断调用 shard_poll
+ *
+ * 分片的协议栈使用调用线程当前协议栈实例的 MAC 和 IP 地址；真正的驱动由调用线程打开，不需要再调用 net_init。
+ *
+ * @param n 分片数，1 到 SHARD_MAX
+ * @param app 在每个分片里运行的应用
+ * @param arg 传给 app 的参数
+ * @return int 成功为 0，失败为 -1
+ */
+int shard_start(int n, const shard_app_t *app, void *arg)
+{
+    // 1 打开驱动，建立间接表和分发线程的包池、发送环
+    if (n < 1 || n > SHARD_MAX || shards.n)
+        return -1;
+    if (driver_open() == -1)
+        return -1;
+    for (int i = 0; i < SHARD_RETA_SIZE; i++)
+        shards.reta[i] = i % n;
+    memset(shards.stat, 0, sizeof(shards.stat));
+    shards.app = app;
+    shards.arg = arg;
+    shards.spares = 0;
+    atomic_store(&shards.ready, 0);
+    atomic_store(&shards.failed, 0);
+    atomic_store(&shards.stop, 0);
+    // 每个分片的接收环、攒着的一批和分片手里的一批都可能占着包
+    shards.rx_pool = pktpool_create(n * (SHARD_RING_SLOTS + SHARD_POLL_BATCH + SHARD_WORKER_BATCH) + SHARD_POLL_BATCH);
+    if (shards.rx_pool == NULL || pktring_init(&shards.tx, SHARD_MAX * SHARD_RING_SLOTS) != 0)
+    {
+        pktpool_destroy(shards.rx_pool);
+        driver_close();
+        return -1;
+    }
+
+    // 2 每个分片一个协议栈实例、一个接收环和一个发送包池，在自己的线程里初始化
+    int started = 0;
+    for (int i = 0; i < n; i++)
+    {
+        shard_t *shard = calloc(1, sizeof(shard_t));
+        if (shard == NULL)
+            break;
+        shards.shard[shards.n++] = shard;
+        shard->id = i;
+        shard->stat = &shards.stat[i];
+        shard->stack = net_stack_create(net_stack()->if_mac, net_stack()->if_ip);
+        shard->tx_pool = pktpool_create(SHARD_RING_SLOTS);
+        if (shard->stack == NULL || shard->tx_pool == NULL || pktring_init(&shard->rx, SHARD_RING_SLOTS) != 0)
+            break;
+        shard->stack->dev = &shard_dev;
+        shard->stack->driver = shard;
+        if (pthread_create(&shard->thread, NULL, shard_main, shard) != 0)
+            break;
+        shard->running = 1;
+        started++;
+    }
+
+    // 3 等所有分片初始化完成，初始化时发出的帧（如无回报 ARP）由 shard_poll 发出
+    while (atomic_load(&shards.ready) + atomic_load(&shards.failed) < started)
+        sched_yield();
+    if (started < n || atomic_load(&shards.failed))
+    {
+        shard_stop();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 停止所有分片，释放它们的协议栈和包，关闭驱动
+ *
+ */
+void shard_stop(void)
+{
+    pkt_t *pkts[SHARD_POLL_BATCH];
+    unsigned n;
+    atomic_store(&shards.stop, 1);
+
+    // 1 等分片线程退出，它们手里的包已经放回
+    for (int i = 0; i < shards.n; i++)
+    {
+        shard_t *shard = shards.shard[i];
+        if (shard->running)
+            pthread_join(shard->thread, NULL); // 分片线程自己释放协议栈
+        else if (shard->stack)
+            net_stack_destroy(shard->stack);
+    }
+
+    // 2 还在路上的包放回包池，再释放包池和环
+    while ((n = pktring_sc_dequeue(&shards.tx, (void **)pkts, SHARD_POLL_BATCH)) > 0)
+        pkt_free(pkts, n);
+    for (int i = 0; i < shards.n; i++)
+    {
+        shard_t *shard = shards.shard[i];
+        if (shard->rx.slots)
+            while ((n = pktring_sc_dequeue(&shard->rx, (void **)pkts, SHARD_POLL_BATCH)) > 0)
+                pkt_free(pkts, n);
+        pkt_free(shard->stage, shard->staged);
+        pktring_free(&shard->rx);
+        pktpool_destroy(shard->tx_pool);
+        free(shard);
+        shards.shard[i] = NULL;
+    }
+    pkt_free(shards.rx_spare, shards.spares);
+    shards.spares = 0;
+    pktring_free(&shards.tx);
+    pktpool_destroy(shards.rx_pool);
+    shards.rx_pool = NULL;
+    shards.n = 0;
+    driver_close();
+}
+
+/**
+ * @brief 分发线程的一次轮询：从驱动收一批帧分给分片，再把分片发出的帧交给驱动
+ *
+ * 帧拷进包里之后只传递包的句柄，复制给所有分片的 ARP 帧也只有一份，由各分片分别放手。
+ * 某个分片的接收环满时，分给它的包留到下一轮，这期间不再从驱动收帧，驱动里后面的帧也等着，不会丢帧。
+ *
+ * @return int 收发的帧数，为 0 时调用者可以让出 CPU
+ */
+int shard_poll(void)
+{
+    int moved = 0;
+    pkt_t *pkts[SHARD_POLL_BATCH];
+
+    // 1 接收：先交完上一轮没交出去的包
+    if (shard_dispatch() == 0)
+    {
+        for (int i = 0; i < SHARD_POLL_BATCH; i++)
+        {
+            if (shards.spares == 0)
+                shards.spares = pkt_alloc(shards.rx_pool, shards.rx_spare, SHARD_POLL_BATCH);
+            if (shards.spares == 0) // 包都在分片手里，等它们放回
+                break;
+            int len = driver_recv(&shards.rxbuf);
+            if (len <= 0)
+                break;
+            moved++;
+            if ((size_t)len > PKT_DATA_MAX)
+                continue;
+            pkt_t *pkt = shards.rx_spare[--shards.spares];
+            pkt->len = len;
+            memcpy(pkt->data, shards.rxbuf.data, len);
+            int target = shard_select(pkt->data, pkt->len);
+            if (target >= 0)
+            {
+                shards.shard[target]->stage[shards.shard[target]->staged++] = pkt;
+                continue;
+            }
+            pkt_ref(pkt, shards.n - 1);
+            for (int j = 0; j < shards.n; j++)
+                shards.shard[j]->stage[shards.shard[j]->staged++] = pkt;
+        }
+        shard_dispatch();
+    }
+
+    // 2 发送
+    unsigned n;
+    while ((n = pktring_sc_dequeue(&shards.tx, (void **)pkts, SHARD_POLL_BATCH)) > 0)
+    {
+        for (unsigned i = 0; i < n; i++)
+        {
+            if (shard_tx_filter(pkts[i]))
+            {
+                shards.stat[pkts[i]->port].arp_drops++;
+                continue;
+            }
+            buf_init(&shards.txbuf, pkts[i]->len);
+            memcpy(shards.txbuf.data, pkts[i]->data, pkts[i]->len);
+            driver_send(&shards.txbuf);
+        }
+        pkt_free(pkts, n);
+        moved += n;
+    }
+    return moved;
+}
+
+/**
+ * @brief 正在运行的分片数，没有启动时为 0
+ *
+ */
+int shard_count(void)
+{
+    return shards.n;
+}
+
+/**
+ * @brief 读取一个分片的计数，分片运行时读到的是近似值，shard_stop 之后读到的是最终值
+ *
+ */
+void shard_get_stat(int shard, shard_stat_t *stat)
+{
+    if (shard < 0 || shard >= SHARD_MAX)
+    {
+        memset(stat, 0, sizeof(shard_stat_t));
+        return;
+    }
+    *stat = shards.stat[shard];
+}
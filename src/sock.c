@@ -0,0 +1,878 @@
+#include <sched.h>
+#include "sock.h"
+#include "tcp.h"
+#include "udp.h"
+#include "ringbuf.h"
+
+typedef enum sock_type
+{
+    SOCK_FREE,
+    SOCK_LISTENER,
+    SOCK_STREAM,
+    SOCK_DGRAM,
+} sock_type_t;
+
+typedef struct sock_queue // 挂在套接字上等待完成的命令，先进先出
+{
+    sock_cmd_t *head, *tail;
+} sock_queue_t;
+
+typedef struct sock // 协议栈一侧的套接字，只由协议栈线程访问
+{
+    sock_type_t type;
+    uint16_t port;       // 本地端口
+    tcp_connect_t *tcp;  // STREAM 的连接，连接被释放后为 NULL
+    sock_queue_t rx;     // 等待的 ACCEPT / RECV / RECVFROM
+    sock_queue_t tx;     // 等待的 SEND，按提交顺序写进发送缓存
+    ringbuf_t dgrams;    // DGRAM 排队的数据报，每个为 sock_dgram_hdr_t 加数据
+    uint8_t *rest;       // STREAM 的连接被释放时 rx_buf 中还没读走的数据
+    size_t rest_len, rest_off;
+    uint8_t posted;      // rx 队头的 RECV 的缓冲区已经投递给 TCP
+    uint8_t ready;       // 已在就绪链表中
+    int next_ready;      // 就绪链表中的下一个，-1 为结尾
+    int next_free;       // 空闲链表中的下一个，-1 为结尾
+} sock_t;
+
+typedef struct sock_dgram_hdr // 排队的数据报的头部
+{
+    uint16_t len;
+    uint16_t port;
+    uint8_t ip[NET_IP_LEN];
+} sock_dgram_hdr_t;
+
+typedef struct sock_bound // 套接字层占用的端口
+{
+    uint16_t port;
+    uint16_t protocol; // NET_PROTOCOL_TCP 或 NET_PROTOCOL_UDP
+    int fd;            // 监听或 UDP 套接字，监听套接字已关闭、还有连接没关时为 -1
+    size_t streams;    // 从这个端口 accept、还没关闭的连接数
+} sock_bound_t;
+
+struct sock_layer
+{
+    pktring_t cmds; // 命令环，应用线程多生产者，协议栈单消费者
+    sock_t socks[SOCK_MAX];
+    int free_head;
+    int ready_head;
+    sock_bound_t bound[SOCK_BOUND_MAX];
+    size_t bound_count;
+};
+
+static inline sock_layer_t *sock_layer(void)
+{
+    return net_stack()->sock;
+}
+
+/**
+ * @brief 完成一个命令，放进提交它的上下文的完成队列
+ *
+ * 上下文未完成的命令数不超过完成队列的容量，入队不会失败。
+ *
+ * @param cmd 命令
+ * @param result 结果
+ */
+static void sock_complete(sock_cmd_t *cmd, int64_t result)
+{
+    cmd->result = result;
+    pktring_sp_enqueue(&cmd->ctx->cq, (void *const *)&cmd, 1);
+}
+
+static void sock_queue_push(sock_queue_t *queue, sock_cmd_t *cmd)
+{
+    cmd->next = NULL;
+    if (queue->tail)
+        queue->tail->next = cmd;
+    else
+        queue->head = cmd;
+    queue->tail = cmd;
+}
+
+static void sock_queue_pop(sock_queue_t *queue)
+{
+    queue->head = queue->head->next;
+    if (queue->head == NULL)
+        queue->tail = NULL;
+}
+
+/**
+ * @brief 以 result 完成队列中所有的命令
+ *
+ * @param queue 队列
+ * @param result 结果
+ */
+static void sock_queue_flush(sock_queue_t *queue, int64_t result)
+{
+    while (queue->head)
+    {
+        sock_cmd_t *cmd = queue->head;
+        sock_queue_pop(queue);
+        sock_complete(cmd, result);
+    }
+}
+
+/**
+ * @brief 把套接字放进就绪链表，由 sock_poll 处理它等待的命令
+ *
+ * @param layer 套接字层
+ * @param sock 套接字
+ */
+static void sock_ready(sock_layer_t *layer, sock_t *sock)
+{
+    if (sock->ready)
+        return;
+    sock->ready = 1;
+    sock->next_ready = layer->ready_head;
+    layer->ready_head = sock - layer->socks;
+}
+
+/**
+ * @brief 分配一个套接字。可能还在就绪链表中，保留 ready 和 next_ready
+ *
+ * @param layer 套接字层
+ * @param type 类型
+ * @param port 本地端口
+ * @return sock_t* 用完时为 NULL
+ */
+static sock_t *sock_alloc(sock_layer_t *layer, sock_type_t type, uint16_t port)
+{
+    if (layer->free_head < 0)
+        return NULL;
+    sock_t *sock = &layer->socks[layer->free_head];
+    layer->free_head = sock->next_free;
+    sock->type = type;
+    sock->port = port;
+    sock->tcp = NULL;
+    sock->rx = (sock_queue_t){0};
+    sock->tx = (sock_queue_t){0};
+    sock->rest = NULL;
+    sock->rest_len = sock->rest_off = 0;
+    sock->posted = 0;
+    return sock;
+}
+
+static void sock_release(sock_layer_t *layer, sock_t *sock)
+{
+    free(sock->rest);
+    sock->rest = NULL;
+    if (sock->type == SOCK_DGRAM)
+        ringbuf_free(&sock->dgrams);
+    sock->type = SOCK_FREE;
+    sock->next_free = layer->free_head;
+    layer->free_head = sock - layer->socks;
+}
+
+/**
+ * @brief 取得命令操作的套接字
+ *
+ * @param layer 套接字层
+ * @param fd 套接字号
+ * @param type 要求的类型，为 SOCK_FREE 时不限
+ * @return sock_t* 不存在或类型不对时为 NULL
+ */
+static sock_t *sock_get(sock_layer_t *layer, int fd, sock_type_t type)
+{
+    if (fd < 0 || fd >= SOCK_MAX || layer->socks[fd].type == SOCK_FREE)
+        return NULL;
+    if (type != SOCK_FREE && layer->socks[fd].type != type)
+        return NULL;
+    return &layer->socks[fd];
+}
+
+static sock_bound_t *sock_bound_find(sock_layer_t *layer, uint16_t port, uint16_t protocol)
+{
+    for (size_t i = 0; i < layer->bound_count; i++)
+        if (layer->bound[i].port == port && layer->bound[i].protocol == protocol)
+            return &layer->bound[i];
+    return NULL;
+}
+
+static void sock_bound_remove(sock_layer_t *layer, sock_bound_t *bound)
+{
+    *bound = layer->bound[--layer->bound_count];
+}
+
+/**
+ * @brief 监听套接字已关闭，最后一个从它 accept 的连接也关闭后才关掉 TCP 端口，
+ *        tcp_close 会释放端口上所有的连接，不能在还有连接被套接字引用时调用
+ *
+ * @param layer 套接字层
+ * @param bound 端口
+ */
+static void sock_bound_check(sock_layer_t *layer, sock_bound_t *bound)
+{
+    if (bound->fd >= 0 || bound->streams)
+        return;
+    tcp_close(bound->port);
+    sock_bound_remove(layer, bound);
+}
+
+/**
+ * @brief TCP 事件回调，只记录哪些套接字就绪，命令在 sock_poll 里处理
+ *
+ * @param tcp 连接
+ * @param state 事件
+ */
+static void sock_tcp_handler(tcp_connect_t *tcp, connect_state_t state)
+{
+    sock_layer_t *layer = sock_layer();
+    if (state == TCP_CONN_CONNECTED) // 连接在 accept 队列中，监听套接字就绪
+    {
+        sock_bound_t *bound = sock_bound_find(layer, tcp->local_port, NET_PROTOCOL_TCP);
+        if (bound && bound->fd >= 0)
+            sock_ready(layer, &layer->socks[bound->fd]);
+        return;
+    }
+    sock_t *sock = tcp->arg;
+    if (sock == NULL)
+        return;
+    if (state == TCP_CONN_CLOSED) // 连接马上会被释放，把没读走的数据留下来，读完即 EOF
+    {
+        if (sock->posted) // 已经收进投递缓冲区的数据在 rx_buf 之前
+            sock->rx.head->done = tcp_connect_unpost_recv(tcp);
+        size_t len = ringbuf_len(&tcp->rx_buf);
+        if (len && (sock->rest = malloc(len)) != NULL)
+        {
+            ringbuf_read(&tcp->rx_buf, sock->rest, len);
+            sock->rest_len = len;
+        }
+        sock->tcp = NULL;
+        tcp->arg = NULL;
+    }
+    sock_ready(layer, sock);
+}
+
+/**
+ * @brief UDP 回调，有等待的 RECVFROM 并且没有排队的数据报时直接拷进它的缓冲区，
+ *        否则排进端口上的套接字，放不下就丢弃
+ *
+ * @param port 本地端口
+ * @param data 数据
+ * @param len 长度
+ * @param src_ip 来源地址
+ * @param src_port 来源端口
+ */
+static void sock_udp_handler(uint16_t port, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port)
+{
+    sock_layer_t *layer = sock_layer();
+    sock_bound_t *bound = sock_bound_find(layer, port, NET_PROTOCOL_UDP);
+    if (bound == NULL || len > UINT16_MAX)
+        return;
+    sock_t *sock = &layer->socks[bound->fd];
+    if (sock->rx.head && ringbuf_len(&sock->dgrams) == 0)
+    {
+        sock_cmd_t *cmd = sock->rx.head;
+        size_t size = len < cmd->len ? len : cmd->len;
+        memcpy(cmd->data, data, size);
+        memcpy(cmd->ip, src_ip, NET_IP_LEN);
+        cmd->port = src_port;
+        sock_queue_pop(&sock->rx);
+        sock_complete(cmd, size);
+        return;
+    }
+    if (ringbuf_space(&sock->dgrams) < sizeof(sock_dgram_hdr_t) + len)
+    {
+        STATS_INC(UDP_RCVBUF_ERRORS);
+        return;
+    }
+    sock_dgram_hdr_t hdr = {.len = len, .port = src_port};
+    memcpy(hdr.ip, src_ip, NET_IP_LEN);
+    ringbuf_write(&sock->dgrams, &hdr, sizeof(hdr));
+    ringbuf_write(&sock->dgrams, data, len);
+    sock_ready(layer, sock);
+}
+
+/**
+ * @brief 从监听套接字的 accept 队列取连接，完成等待的 ACCEPT
+ *
+ * @param layer 套接字层
+ * @param sock 监听套接字
+ */
+static void sock_process_listener(sock_layer_t *layer, sock_t *sock)
+{
+    sock_bound_t *bound = sock_bound_find(layer, sock->port, NET_PROTOCOL_TCP);
+    while (sock->rx.head)
+    {
+        tcp_connect_t *tcp = tcp_accept(sock->port);
+        if (tcp == NULL)
+            break;
+        sock_cmd_t *cmd = sock->rx.head;
+        sock_queue_pop(&sock->rx);
+        sock_t *conn = sock_alloc(layer, SOCK_STREAM, sock->port);
+        if (conn == NULL)
+        {
+            tcp_connect_close(tcp);
+            sock_complete(cmd, SOCK_ENOMEM);
+            continue;
+        }
+        conn->tcp = tcp;
+        tcp->arg = conn;
+        bound->streams++;
+        memcpy(cmd->ip, tcp->ip, NET_IP_LEN);
+        cmd->port = tcp->remote_port;
+        sock_complete(cmd, conn - layer->socks);
+        sock_ready(layer, conn); // accept 之前可能已经收到了数据
+    }
+}
+
+/**
+ * @brief SEND_FIXED 引用的数据被确认或连接被释放，缓冲区还给应用
+ *
+ * @param arg 命令
+ * @param acked 为 0 时连接在数据被全部确认之前就被复位或关闭了，命令以 SOCK_ECLOSED 完成
+ */
+static void sock_send_release(void *arg, int acked)
+{
+    sock_cmd_t *cmd = arg;
+    if (net_stack()->sock == NULL) // 套接字层已经 sock_free，挂着的命令不再完成
+        return;
+    sock_complete(cmd, acked ? (int64_t)cmd->len : SOCK_ECLOSED);
+}
+
+/**
+ * @brief 完成连接上等待的 RECV，再把等待的 SEND 尽量写进发送缓存
+ *
+ * @param sock 连接的套接字
+ */
+static void sock_process_stream(sock_t *sock)
+{
+    // 1 接收：先读连接释放时留下的数据，再读 rx_buf，都读完且连接不再是 ESTABLISHED 即 EOF，
+    //   否则把队头的缓冲区投递给 TCP，新到的数据直接拷进去
+    while (sock->rx.head)
+    {
+        sock_cmd_t *cmd = sock->rx.head;
+        size_t size;
+        if (sock->posted)
+        {
+            int open = sock->tcp && sock->tcp->state == TCP_ESTABLISHED;
+            if (sock->tcp)
+                cmd->done = sock->tcp->rx_post_done;
+            if (cmd->done == 0 && open)
+                break;
+            if (sock->tcp)
+                tcp_connect_unpost_recv(sock->tcp);
+            sock->posted = 0;
+            size = cmd->done;
+        }
+        else if (sock->rest_off < sock->rest_len)
+        {
+            size = sock->rest_len - sock->rest_off;
+            size = size < cmd->len ? size : cmd->len;
+            memcpy(cmd->data, sock->rest + sock->rest_off, size);
+            sock->rest_off += size;
+        }
+        else if (sock->tcp && ringbuf_len(&sock->tcp->rx_buf))
+            size = tcp_connect_read(sock->tcp, cmd->data, cmd->len);
+        else if (sock->tcp == NULL || sock->tcp->state != TCP_ESTABLISHED)
+            size = 0;
+        else
+        {
+            sock->posted = tcp_connect_post_recv(sock->tcp, cmd->data, cmd->len) == 0;
+            cmd->done = 0;
+            break;
+        }
+        sock_queue_pop(&sock->rx);
+        sock_complete(cmd, size);
+    }
+
+    // 2 发送：发送缓存满时停下，等 TCP_CONN_WRITABLE
+    while (sock->tx.head)
+    {
+        sock_cmd_t *cmd = sock->tx.head;
+        if (sock->tcp == NULL || !tcp_connect_sendable(sock->tcp)) // 对端发了 FIN 之后仍可以发送
+        {
+            sock_queue_flush(&sock->tx, SOCK_ECLOSED);
+            break;
+        }
+        if (cmd->op == SOCK_OP_SEND_FIXED && cmd->len) // 描述符用完时等 ACK，排进去之后由 sock_send_release 完成
+        {
+            if (tcp_connect_write_ref(sock->tcp, cmd->data, cmd->len, sock_send_release, cmd) == 0)
+                break;
+            sock_queue_pop(&sock->tx);
+            continue;
+        }
+        cmd->done += tcp_connect_write(sock->tcp, cmd->data + cmd->done, cmd->len - cmd->done);
+        if (cmd->done < cmd->len)
+            break;
+        sock_queue_pop(&sock->tx);
+        sock_complete(cmd, cmd->len);
+    }
+}
+
+/**
+ * @brief 用排队的数据报完成等待的 RECVFROM
+ *
+ * @param sock UDP 套接字
+ */
+static void sock_process_dgram(sock_t *sock)
+{
+    while (sock->rx.head && ringbuf_len(&sock->dgrams))
+    {
+        sock_cmd_t *cmd = sock->rx.head;
+        sock_dgram_hdr_t hdr;
+        ringbuf_read(&sock->dgrams, &hdr, sizeof(hdr));
+        size_t size = hdr.len < cmd->len ? hdr.len : cmd->len;
+        ringbuf_read(&sock->dgrams, cmd->data, size);
+        ringbuf_consume(&sock->dgrams, hdr.len - size); // 截掉放不下的部分
+        memcpy(cmd->ip, hdr.ip, NET_IP_LEN);
+        cmd->port = hdr.port;
+        sock_queue_pop(&sock->rx);
+        sock_complete(cmd, size);
+    }
+}
+
+/**
+ * @brief 关闭套接字，等待的命令以 SOCK_ECLOSED 完成
+ *
+ * @param layer 套接字层
+ * @param sock 套接字
+ */
+static void sock_close_sock(sock_layer_t *layer, sock_t *sock)
+{
+    sock_queue_flush(&sock->rx, SOCK_ECLOSED);
+    sock_queue_flush(&sock->tx, SOCK_ECLOSED);
+    if (sock->type == SOCK_LISTENER)
+    {
+        sock_bound_t *bound = sock_bound_find(layer, sock->port, NET_PROTOCOL_TCP);
+        bound->fd = -1;
+        sock_bound_check(layer, bound); // 还有连接时由 sock_poll 关掉之后到达的连接
+    }
+    else if (sock->type == SOCK_STREAM)
+    {
+        if (sock->tcp)
+        {
+            if (sock->posted)
+                tcp_connect_unpost_recv(sock->tcp);
+            sock->tcp->arg = NULL;
+            tcp_connect_close(sock->tcp);
+        }
+        sock_bound_t *bound = sock_bound_find(layer, sock->port, NET_PROTOCOL_TCP);
+        bound->streams--;
+        sock_bound_check(layer, bound);
+    }
+    else
+    {
+        udp_close(sock->port);
+        sock_bound_remove(layer, sock_bound_find(layer, sock->port, NET_PROTOCOL_UDP));
+    }
+    sock_release(layer, sock);
+}
+
+/**
+ * @brief 在一个端口上打开监听或 UDP 套接字
+ *
+ * @param layer 套接字层
+ * @param cmd LISTEN 或 UDP_OPEN 命令
+ * @return int64_t 套接字号或错误码
+ */
+static int64_t sock_open(sock_layer_t *layer, sock_cmd_t *cmd)
+{
+    uint16_t protocol = cmd->op == SOCK_OP_LISTEN ? NET_PROTOCOL_TCP : NET_PROTOCOL_UDP;
+    if (sock_bound_find(layer, cmd->port, protocol))
+        return SOCK_EBUSY;
+    if (layer->bound_count == SOCK_BOUND_MAX)
+        return SOCK_ENOMEM;
+    sock_t *sock = sock_alloc(layer, protocol == NET_PROTOCOL_TCP ? SOCK_LISTENER : SOCK_DGRAM, cmd->port);
+    if (sock == NULL)
+        return SOCK_ENOMEM;
+    int ret;
+    if (protocol == NET_PROTOCOL_TCP)
+        ret = tcp_listen(cmd->port, sock_tcp_handler, TCP_ACCEPT_BACKLOG);
+    else if ((ret = ringbuf_init(&sock->dgrams, SOCK_UDP_QUEUE)) == 0 &&
+             (ret = udp_open_port(cmd->port, sock_udp_handler)) != 0)
+        ringbuf_free(&sock->dgrams);
+    if (ret != 0)
+    {
+        sock->type = SOCK_FREE; // 没有分配 dgrams，直接放回
+        sock_release(layer, sock);
+        return SOCK_ENOMEM;
+    }
+    int fd = sock - layer->socks;
+    layer->bound[layer->bound_count++] = (sock_bound_t){.port = cmd->port, .protocol = protocol, .fd = fd};
+    return fd;
+}
+
+/**
+ * @brief 执行一个命令，能立即完成的直接完成，其余的挂在套接字上
+ *
+ * @param layer 套接字层
+ * @param cmd 命令
+ */
+static void sock_exec(sock_layer_t *layer, sock_cmd_t *cmd)
+{
+    sock_t *sock;
+    switch (cmd->op)
+    {
+    case SOCK_OP_LISTEN:
+    case SOCK_OP_UDP_OPEN:
+        sock_complete(cmd, sock_open(layer, cmd));
+        return;
+
+    case SOCK_OP_ACCEPT:
+    case SOCK_OP_RECV:
+    case SOCK_OP_RECVFROM:
+        sock = sock_get(layer, cmd->fd, cmd->op == SOCK_OP_ACCEPT ? SOCK_LISTENER : cmd->op == SOCK_OP_RECV ? SOCK_STREAM
+                                                                                                          : SOCK_DGRAM);
+        if (sock == NULL)
+            break;
+        sock_queue_push(&sock->rx, cmd);
+        sock_ready(layer, sock);
+        return;
+
+    case SOCK_OP_SEND_FIXED:
+        // data 先要落在缓冲区里，再比较剩下的长度，否则减法会回绕成很大的数
+        if (cmd->buf_index >= cmd->ctx->nbufs || cmd->data < cmd->ctx->bufs[cmd->buf_index].base ||
+            (size_t)(cmd->data - cmd->ctx->bufs[cmd->buf_index].base) > cmd->ctx->bufs[cmd->buf_index].len ||
+            cmd->len > cmd->ctx->bufs[cmd->buf_index].len - (size_t)(cmd->data - cmd->ctx->bufs[cmd->buf_index].base))
+        {
+            sock_complete(cmd, SOCK_EINVAL);
+            return;
+        }
+        // fall through
+    case SOCK_OP_SEND:
+        if ((sock = sock_get(layer, cmd->fd, SOCK_STREAM)) == NULL)
+            break;
+        cmd->done = 0;
+        sock_queue_push(&sock->tx, cmd);
+        sock_ready(layer, sock);
+        return;
+
+    case SOCK_OP_SENDTO:
+        if ((sock = sock_get(layer, cmd->fd, SOCK_DGRAM)) == NULL)
+            break;
+        if (cmd->len > UINT16_MAX - sizeof(udp_hdr_t) - 20) // 20 字节 IP 首部
+        {
+            sock_complete(cmd, SOCK_EINVAL);
+            return;
+        }
+        udp_send(cmd->data, cmd->len, sock->port, cmd->ip, cmd->port);
+        sock_complete(cmd, cmd->len);
+        return;
+
+    case SOCK_OP_CLOSE:
+        if ((sock = sock_get(layer, cmd->fd, SOCK_FREE)) == NULL)
+            break;
+        sock_close_sock(layer, sock);
+        sock_complete(cmd, 0);
+        return;
+
+    default:
+        sock_complete(cmd, SOCK_EINVAL);
+        return;
+    }
+    sock_complete(cmd, SOCK_EBADF);
+}
+
+/**
+ * @brief 在当前线程的协议栈实例上启用套接字层
+ *
+ * 必须在协议栈线程上 net_init 之后调用，并且在其他线程 sock_ctx_create 之前完成。
+ * 之后协议栈线程的主循环每次 net_poll 之后调用 sock_poll，执行应用线程提交的命令。
+ *
+ * @return int 成功为 0，失败为 -1
+ */
+int sock_init(void)
+{
+    net_stack_t *stack = net_stack();
+    if (stack->sock)
+        return 0;
+    sock_layer_t *layer = calloc(1, sizeof(sock_layer_t));
+    if (layer == NULL)
+        return -1;
+    if (pktring_init(&layer->cmds, SOCK_CMD_RING) != 0)
+    {
+        free(layer);
+        return -1;
+    }
+    for (int i = 0; i < SOCK_MAX; i++)
+        layer->socks[i].next_free = i + 1 < SOCK_MAX ? i + 1 : -1;
+    layer->free_head = 0;
+    layer->ready_head = -1;
+    stack->sock = layer;
+    net_add_fini(sock_free);
+    return 0;
+}
+
+/**
+ * @brief 取出一批命令执行，再处理就绪的套接字，在协议栈线程上 net_poll 之后调用
+ *
+ */
+void sock_poll(void)
+{
+    sock_layer_t *layer = sock_layer();
+
+    // 1 执行应用线程提交的命令
+    sock_cmd_t *cmds[SOCK_POLL_BATCH];
+    unsigned n = pktring_sc_dequeue(&layer->cmds, (void **)cmds, SOCK_POLL_BATCH);
+    for (unsigned i = 0; i < n; i++)
+        sock_exec(layer, cmds[i]);
+
+    // 2 监听套接字已关闭的端口上新到的连接直接关掉
+    for (size_t i = 0; i < layer->bound_count; i++)
+    {
+        sock_bound_t *bound = &layer->bound[i];
+        tcp_connect_t *tcp;
+        if (bound->protocol == NET_PROTOCOL_TCP && bound->fd < 0)
+            while ((tcp = tcp_accept(bound->port)) != NULL)
+                tcp_connect_close(tcp);
+    }
+
+    // 3 处理就绪的套接字，处理过程中可能有新的套接字就绪
+    while (layer->ready_head >= 0)
+    {
+        sock_t *sock = &layer->socks[layer->ready_head];
+        layer->ready_head = sock->next_ready;
+        sock->ready = 0;
+        if (sock->type == SOCK_LISTENER)
+            sock_process_listener(layer, sock);
+        else if (sock->type == SOCK_STREAM)
+            sock_process_stream(sock);
+        else if (sock->type == SOCK_DGRAM)
+            sock_process_dgram(sock);
+    }
+}
+
+/**
+ * @brief 释放当前协议栈实例的套接字层，由 net_stack_destroy 调用，也可以在协议栈线程上提前调用
+ *
+ * 连接由 TCP 层自己释放，挂着的命令不再完成，所有上下文都必须已经不再提交命令。
+ * 它在 tcp_fini 之前运行，tcp_fini 还回引用的内存时套接字层已经不在了（见 sock_send_release）。
+ */
+void sock_free(void)
+{
+    net_stack_t *stack = net_stack();
+    sock_layer_t *layer = stack->sock;
+    if (layer == NULL)
+        return;
+    for (int i = 0; i < SOCK_MAX; i++)
+        if (layer->socks[i].type != SOCK_FREE)
+        {
+            free(layer->socks[i].rest);
+            if (layer->socks[i].type == SOCK_DGRAM)
+                ringbuf_free(&layer->socks[i].dgrams);
+        }
+    pktring_free(&layer->cmds);
+    free(layer);
+    stack->sock = NULL;
+}
+
+/**
+ * @brief 为当前线程创建一个使用 stack 的上下文
+ *
+ * @param stack 已经 sock_init 的协议栈实例
+ * @return sock_ctx_t* 失败为 NULL
+ */
+sock_ctx_t *sock_ctx_create(net_stack_t *stack)
+{
+    if (stack == NULL || stack->sock == NULL)
+        return NULL;
+    sock_ctx_t *ctx = calloc(1, sizeof(sock_ctx_t));
+    if (ctx == NULL)
+        return NULL;
+    if (pktring_init(&ctx->cq, SOCK_CQ_DEPTH) != 0)
+    {
+        free(ctx);
+        return NULL;
+    }
+    ctx->stack = stack;
+    return ctx;
+}
+
+/**
+ * @brief 释放上下文，所有提交的命令都必须已经收割
+ *
+ * @param ctx 上下文
+ */
+void sock_ctx_destroy(sock_ctx_t *ctx)
+{
+    if (ctx == NULL)
+        return;
+    pktring_free(&ctx->cq);
+    free(ctx);
+}
+
+/**
+ * @brief 提交一批命令，命令环满或未完成的命令数达到 SOCK_CQ_DEPTH 时只提交前面一部分
+ *
+ * @param ctx 上下文
+ * @param cmds 命令
+ * @param n 命令数
+ * @return unsigned 实际提交的个数，没提交的由调用者稍后重试
+ */
+unsigned sock_submit(sock_ctx_t *ctx, sock_cmd_t *const *cmds, unsigned n)
+{
+    unsigned space = SOCK_CQ_DEPTH - ctx->inflight;
+    if (n > space)
+        n = space;
+    for (unsigned i = 0; i < n; i++)
+        cmds[i]->ctx = ctx;
+    n = pktring_mp_enqueue(&ctx->stack->sock->cmds, (void *const *)cmds, n);
+    ctx->inflight += n;
+    return n;
+}
+
+/**
+ * @brief 收割一批完成的命令，不等待
+ *
+ * @param ctx 上下文
+ * @param cmds 出口参数，完成的命令
+ * @param n 最多收割的个数
+ * @return unsigned 实际收割的个数
+ */
+unsigned sock_reap(sock_ctx_t *ctx, sock_cmd_t **cmds, unsigned n)
+{
+    n = pktring_sc_dequeue(&ctx->cq, (void **)cmds, n);
+    ctx->inflight -= n;
+    return n;
+}
+
+/**
+ * @brief 登记一组缓冲区供 SEND_FIXED 使用，替换之前登记的
+ *
+ * @param ctx 上下文，不能有未完成的命令
+ * @param bufs 缓冲区
+ * @param n 个数，最多 SOCK_BUFS_MAX
+ * @return int 0 或错误码
+ */
+int sock_register_buffers(sock_ctx_t *ctx, const sock_buf_t *bufs, unsigned n)
+{
+    if (ctx->inflight)
+        return SOCK_EBUSY;
+    if (n > SOCK_BUFS_MAX)
+        return SOCK_EINVAL;
+    memcpy(ctx->bufs, bufs, n * sizeof(sock_buf_t));
+    ctx->nbufs = n;
+    return 0;
+}
+
+/**
+ * @brief 同步执行一个命令：提交后让出 CPU 等它完成
+ *
+ * @param ctx 上下文，不能有未完成的命令
+ * @param cmd 命令
+ * @return int64_t 命令的结果
+ */
+static int64_t sock_call(sock_ctx_t *ctx, sock_cmd_t *cmd)
+{
+    if (ctx->inflight)
+        return SOCK_EBUSY;
+    sock_cmd_t *done;
+    while (sock_submit(ctx, &cmd, 1) == 0)
+        sched_yield();
+    while (sock_reap(ctx, &done, 1) == 0)
+        sched_yield();
+    return done->result;
+}
+
+/**
+ * @brief 在 port 上监听 TCP
+ *
+ * @return int 套接字号或错误码
+ */
+int sock_listen(sock_ctx_t *ctx, uint16_t port)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_LISTEN, .port = port};
+    return sock_call(ctx, &cmd);
+}
+
+/**
+ * @brief 打开 UDP 端口 port
+ *
+ * @return int 套接字号或错误码
+ */
+int sock_udp_open(sock_ctx_t *ctx, uint16_t port)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_UDP_OPEN, .port = port};
+    return sock_call(ctx, &cmd);
+}
+
+/**
+ * @brief 等待并取出一个新连接
+ *
+ * @param ip 出口参数，对端地址，可以为 NULL
+ * @param port 出口参数，对端端口，可以为 NULL
+ * @return int 连接的套接字号或错误码
+ */
+int sock_accept(sock_ctx_t *ctx, int fd, uint8_t *ip, uint16_t *port)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_ACCEPT, .fd = fd};
+    int ret = sock_call(ctx, &cmd);
+    if (ret >= 0 && ip)
+        memcpy(ip, cmd.ip, NET_IP_LEN);
+    if (ret >= 0 && port)
+        *port = cmd.port;
+    return ret;
+}
+
+/**
+ * @brief 把 len 字节全部写进连接的发送缓存
+ *
+ * @return int64_t 字节数或错误码
+ */
+int64_t sock_send(sock_ctx_t *ctx, int fd, const void *data, size_t len)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_SEND, .fd = fd, .data = (uint8_t *)data, .len = len};
+    return sock_call(ctx, &cmd);
+}
+
+/**
+ * @brief 从登记的缓冲区发送 len 字节，等对端确认后返回
+ *
+ * @return int64_t 字节数或错误码
+ */
+int64_t sock_send_fixed(sock_ctx_t *ctx, int fd, uint16_t buf_index, const void *data, size_t len)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_SEND_FIXED, .fd = fd, .buf_index = buf_index, .data = (uint8_t *)data, .len = len};
+    return sock_call(ctx, &cmd);
+}
+
+/**
+ * @brief 等待连接上的数据，最多读 len 字节
+ *
+ * @return int64_t 字节数，0 表示对端已关闭，负数为错误码
+ */
+int64_t sock_recv(sock_ctx_t *ctx, int fd, void *data, size_t len)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_RECV, .fd = fd, .data = data, .len = len};
+    return sock_call(ctx, &cmd);
+}
+
+/**
+ * @brief 向 ip:port 发送一个数据报
+ *
+ * @return int64_t 字节数或错误码
+ */
+int64_t sock_sendto(sock_ctx_t *ctx, int fd, const void *data, size_t len, const uint8_t *ip, uint16_t port)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_SENDTO, .fd = fd, .data = (uint8_t *)data, .len = len, .port = port};
+    memcpy(cmd.ip, ip, NET_IP_LEN);
+    return sock_call(ctx, &cmd);
+}
+
+/**
+ * @brief 等待一个数据报，超出 len 的部分截掉
+ *
+ * @param ip 出口参数，来源地址，可以为 NULL
+ * @param port 出口参数，来源端口，可以为 NULL
+ * @return int64_t 字节数或错误码
+ */
+int64_t sock_recvfrom(sock_ctx_t *ctx, int fd, void *data, size_t len, uint8_t *ip, uint16_t *port)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_RECVFROM, .fd = fd, .data = data, .len = len};
+    int64_t ret = sock_call(ctx, &cmd);
+    if (ret >= 0 && ip)
+        memcpy(ip, cmd.ip, NET_IP_LEN);
+    if (ret >= 0 && port)
+        *port = cmd.port;
+    return ret;
+}
+
+/**
+ * @brief 关闭套接字
+ *
+ * @return int 0 或错误码
+ */
+int sock_close(sock_ctx_t *ctx, int fd)
+{
+    sock_cmd_t cmd = {.op = SOCK_OP_CLOSE, .fd = fd};
+    return sock_call(ctx, &cmd);
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <sched.h>
+#include "net.h"
+#include "stats.h"
+#include "utils.h"
+
+/* 登记的协议栈实例。登记、注销和读取都很少发生，用一个自旋锁保护，
+    注销时先把实例的计数加进 stats_retired，读的时候就不会碰到已经释放的实例。
+    计数器本身的写不经过这里，不受锁影响。
+*/
+static net_stack_t *stats_stacks[STATS_STACK_MAX];
+static stats_snapshot_t stats_retired;
+static atomic_flag stats_lock = ATOMIC_FLAG_INIT;
+
+static const char *const stats_layers[STATS_MAX] = {
+#define STATS_LAYER(id, layer, name) layer,
+    STATS_LIST(STATS_LAYER)
+#undef STATS_LAYER
+};
+
+static const char *const stats_names[STATS_MAX] = {
+#define STATS_NAME(id, layer, name) name,
+    STATS_LIST(STATS_NAME)
+#undef STATS_NAME
+};
+
+static void stats_lock_acquire()
+{
+    while (atomic_flag_test_and_set_explicit(&stats_lock, memory_order_acquire))
+        sched_yield();
+}
+
+static void stats_lock_release()
+{
+    atomic_flag_clear_explicit(&stats_lock, memory_order_release);
+}
+
+/**
+ * @brief 把一个实例的计数加到 snap 上
+ *
+ * @param stack 协议栈实例
+ * @param snap 累加到这里
+ */
+static void stats_accumulate(const net_stack_t *stack, stats_snapshot_t *snap)
+{
+    for (int i = 0; i < STATS_MAX; i++)
+        snap->counter[i] += atomic_load_explicit(&stack->stats.counter[i], memory_order_relaxed);
+#ifdef NET_LATENCY
+    for (int i = 0; i < LATENCY_MAX; i++)
+    {
+        const latency_hist_t *hist = &stack->stats.latency[i];
+        snap->latency[i].sum += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+        for (int j = 0; j < LATENCY_BUCKETS; j++)
+            snap->latency[i].bucket[j] += atomic_load_explicit(&hist->bucket[j], memory_order_relaxed);
+    }
+#endif
+}
+
+/**
+ * @brief 登记一个协议栈实例，之后它的计数计入 stats_snapshot。net_init 时调用，重复登记没有影响
+ *
+ * @param stack 协议栈实例
+ */
+void stats_register(net_stack_t *stack)
+{
+    stats_lock_acquire();
+    int free_slot = -1;
+    for (int i = 0; i < STATS_STACK_MAX; i++)
+    {
+        if (stats_stacks[i] == stack)
+        {
+            free_slot = -1;
+            break;
+        }
+        if (stats_stacks[i] == NULL && free_slot < 0)
+            free_slot = i;
+    }
+    if (free_slot >= 0)
+        stats_stacks[free_slot] = stack;
+    stats_lock_release();
+}
+
+/**
+ * @brief 注销一个协议栈实例，它的计数留在总数里。net_stack_destroy 时调用
+ *
+ * @param stack 协议栈实例
+ */
+void stats_unregister(net_stack_t *stack)
+{
+    stats_lock_acquire();
+    for (int i = 0; i < STATS_STACK_MAX; i++)
+    {
+        if (stats_stacks[i] == stack)
+        {
+            stats_accumulate(stack, &stats_retired);
+            stats_stacks[i] = NULL;
+            break;
+        }
+    }
+    stats_lock_release();
+}
+
+/**
+ * @brief 读一个协议栈实例的计数，可以在任何线程调用，实例不能正在被释放
+ *
+ * @param stack 协议栈实例
+ * @param snap 出口参数
+ */
+void stats_stack_snapshot(const net_stack_t *stack, stats_snapshot_t *snap)
+{
+    memset(snap, 0, sizeof(stats_snapshot_t));
+    stats_accumulate(stack, snap);
+}
+
+/**
+ * @brief 读所有协议栈实例的计数之和，包括已经释放的实例，可以在任何线程调用
+ *
+ * @param snap 出口参数
+ */
+void stats_snapshot(stats_snapshot_t *snap)
+{
+    stats_lock_acquire();
+    *snap = stats_retired;
+    for (int i = 0; i < STATS_STACK_MAX; i++)
+        if (stats_stacks[i])
+            stats_accumulate(stats_stacks[i], snap);
+    stats_lock_release();
+}
+
+/**
+ * @brief 计数器的名字，如 "Ip" 层的 "InCsumErrors"
+ *
+ * @param id 编号
+ * @return const char* 名字
+ */
+const char *stats_name(stats_id_t id)
+{
+    return id < STATS_MAX ? stats_names[id] : NULL;
+}
+
+/**
+ * @brief 按 /proc/net/snmp 的格式输出计数：每层一行名字、一行数值
+ *
+ * @param snap 计数
+ * @param buf 输出缓冲区，结果以 '\0' 结尾，放不下时截断
+ * @param size 缓冲区大小
+ * @return size_t 完整输出需要的长度，不含 '\0'
+ */
+size_t stats_dump(const stats_snapshot_t *snap, char *buf, size_t size)
+{
+    size_t len = 0;
+    for (int first = 0; first < STATS_MAX;)
+    {
+        int end = first;
+        while (end < STATS_MAX && !strcmp(stats_layers[end], stats_layers[first]))
+            end++;
+        str_append(buf, size, &len, "%s:", stats_layers[first]);
+        for (int i = first; i < end; i++)
+            str_append(buf, size, &len, " %s", stats_names[i]);
+        str_append(buf, size, &len, "\n%s:", stats_layers[first]);
+        for (int i = first; i < end; i++)
+            str_append(buf, size, &len, " %llu", (unsigned long long)snap->counter[i]);
+        str_append(buf, size, &len, "\n");
+        first = end;
+    }
+    return len;
+}
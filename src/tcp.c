@@ -5,32 +5,100 @@
 
 static void panic(const char *msg, int line)
 {
+    TRACE(TCP_PANIC, line); // 先进跟踪环，崩溃后能从跟踪文件里看到
     printf("panic %s! at line %d\n", msg, line);
     assert(0);
 }
 
-static void display_flags(tcp_flags_t flags)
+typedef struct tcp_listener // 监听端口，握手完成的连接排进 accept 队列，由应用层按自己的节奏取走
 {
-    printf("flags:%s%s%s%s%s%s%s%s\n",
-           flags.cwr ? " cwr" : "",
-           flags.ece ? " ece" : "",
-           flags.urg ? " urg" : "",
-           flags.ack ? " ack" : "",
-           flags.psh ? " psh" : "",
-           flags.rst ? " rst" : "",
-           flags.syn ? " syn" : "",
-           flags.fin ? " fin" : "");
-}
+    tcp_handler_t handler; // 连接事件回调
+    tcp_key_t *queue;      // accept 队列，存四元组而不是指针，这样能识别出 accept 前已经关闭的连接
+    size_t backlog;        // 队列容量，为 0 表示不排队，只通过回调通知
+    size_t head, count;    // 队头位置和排队的连接数
+    size_t queued, accepted, overflow;
+} tcp_listener_t;
 
-// dst-port -> handler
-static map_t tcp_table; // tcp_table 里面放了一个 dst_port 的回调函数
+/* TIME_WAIT 表：固定大小的记录池，按 key 哈希查找，按到期时间挂在时间轮上。
+    记录之间用 16 位下标链接，TCP_TW_NIL 表示链表结束。
+*/
+#define TCP_TW_NIL UINT16_MAX
+#define TCP_TW_HASH_SIZE 1024 // 哈希桶数，2 的幂
 
-// tcp_key_t[IP, src port, dst port] -> tcp_connect_t
+struct tcp_layer // 一个协议栈实例的 TCP 状态，放在 net_stack()->tcp
+{
+    // dst-port -> tcp_listener_t
+    map_t tcp_table; // tcp_table 里面放了 dst_port 的监听信息和回调函数
 
-/* Connect_table 放置了一堆 TCP 连接，
-    KEY 为 [IP，src port，dst port], 即 tcp_key_t，VALUE 为 tcp_connect_t。
-*/
-static map_t connect_table;
+    // tcp_key_t[IP, src port, dst port] -> tcp_connect_t
+
+    /* Connect_table 放置了一堆 TCP 连接，
+        KEY 为 [IP，src port，dst port], 即 tcp_key_t，VALUE 为 tcp_connect_t。
+    */
+    map_t connect_table;
+
+    tcp_timewait_t tw_pool[TCP_TW_MAX];
+    uint16_t tw_hash[TCP_TW_HASH_SIZE];
+    uint16_t tw_wheel[TCP_TW_WHEEL_SLOTS];
+    uint16_t tw_free;   // 空闲链表头
+    uint16_t tw_tick;   // 时间轮已经处理到的刻度
+    size_t tw_count;    // 使用中的记录数
+    size_t tw_overflow; // 表满而没能进入 TIME_WAIT 的连接数
+
+    size_t syn_rcvd_count;  // 处于 SYN_RCVD 的半连接数，不超过 TCP_SYN_BACKLOG
+    size_t ring_bytes;      // 所有连接的收发缓存占用的字节数
+    uint64_t cookie_secret; // SYN cookie 的密钥，tcp_init 时随机生成
+    uint64_t cookie_slice;  // 最近一次发出 SYN cookie 时的时间片（不取模）加 1，为 0 表示从没发过
+    uint64_t rng;           // 本实例的随机数状态，不用全局的 rand()，分片线程之间互不影响
+    tcp_stat_t tcp_counter; // 握手相关的计数，资源占用部分在 tcp_get_stat 时计算
+    uint64_t last_tick;     // tcp_poll 上一次扫描定时器的时间
+};
+
+/**
+ * @brief 当前协议栈实例的 TCP 状态
+ *
+ * @return tcp_layer_t*
+ */
+static inline tcp_layer_t *tcp_layer()
+{
+    return net_stack()->tcp;
+}
+
+/**
+ * @brief 随机数种子：系统的熵源，再混入实例的地址和时间。
+ *        同一秒里创建的分片也得到不同的种子；没有熵源（Windows）时只靠地址和时间
+ *
+ * @param tcp 本实例的 TCP 状态
+ * @return uint64_t 种子
+ */
+static uint64_t tcp_seed(tcp_layer_t *tcp)
+{
+    uint64_t seed = 0;
+#ifndef _WIN32
+    FILE *fp = fopen("/dev/urandom", "rb");
+    if (fp != NULL)
+    {
+        if (fread(&seed, sizeof(seed), 1, fp) != 1)
+            seed = 0;
+        fclose(fp);
+    }
+#endif
+    return seed ^ (uint64_t)(uintptr_t)tcp ^ ((uint64_t)time(NULL) << 32) ^ time_ms();
+}
+
+/**
+ * @brief 从本实例的随机数状态取下一个数（splitmix64）
+ *
+ * @param tcp 本实例的 TCP 状态
+ * @return uint64_t 随机数
+ */
+static uint64_t tcp_random(tcp_layer_t *tcp)
+{
+    uint64_t z = (tcp->rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
 
 /**
  * @brief 生成一个用于 connect_table 的 key
@@ -40,274 +108,1444 @@ static map_t connect_table;
  * @param dst_port
  * @return tcp_key_t
  */
-static tcp_key_t new_tcp_key(uint8_t ip[NET_IP_LEN], uint16_t src_port, uint16_t dst_port)
+static tcp_key_t new_tcp_key(uint8_t ip[NET_IP_LEN], uint16_t src_port, uint16_t dst_port)
+{
+    tcp_key_t key;
+    memcpy(key.ip, ip, NET_IP_LEN);
+    key.src_port = src_port;
+    key.dst_port = dst_port;
+    return key;
+}
+
+/**
+ * @brief 当前的时间轮刻度，以秒为单位
+ *
+ * @return uint16_t 刻度，会回绕，只用于比较相等和取模
+ */
+static uint16_t tcp_timewait_now()
+{
+    return (uint16_t)(time_ms() / 1000);
+}
+
+/**
+ * @brief TIME_WAIT 表的哈希函数
+ *
+ * @param key
+ * @return uint16_t 哈希桶下标
+ */
+static uint16_t tcp_timewait_hash(const tcp_key_t *key)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    const uint8_t *p = (const uint8_t *)key;
+    for (size_t i = 0; i < sizeof(tcp_key_t); i++)
+    {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h & (TCP_TW_HASH_SIZE - 1);
+}
+
+/**
+ * @brief 初始化 TIME_WAIT 表，所有记录进入空闲链表
+ *
+ */
+static void tcp_timewait_init()
+{
+    tcp_layer_t *tcp = tcp_layer();
+    for (size_t i = 0; i < TCP_TW_MAX; i++)
+    {
+        tcp->tw_pool[i].hash_next = i + 1 < TCP_TW_MAX ? i + 1 : TCP_TW_NIL;
+    }
+    for (size_t i = 0; i < TCP_TW_HASH_SIZE; i++)
+    {
+        tcp->tw_hash[i] = TCP_TW_NIL;
+    }
+    for (size_t i = 0; i < TCP_TW_WHEEL_SLOTS; i++)
+    {
+        tcp->tw_wheel[i] = TCP_TW_NIL;
+    }
+    tcp->tw_free = 0;
+    tcp->tw_tick = tcp_timewait_now();
+    tcp->tw_count = 0;
+    tcp->tw_overflow = 0;
+}
+
+/**
+ * @brief 查找 key 对应的 TIME_WAIT 记录
+ *
+ * @param key
+ * @return tcp_timewait_t* 找不到为 NULL
+ */
+static tcp_timewait_t *tcp_timewait_find(const tcp_key_t *key)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    for (uint16_t i = tcp->tw_hash[tcp_timewait_hash(key)]; i != TCP_TW_NIL; i = tcp->tw_pool[i].hash_next)
+    {
+        if (memcmp(&tcp->tw_pool[i].key, key, sizeof(tcp_key_t)) == 0)
+        {
+            return &tcp->tw_pool[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 把记录挂到 2MSL 之后到期的时间轮槽上
+ *
+ * @param idx 记录下标
+ */
+static void tcp_timewait_arm(uint16_t idx)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    tcp_timewait_t *tw = &tcp->tw_pool[idx];
+    tw->expire = tcp_timewait_now() + 2 * TCP_MSL_SEC;
+    uint16_t slot = tw->expire % TCP_TW_WHEEL_SLOTS;
+    tw->wheel_next = tcp->tw_wheel[slot];
+    tcp->tw_wheel[slot] = idx;
+}
+
+/**
+ * @brief 把记录从所在的链表中摘下
+ *
+ * @param head 链表头
+ * @param idx 记录下标
+ * @param wheel 为 1 时按 wheel_next 遍历，否则按 hash_next
+ */
+static void tcp_timewait_unlink(uint16_t *head, uint16_t idx, int wheel)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    for (uint16_t *p = head; *p != TCP_TW_NIL;
+         p = wheel ? &tcp->tw_pool[*p].wheel_next : &tcp->tw_pool[*p].hash_next)
+    {
+        if (*p == idx)
+        {
+            *p = wheel ? tcp->tw_pool[idx].wheel_next : tcp->tw_pool[idx].hash_next;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 删除一条 TIME_WAIT 记录，放回空闲链表
+ *
+ * @param tw
+ */
+static void tcp_timewait_remove(tcp_timewait_t *tw)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    uint16_t idx = tw - tcp->tw_pool;
+    tcp_timewait_unlink(&tcp->tw_wheel[tw->expire % TCP_TW_WHEEL_SLOTS], idx, 1);
+    tcp_timewait_unlink(&tcp->tw_hash[tcp_timewait_hash(&tw->key)], idx, 0);
+    tw->hash_next = tcp->tw_free;
+    tcp->tw_free = idx;
+    tcp->tw_count--;
+}
+
+/**
+ * @brief 初始化 tcp 在静态区的 map
+ *
+ * 供应用层使用
+ */
+void tcp_init()
+{
+    net_stack_t *stack = net_stack();
+    if (stack->tcp == NULL && (stack->tcp = malloc(sizeof(tcp_layer_t))) == NULL)
+        panic("tcp_init: out of memory", __LINE__);
+    tcp_layer_t *tcp = stack->tcp;
+    map_init(&tcp->tcp_table, sizeof(uint16_t), sizeof(tcp_listener_t), 0, 0, NULL);
+    map_init(&tcp->connect_table, sizeof(tcp_key_t), sizeof(tcp_connect_t), 0, 0, NULL);
+    tcp_timewait_init();
+    tcp->syn_rcvd_count = 0;
+    tcp->ring_bytes = 0;
+    tcp->last_tick = 0;
+    memset(&tcp->tcp_counter, 0, sizeof(tcp->tcp_counter));
+    tcp->rng = tcp_seed(tcp);
+    tcp->cookie_secret = tcp_random(tcp);
+    net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
+    net_add_fini(tcp_fini);
+}
+
+/**
+ * @brief 向 port 注册一个 TCP 连接以及关联的回调函数
+ *
+ * 供应用层使用。不带 accept 队列，新连接只通过回调 TCP_CONN_CONNECTED 交给应用层。
+ *
+ * @param port
+ * @param handler
+ * @return int 成功为 0，失败为 -1
+ */
+int tcp_open(uint16_t port, tcp_handler_t handler)
+{
+    return tcp_listen(port, handler, 0);
+}
+
+/**
+ * @brief 在 port 上监听，握手完成的连接排进长度为 backlog 的 accept 队列
+ *
+ * 供应用层使用。连接入队后仍会以 TCP_CONN_CONNECTED 调用 handler，作为有连接可以 accept 的通知，
+ * 应用层可以在回调里什么都不做，之后按自己的节奏用 tcp_accept / tcp_accept_batch 取走。
+ * 队列满时新完成握手的连接会被复位，并计入 overflow。
+ *
+ * @param port
+ * @param handler 连接事件回调，不能为 NULL
+ * @param backlog accept 队列长度，为 0 表示不排队，超过 TCP_ACCEPT_BACKLOG_MAX 时取上限
+ * @return int 成功为 0，失败为 -1
+ */
+int tcp_listen(uint16_t port, tcp_handler_t handler, size_t backlog)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    TRACE(TCP_LISTEN, port, backlog);
+    if (handler == NULL)
+    {
+        return -1;
+    }
+    tcp_listener_t listener = {.handler = handler};
+    if (backlog > TCP_ACCEPT_BACKLOG_MAX)
+    {
+        backlog = TCP_ACCEPT_BACKLOG_MAX;
+    }
+    if (backlog)
+    {
+        listener.queue = malloc(backlog * sizeof(tcp_key_t));
+        if (listener.queue == NULL)
+        {
+            return -1;
+        }
+        listener.backlog = backlog;
+    }
+    tcp_listener_t *old = map_get(&tcp->tcp_table, &port);
+    if (old != NULL) // 重复注册时换掉旧的队列
+    {
+        free(old->queue);
+    }
+    if (map_set(&tcp->tcp_table, &port, &listener) != 0)
+    {
+        free(listener.queue);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把握手完成的连接排进 accept 队列
+ *
+ * @param listener
+ * @param key 连接的四元组
+ * @return int 成功或不需要排队为 0，队列满为 -1
+ */
+static int tcp_listener_push(tcp_listener_t *listener, const tcp_key_t *key)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    if (listener->backlog == 0)
+    {
+        return 0;
+    }
+    if (listener->count == listener->backlog)
+    {
+        listener->overflow++;
+        tcp->tcp_counter.accept_overflow++;
+        STATS_INC(TCP_LISTEN_OVERFLOWS);
+        return -1;
+    }
+    listener->queue[(listener->head + listener->count) % listener->backlog] = *key;
+    listener->count++;
+    listener->queued++;
+    return 0;
+}
+
+/**
+ * @brief 从 port 的 accept 队列中取出最多 max 个连接
+ *
+ * 供应用层使用。队列里保存的是四元组，在 accept 之前已经关闭的连接会被跳过。
+ *
+ * @param port
+ * @param connects 出口参数，取出的连接
+ * @param max connects 的容量
+ * @return size_t 取出的连接数
+ */
+size_t tcp_accept_batch(uint16_t port, tcp_connect_t **connects, size_t max)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    tcp_listener_t *listener = map_get(&tcp->tcp_table, &port);
+    if (listener == NULL)
+    {
+        return 0;
+    }
+    size_t n = 0;
+    while (n < max && listener->count)
+    {
+        tcp_key_t *key = &listener->queue[listener->head];
+        listener->head = (listener->head + 1) % listener->backlog;
+        listener->count--;
+        tcp_connect_t *connect = map_get(&tcp->connect_table, key);
+        if (connect == NULL || connect->accepted || connect->state < TCP_ESTABLISHED)
+        {
+            continue;
+        }
+        connect->accepted = 1;
+        listener->accepted++;
+        connects[n++] = connect;
+    }
+    return n;
+}
+
+/**
+ * @brief 从 port 的 accept 队列中取出一个连接
+ *
+ * 供应用层使用
+ *
+ * @param port
+ * @return tcp_connect_t* 队列为空时为 NULL
+ */
+tcp_connect_t *tcp_accept(uint16_t port)
+{
+    tcp_connect_t *connect;
+    return tcp_accept_batch(port, &connect, 1) ? connect : NULL;
+}
+
+/**
+ * @brief 获取 port 的 accept 队列状态
+ *
+ * 供应用层使用
+ *
+ * @param port
+ * @param stat 出口参数
+ * @return int 成功为 0，端口没有监听为 -1
+ */
+int tcp_listen_stat(uint16_t port, tcp_listen_stat_t *stat)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    tcp_listener_t *listener = map_get(&tcp->tcp_table, &port);
+    if (listener == NULL)
+    {
+        return -1;
+    }
+    stat->backlog = listener->backlog;
+    stat->pending = listener->count;
+    stat->queued = listener->queued;
+    stat->accepted = listener->accepted;
+    stat->overflow = listener->overflow;
+    return 0;
+}
+
+/**
+ * @brief 初始化半连接，状态切换为 TCP_SYN_RCVD
+ *
+ * 半连接不分配收发缓存，只占用 connect_table 的一项，握手完成时才由 tcp_connect_establish 分配。
+ *
+ * @param connect
+ */
+static void init_tcp_connect_rcvd(tcp_connect_t *connect)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    memset(&connect->rx_buf, 0, sizeof(ringbuf_t));
+    memset(&connect->tx_buf, 0, sizeof(ringbuf_t));
+    connect->tx_refs = NULL;
+    connect->tx_ref_head = 0;
+    connect->tx_ref_count = 0;
+    connect->tx_len = 0;
+    connect->ack_pending = 0;
+    connect->acks_delayed = 0;
+    connect->nodelay = 0;
+    connect->cork = 0;
+    connect->segs_out = 0;
+    connect->accepted = 0;
+    connect->fin_pending = 0;
+    connect->rx_post = NULL;
+    connect->rx_post_len = connect->rx_post_done = 0;
+    connect->arg = NULL;
+    connect->syn_deadline = time_ms() + TCP_SYN_RCVD_TIMEOUT_MS;
+    connect->state = TCP_SYN_RCVD;
+    tcp->syn_rcvd_count++;
+}
+
+/**
+ * @brief 握手完成，分配收发缓存，状态切换为 TCP_ESTABLISHED
+ *
+ * rx_buf 和 tx_buf 是环形缓冲区，读写到末尾时自动回绕，不需要搬移数据。
+ * tx_refs 是发送队列的描述符，记录 tx_buf 中的数据和应用层借给 TCP 的内存的先后顺序。
+ *
+ * @param connect SYN_RCVD 状态的连接，或凭 SYN cookie 新建的连接
+ * @return int 成功为 0，分配缓存失败为 -1
+ */
+static int tcp_connect_establish(tcp_connect_t *connect)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    if (ringbuf_init(&connect->rx_buf, TCP_RX_BUF_SIZE) != 0)
+    {
+        return -1;
+    }
+    if (ringbuf_init(&connect->tx_buf, TCP_TX_BUF_SIZE) != 0)
+    {
+        ringbuf_free(&connect->rx_buf);
+        return -1;
+    }
+    connect->tx_refs = malloc(TCP_TX_REFS * sizeof(tcp_txref_t));
+    if (connect->tx_refs == NULL)
+    {
+        ringbuf_free(&connect->rx_buf);
+        ringbuf_free(&connect->tx_buf);
+        return -1;
+    }
+    tcp->ring_bytes += TCP_RX_BUF_SIZE + TCP_TX_BUF_SIZE + TCP_TX_REFS * sizeof(tcp_txref_t);
+    if (connect->state == TCP_SYN_RCVD)
+    {
+        tcp->syn_rcvd_count--;
+    }
+    connect->state = TCP_ESTABLISHED;
+    tcp->tcp_counter.established++;
+    STATS_INC(TCP_PASSIVE_OPENS);
+    return 0;
+}
+
+/**
+ * @brief 发送队列中从队头数起的第 i 个描述符
+ *
+ * @param connect
+ * @param i
+ * @return tcp_txref_t*
+ */
+static tcp_txref_t *tcp_txref_at(tcp_connect_t *connect, uint16_t i)
+{
+    return &connect->tx_refs[(connect->tx_ref_head + i) % TCP_TX_REFS];
+}
+
+/**
+ * @brief 在发送队列末尾追加 len 字节
+ *
+ * data 为 NULL 表示刚写进 tx_buf 的数据，与末尾同样在 tx_buf 中的描述符合并，不占用新的描述符。
+ *
+ * @param connect
+ * @param data 外部内存，为 NULL 表示数据在 tx_buf 中
+ * @param len 字节数，不能为 0
+ * @param release 外部内存全部被确认后的回调
+ * @param arg release 的参数
+ * @return int 成功为 0，描述符用完为 -1
+ */
+static int tcp_txref_push(tcp_connect_t *connect, const uint8_t *data, uint32_t len, tcp_release_t release, void *arg)
+{
+    if (data == NULL && connect->tx_ref_count > 0)
+    {
+        tcp_txref_t *tail = tcp_txref_at(connect, connect->tx_ref_count - 1);
+        if (tail->data == NULL)
+        {
+            tail->len += len;
+            connect->tx_len += len;
+            return 0;
+        }
+    }
+    if (connect->tx_refs == NULL || connect->tx_ref_count == TCP_TX_REFS)
+    {
+        return -1;
+    }
+    tcp_txref_t *ref = tcp_txref_at(connect, connect->tx_ref_count++);
+    ref->data = data;
+    ref->len = len;
+    ref->release = release;
+    ref->arg = arg;
+    connect->tx_len += len;
+    return 0;
+}
+
+/**
+ * @brief 从发送队列开头去掉 len 字节
+ *
+ * tx_buf 中的数据直接丢弃；外部内存只移动起始地址，全部去掉后调用 release 还给应用层。
+ *
+ * @param connect
+ * @param len 不超过 tx_len
+ * @param acked 这些数据是否被对端确认，连接释放时丢掉的数据为 0，传给 release
+ */
+static void tcp_txref_consume(tcp_connect_t *connect, uint32_t len, int acked)
+{
+    connect->tx_len -= len;
+    while (connect->tx_ref_count > 0)
+    {
+        tcp_txref_t *ref = tcp_txref_at(connect, 0);
+        uint32_t n = min32(len, ref->len);
+        if (ref->data == NULL)
+        {
+            ringbuf_consume(&connect->tx_buf, n);
+        }
+        else
+        {
+            ref->data += n;
+        }
+        ref->len -= n;
+        len -= n;
+        if (ref->len > 0)
+        {
+            break;
+        }
+        if (ref->data != NULL && ref->release != NULL)
+        {
+            ref->release(ref->arg, acked);
+        }
+        connect->tx_ref_head = (connect->tx_ref_head + 1) % TCP_TX_REFS;
+        connect->tx_ref_count--;
+    }
+}
+
+/**
+ * @brief 把发送队列中从 offset 开始的 len 字节拷贝到 dst，同时累加校验和
+ *
+ * 这是负载在发送路径上唯一的一次拷贝：tx_buf 中的数据和外部内存都直接拷进要发出的段，
+ * 校验和在拷贝的同时按源数据累加。
+ *
+ * @param connect
+ * @param offset 相对于 unack_seq 的偏移
+ * @param dst 段的负载
+ * @param len 字节数，offset + len 不超过 tx_len
+ * @return uint32_t 负载的 checksum_add 累加结果
+ */
+static uint32_t tcp_txref_copy(tcp_connect_t *connect, uint32_t offset, uint8_t *dst, uint32_t len)
+{
+    uint32_t sum = 0;
+    uint32_t off = 0;
+    uint32_t ring_off = 0; // 当前描述符在 tx_buf 中的起始偏移
+    for (uint16_t i = 0; i < connect->tx_ref_count && off < len; i++)
+    {
+        tcp_txref_t *ref = tcp_txref_at(connect, i);
+        if (offset >= ref->len)
+        {
+            offset -= ref->len;
+            ring_off += ref->data == NULL ? ref->len : 0;
+            continue;
+        }
+        uint32_t n = min32(ref->len - offset, len - off);
+        if (ref->data == NULL)
+        {
+            ringbuf_iov_t iov[2];
+            int cnt = ringbuf_peek(&connect->tx_buf, ring_off + offset, n, iov);
+            for (int j = 0; j < cnt; j++)
+            {
+                memcpy(dst + off, iov[j].base, iov[j].len);
+                sum = checksum_add_at(sum, off, iov[j].base, iov[j].len);
+                off += iov[j].len;
+            }
+            ring_off += ref->len;
+        }
+        else
+        {
+            memcpy(dst + off, ref->data + offset, n);
+            sum = checksum_add_at(sum, off, ref->data + offset, n);
+            off += n;
+        }
+        offset = 0;
+    }
+    return sum;
+}
+
+/**
+ * @brief 释放 TCP 连接，这会释放分配的空间，并把状态变回 LISTEN。
+ *
+ * 一般这个后边都会跟个 map_delete(&connect_table, &key) 把状态变回 CLOSED
+ *
+ * @param connect
+ */
+static void release_tcp_connect(tcp_connect_t *connect)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    if (connect->state == TCP_LISTEN)
+        return;
+    if (connect->state == TCP_SYN_RCVD)
+        tcp->syn_rcvd_count--;
+    tcp->ring_bytes -= connect->rx_buf.size + connect->tx_buf.size;
+    if (connect->tx_refs != NULL) // 还没确认的外部内存全部还给应用层
+    {
+        tcp_txref_consume(connect, connect->tx_len, 0);
+        free(connect->tx_refs);
+        connect->tx_refs = NULL;
+        tcp->ring_bytes -= TCP_TX_REFS * sizeof(tcp_txref_t);
+    }
+    ringbuf_free(&connect->rx_buf);
+    ringbuf_free(&connect->tx_buf);
+    connect->state = TCP_LISTEN;
+}
+
+/**
+ * @brief 累加 TCP 伪头部
+ *
+ * 伪头部在栈上单独累加，不再整块复制 buf，收发每个段都只遍历一次数据。
+ *
+ * @param src_ip 源 IP 地址
+ * @param dst_ip 目的 IP 地址
+ * @param len TCP 首部加数据的长度
+ * @return uint32_t 伪头部的累加结果
+ */
+static uint32_t tcp_peso_sum(uint8_t *src_ip, uint8_t *dst_ip, size_t len)
+{
+    tcp_peso_hdr_t peso_hdr;
+    memcpy(peso_hdr.src_ip, src_ip, NET_IP_LEN);
+    memcpy(peso_hdr.dst_ip, dst_ip, NET_IP_LEN);
+    peso_hdr.placeholder = 0;
+    peso_hdr.protocol = NET_PROTOCOL_TCP;
+    peso_hdr.total_len16 = swap16(len);
+    return checksum_add(0, &peso_hdr, sizeof(tcp_peso_hdr_t));
+}
+
+/**
+ * @brief 计算 TCP 校验和
+ *
+ * TCP 校验和需要覆盖一个伪头部、TCP 头部和 TCP 数据，分两段累加
+ *
+ * @param buf TCP 首部加数据
+ * @param src_ip 源 IP 地址
+ * @param dst_ip 目的 IP 地址
+ * @return uint16_t 校验和
+ */
+static uint16_t tcp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dst_ip)
+{
+    uint32_t sum = tcp_peso_sum(src_ip, dst_ip, buf->len);
+    sum = checksum_add(sum, buf->data, buf->len);
+    return checksum_fold(sum);
+}
+
+/**
+ * @brief 从 SYN 的选项中取出对端通告的 MSS
+ *
+ * @param hdr TCP 首部
+ * @param hdr_len 首部长度，包括选项
+ * @return uint16_t 限制在 TCP_MAX_MSS 以内的 MSS，没有 MSS 选项时为 TCP_DEFAULT_MSS
+ */
+static uint16_t tcp_parse_mss(tcp_hdr_t *hdr, size_t hdr_len)
+{
+    uint8_t *opt = (uint8_t *)hdr + sizeof(tcp_hdr_t);
+    uint8_t *end = (uint8_t *)hdr + hdr_len;
+    while (opt < end && *opt != TCP_OPT_END)
+    {
+        if (*opt == TCP_OPT_NOP)
+        {
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end) // 选项长度不合法，放弃解析
+        {
+            break;
+        }
+        if (opt[0] == TCP_OPT_MSS && opt[1] == TCP_OPT_MSS_LEN)
+        {
+            uint16_t mss = (opt[2] << 8) | opt[3];
+            return mss ? min32(mss, TCP_MAX_MSS) : TCP_DEFAULT_MSS;
+        }
+        opt += opt[1];
+    }
+    return TCP_DEFAULT_MSS;
+}
+
+static _Thread_local uint16_t delete_port;
+
+/**
+ * @brief tcp_close 使用这个函数来查找可以关闭的连接，使用 thread-local 变量 delete_port 传递端口号。
+ *
+ * @param key, value, timestamp
+ */
+static void close_port_fn(void *key, void *value, time_t *timestamp)
+{
+    tcp_key_t *tcp_key = key;
+    tcp_connect_t *connect = value;
+    if (tcp_key->dst_port == delete_port)
+    {
+        release_tcp_connect(connect);
+    }
+}
+
+/**
+ * @brief 关闭 port 上的 TCP 连接
+ *
+ * 供应用层使用
+ *
+ * @param port
+ */
+void tcp_close(uint16_t port)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    delete_port = port;
+    map_foreach(&tcp->connect_table, close_port_fn);
+    tcp_listener_t *listener = map_get(&tcp->tcp_table, &port);
+    if (listener != NULL)
+    {
+        free(listener->queue);
+    }
+    map_delete(&tcp->tcp_table, &port);
+}
+
+static void release_connect_fn(void *key, void *value, time_t *timestamp)
+{
+    release_tcp_connect(value);
+}
+
+static void free_listener_fn(void *key, void *value, time_t *timestamp)
+{
+    tcp_listener_t *listener = value;
+    free(listener->queue);
+}
+
+/**
+ * @brief 释放当前协议栈实例的所有连接的缓存和发送队列，以及监听端口的 accept 队列。
+ *        由 net_stack_destroy 调用，引用的外部内存以未确认的方式还给应用层
+ *
+ */
+void tcp_fini()
+{
+    tcp_layer_t *tcp = tcp_layer();
+    map_foreach(&tcp->connect_table, release_connect_fn);
+    map_foreach(&tcp->tcp_table, free_listener_fn);
+    map_init(&tcp->connect_table, sizeof(tcp_key_t), sizeof(tcp_connect_t), 0, 0, NULL);
+    map_init(&tcp->tcp_table, sizeof(uint16_t), sizeof(tcp_listener_t), 0, 0, NULL);
+}
+
+/**
+ * @brief 从 buf 中读取数据到 connect->rx_buf
+ *
+ * 应用层投递了接收缓冲区并且 rx_buf 为空时，数据先直接拷进投递的缓冲区，装不下的部分再进 rx_buf。
+ * rx_buf 放不下的部分不会被确认，对端会在窗口打开后重传。
+ *
+ * @param connect
+ * @param buf
+ * @return uint16_t 字节数
+ */
+static uint16_t tcp_read_from_buf(tcp_connect_t *connect, buf_t *buf)
+{
+    size_t direct = 0;
+    if (connect->rx_post && ringbuf_len(&connect->rx_buf) == 0)
+    {
+        direct = min32(buf->len, connect->rx_post_len - connect->rx_post_done);
+        memcpy(connect->rx_post + connect->rx_post_done, buf->data, direct);
+        connect->rx_post_done += direct;
+        tcp_layer()->tcp_counter.rx_direct += direct;
+    }
+    size_t size = ringbuf_write(&connect->rx_buf, buf->data + direct, buf->len - direct);
+    connect->ack += direct + size;
+    return direct + size;
+}
+
+/**
+ * @brief 本端的接收窗口，即 rx_buf 的剩余空间
+ *
+ * @param connect
+ * @return uint16_t 窗口大小
+ */
+static uint16_t tcp_rcv_wnd(tcp_connect_t *connect)
+{
+    if (connect->state == TCP_LISTEN)
+    {
+        return 0;
+    }
+    if (connect->rx_buf.data == NULL) // 半连接还没有分配缓存，通告握手后的窗口
+    {
+        return min32(TCP_RX_BUF_SIZE, UINT16_MAX);
+    }
+    return min32(ringbuf_space(&connect->rx_buf), UINT16_MAX);
+}
+
+/**
+ * @brief 发送 TCP 包，负载的累加和已由调用者算好
+ *
+ * tcp_send_segments 在从发送队列拷贝数据时顺带累加，这里只需再累加伪头部和 TCP 首部。
+ *
+ * @param buf
+ * @param connect
+ * @param flags
+ * @param payload_sum buf 中负载的 checksum_add 累加结果
+ */
+static void tcp_send_sum(buf_t *buf, tcp_connect_t *connect, tcp_flags_t flags, uint32_t payload_sum)
+{
+    size_t prev_len = buf->len;
+    TRACE(TCP_OUT, connect->local_port, connect->remote_port, connect->next_seq - prev_len, prev_len, *(uint8_t *)&flags);
+    size_t opt_len = 0;
+    if (flags.syn)
+    {
+        opt_len = TCP_OPT_MSS_LEN;
+        buf_add_header(buf, opt_len);
+        buf->data[0] = TCP_OPT_MSS;
+        buf->data[1] = TCP_OPT_MSS_LEN;
+        buf->data[2] = TCP_MAX_MSS >> 8;
+        buf->data[3] = TCP_MAX_MSS & 0xFF;
+    }
+    buf_add_header(buf, sizeof(tcp_hdr_t));
+    tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+    hdr->src_port16 = swap16(connect->local_port);
+    hdr->dst_port16 = swap16(connect->remote_port);
+    hdr->seq_number32 = swap32(connect->next_seq - prev_len);
+    hdr->ack_number32 = swap32(connect->ack);
+    hdr->data_offset = (sizeof(tcp_hdr_t) + opt_len) / sizeof(uint32_t);
+    hdr->reserved = 0;
+    hdr->flags = flags;
+    hdr->window_size16 = swap16(tcp_rcv_wnd(connect));
+    hdr->checksum16 = 0;
+    hdr->urgent_pointer16 = 0;
+    uint64_t sum = tcp_peso_sum(net_stack()->if_ip, connect->ip, buf->len);
+    sum += checksum_add(0, buf->data, sizeof(tcp_hdr_t) + opt_len); // 首部和选项都是偶数长度，负载的累加和可以直接相加
+    sum += payload_sum;
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    hdr->checksum16 = checksum_fold((sum >> 32) + (uint32_t)sum);
+    if (flags.ack && connect->ack_pending) // 这个包确认了之前延迟的所有数据段
+    {
+        int pure_ack = prev_len == 0 && !flags.syn && !flags.fin;
+        connect->acks_delayed += connect->ack_pending - pure_ack;
+        connect->ack_pending = 0;
+    }
+    STATS_INC(TCP_OUT_SEGS);
+    if (flags.rst)
+    {
+        STATS_INC(TCP_OUT_RSTS);
+    }
+    ip_out(buf, connect->ip, NET_PROTOCOL_TCP);
+    if (flags.syn || flags.fin)
+    {
+        connect->next_seq += 1;
+    }
+}
+
+/**
+ * @brief 发送 TCP 包，seq_number32 = connect->next_seq - buf->len
+ *
+ * buf 里的数据将作为负载，加上 tcp 头发送出去。如果 flags 包含 syn 或 fin，seq 会递增。
+ * syn 包会带上本机的 MSS 选项，让对端也按不分片的大小发送。
+ *
+ * @param buf
+ * @param connect
+ * @param flags
+ */
+static void tcp_send(buf_t *buf, tcp_connect_t *connect, tcp_flags_t flags)
+{
+    tcp_send_sum(buf, connect, flags, checksum_add(0, buf->data, buf->len));
+}
+
+/**
+ * @brief 收到一个数据段后安排 ACK，而不是立即回复纯 ACK
+ *
+ * 每累计 TCP_DELACK_SEGS 个段立即确认一次，否则最多等待 TCP_DELACK_MS 毫秒，
+ * 期间如果有数据要发送，ACK 会捎带在数据段上（见 tcp_send）。
+ *
+ * @param connect
+ */
+static void tcp_delay_ack(tcp_connect_t *connect)
+{
+    if (connect->ack_pending == 0)
+    {
+        connect->ack_deadline = time_ms() + TCP_DELACK_MS;
+    }
+    connect->ack_pending++;
+}
+
+/**
+ * @brief 如果延迟的 ACK 已攒够段数，立即发一个纯 ACK
+ *
+ * @param connect
+ */
+static void tcp_ack_check(tcp_connect_t *connect)
+{
+    if (connect->ack_pending >= TCP_DELACK_SEGS)
+    {
+        buf_init(&net_stack()->txbuf, 0);
+        tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+    }
+}
+
+/**
+ * @brief 软件 TSO：把发送队列中未发送、且在对端窗口内的数据切成不超过 MSS 的段，逐段发出
+ *
+ * 每个段单独加 TCP 首部并计算校验和，一次遍历发送缓存即可完成，
+ * 交给 ip_out 的段都不超过 MTU，不会再被 IP 分片。最后一个段带上 psh。
+ *
+ * 满 MSS 的段总是发送；不足 MSS 的尾巴按 Nagle 算法处理：
+ * 没有在途未确认的数据（或设置了 nodelay）时才发送，cork 时一直攒着，push 时无条件发送。
+ *
+ * @param connect
+ * @param flags 每个段都带的标志，一般为 tcp_flags_ack
+ * @param push 为 1 时忽略 Nagle 与 cork，立即发出全部窗口内的数据
+ * @return size_t 本次发出的负载字节数
+ */
+static size_t tcp_send_segments(tcp_connect_t *connect, tcp_flags_t flags, int push)
+{
+    size_t total = 0;
+    while (1)
+    {
+        uint32_t sent = connect->next_seq - connect->unack_seq; // 已发送未确认的字节数
+        uint32_t queued = connect->tx_len;
+        if (sent >= queued || sent >= connect->remote_win)
+        {
+            break;
+        }
+        size_t unsent = queued - sent;
+        size_t size = min32(min32(unsent, connect->remote_win - sent), connect->remote_mss);
+
+        if (size < connect->remote_mss && !push &&
+            (connect->cork || (!connect->nodelay && sent > 0))) // 小段等到 ACK 回来或被 push 时再发
+        {
+            break;
+        }
+
+        // 直接从 tx_buf 或应用层的内存中拷贝负载，同时累加校验和
+        buf_init(&net_stack()->txbuf, size);
+        uint32_t sum = tcp_txref_copy(connect, sent, net_stack()->txbuf.data, size);
+        connect->next_seq += size;
+
+        tcp_flags_t seg_flags = flags;
+        seg_flags.psh = (size == unsent);
+        tcp_send_sum(&net_stack()->txbuf, connect, seg_flags, sum);
+        connect->segs_out++;
+        total += size;
+    }
+    return total;
+}
+
+/**
+ * @brief 应用层关闭后，等发送队列中的数据全部发出再发送 FIN
+ *
+ * @param connect
+ */
+static void tcp_send_fin(tcp_connect_t *connect)
+{
+    if (connect->fin_pending && connect->next_seq - connect->unack_seq >= connect->tx_len)
+    {
+        connect->fin_pending = 0;
+        buf_init(&net_stack()->txbuf, 0);
+        tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack_fin);
+    }
+}
+
+/**
+ * @brief 处理对端的 ACK：从发送队列中去掉被确认的数据，并更新对端窗口
+ *
+ * 如果 unack_seq 小于 ack number（说明有部分数据被对端接收确认了，否则可能是之前重发的 ack，可以不处理），
+ * 且 next_seq 不小于 ack number（全部确认时二者相等），则调用 tcp_txref_consume 去掉已确认的数据。
+ * 序号会越过 2^32 回绕，大小按 32 位差值的符号比较。
+ *
+ * @param connect
+ * @param ack_number
+ * @param window_size
+ * @return size_t 发送队列中新确认的字节数
+ */
+static size_t tcp_ack_in(tcp_connect_t *connect, uint32_t ack_number, uint16_t window_size)
+{
+    size_t acked = 0;
+    if ((int32_t)(ack_number - connect->unack_seq) > 0 && (int32_t)(connect->next_seq - ack_number) >= 0)
+    {
+        acked = min32(ack_number - connect->unack_seq, connect->tx_len); // 超过数据量的部分是 fin 占用的序号
+        tcp_txref_consume(connect, acked, 1);
+        connect->unack_seq = ack_number;
+    }
+    connect->remote_win = window_size; // 对端窗口随每个 ack 更新，决定还能发多少数据
+    return acked;
+}
+
+/**
+ * @brief 连接是否还能发送数据：已建立，或者对端已发 FIN（CLOSE_WAIT）而本端还没有关闭
+ *
+ * 供应用层使用
+ *
+ * @param connect
+ * @return int 能发送为 1，否则为 0
+ */
+int tcp_connect_sendable(tcp_connect_t *connect)
+{
+    return connect->state == TCP_ESTABLISHED || connect->state == TCP_CLOSE_WAIT;
+}
+
+/**
+ * @brief 立即发出 connect 中已写入的全部数据（受对端窗口限制），最后一个段带 psh
+ *
+ * 忽略 Nagle 算法与 cork，供应用层在一次响应写完后使用
+ *
+ * @param connect
+ */
+void tcp_connect_flush(tcp_connect_t *connect)
+{
+    if (tcp_connect_sendable(connect))
+    {
+        tcp_send_segments(connect, tcp_flags_ack, 1);
+    }
+}
+
+/**
+ * @brief 设置 cork。cork 期间只发送满 MSS 的段，取消 cork 时立即发出剩余数据
+ *
+ * 供应用层使用，用于把响应头和响应体合并到同一批段里
+ *
+ * @param connect
+ * @param on 1 为 cork，0 为取消
+ */
+void tcp_connect_cork(tcp_connect_t *connect, int on)
+{
+    connect->cork = on;
+    if (!on)
+    {
+        tcp_connect_flush(connect);
+    }
+}
+
+/**
+ * @brief 设置 nodelay，关闭 Nagle 算法后小段写入会立即发送
+ *
+ * 供应用层使用
+ *
+ * @param connect
+ * @param on 1 为关闭 Nagle 算法，0 为开启（默认）
+ */
+void tcp_connect_set_nodelay(tcp_connect_t *connect, int on)
+{
+    connect->nodelay = on;
+}
+
+/**
+ * @brief 从外部关闭一个 TCP 连接，会发送剩余数据
+ *
+ * 供应用层使用
+ *
+ * @param connect
+ */
+void tcp_connect_close(tcp_connect_t *connect)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    if (connect->state == TCP_ESTABLISHED)
+    {
+        // 窗口内的数据立即发出，其余的随 ACK 继续发送，发完后再发 FIN
+        connect->state = TCP_FIN_WAIT_1;
+        connect->fin_pending = 1;
+        tcp_send_segments(connect, tcp_flags_ack, 1);
+        tcp_send_fin(connect);
+        return;
+    }
+    if (connect->state == TCP_CLOSE_WAIT)
+    {
+        // 对端已经关闭，发完剩余数据后发 FIN，等对端确认
+        connect->state = TCP_LAST_ACK;
+        connect->fin_pending = 1;
+        tcp_send_segments(connect, tcp_flags_ack, 1);
+        tcp_send_fin(connect);
+        return;
+    }
+    if (connect->state >= TCP_LAST_ACK) // 已经在关闭过程中，由 tcp_in 完成剩下的挥手
+    {
+        return;
+    }
+    tcp_key_t key = new_tcp_key(connect->ip, connect->remote_port, connect->local_port);
+    release_tcp_connect(connect);
+    map_delete(&tcp->connect_table, &key);
+}
+
+/**
+ * @brief 应用层取走数据后，窗口从不足一个 MSS 重新打开时，主动通告一次，否则对端可能一直等待
+ *
+ * @param connect
+ * @param old_wnd 取走数据之前的窗口
+ */
+static void tcp_window_update(tcp_connect_t *connect, uint16_t old_wnd)
+{
+    if (tcp_connect_sendable(connect) && old_wnd < TCP_MAX_MSS && tcp_rcv_wnd(connect) >= TCP_MAX_MSS)
+    {
+        buf_init(&net_stack()->txbuf, 0);
+        tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+    }
+}
+
+/**
+ * @brief 从 connect 中读取数据到 buf，返回成功的字节数。
+ *
+ * 供应用层使用
+ *
+ * @param connect
+ * @param data
+ * @param len
+ * @return size_t
+ */
+size_t tcp_connect_read(tcp_connect_t *connect, uint8_t *data, size_t len)
+{
+    uint16_t old_wnd = tcp_rcv_wnd(connect);
+    size_t size = ringbuf_read(&connect->rx_buf, data, len);
+    tcp_window_update(connect, old_wnd);
+    return size;
+}
+
+/**
+ * @brief 投递一个接收缓冲区，之后到达的数据不经过 rx_buf，直接拷进 data
+ *
+ * 供应用层使用。rx_buf 中还有数据时不能投递，要先读走，这样数据的顺序不会乱。
+ * 有数据到达时照常以 TCP_CONN_DATA_RECV 通知，应用层看 rx_post_done 得知收到了多少，
+ * 再用 tcp_connect_unpost_recv 取回缓冲区。连接被释放之后 TCP 不再写它。
+ *
+ * @param connect
+ * @param data 接收缓冲区，取回之前 TCP 会写它
+ * @param len 缓冲区大小
+ * @return int 成功为 0，rx_buf 非空、已经投递了缓冲区或 len 为 0 时为 -1
+ */
+int tcp_connect_post_recv(tcp_connect_t *connect, uint8_t *data, size_t len)
+{
+    if (connect->rx_post || data == NULL || len == 0 || ringbuf_len(&connect->rx_buf))
+    {
+        return -1;
+    }
+    connect->rx_post = data;
+    connect->rx_post_len = len < UINT32_MAX ? len : UINT32_MAX;
+    connect->rx_post_done = 0;
+    return 0;
+}
+
+/**
+ * @brief 取回投递的接收缓冲区
+ *
+ * 供应用层使用
+ *
+ * @param connect
+ * @return size_t 直接收进缓冲区的字节数
+ */
+size_t tcp_connect_unpost_recv(tcp_connect_t *connect)
+{
+    size_t done = connect->rx_post_done;
+    connect->rx_post = NULL;
+    connect->rx_post_len = connect->rx_post_done = 0;
+    return done;
+}
+
+/**
+ * @brief 不拷贝、不取走，直接查看 rx_buf 中从 offset 开始的最多 len 字节
+ *
+ * 供应用层使用，数据在环形缓冲区中可能分成两段。处理完后调用 tcp_connect_consume 取走。
+ *
+ * @param connect
+ * @param offset 相对于未读数据开头的偏移
+ * @param len 最多查看的字节数
+ * @param iov 出口参数，数据所在的一到两段内存
+ * @return int 段数，没有数据时为 0
+ */
+int tcp_connect_peek(tcp_connect_t *connect, size_t offset, size_t len, ringbuf_iov_t iov[2])
 {
-    tcp_key_t key;
-    memcpy(key.ip, ip, NET_IP_LEN);
-    key.src_port = src_port;
-    key.dst_port = dst_port;
-    return key;
+    return ringbuf_peek(&connect->rx_buf, offset, len, iov);
 }
 
 /**
- * @brief 初始化 tcp 在静态区的 map
+ * @brief 从 rx_buf 中取走 len 字节，与 tcp_connect_peek 配合使用
  *
  * 供应用层使用
+ *
+ * @param connect
+ * @param len
  */
-void tcp_init()
+void tcp_connect_consume(tcp_connect_t *connect, size_t len)
 {
-    map_init(&tcp_table, sizeof(uint16_t), sizeof(tcp_handler_t), 0, 0, NULL);
-    map_init(&connect_table, sizeof(tcp_key_t), sizeof(tcp_connect_t), 0, 0, NULL);
-    net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
+    uint16_t old_wnd = tcp_rcv_wnd(connect);
+    ringbuf_consume(&connect->rx_buf, len);
+    tcp_window_update(connect, old_wnd);
 }
 
 /**
- * @brief 向 port 注册一个 TCP 连接以及关联的回调函数
+ * @brief 往 connect 的 tx_buf 里面写东西，返回成功的字节数，tx_buf 满了之后只写入能容纳的部分。
+ *
+ * 写入后按 Nagle 算法与 cork 设置尝试发送，需要立即发出时调用 tcp_connect_flush。
+ * 对端窗口不够时数据留在 tx_buf 中，收到 ACK 窗口打开后再发送。
  *
  * 供应用层使用
  *
- * @param port
- * @param handler
- * @return int
+ * @param connect
+ * @param data
+ * @param len
  */
-int tcp_open(uint16_t port, tcp_handler_t handler)
+size_t tcp_connect_write(tcp_connect_t *connect, const uint8_t *data, size_t len)
 {
-    printf("tcp open\n");
-    return map_set(&tcp_table, &port, &handler);
+    tcp_layer_t *tcp = tcp_layer();
+    // printf("tcp_connect_write size: %zu\n", len);
+    size_t space = ringbuf_space(&connect->tx_buf);
+    size_t size = len < space ? len : space;
+    if (size == 0 || tcp_txref_push(connect, NULL, size, NULL, NULL) != 0) // 描述符用完时也要等 ACK
+    {
+        return 0;
+    }
+    ringbuf_write(&connect->tx_buf, data, size);
+    tcp->tcp_counter.tx_copied += size;
+    if (tcp_connect_sendable(connect))
+    {
+        tcp_send_segments(connect, tcp_flags_ack, 0);
+    }
+    return size;
 }
 
 /**
- * @brief 完成了缓存分配工作，状态也会切换为 TCP_SYN_RCVD
+ * @brief 把应用层的一段只读内存以引用方式排进发送队列，不拷贝进 tx_buf
+ *
+ * 发送时直接从 data 拷贝到要发出的段里。TCP 在这段内存全部被确认、或连接被释放时调用 release(arg, acked)，
+ * 在此之前应用层不能修改或释放它。返回 0 时 TCP 没有接管这段内存，也不会调用 release，
+ * 一般是描述符用完了，应用层等 TCP_CONN_WRITABLE 事件后再试。
  *
- * rx_buf 和 tx_buf 在触及边界时会把数据重新移动到头部，防止溢出。
+ * 供应用层使用
  *
  * @param connect
+ * @param data 只读内存
+ * @param len 字节数
+ * @param release 回调，可以为 NULL
+ * @param arg release 的参数
+ * @return size_t 成功为 len，失败为 0
  */
-static void init_tcp_connect_rcvd(tcp_connect_t *connect)
+size_t tcp_connect_write_ref(tcp_connect_t *connect, const uint8_t *data, size_t len, tcp_release_t release, void *arg)
 {
-    if (connect->state == TCP_LISTEN)
+    tcp_layer_t *tcp = tcp_layer();
+    if (data == NULL || len == 0 || len > UINT32_MAX - connect->tx_len ||
+        tcp_txref_push(connect, data, len, release, arg) != 0)
     {
-        connect->rx_buf = malloc(sizeof(buf_t));
-        connect->tx_buf = malloc(sizeof(buf_t));
+        return 0;
     }
-    buf_init(connect->rx_buf, 0);
-    buf_init(connect->tx_buf, 0);
-    connect->state = TCP_SYN_RCVD;
+    tcp->tcp_counter.tx_referenced += len;
+    if (tcp_connect_sendable(connect))
+    {
+        tcp_send_segments(connect, tcp_flags_ack, 0);
+    }
+    return len;
 }
 
 /**
- * @brief 释放 TCP 连接，这会释放分配的空间，并把状态变回 LISTEN。
+ * @brief 连接进入 TIME_WAIT：记下四元组和序号后，连接本身连同缓存一起释放
  *
- * 一般这个后边都会跟个 map_delete(&connect_table, &key) 把状态变回 CLOSED
+ * 表满时连接直接关闭，与没有 TIME_WAIT 时的行为一致。
  *
  * @param connect
+ * @param key connect 在 connect_table 中的 key
  */
-static void release_tcp_connect(tcp_connect_t *connect)
+static void tcp_timewait_enter(tcp_connect_t *connect, tcp_key_t *key)
 {
-    if (connect->state == TCP_LISTEN)
-        return;
-    free(connect->rx_buf);
-    free(connect->tx_buf);
-    connect->state = TCP_LISTEN;
+    tcp_layer_t *tcp = tcp_layer();
+    if (tcp->tw_free == TCP_TW_NIL)
+    {
+        tcp->tw_overflow++;
+    }
+    else
+    {
+        uint16_t idx = tcp->tw_free;
+        tcp_timewait_t *tw = &tcp->tw_pool[idx];
+        tcp->tw_free = tw->hash_next;
+        tw->key = *key;
+        tw->snd_nxt = connect->next_seq;
+        tw->rcv_nxt = connect->ack;
+        uint16_t bucket = tcp_timewait_hash(key);
+        tw->hash_next = tcp->tw_hash[bucket];
+        tcp->tw_hash[bucket] = idx;
+        tcp_timewait_arm(idx);
+        tcp->tw_count++;
+    }
+    release_tcp_connect(connect);
+    map_delete(&tcp->connect_table, key);
 }
 
-static uint16_t tcp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dst_ip)
+/**
+ * @brief 从 TIME_WAIT 记录回复一个 ACK，借用栈上的临时连接填写首部
+ *
+ * @param tw
+ */
+static void tcp_timewait_ack(tcp_timewait_t *tw)
 {
-    // S1 复制一整个
-    buf_t tmp_buf;
-    buf_copy(&tmp_buf, buf, sizeof(buf));
-
-    // S2 增加 TCP 伪头部
-    buf_add_header(&tmp_buf, sizeof(tcp_peso_hdr_t));
-
-    // S3 填写伪头部
-    tcp_peso_hdr_t *peso_hdr = (tcp_peso_hdr_t *)tmp_buf.data;
-    memcpy(peso_hdr->src_ip, src_ip, NET_IP_LEN);
-    memcpy(peso_hdr->dst_ip, dst_ip, NET_IP_LEN);
-    peso_hdr->placeholder = 0;
-    peso_hdr->protocol = NET_PROTOCOL_TCP;
-    peso_hdr->total_len16 = swap16(buf->len); // 需要解释
-
-    // S4 计算 TCP 校验和，并返回
-    // TCP 校验和需要覆盖 TCP 头部、TCP 数据和一个伪头部。
-    return checksum16((uint16_t *)(tmp_buf.data), tmp_buf.len);
+    tcp_connect_t connect = {.state = TCP_TIME_WAIT};
+    connect.local_port = tw->key.dst_port;
+    connect.remote_port = tw->key.src_port;
+    memcpy(connect.ip, tw->key.ip, NET_IP_LEN);
+    connect.next_seq = tw->snd_nxt;
+    connect.ack = tw->rcv_nxt;
+    buf_init(&net_stack()->txbuf, 0);
+    tcp_send(&net_stack()->txbuf, &connect, tcp_flags_ack);
 }
 
-static _Thread_local uint16_t delete_port;
-
 /**
- * @brief tcp_close 使用这个函数来查找可以关闭的连接，使用 thread-local 变量 delete_port 传递端口号。
+ * @brief 处理发往 TIME_WAIT 四元组的报文
  *
- * @param key, value, timestamp
+ * 重传的 FIN 重新确认并重启 2MSL 计时；序号比旧连接大的 SYN 允许复用四元组（RFC 6191），
+ * 此时删除记录并返回 1，由调用者按新连接处理；RST 按 RFC 1337 忽略。
+ *
+ * @param tw
+ * @param flags 收到的标志
+ * @param seq_number 收到的序号
+ * @return int 1 表示记录已删除、应按新连接处理，0 表示已处理完毕
  */
-static void close_port_fn(void *key, void *value, time_t *timestamp)
+static int tcp_timewait_in(tcp_timewait_t *tw, tcp_flags_t flags, uint32_t seq_number)
 {
-    tcp_key_t *tcp_key = key;
-    tcp_connect_t *connect = value;
-    if (tcp_key->dst_port == delete_port)
+    tcp_layer_t *tcp = tcp_layer();
+    if (flags.rst)
     {
-        release_tcp_connect(connect);
+        return 0;
+    }
+    if (flags.syn && !flags.ack && (int32_t)(seq_number - tw->rcv_nxt) > 0)
+    {
+        tcp_timewait_remove(tw);
+        return 1;
+    }
+    if (flags.fin)
+    {
+        uint16_t idx = tw - tcp->tw_pool;
+        tcp_timewait_unlink(&tcp->tw_wheel[tw->expire % TCP_TW_WHEEL_SLOTS], idx, 1);
+        tcp_timewait_arm(idx);
+    }
+    if (flags.fin || flags.syn)
+    {
+        tcp_timewait_ack(tw);
     }
+    return 0;
 }
 
 /**
- * @brief 关闭 port 上的 TCP 连接
- *
- * 供应用层使用
+ * @brief 推进时间轮，删除到期的 TIME_WAIT 记录
  *
- * @param port
  */
-void tcp_close(uint16_t port)
+static void tcp_timewait_poll()
 {
-    delete_port = port;
-    map_foreach(&connect_table, close_port_fn);
-    map_delete(&tcp_table, &port);
+    tcp_layer_t *tcp = tcp_layer();
+    uint16_t now = tcp_timewait_now();
+    int steps = 0;
+    while (tcp->tw_tick != now && steps++ < TCP_TW_WHEEL_SLOTS) // 停顿太久时转一圈就够了
+    {
+        tcp->tw_tick++;
+        uint16_t *p = &tcp->tw_wheel[tcp->tw_tick % TCP_TW_WHEEL_SLOTS];
+        while (*p != TCP_TW_NIL)
+        {
+            tcp_timewait_t *tw = &tcp->tw_pool[*p];
+            if (tw->expire == tcp->tw_tick)
+            {
+                tcp_timewait_remove(tw); // 会把 *p 改成下一项
+            }
+            else
+            {
+                p = &tw->wheel_next;
+            }
+        }
+    }
+    tcp->tw_tick = now;
 }
 
+/* SYN cookie：半连接数达到 TCP_SYN_BACKLOG 或连接表已满时，不保存任何状态，
+    把 [时间片, MSS 档位, 四元组与对端序号的带密钥哈希] 编码进 SYN + ACK 的初始序号，
+    收到最后一个 ACK 时从确认号中还原并校验，通过后才建立连接。
+*/
+static const uint16_t cookie_mss_table[] = {536, 1024, 1200, 1300, 1360, 1400, 1440, 1460};
+
 /**
- * @brief 从 buf 中读取数据到 connect->rx_buf
+ * @brief SYN cookie 的带密钥哈希
  *
- * @param connect
- * @param buf
- * @return uint16_t 字节数
+ * @param key 四元组
+ * @param peer_isn 对端的初始序号
+ * @param t 时间片
+ * @return uint32_t 24 位哈希值
  */
-static uint16_t tcp_read_from_buf(tcp_connect_t *connect, buf_t *buf)
+static uint32_t tcp_cookie_hash(const tcp_key_t *key, uint32_t peer_isn, uint32_t t)
 {
-    uint8_t *dst = connect->rx_buf->data + connect->rx_buf->len;
-    buf_add_padding(connect->rx_buf, buf->len);
-    memcpy(dst, buf->data, buf->len);
-    connect->ack += buf->len;
-    return buf->len;
+    tcp_layer_t *tcp = tcp_layer();
+    uint64_t h = tcp->cookie_secret;
+    uint64_t words[3];
+    memcpy(&words[0], key, sizeof(uint64_t)); // tcp_key_t 恰好 8 字节
+    words[1] = peer_isn;
+    words[2] = t;
+    for (int i = 0; i < 3; i++) // murmur3 的 fmix64
+    {
+        h ^= words[i];
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+    }
+    return h & 0xFFFFFF;
 }
 
 /**
- * @brief 把 connect 内 tx_buf 的数据写入到 buf 里面供 tcp_send 使用，buf 原来的内容会无效。
+ * @brief 当前的 cookie 时间片，64 秒一片，不取模
  *
- * @param connect
- * @param buf
- * @return uint16_t 字节数
+ * @return uint64_t 时间片
  */
-static uint16_t tcp_write_to_buf(tcp_connect_t *connect, buf_t *buf)
+static uint64_t tcp_cookie_slice()
 {
-    uint16_t sent = connect->next_seq - connect->unack_seq;
-    uint16_t size = min32(connect->tx_buf->len - sent, connect->remote_win);
-    buf_init(buf, size);
-    memcpy(buf->data, connect->tx_buf->data + sent, size);
-    connect->next_seq += size;
-    return size;
+    return time_ms() / 1000 / 64;
 }
 
 /**
- * @brief 发送 TCP 包，seq_number32 = connect->next_seq - buf->len
- *
- * buf 里的数据将作为负载，加上 tcp 头发送出去。如果 flags 包含 syn 或 fin，seq 会递增。
+ * @brief 当前的 cookie 时间片，取低 5 位编进 cookie
  *
- * @param buf
- * @param connect
- * @param flags
+ * @return uint32_t 时间片
  */
-static void tcp_send(buf_t *buf, tcp_connect_t *connect, tcp_flags_t flags)
+static uint32_t tcp_cookie_time()
 {
-    // printf("<< tcp send >> sz=%zu\n", buf->len);
-    display_flags(flags);
-    size_t prev_len = buf->len;
-    buf_add_header(buf, sizeof(tcp_hdr_t));
-    tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
-    hdr->src_port16 = swap16(connect->local_port);
-    hdr->dst_port16 = swap16(connect->remote_port);
-    hdr->seq_number32 = swap32(connect->next_seq - prev_len);
-    hdr->ack_number32 = swap32(connect->ack);
-    hdr->data_offset = sizeof(tcp_hdr_t) / sizeof(uint32_t);
-    hdr->reserved = 0;
-    hdr->flags = flags;
-    hdr->window_size16 = swap16(connect->remote_win);
-    hdr->checksum16 = 0;
-    hdr->urgent_pointer16 = 0;
-    hdr->checksum16 = tcp_checksum(buf, connect->ip, net_if_ip);
-    ip_out(buf, connect->ip, NET_PROTOCOL_TCP);
-    if (flags.syn || flags.fin)
-    {
-        connect->next_seq += 1;
-    }
+    return tcp_cookie_slice() & 0x1F;
 }
 
 /**
- * @brief 从外部关闭一个 TCP 连接，会发送剩余数据
+ * @brief 最近是否发过 SYN cookie，即上一次发送仍在可以接受的两个时间片之内
  *
- * 供应用层使用
+ * 和 Linux 的 "recent overflow" 检查一样，没有发过 cookie 时不校验没有连接的 ACK，
+ * 免得 24 位的哈希随时可以被盲猜，已经释放的连接迟到的 ACK 也不算作 cookie 校验失败。
  *
- * @param connect
+ * @return int 是为 1，否为 0
  */
-void tcp_connect_close(tcp_connect_t *connect)
+static int tcp_syncookie_recent()
 {
-    if (connect->state == TCP_ESTABLISHED)
-    {
-        tcp_write_to_buf(connect, &txbuf);
-        tcp_send(&txbuf, connect, tcp_flags_ack_fin);
-        connect->state = TCP_FIN_WAIT_1;
-        return;
-    }
-    tcp_key_t key = new_tcp_key(connect->ip, connect->remote_port, connect->local_port);
-    release_tcp_connect(connect);
-    map_delete(&connect_table, &key);
+    tcp_layer_t *tcp = tcp_layer();
+    return tcp->cookie_slice != 0 && tcp_cookie_slice() + 1 - tcp->cookie_slice <= 1;
 }
 
 /**
- * @brief 从 connect 中读取数据到 buf，返回成功的字节数。
- *
- * 供应用层使用
+ * @brief 不保存状态，以 SYN cookie 作为初始序号回复 SYN + ACK
  *
- * @param connect
- * @param data
- * @param len
- * @return size_t
+ * @param key 四元组
+ * @param peer_isn 对端的初始序号
+ * @param mss 对端通告的 MSS
  */
-size_t tcp_connect_read(tcp_connect_t *connect, uint8_t *data, size_t len)
+static void tcp_syncookie_send(const tcp_key_t *key, uint32_t peer_isn, uint16_t mss)
 {
-    buf_t *rx_buf = connect->rx_buf;
-    size_t size = min32(rx_buf->len, len);
-    memcpy(data, rx_buf->data, size);
-    if (buf_remove_header(rx_buf, size) != 0)
+    tcp_layer_t *tcp = tcp_layer();
+    uint32_t idx = 0;
+    for (uint32_t i = 0; i < sizeof(cookie_mss_table) / sizeof(cookie_mss_table[0]); i++)
     {
-        memmove(rx_buf->payload, rx_buf->data, rx_buf->len);
-        rx_buf->data = rx_buf->payload;
+        if (cookie_mss_table[i] <= mss)
+            idx = i;
     }
-    return size;
+    uint64_t slice = tcp_cookie_slice();
+    uint32_t t = slice & 0x1F;
+    tcp->cookie_slice = slice + 1;
+    tcp_connect_t connect = {.state = TCP_SYN_RCVD}; // 临时连接，只用于填写首部
+    connect.local_port = key->dst_port;
+    connect.remote_port = key->src_port;
+    memcpy(connect.ip, key->ip, NET_IP_LEN);
+    connect.next_seq = (t << 27) | (idx << 24) | tcp_cookie_hash(key, peer_isn, t);
+    connect.ack = peer_isn + 1;
+    buf_init(&net_stack()->txbuf, 0);
+    tcp_send(&net_stack()->txbuf, &connect, tcp_flags_ack_syn);
+    tcp->tcp_counter.syncookies_sent++;
 }
 
 /**
- * @brief 往 connect 的 tx_buf 里面写东西，返回成功的字节数，这里要判断窗口够不够，否则图片显示不全。
- *
- * 供应用层使用
+ * @brief 校验最后一个 ACK 中的 SYN cookie
  *
- * @param connect
- * @param data
- * @param len
+ * @param key 四元组
+ * @param seq_number ACK 的序号，即对端初始序号 + 1
+ * @param ack_number ACK 的确认号，即 cookie + 1
+ * @return uint16_t 合法时返回 cookie 中的 MSS，不合法为 0
  */
-size_t tcp_connect_write(tcp_connect_t *connect, const uint8_t *data, size_t len)
+static uint16_t tcp_syncookie_check(const tcp_key_t *key, uint32_t seq_number, uint32_t ack_number)
 {
-    // printf("tcp_connect_write size: %zu\n", len);
-    buf_t *tx_buf = connect->tx_buf;
-
-    uint8_t *dst = tx_buf->data + tx_buf->len;
-    size_t size = min32(&tx_buf->payload[BUF_MAX_LEN] - dst, len);
-
-    if (connect->next_seq - connect->unack_seq + len >= connect->remote_win)
+    uint32_t cookie = ack_number - 1;
+    uint32_t t = cookie >> 27;
+    uint32_t now = tcp_cookie_time();
+    if (t != now && t != ((now - 1) & 0x1F)) // 只接受当前和上一个时间片
     {
         return 0;
     }
-    if (buf_add_padding(tx_buf, size) != 0)
+    if ((cookie & 0xFFFFFF) != tcp_cookie_hash(key, seq_number - 1, t))
     {
-        memmove(tx_buf->payload, tx_buf->data, tx_buf->len);
-        tx_buf->data = tx_buf->payload;
-        if (tcp_write_to_buf(connect, &txbuf))
-        {
-            tcp_send(&txbuf, connect, tcp_flags_ack);
-        }
         return 0;
     }
-    memcpy(dst, data, size);
-    return size;
+    return cookie_mss_table[(cookie >> 24) & 0x7];
+}
+
+/**
+ * @brief 获取 TCP 的资源占用与握手计数
+ *
+ * 供应用层和测试使用
+ *
+ * @param stat 出口参数
+ */
+void tcp_get_stat(tcp_stat_t *stat)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    *stat = tcp->tcp_counter;
+    stat->connects = map_size(&tcp->connect_table);
+    stat->half_open = tcp->syn_rcvd_count;
+    stat->timewait = tcp->tw_count;
+    stat->timewait_overflow = tcp->tw_overflow;
+    stat->bytes = stat->connects * sizeof(tcp_connect_t) + stat->timewait * sizeof(tcp_timewait_t) + tcp->ring_bytes;
 }
 
 /**
@@ -321,12 +1559,21 @@ size_t tcp_connect_write(tcp_connect_t *connect, const uint8_t *data, size_t len
  */
 void tcp_in(buf_t *buf, uint8_t *src_ip)
 {
-    printf("<<< tcp_in >>>\n");
+    tcp_layer_t *tcp = tcp_layer();
+    LATENCY_MARK(TCP_IN);
+    STATS_INC(TCP_IN_SEGS);
 
     // 1 大小检查
-    // 检查 buf 长度是否小于 tcp 头部。如果是，则丢弃
+    // 检查 buf 长度是否小于 tcp 头部，或者 data_offset 标出的首部长度（含选项）不足固定首部、超出 buf。如果是，则丢弃
     if (buf->len < sizeof(tcp_hdr_t))
     {
+        STATS_INC(TCP_IN_ERRS);
+        return;
+    }
+    size_t hdr_len = 4 * (uint16_t)((tcp_hdr_t *)buf->data)->data_offset; // 占 4 位，4 字节为计算单位
+    if (hdr_len < sizeof(tcp_hdr_t) || hdr_len > buf->len)
+    {
+        STATS_INC(TCP_IN_ERRS);
         return;
     }
 
@@ -334,9 +1581,10 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
     tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
     uint16_t tmp_checksum16 = hdr->checksum16;
     hdr->checksum16 = 0;
-    uint16_t re_checksum16 = tcp_checksum(buf, src_ip, net_if_ip);
+    uint16_t re_checksum16 = tcp_checksum(buf, src_ip, net_stack()->if_ip);
     if (tmp_checksum16 != re_checksum16)
     {
+        STATS_INC(TCP_IN_CSUM_ERRORS);
         return;
     }
     hdr->checksum16 = tmp_checksum16;
@@ -351,11 +1599,12 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
     uint32_t get_seq = seq_number;
     uint32_t ack_number = swap32(hdr->ack_number32);
     uint16_t window_size = swap16(hdr->window_size16); // 原框架第 7 步
-    size_t hdr_len = 4 * (uint16_t)hdr->data_offset;   // 占 4 位，4 字节为计算单位
     tcp_flags_t flags = hdr->flags;
+    TRACE(TCP_IN, src_port, dest_port, seq_number, ack_number, *(uint8_t *)&flags);
 
-    // 4 调用 map_get 函数，根据 destination port 查找对应的 handler 函数
-    tcp_handler_t *handler = map_get(&tcp_table, &dest_port);
+    // 4 调用 map_get 函数，根据 destination port 查找监听信息和对应的 handler 函数
+    tcp_listener_t *listener = map_get(&tcp->tcp_table, &dest_port);
+    tcp_handler_t *handler = listener ? &listener->handler : NULL;
 
     // 5 调用 new_tcp_key 函数，根据通信五元组中的：
     // 源 IP 地址、目标 IP 地址、目标端口号
@@ -363,14 +1612,82 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
     tcp_key_t tcp_key = new_tcp_key(src_ip, src_port, dest_port);
 
     // 6 调用 map_get 函数，根据 key 查找一个 tcp_connect_t* connect
-    // 如果没有找到，则调用 map_set 建立新的链接，并设置为 CONNECT_LISTEN 状态，然后调用 mag_get 获取到该链接。
-    tcp_connect_t *connect = (tcp_connect_t *)map_get(&connect_table, &tcp_key);
+    // 如果没有找到，先看这个四元组是否处于 TIME_WAIT，是的话由 TIME_WAIT 表处理（除非允许复用）
+    // 否则调用 map_set 建立新的链接，并设置为 CONNECT_LISTEN 状态，然后调用 mag_get 获取到该链接。
+    tcp_connect_t *connect = (tcp_connect_t *)map_get(&tcp->connect_table, &tcp_key);
+    uint32_t reuse_seq = 0; // 复用 TIME_WAIT 四元组时，新连接的初始序号要大于旧连接的序号
     if (connect == NULL)
     {
-        tcp_connect_t new_connect;
-        new_connect.state = TCP_LISTEN;
-        map_set(&connect_table, &tcp_key, &new_connect);
-        connect = (tcp_connect_t *)map_get(&connect_table, &tcp_key);
+        tcp_timewait_t *tw = tcp_timewait_find(&tcp_key);
+        if (tw != NULL)
+        {
+            reuse_seq = tw->snd_nxt;
+            if (!tcp_timewait_in(tw, flags, seq_number))
+            {
+                return;
+            }
+        }
+        // 6.1 半连接已满时，SYN 以 cookie 回复，不建立任何状态
+        if (flags.syn && !flags.ack && !flags.rst && handler != NULL && tcp->syn_rcvd_count >= TCP_SYN_BACKLOG)
+        {
+            tcp->tcp_counter.syn_recv++;
+            tcp_syncookie_send(&tcp_key, seq_number, tcp_parse_mss(hdr, hdr_len));
+            return;
+        }
+
+        // 6.2 没有对应连接的 ACK，最近发过 cookie 时可能是凭 cookie 完成的握手，否则按 LISTEN 处理，复位
+        uint16_t cookie_mss = 0;
+        if (flags.ack && !flags.syn && !flags.rst && !flags.fin && handler != NULL && tcp_syncookie_recent())
+        {
+            cookie_mss = tcp_syncookie_check(&tcp_key, seq_number, ack_number);
+            if (cookie_mss == 0)
+            {
+                tcp->tcp_counter.syncookies_failed++;
+            }
+        }
+
+        tcp_connect_t new_connect = {.state = TCP_LISTEN}; // 端口和地址要填好，reset_tcp 会用到
+        new_connect.local_port = dest_port;
+        new_connect.remote_port = src_port;
+        memcpy(new_connect.ip, src_ip, NET_IP_LEN);
+        if (map_set(&tcp->connect_table, &tcp_key, &new_connect) != 0)
+        {
+            // 连接表已满：SYN 改用 cookie 回复，其他报文直接丢弃
+            if (flags.syn && !flags.ack && !flags.rst && handler != NULL)
+            {
+                tcp->tcp_counter.syn_recv++;
+                tcp_syncookie_send(&tcp_key, seq_number, tcp_parse_mss(hdr, hdr_len));
+            }
+            else
+            {
+                STATS_INC(TCP_TABLE_DROPS);
+            }
+            return;
+        }
+        connect = (tcp_connect_t *)map_get(&tcp->connect_table, &tcp_key);
+
+        // 6.3 cookie 合法，跳过 SYN_RCVD 直接建立连接，之后按 ESTABLISHED 处理这个 ACK 携带的数据
+        if (cookie_mss)
+        {
+            connect->ack = seq_number;
+            connect->unack_seq = ack_number;
+            connect->next_seq = ack_number;
+            connect->remote_win = window_size;
+            connect->remote_mss = min32(cookie_mss, TCP_MAX_MSS);
+            connect->handler = *handler;
+            init_tcp_connect_rcvd(connect);
+            if (tcp_listener_push(listener, &tcp_key) != 0)
+            {
+                goto reset_tcp;
+            }
+            if (tcp_connect_establish(connect) != 0)
+            {
+                goto close_tcp;
+            }
+            tcp->tcp_counter.syncookies_ok++;
+            LATENCY_MARK(HANDLER);
+            (*handler)(connect, TCP_CONN_CONNECTED);
+        }
     }
 
     // 7 如果为 TCP_LISTEN 状态，则需要完成如下功能
@@ -383,30 +1700,36 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
         }
 
         // 7.2 如果收到的 flag 不是 syn，则 reset_tcp 复位通知
-        // 因为收到的第一个包必须是 syn
-        if (!flags.syn)
+        // 因为收到的第一个包必须是 syn；端口上没有监听时同样复位
+        if (!flags.syn || handler == NULL)
         {
             goto reset_tcp;
         }
 
         // 7.3 调用 init_tcp_connect_rcvd 函数，初始化 connect，将状态设为 TCP_SYN_RCVD
+        // 半连接不分配缓存，握手完成时再分配
+        tcp->tcp_counter.syn_recv++;
         init_tcp_connect_rcvd(connect);
 
         // 7.4 填充 connect 字段，包括以下：
         connect->local_port = dest_port;
         connect->remote_port = src_port;
         memcpy(connect->ip, src_ip, NET_IP_LEN);
-        srand((unsigned)time(NULL));
-        connect->unack_seq = rand();            // 设为随机值
+        connect->unack_seq = (uint32_t)tcp_random(tcp); // 设为随机值，随机数状态在 tcp_init 中播种
+        if (reuse_seq)
+        {
+            connect->unack_seq = reuse_seq + 250000 + (connect->unack_seq & 0xFFFF); // 复用 TIME_WAIT 四元组，与旧连接的序号错开
+        }
         connect->next_seq = connect->unack_seq; // 对 syn 的 ack 应答包，与 unack_seq 一致
         connect->ack = seq_number + 1;
         connect->remote_win = window_size;
+        connect->remote_mss = tcp_parse_mss(hdr, hdr_len);
 
-        // 7.5 调用 buf_init 初始化 txbuf
-        buf_init(&txbuf, 0);
+        // 7.5 调用 buf_init 初始化 net_stack()->txbuf
+        buf_init(&net_stack()->txbuf, 0);
 
-        // 7.6 调用 tcp_send 将 txbuf 发送出去，也就是回复一个 tcp_flags_ack_syn（SYN + ACK）报文
-        tcp_send(&txbuf, connect, tcp_flags_ack_syn);
+        // 7.6 调用 tcp_send 将 net_stack()->txbuf 发送出去，也就是回复一个 tcp_flags_ack_syn（SYN + ACK）报文
+        tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack_syn);
 
         // 7.7 处理结束，返回。
         return;
@@ -445,10 +1768,14 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
         // 12.1 将 unack_seq + 1
         connect->unack_seq++;
 
-        // 12.2 将状态转成 ESTABLISHED
-        connect->state = TCP_ESTABLISHED;
+        // 12.2 排进 accept 队列，分配收发缓存，将状态转成 ESTABLISHED，队列满或分配失败则复位
+        if (tcp_listener_push(listener, &tcp_key) != 0 || tcp_connect_establish(connect) != 0)
+        {
+            goto reset_tcp;
+        }
 
         // 12.3 调用回调函数，完成三次握手，进入连接状态 TCP_CONN_CONNECTED
+        LATENCY_MARK(HANDLER);
         (*handler)(connect, TCP_CONN_CONNECTED);
 
         break;
@@ -460,66 +1787,107 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
             break;
         }
 
-        // 14 处理 ACK 的值
-        // 如果是 ack 包，
-        // 且 unack_seq 小于 sequence number（说明有部分数据被对端接收确认了，否则可能是之前重发的 ack，可以不处理），
-        // 且 next_seq 大于 sequence number
-        // 则调用 buf_remove_header 函数，去掉被对端接收确认的部分数据，并更新 unack_seq 值
-        if (flags.ack &&
-            connect->unack_seq < ack_number &&
-            connect->next_seq > ack_number) // 存在新确认的数据，更新 ACK 的值
-        {
-            buf_remove_header(connect->tx_buf, ack_number - connect->unack_seq);
-            connect->unack_seq = ack_number;
-        }
+        // 14 处理 ACK 的值，调用 tcp_ack_in 从发送队列中去掉被对端接收确认的部分数据，并更新 unack_seq 和对端窗口
+        size_t acked = flags.ack ? tcp_ack_in(connect, ack_number, window_size) : 0;
 
         // 15 接收数据，调用 tcp_read_from_buf 函数，把 buf 放入 rx_buf 中
         int read_buf_len = tcp_read_from_buf(connect, buf);
 
         // 16 根据当前的标志位进一步处理
-        // 16.1 首先调用 buf_init 初始化 txbuf
-        buf_init(&txbuf, 0); // 其实很意外 txbuf 是全局的
+        // 16.1 首先调用 buf_init 初始化 net_stack()->txbuf
+        buf_init(&net_stack()->txbuf, 0); // 其实很意外 net_stack()->txbuf 是全局的
 
-        // 16.2 判断是否收到关闭请求（FIN），如果是，将状态改为 TCP_LAST_ACK，ack + 1，再发送一个 ACK + FIN 包，并退出
-        // 这样就无需进入 CLOSE_WAIT，直接等待对方的 ACK
-        if (flags.fin)
+        // 16.2 判断是否收到关闭请求（FIN），如果是，将状态改为 TCP_CLOSE_WAIT，ack + 1，并立即确认对方的 FIN
+        // 对端只是不再发送，仍然可以接收，应用层可以继续写（如回复和 FIN 一起到达的请求），
+        // 写完后调用 tcp_connect_close 发送 FIN，进入 TCP_LAST_ACK
+        // 数据没有全部收下时 FIN 也不能确认，留在 ESTABLISHED 只确认收下的部分，对端会连同 FIN 一起重传剩下的
+        if (flags.fin && (size_t)read_buf_len == buf->len)
         {
-            connect->state = TCP_LAST_ACK;
+            connect->state = TCP_CLOSE_WAIT;
             connect->ack++;
-            tcp_send(connect->tx_buf, connect, tcp_flags_ack_fin);
+            tcp_send_segments(connect, tcp_flags_ack, 1);
+            buf_init(&net_stack()->txbuf, 0);
+            tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+            // 通知应用层读走 FIN 之前剩下的数据，读完即 EOF
+            if (handler)
+            {
+                LATENCY_MARK(HANDLER);
+                (*handler)(connect, TCP_CONN_DATA_RECV);
+            }
             break;
         }
-        else // 16.3 如果不是 FIN，则看看是否有数据，如果有，则发 ACK 相应，并调用 handler 回调函数进行处理
+        else // 16.3 如果不是 FIN，则看看是否有数据，如果有，则调用 handler 回调函数进行处理，ACK 延迟发送
         {
             if (read_buf_len > 0)
             {
+                tcp_delay_ack(connect);
+                LATENCY_MARK(HANDLER);
                 (*handler)(connect, TCP_CONN_DATA_RECV);
-                tcp_send(&txbuf, connect, tcp_flags_ack);
             }
-            // 16.4 调用 tcp_write_to_buf 函数，看看是否有数据需要发送，如果有，同时发数据和 ACK
-            int write_buf_len = tcp_write_to_buf(connect, &txbuf);
-            if (write_buf_len > 0)
+            if (flags.fin && connect->state == TCP_ESTABLISHED) // 没收下的数据和 FIN 要对端重传，立即告诉它收到了哪里
+            {
+                buf_init(&net_stack()->txbuf, 0);
+                tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+            }
+            // 发送队列腾出了空间，通知应用层可以继续写
+            if (acked > 0 && connect->state == TCP_ESTABLISHED)
             {
-                tcp_send(&txbuf, connect, tcp_flags_ack);
+                LATENCY_MARK(HANDLER);
+                (*handler)(connect, TCP_CONN_WRITABLE);
             }
+            // 16.4 调用 tcp_send_segments 函数，看看是否有数据需要发送，如果有，按 MSS 切段后同时发数据和 ACK
+            // 新确认的数据可能让 Nagle 攒着的小段可以发出了
+            tcp_send_segments(connect, tcp_flags_ack, 0);
+            // 没有数据可以捎带 ACK 时，攒够段数就单独确认，否则交给 tcp_poll 的定时器
+            tcp_ack_check(connect);
         }
         // 16.5 没有收到数据，可能对方只发一个 ACK，可以不响应
         break;
 
     case TCP_CLOSE_WAIT:
-        panic("switch TCP_CLOSE_WAIT", __LINE__);
+        // 对端已经关闭，只处理 ACK：去掉被确认的数据，通知应用层可以继续写，并发送剩余的数据
+        if (flags.ack && tcp_ack_in(connect, ack_number, window_size) > 0)
+        {
+            LATENCY_MARK(HANDLER);
+            (*handler)(connect, TCP_CONN_WRITABLE);
+        }
+        if (connect->state == TCP_CLOSE_WAIT) // 应用层可能在回调中关闭了连接
+        {
+            tcp_send_segments(connect, tcp_flags_ack, 0);
+        }
         break;
 
     case TCP_FIN_WAIT_1:
         // 17
-        // 17.1 如果收到 FIN && ACK，则 close_tcp 直接关闭 TCP
-        if (flags.fin && flags.ack)
+        // 17.0 FIN 之前的数据可能还没发完，处理 ACK 后继续发送，发完再发 FIN
+        if (flags.ack)
         {
-            goto close_tcp;
+            tcp_ack_in(connect, ack_number, window_size);
+            tcp_send_segments(connect, tcp_flags_ack, 1);
+            tcp_send_fin(connect);
         }
 
-        // 17.2 如果只收到 ACK，则将状态转为 TCP_FIN_WAIT_2
-        if (flags.ack)
+        // 17.1 如果收到 FIN && ACK（确认了我们的 FIN），则 ACK 对方的 FIN 并进入 TIME_WAIT
+        if (flags.fin && flags.ack && !connect->fin_pending && ack_number == connect->next_seq)
+        {
+            connect->ack++;
+            buf_init(&net_stack()->txbuf, 0);
+            tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+            goto time_wait;
+        }
+
+        // 17.2 如果只收到 FIN，双方同时关闭，ACK 后进入 TCP_CLOSING 等待对方确认我们的 FIN
+        if (flags.fin && !connect->fin_pending)
+        {
+            connect->ack++;
+            buf_init(&net_stack()->txbuf, 0);
+            tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+            connect->state = TCP_CLOSING;
+            break;
+        }
+
+        // 17.3 如果只收到 ACK，则将状态转为 TCP_FIN_WAIT_2
+        if (flags.ack && !connect->fin_pending && ack_number == connect->next_seq)
         {
             connect->state = TCP_FIN_WAIT_2;
         }
@@ -530,18 +1898,31 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
         if (flags.fin) // 如果是，则：
         {
             connect->ack++;                           // 将 ACK + 1
-            buf_init(&txbuf, 0);                      // 调用 buf_init 初始化 txbuf
-            tcp_send(&txbuf, connect, tcp_flags_ack); // 调用 tcp_send 发送一个 ACK 数据包
-            goto close_tcp;                           // 再 close_tcp 关闭 TCP
+            buf_init(&net_stack()->txbuf, 0);                      // 调用 buf_init 初始化 net_stack()->txbuf
+            tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack); // 调用 tcp_send 发送一个 ACK 数据包
+            goto time_wait;                           // 再进入 TIME_WAIT，释放连接的缓存
+        }
+        break;
+
+    case TCP_CLOSING:
+        // 对方确认了我们的 FIN，进入 TIME_WAIT
+        if (flags.ack && ack_number == connect->next_seq)
+        {
+            goto time_wait;
         }
         break;
 
     case TCP_LAST_ACK:
         // 19 如果不是 ACK，则不做处理
-        if (flags.ack) // 如果是，则：
+        if (flags.ack) // 如果是，则继续发送 FIN 之前剩余的数据，FIN 被确认后 close_tcp 关闭 TCP
         {
-            (*handler)(connect, TCP_CONN_CLOSED); // 调用 handler 函数，进入 TCP_CONN_CLOSED 状态
-            goto close_tcp;                       // 再 close_tcp 关闭 TCP
+            tcp_ack_in(connect, ack_number, window_size);
+            tcp_send_segments(connect, tcp_flags_ack, 1);
+            tcp_send_fin(connect);
+            if (!connect->fin_pending && ack_number == connect->next_seq)
+            {
+                goto close_tcp;
+            }
         }
         break;
 
@@ -551,14 +1932,71 @@ void tcp_in(buf_t *buf, uint8_t *src_ip)
     }
     return;
 
+time_wait:
+    if (handler)
+    {
+        LATENCY_MARK(HANDLER);
+        (*handler)(connect, TCP_CONN_CLOSED);
+    }
+    tcp_timewait_enter(connect, &tcp_key);
+    return;
+
 reset_tcp:
-    printf("!!! reset tcp !!!\n");
+    TRACE(TCP_RESET, dest_port, src_port, get_seq);
     connect->next_seq = 0;
     connect->ack = get_seq + 1;
-    buf_init(&txbuf, 0);
-    tcp_send(&txbuf, connect, tcp_flags_ack_rst);
+    buf_init(&net_stack()->txbuf, 0);
+    tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack_rst);
 close_tcp:
+    if (handler && connect->state >= TCP_ESTABLISHED) // 已建立的连接被关闭或复位，通知应用层
+    {
+        LATENCY_MARK(HANDLER);
+        (*handler)(connect, TCP_CONN_CLOSED);
+    }
     release_tcp_connect(connect);
-    map_delete(&connect_table, &tcp_key);
+    map_delete(&tcp->connect_table, &tcp_key);
     return;
 }
+
+static _Thread_local uint64_t poll_now;
+
+/**
+ * @brief tcp_poll 使用这个函数检查每个连接的定时器，使用 thread-local 变量 poll_now 传递当前时间。
+ *
+ * @param key, value, timestamp
+ */
+static void tcp_timer_fn(void *key, void *value, time_t *timestamp)
+{
+    tcp_layer_t *tcp = tcp_layer();
+    tcp_connect_t *connect = value;
+    if (connect->state == TCP_SYN_RCVD && poll_now >= connect->syn_deadline) // 握手超时，删除半连接
+    {
+        tcp->tcp_counter.syn_rcvd_timeout++;
+        release_tcp_connect(connect);
+        map_delete(&tcp->connect_table, key);
+        return;
+    }
+    if (connect->state != TCP_LISTEN && connect->ack_pending && poll_now >= connect->ack_deadline)
+    {
+        buf_init(&net_stack()->txbuf, 0);
+        tcp_send(&net_stack()->txbuf, connect, tcp_flags_ack);
+    }
+}
+
+/**
+ * @brief TCP 定时器轮询，发送到期的延迟 ACK，清理到期的 TIME_WAIT 记录
+ *
+ * 由 net_poll 调用，最多每 TCP_TIMER_TICK_MS 毫秒扫描一次连接表。
+ */
+void tcp_poll()
+{
+    tcp_layer_t *tcp = tcp_layer();
+    poll_now = time_ms();
+    if (poll_now - tcp->last_tick < TCP_TIMER_TICK_MS)
+    {
+        return;
+    }
+    tcp->last_tick = poll_now;
+    map_foreach(&tcp->connect_table, tcp_timer_fn);
+    tcp_timewait_poll();
+}
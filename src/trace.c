@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "trace.h"
+
+static trace_area_t *trace_area; // 为 NULL 时不记录
+static int trace_mapped;         // trace_area 映射在文件上
+
+static const char *const trace_formats[TRACE_MAX] = {
+#define TRACE_EVENT_FORMAT(name, level, fmt) fmt,
+    TRACE_EVENTS(TRACE_EVENT_FORMAT)
+#undef TRACE_EVENT_FORMAT
+};
+
+static uint64_t trace_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 建立跟踪区，之后各协议栈实例的 TRACE 才会记录
+ *
+ * @param path 跟踪文件，进程崩溃后可以用 trace_decode 工具解码；为 NULL 时只放在内存里。Windows 上总是只放在内存里
+ * @return int 成功为 0，失败为 -1
+ */
+int trace_init(const char *path)
+{
+    trace_area_t *area = NULL;
+    if (trace_area)
+        return 0;
+#ifndef _WIN32
+    if (path)
+    {
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return -1;
+        if (ftruncate(fd, sizeof(trace_area_t)) == 0)
+            area = mmap(NULL, sizeof(trace_area_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (area == MAP_FAILED || area == NULL)
+            return -1;
+        trace_mapped = 1;
+    }
+#endif
+    if (area == NULL && (area = calloc(1, sizeof(trace_area_t))) == NULL)
+        return -1;
+    area->rings = TRACE_RINGS;
+    area->ring_size = TRACE_RING_SIZE;
+    area->events = TRACE_MAX;
+    area->version = TRACE_VERSION;
+    area->start_sec = time(NULL);
+    area->start_ns = trace_now_ns();
+    area->magic = TRACE_MAGIC; // 最后写，解码工具看到 magic 时其他字段都已经填好
+    trace_area = area;
+    return 0;
+}
+
+/**
+ * @brief 释放跟踪区。调用时不能再有线程在记录
+ *
+ */
+void trace_close(void)
+{
+    if (trace_area == NULL)
+        return;
+#ifndef _WIN32
+    if (trace_mapped)
+        munmap(trace_area, sizeof(trace_area_t));
+    else
+#endif
+        free(trace_area);
+    trace_area = NULL;
+    trace_mapped = 0;
+}
+
+/**
+ * @brief 领一个没人用的环
+ *
+ * @return trace_ring_t* 环都被领完时为 NULL
+ */
+static trace_ring_t *trace_claim()
+{
+    uint32_t used = atomic_load(&trace_area->used);
+    while (1)
+    {
+        int i = 0;
+        while (i < TRACE_RINGS && (used >> i) & 1)
+            i++;
+        if (i == TRACE_RINGS)
+            return NULL;
+        if (atomic_compare_exchange_weak(&trace_area->used, &used, used | (1u << i)))
+            return &trace_area->ring[i];
+    }
+}
+
+/**
+ * @brief 归还协议栈实例的环，记录留在环里直到被下一个使用者覆盖。net_stack_destroy 时调用
+ *
+ * @param ring 环，可以为 NULL
+ */
+void trace_release(trace_ring_t *ring)
+{
+    if (ring == NULL || trace_area == NULL)
+        return;
+    atomic_fetch_and(&trace_area->used, ~(1u << (ring - trace_area->ring)));
+}
+
+/**
+ * @brief 在环的下一个位置写一条记录，写完再推进 head，读的一方看不到写了一半的记录
+ *
+ * @param slot 协议栈实例里的环指针，为 NULL 时先领一个
+ * @return trace_rec_t* 要填写的记录，没有跟踪区或没有空闲的环时为 NULL
+ */
+static inline trace_rec_t *trace_begin(trace_ring_t **slot, trace_event_t event)
+{
+    if (trace_area == NULL)
+        return NULL;
+    if (*slot == NULL && (*slot = trace_claim()) == NULL)
+        return NULL;
+    trace_ring_t *ring = *slot;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_rec_t *rec = &ring->rec[head & (TRACE_RING_SIZE - 1)];
+    rec->ts = trace_now_ns() - trace_area->start_ns;
+    rec->event = event;
+    rec->reserved = 0;
+    return rec;
+}
+
+static inline void trace_commit(trace_ring_t *ring)
+{
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + 1, memory_order_release);
+}
+
+/**
+ * @brief 记录一个事件，通过 TRACE 宏调用
+ *
+ * @param slot 协议栈实例里的环指针
+ * @param event 事件
+ * @param a0 参数，含义见事件的格式
+ */
+void trace_emit(trace_ring_t **slot, trace_event_t event, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+    trace_rec_t *rec = trace_begin(slot, event);
+    if (rec == NULL)
+        return;
+    rec->arg[0] = a0;
+    rec->arg[1] = a1;
+    rec->arg[2] = a2;
+    rec->arg[3] = a3;
+    rec->arg[4] = a4;
+    trace_commit(*slot);
+}
+
+/**
+ * @brief 记录一个带文本的事件，通过 TRACE_TEXT 宏调用
+ *
+ * @param slot 协议栈实例里的环指针
+ * @param event 事件
+ * @param a0 整数参数
+ * @param text 文本，不需要以 '\0' 结尾
+ * @param len 文本长度，超过 4 * (TRACE_ARGS - 1) 的部分截掉
+ */
+void trace_emit_text(trace_ring_t **slot, trace_event_t event, uint32_t a0, const char *text, size_t len)
+{
+    trace_rec_t *rec = trace_begin(slot, event);
+    if (rec == NULL)
+        return;
+    rec->arg[0] = a0;
+    memset(&rec->arg[1], 0, sizeof(uint32_t) * (TRACE_ARGS - 1));
+    memcpy(&rec->arg[1], text, len < sizeof(uint32_t) * (TRACE_ARGS - 1) ? len : sizeof(uint32_t) * (TRACE_ARGS - 1));
+    trace_commit(*slot);
+}
+
+/**
+ * @brief 按事件的格式把一条记录格式化成一行文本（不含时间戳和换行）
+ *
+ * @param rec 记录
+ * @param buf 输出缓冲区，结果以 '\0' 结尾
+ * @param size 缓冲区大小
+ * @return int 成功为 0，不认识的事件为 -1（仍然输出事件号和参数）
+ */
+int trace_format(const trace_rec_t *rec, char *buf, size_t size)
+{
+    if (size == 0)
+        return -1;
+    if (rec->event >= TRACE_MAX)
+    {
+        snprintf(buf, size, "event %u: %u %u %u %u %u", rec->event,
+                 rec->arg[0], rec->arg[1], rec->arg[2], rec->arg[3], rec->arg[4]);
+        return -1;
+    }
+    size_t len = 0;
+    int next = 0;
+    for (const char *p = trace_formats[rec->event]; *p && len + 1 < size; p++)
+    {
+        if (p[0] != '%' || (p[1] != 'u' && p[1] != 'x' && p[1] != 's'))
+        {
+            buf[len++] = *p;
+            continue;
+        }
+        int n = 0;
+        p++;
+        if (*p == 's') // 剩下的参数都是文本
+        {
+            const char *text = (const char *)&rec->arg[next];
+            size_t max = sizeof(uint32_t) * (TRACE_ARGS - next);
+            size_t text_len = 0;
+            while (text_len < max && text[text_len])
+                text_len++;
+            n = snprintf(buf + len, size - len, "%.*s", (int)text_len, text);
+            next = TRACE_ARGS;
+        }
+        else if (next < TRACE_ARGS)
+            n = snprintf(buf + len, size - len, *p == 'u' ? "%u" : "%x", rec->arg[next++]);
+        len += n < 0 ? 0 : (size_t)n < size - len ? (size_t)n : size - len - 1;
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+static int trace_cmp_ts(const void *a, const void *b)
+{
+    uint64_t x = ((const trace_rec_t *)a)->ts, y = ((const trace_rec_t *)b)->ts;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 读出所有环里的记录，按时间排序后逐行格式化输出
+ *
+ * 可以在协议栈运行时调用：先读 head，拷出记录，再读一次 head，期间可能被覆盖的记录丢掉。
+ *
+ * @param area 跟踪区，为 NULL 时读本进程的跟踪区
+ * @param size 跟踪区的大小，area 为 NULL 时不用
+ * @param out 输出
+ * @return size_t 输出的记录数，跟踪区无效时为 0
+ */
+size_t trace_decode(const trace_area_t *area, size_t size, FILE *out)
+{
+    if (area == NULL)
+    {
+        area = trace_area;
+        size = sizeof(trace_area_t);
+    }
+    if (area == NULL || size < sizeof(trace_area_t) || area->magic != TRACE_MAGIC || area->version != TRACE_VERSION ||
+        area->rings != TRACE_RINGS || area->ring_size != TRACE_RING_SIZE)
+        return 0;
+    if (area->events > TRACE_MAX)
+        fprintf(out, "# trace has %u event types, this decoder knows %d\n", area->events, TRACE_MAX);
+
+    trace_rec_t *recs = malloc(sizeof(trace_rec_t) * TRACE_RINGS * TRACE_RING_SIZE);
+    if (recs == NULL)
+        return 0;
+    size_t count = 0;
+    for (int i = 0; i < TRACE_RINGS; i++)
+    {
+        const trace_ring_t *ring = &area->ring[i];
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        size_t start = count;
+        for (uint64_t j = first; j < head; j++)
+            recs[count++] = ring->rec[j & (TRACE_RING_SIZE - 1)];
+        uint64_t now = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (now - first > TRACE_RING_SIZE) // 读的时候写的一方绕过来覆盖了最前面的记录
+        {
+            size_t lost = now - first - TRACE_RING_SIZE;
+            lost = lost < count - start ? lost : count - start;
+            memmove(&recs[start], &recs[start + lost], (count - start - lost) * sizeof(trace_rec_t));
+            count -= lost;
+        }
+    }
+    qsort(recs, count, sizeof(trace_rec_t), trace_cmp_ts);
+
+    time_t start = area->start_sec;
+    fprintf(out, "# trace started %s", ctime(&start));
+    char line[256];
+    for (size_t i = 0; i < count; i++)
+    {
+        trace_format(&recs[i], line, sizeof(line));
+        fprintf(out, "%12.6f %s\n", recs[i].ts / 1e9, line);
+    }
+    free(recs);
+    return count;
+}
+
+/**
+ * @brief 只读地映射一个跟踪文件，交给 trace_decode
+ *
+ * @param path 跟踪文件
+ * @param size 出口参数，文件大小
+ * @return const trace_area_t* 失败为 NULL，Windows 上总是 NULL
+ */
+const trace_area_t *trace_map_file(const char *path, size_t *size)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *area = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        area = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (area == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+    return area;
+#else
+    return NULL;
+#endif
+}
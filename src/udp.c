@@ -2,11 +2,11 @@
 #include "ip.h"
 #include "icmp.h"
 
-/**
- * @brief udp 处理程序表
- *
- */
-map_t udp_table;
+typedef struct udp_entry // udp_table 的值，两种处理程序只有一个不为 NULL
+{
+    udp_handler_t handler;
+    udp_port_handler_t port_handler;
+} udp_entry_t;
 
 /**
  * @brief udp 伪校验和计算
@@ -53,9 +53,11 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
     // Step1
     // 首先做包检查，检测该数据报的长度是否小于 UDP 首部长度，
     // 或者接收到的包长度小于 UDP 首部长度字段给出的长度，如果是，则丢弃不处理。
+    LATENCY_MARK(UDP_IN);
     udp_hdr_t *hdr = (udp_hdr_t *)buf->data;
     if (buf->len < sizeof(udp_hdr_t) || buf->len < swap16(hdr->total_len16))
     {
+        STATS_INC(UDP_IN_ERRORS);
         return;
     }
 
@@ -65,9 +67,10 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
     // 如果该值与接收到的 UDP 数据报的校验和不一致，则丢弃不处理。
     uint16_t tmp_checksum16 = hdr->checksum16;
     hdr->checksum16 = 0;
-    uint16_t re_checksum16 = udp_checksum(buf, src_ip, net_if_ip);
+    uint16_t re_checksum16 = udp_checksum(buf, src_ip, net_stack()->if_ip);
     if (tmp_checksum16 != re_checksum16)
     {
+        STATS_INC(UDP_IN_CSUM_ERRORS);
         return;
     }
     hdr->checksum16 = tmp_checksum16;
@@ -76,12 +79,13 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
     // 调用 map_get() 函数查询 udp_table 是否有该目的端口号对应的处理函数（回调函数）。
     uint16_t src_port16 = swap16(hdr->src_port16); // 函数返回值不可取地址
     uint16_t dst_port16 = swap16(hdr->dst_port16);
-    udp_handler_t *handler = (udp_handler_t *)map_get(&udp_table, (void *)&dst_port16);
+    udp_entry_t *entry = map_get(&net_stack()->udp_table, (void *)&dst_port16);
 
     // Step4
     // 如果没有找到，则调用 buf_add_header() 函数增加 IPv4 数据报头部，再调用 icmp_unreachable() 函数发送一个端口不可达的 ICMP 差错报文。
-    if (handler == NULL)
+    if (entry == NULL)
     {
+        STATS_INC(UDP_NO_PORTS);
         buf_add_header(buf, sizeof(ip_hdr_t));
         icmp_unreachable(buf, src_ip, ICMP_CODE_PROTOCOL_UNREACH);
         return;
@@ -90,7 +94,12 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
     // Step5
     // 如果能找到，则去掉 UDP 报头，调用处理函数来做相应处理。
     buf_remove_header(buf, sizeof(udp_hdr_t));
-    (*handler)(buf->data, buf->len, src_ip, src_port16);
+    STATS_INC(UDP_IN_DATAGRAMS);
+    LATENCY_MARK(HANDLER);
+    if (entry->port_handler)
+        entry->port_handler(dst_port16, buf->data, buf->len, src_ip, src_port16);
+    else
+        entry->handler(buf->data, buf->len, src_ip, src_port16);
 }
 
 /**
@@ -119,10 +128,11 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
     // Step3
     // 先将校验和字段填充 0，然后调用 udp_checksum() 函数计算出校验和，再将计算出来的校验和结果填入校验和字段。
     hdr->checksum16 = 0;
-    hdr->checksum16 = udp_checksum(buf, net_if_ip, dst_ip);
+    hdr->checksum16 = udp_checksum(buf, net_stack()->if_ip, dst_ip);
 
     // Step4
     // 调用 ip_out() 函数发送 UDP 数据报。
+    STATS_INC(UDP_OUT_DATAGRAMS);
     ip_out(buf, dst_ip, NET_PROTOCOL_UDP);
 }
 
@@ -132,7 +142,7 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
  */
 void udp_init()
 {
-    map_init(&udp_table, sizeof(uint16_t), sizeof(udp_handler_t), 0, 0, NULL);
+    map_init(&net_stack()->udp_table, sizeof(uint16_t), sizeof(udp_entry_t), 0, 0, NULL);
     net_add_protocol(NET_PROTOCOL_UDP, udp_in);
 }
 
@@ -145,7 +155,21 @@ void udp_init()
  */
 int udp_open(uint16_t port, udp_handler_t handler)
 {
-    return map_set(&udp_table, &port, &handler);
+    udp_entry_t entry = {.handler = handler};
+    return map_set(&net_stack()->udp_table, &port, &entry);
+}
+
+/**
+ * @brief 打开一个 udp 端口并注册处理程序，处理程序会收到本地端口号
+ *
+ * @param port 端口号
+ * @param handler 处理程序
+ * @return int 成功为 0，失败为 -1
+ */
+int udp_open_port(uint16_t port, udp_port_handler_t handler)
+{
+    udp_entry_t entry = {.port_handler = handler};
+    return map_set(&net_stack()->udp_table, &port, &entry);
 }
 
 /**
@@ -155,7 +179,7 @@ int udp_open(uint16_t port, udp_handler_t handler)
  */
 void udp_close(uint16_t port)
 {
-    map_delete(&udp_table, &port);
+    map_delete(&net_stack()->udp_table, &port);
 }
 
 /**
@@ -169,7 +193,7 @@ void udp_close(uint16_t port)
  */
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
 {
-    buf_init(&txbuf, len);
-    memcpy(txbuf.data, data, len);
-    udp_out(&txbuf, src_port, dst_ip, dst_port);
+    buf_init(&net_stack()->txbuf, len);
+    memcpy(net_stack()->txbuf.data, data, len);
+    udp_out(&net_stack()->txbuf, src_port, dst_ip, dst_port);
 }
\ No newline at end of file
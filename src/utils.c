@@ -1,5 +1,6 @@
 #include "utils.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 /**
  * @brief ip 转字符串串
@@ -9,7 +10,7 @@
  */
 char *iptos(uint8_t *ip)
 {
-    static char output[3 * 4 + 3 + 1];
+    static _Thread_local char output[3 * 4 + 3 + 1];
     sprintf(output, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
     return output;
 }
@@ -22,7 +23,7 @@ char *iptos(uint8_t *ip)
  */
 char *mactos(uint8_t *mac)
 {
-    static char output[2 * 6 + 5 + 1];
+    static _Thread_local char output[2 * 6 + 5 + 1];
     sprintf(output, "%02X-%02X-%02X-%02X-%02X-%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
     return output;
 }
@@ -35,15 +36,50 @@ char *mactos(uint8_t *mac)
  */
 char *timetos(time_t timestamp)
 {
-    static char output[20];
-    struct tm *utc_time = gmtime(&timestamp);
+    static _Thread_local char output[20];
+    struct tm utc_time; // gmtime 的结果是全进程共享的，各线程用自己的
+#ifdef _WIN32
+    gmtime_s(&utc_time, &timestamp);
+#else
+    gmtime_r(&timestamp, &utc_time);
+#endif
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wformat-overflow"
-    sprintf(output, "%04d-%02d-%02d %02d:%02d:%02d", utc_time->tm_year + 1900, utc_time->tm_mon + 1, utc_time->tm_mday, utc_time->tm_hour, utc_time->tm_min, utc_time->tm_sec);
+    sprintf(output, "%04d-%02d-%02d %02d:%02d:%02d", utc_time.tm_year + 1900, utc_time.tm_mon + 1, utc_time.tm_mday, utc_time.tm_hour, utc_time.tm_min, utc_time.tm_sec);
     return output;
 #pragma GCC diagnostic pop
 }
 
+/**
+ * @brief 在 buf 的 *len 处追加格式化的内容，放不下时只记长度，供各种 dump 函数拼接输出
+ *
+ * @param buf 输出缓冲区
+ * @param size 缓冲区大小
+ * @param len 已经输出的长度（含放不下的部分）
+ * @param fmt 格式
+ */
+void str_append(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(*len < size ? buf + *len : NULL, *len < size ? size - *len : 0, fmt, args);
+    va_end(args);
+    if (n > 0)
+        *len += n;
+}
+
+/**
+ * @brief 单调时钟的当前毫秒数，供协议栈内的定时器使用
+ *
+ * @return uint64_t 毫秒数，只有差值有意义
+ */
+uint64_t time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /**
  * @brief ip 前缀匹配
  *
@@ -103,4 +139,81 @@ uint16_t checksum16(uint16_t *data, size_t len)
     // 将上述的和（低 16 位）取反，即得到校验和。
     checksum16 = ~(uint16_t)res32;
     return checksum16;
+}
+
+/**
+ * @brief 累加一段数据的 16 位反码和，不取反，可分段多次调用
+ *
+ * 除最后一段外，每段的长度都应为偶数，否则后续数据的字节序会错位。
+ *
+ * @param sum 之前各段累加的结果，第一段传 0
+ * @param data 要累加的数据
+ * @param len 数据长度（字节）
+ * @return uint32_t 累加结果，交给 checksum_fold 得到校验和
+ */
+uint32_t checksum_add(uint32_t sum, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t res64 = sum; // 64 位累加，避免长数据溢出
+    uint16_t word;
+    while (len >= 2)
+    {
+        memcpy(&word, p, sizeof(word)); // 数据不一定按 2 字节对齐
+        res64 += word;
+        p += 2;
+        len -= 2;
+    }
+    if (len) // 最后剩下的 8 bit 按后面补一个 0 字节处理
+    {
+        word = 0;
+        memcpy(&word, p, 1);
+        res64 += word;
+    }
+    while (res64 >> 32)
+    {
+        res64 = (res64 >> 32) + (res64 & 0xFFFFFFFF);
+    }
+    return (uint32_t)res64;
+}
+
+/**
+ * @brief 累加位于整段数据 offset 处的一小段数据，offset 可以是奇数
+ *
+ * 用于数据分散在多块内存中（如环形缓冲区跨越末尾）时逐块累加。
+ * 奇数偏移处开始的数据，其 16 位字的高低字节与整段对齐时相反，需要交换后再累加。
+ *
+ * @param sum 之前各段累加的结果
+ * @param offset 这段数据在整段数据中的偏移
+ * @param data 要累加的数据
+ * @param len 数据长度（字节）
+ * @return uint32_t 累加结果
+ */
+uint32_t checksum_add_at(uint32_t sum, size_t offset, const void *data, size_t len)
+{
+    uint32_t part = checksum_add(0, data, len);
+    if (offset & 1)
+    {
+        while (part >> 16)
+        {
+            part = (part >> 16) + (part & 0xFFFF);
+        }
+        part = swap16(part);
+    }
+    uint64_t res64 = (uint64_t)sum + part;
+    return (uint32_t)((res64 >> 32) + (res64 & 0xFFFFFFFF));
+}
+
+/**
+ * @brief 把 checksum_add 的累加结果折叠为 16 位并取反，得到校验和
+ *
+ * @param sum 累加结果
+ * @return uint16_t 校验和
+ */
+uint16_t checksum_fold(uint32_t sum)
+{
+    while (sum >> 16)
+    {
+        sum = (sum >> 16) + (sum & 0xFFFF);
+    }
+    return ~(uint16_t)sum;
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+#include "utils.h"
+
+/**
+ * @brief 一个 TCP 段的长度：首部、SYN 的 MSS 选项和负载
+ *
+ * @param flags 标志
+ * @param len 负载字节数
+ * @return size_t 段长度
+ */
+size_t bench_tcp_len(tcp_flags_t flags, size_t len)
+{
+        return sizeof(tcp_hdr_t) + (flags.syn ? TCP_OPT_MSS_LEN : 0) + len;
+}
+
+/**
+ * @brief 在 seg 处组一个从 src_ip:src_port 发往本机 dst_port 的 TCP 段
+ *
+ * SYN 带上 TCP_MAX_MSS 的 MSS 选项，窗口固定为 65535，校验和按发往 net_stack()->if_ip 的伪首部计算。
+ *
+ * @param seg 输出，至少 bench_tcp_len(flags, len) 字节
+ * @param data 负载，len 为 0 时可以为 NULL
+ * @return size_t 段长度
+ */
+size_t bench_tcp_seg(uint8_t *seg, const uint8_t *src_ip, uint16_t src_port, uint16_t dst_port,
+                     uint32_t seq, uint32_t ack, tcp_flags_t flags, const void *data, size_t len)
+{
+        tcp_hdr_t *hdr = (tcp_hdr_t *)seg;
+        size_t hdr_len = bench_tcp_len(flags, 0);
+        memset(hdr, 0, hdr_len);
+        hdr->src_port16 = swap16(src_port);
+        hdr->dst_port16 = swap16(dst_port);
+        hdr->seq_number32 = swap32(seq);
+        hdr->ack_number32 = swap32(ack);
+        hdr->data_offset = hdr_len / 4;
+        hdr->flags = flags;
+        hdr->window_size16 = swap16(65535);
+        if (flags.syn)
+        {
+                uint8_t *opt = seg + sizeof(tcp_hdr_t);
+                opt[0] = TCP_OPT_MSS;
+                opt[1] = TCP_OPT_MSS_LEN;
+                opt[2] = TCP_MAX_MSS >> 8;
+                opt[3] = TCP_MAX_MSS & 0xFF;
+        }
+        if (len)
+                memcpy(seg + hdr_len, data, len);
+
+        tcp_peso_hdr_t peso;
+        memcpy(peso.src_ip, src_ip, NET_IP_LEN);
+        memcpy(peso.dst_ip, net_stack()->if_ip, NET_IP_LEN);
+        peso.placeholder = 0;
+        peso.protocol = NET_PROTOCOL_TCP;
+        peso.total_len16 = swap16(hdr_len + len);
+        hdr->checksum16 = checksum_fold(checksum_add(checksum_add(0, &peso, sizeof(peso)), seg, hdr_len + len));
+        return hdr_len + len;
+}
+
+/**
+ * @brief 新连接开始前清空解析状态
+ *
+ * @param resp
+ */
+void bench_resp_reset(bench_resp_t *resp)
+{
+        resp->head_len = 0;
+        resp->body_left = 0;
+}
+
+/**
+ * @brief 从 *data 开始消费响应流，遇到报头收齐或响应收完时停下
+ *
+ * 报头逐字节攒到 "\r\n\r\n"，再按 Content-Length 跳过正文。返回 BENCH_RESP_HEAD 时 head、status、
+ * content_length 是这个报头的内容，直到下一次调用；没有正文的响应同时带 BENCH_RESP_DONE。
+ * *data 和 *len 前进到没有消费的部分，返回 0 时已经全部消费。
+ *
+ * @param resp
+ * @param data 输入输出，响应流
+ * @param len 输入输出，字节数
+ * @return int BENCH_RESP_HEAD 与 BENCH_RESP_DONE 的组合，报头超长时为 -1
+ */
+int bench_resp_feed(bench_resp_t *resp, const uint8_t **data, size_t *len)
+{
+        while (*len)
+        {
+                if (resp->body_left)
+                {
+                        size_t n = *len < resp->body_left ? *len : resp->body_left;
+                        resp->body_left -= n;
+                        *data += n;
+                        *len -= n;
+                        if (resp->body_left == 0)
+                                return BENCH_RESP_DONE;
+                        continue;
+                }
+                if (resp->head_len == sizeof(resp->head) - 1)
+                        return -1;
+                resp->head[resp->head_len++] = *(*data)++;
+                (*len)--;
+                resp->head[resp->head_len] = '\0';
+                if (resp->head_len < 4 || strcmp(resp->head + resp->head_len - 4, "\r\n\r\n"))
+                        continue;
+                char *cl = strstr(resp->head, "Content-Length: ");
+                if (sscanf(resp->head, "HTTP/1.%*d %d", &resp->status) != 1)
+                        resp->status = 0;
+                resp->content_length = cl ? (int64_t)strtoull(cl + 16, NULL, 10) : -1;
+                resp->body_left = cl ? resp->content_length : 0;
+                resp->head_len = 0;
+                return resp->body_left ? BENCH_RESP_HEAD : BENCH_RESP_HEAD | BENCH_RESP_DONE;
+        }
+        return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tcp.h"
+
+/*
+ * 基准和测试程序共用的客户端工具：
+ * 组发往本机协议栈的 TCP 段，以及逐段解析 HTTP 响应流。
+ */
+
+#define BENCH_RESP_HEAD 1 // 收齐了一个报头
+#define BENCH_RESP_DONE 2 // 收完了一个响应（报头和正文）
+
+typedef struct bench_resp // 一个连接上响应流的解析状态
+{
+        char head[1024];        // 当前响应已经收到的报头，以 '\0' 结尾
+        size_t head_len;
+        size_t body_left;       // 当前响应还没收到的正文字节数
+        int status;             // 最近一个报头的状态码，解析不出时为 0
+        int64_t content_length; // 最近一个报头的 Content-Length，没有时为 -1
+} bench_resp_t;
+
+size_t bench_tcp_len(tcp_flags_t flags, size_t len);
+size_t bench_tcp_seg(uint8_t *seg, const uint8_t *src_ip, uint16_t src_port, uint16_t dst_port,
+                     uint32_t seq, uint32_t ack, tcp_flags_t flags, const void *data, size_t len);
+void bench_resp_reset(bench_resp_t *resp);
+int bench_resp_feed(bench_resp_t *resp, const uint8_t **data, size_t *len);
+
+#endif
@@ -0,0 +1,1022 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <pcap.h>
+#include "net.h"
+#include "ethernet.h"
+#include "arp.h"
+#include "ip.h"
+#include "tcp.h"
+#include "http.h"
+#include "utils.h"
+#include "driver.h"
+#include "loopback.h"
+#include "shard.h"
+#include "sock.h"
+#include "coro.h"
+#include "bench.h"
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * HTTP 吞吐量基准：整个协议栈（ethernet/arp/ip/tcp/http）跑在进程内的回环驱动上，
+ * 模拟成千上万个 TCP 客户端流。每个流建立连接后在持久连接上依次发出若干个请求，
+ * 一个响应收完再发下一个，记录每个请求从发出到响应最后一个字节到达的时间。
+ *
+ * 请求内容取自 testing/data/http.pcap 中浏览器发出的 GET 请求，打不开时使用内置的请求。
+ *
+ * 分片数为 0 时协议栈和客户端在同一个线程里交替运行；大于 0 时协议栈以分片模式运行在这么多个工作线程上，
+ * 本线程是分发线程兼客户端。分片数写成 1-8 这样的范围时依次运行每个分片数，最后打印吞吐量随分片数的变化。
+ *
+ * 应用线程数大于 0 时（分片数必须为 0）协议栈仍在本线程运行，但不启动 HTTP 服务器，而是由这么多个应用线程
+ * 通过 sock.h 的消息式套接字接口异步地 accept、收请求、回一个固定的响应，测的是跨线程提交命令、收割完成的开销。
+ * 请求直接收进应用线程投递的缓冲区，响应放在登记的缓冲区里用 SEND_FIXED 发送，协议栈里不拷贝。
+ *
+ * 应用线程数写成 coro 时协议栈在本线程运行，每个连接由 coro.h 的一个协程处理，
+ * 用顺序的 coro_read / coro_write 收请求、回同样的固定响应，测的是协程切换的开销。
+ *
+ * 用法：http_flood [流数] [并发流数] [每个流的请求数] [pcap 文件] [分片数或范围] [应用线程数或 coro]
+ * 需要在 testing 目录下运行，服务器从 ../htmldocs 读取页面。
+ */
+
+#define SERVER_PORT 80
+#define CLIENT_HOSTS 16      // 客户端分布在这么多个 IP / MAC 上
+#define MAX_TEMPLATES 16     // 最多从 pcap 中取出的请求数
+#define REQUEST_MAX 2048     // 单个请求的最大长度
+#define CLIENT_PORT_MIN 10000
+#define CLIENT_PORT_MAX 60000
+#define POLL_BATCH 32        // 每调用一次 http_server_run 或 coro_run 之前收的帧数
+#define STALL_TIMEOUT_US 10000000 // 分片模式下这么久没有任何进展就认为卡住了
+#define APP_MAX 8            // 最多的应用线程数
+#define APP_CONNS 320        // 每个应用线程同时处理的连接数，每个连接最多 3 个命令在途，加上 ACCEPT 不超过 SOCK_CQ_DEPTH
+#define APP_ACCEPTS 64       // 每个应用线程在途的 ACCEPT 数，太少时一轮的 SYN 会撑满 accept 队列
+#define APP_REAP_BATCH 32    // 应用线程一次收割的完成数
+#define APP_BODY_LEN 1024    // 应用线程回的响应正文长度
+#define APP_FD_PENDING -100  // 监听套接字还没有打开
+
+typedef enum flow_state
+{
+        FLOW_IDLE,     // 空闲，等待开始下一个流
+        FLOW_SYN_SENT, // 等待 SYN + ACK
+        FLOW_OPEN,     // 发请求、收响应
+        FLOW_FIN_SENT, // 已经发出 FIN，等待服务器的 FIN
+} flow_state_t;
+
+typedef struct flow
+{
+        flow_state_t state;
+        uint8_t host;
+        uint16_t port;
+        uint32_t snd_nxt, rcv_nxt;
+        uint8_t need_ack, fin_rcvd;
+        uint8_t fin_sent;   // FIN 已经和最后一个请求一起发出
+        size_t requests;    // 这个流已经收完的响应数
+        size_t template;    // 下一个请求使用的模板
+        uint64_t sent_at;   // 当前请求发出的时间（微秒）
+        bench_resp_t resp;  // 响应流的解析状态
+} flow_t;
+
+static const uint8_t server_mac[NET_MAC_LEN] = NET_IF_MAC;
+static char templates[MAX_TEMPLATES][REQUEST_MAX];
+static size_t template_len[MAX_TEMPLATES], num_templates;
+
+static flow_t *flows;
+static int32_t port_owner[65536]; // 客户端端口 -> 流下标，-1 为空闲
+static uint16_t next_port = CLIENT_PORT_MIN;
+static size_t *ack_list, ack_count; // 这一轮需要回 ACK 的流
+static size_t flows_total, flows_started, flows_done, reqs_per_flow;
+static size_t requests_done, bad_responses, resets, status_2xx, status_other;
+static uint32_t *latency; // 每个请求的延迟（微秒）
+static tcp_stat_t shard_tcp[SHARD_MAX]; // 分片退出前取出的计数
+static http_stat_t shard_http[SHARD_MAX];
+static uint8_t frame[ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t)];
+
+static uint64_t now_us()
+{
+#ifdef _WIN32
+        LARGE_INTEGER freq, count;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&count);
+        return count.QuadPart * 1000000 / freq.QuadPart;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void host_ip(uint8_t host, uint8_t ip[NET_IP_LEN])
+{
+        ip[0] = 10;
+        ip[1] = 0;
+        ip[2] = 0;
+        ip[3] = host + 1;
+}
+
+static void host_mac(uint8_t host, uint8_t mac[NET_MAC_LEN])
+{
+        static const uint8_t base[NET_MAC_LEN] = {0x02, 0, 0, 0, 0, 0};
+        memcpy(mac, base, NET_MAC_LEN);
+        mac[5] = host + 1;
+}
+
+/* 组一个以太网帧交给协议栈，不足最小帧长时像真实网卡一样补零 */
+static void inject_eth(uint8_t host, uint16_t protocol, size_t len)
+{
+        ether_hdr_t *eth = (ether_hdr_t *)frame;
+        memcpy(eth->dst, protocol == NET_PROTOCOL_ARP ? ether_broadcast_mac : server_mac, NET_MAC_LEN);
+        host_mac(host, eth->src);
+        eth->protocol16 = swap16(protocol);
+        len += sizeof(ether_hdr_t);
+        if (len < sizeof(ether_hdr_t) + ETHERNET_MIN_TRANSPORT_UNIT)
+        {
+                memset(frame + len, 0, sizeof(ether_hdr_t) + ETHERNET_MIN_TRANSPORT_UNIT - len);
+                len = sizeof(ether_hdr_t) + ETHERNET_MIN_TRANSPORT_UNIT;
+        }
+        loopback_inject(frame, len);
+}
+
+/* 客户端主机上线时发一个 ARP 请求，协议栈顺带学到它的 MAC */
+static void client_arp(uint8_t host)
+{
+        arp_pkt_t *pkt = (arp_pkt_t *)(frame + sizeof(ether_hdr_t));
+        memset(pkt, 0, sizeof(arp_pkt_t));
+        pkt->hw_type16 = swap16(ARP_HW_ETHER);
+        pkt->pro_type16 = swap16(NET_PROTOCOL_IP);
+        pkt->hw_len = NET_MAC_LEN;
+        pkt->pro_len = NET_IP_LEN;
+        pkt->opcode16 = swap16(ARP_REQUEST);
+        host_mac(host, pkt->sender_mac);
+        host_ip(host, pkt->sender_ip);
+        memcpy(pkt->target_ip, net_stack()->if_ip, NET_IP_LEN);
+        inject_eth(host, NET_PROTOCOL_ARP, sizeof(arp_pkt_t));
+}
+
+static void flow_send(flow_t *f, tcp_flags_t flags, const char *data, size_t len)
+{
+        ip_hdr_t *ip = (ip_hdr_t *)(frame + sizeof(ether_hdr_t));
+        uint8_t src_ip[NET_IP_LEN];
+        host_ip(f->host, src_ip);
+        size_t seg_len = bench_tcp_seg((uint8_t *)(ip + 1), src_ip, f->port, SERVER_PORT, f->snd_nxt,
+                                       flags.ack ? f->rcv_nxt : 0, flags, data, len);
+
+        memset(ip, 0, sizeof(ip_hdr_t));
+        ip->hdr_len = sizeof(ip_hdr_t) / IP_HDR_LEN_PER_BYTE;
+        ip->version = IP_VERSION_4;
+        ip->total_len16 = swap16(sizeof(ip_hdr_t) + seg_len);
+        ip->ttl = IP_DEFALUT_TTL;
+        ip->protocol = NET_PROTOCOL_TCP;
+        memcpy(ip->src_ip, src_ip, NET_IP_LEN);
+        memcpy(ip->dst_ip, net_stack()->if_ip, NET_IP_LEN);
+        ip->hdr_checksum16 = checksum16((uint16_t *)ip, sizeof(ip_hdr_t));
+
+        f->snd_nxt += len + flags.syn + flags.fin;
+        f->need_ack = 0;
+        inject_eth(f->host, NET_PROTOCOL_IP, sizeof(ip_hdr_t) + seg_len);
+}
+
+static void flow_start(size_t idx)
+{
+        static const tcp_flags_t syn = {.syn = 1};
+        flow_t *f = &flows[idx];
+        while (port_owner[next_port] != -1) // 跳过还在使用的端口
+                next_port = next_port + 1 < CLIENT_PORT_MAX ? next_port + 1 : CLIENT_PORT_MIN;
+        f->port = next_port;
+        next_port = next_port + 1 < CLIENT_PORT_MAX ? next_port + 1 : CLIENT_PORT_MIN;
+        port_owner[f->port] = idx;
+        f->host = flows_started % CLIENT_HOSTS;
+        f->snd_nxt = (uint32_t)rand() << 8;
+        f->state = FLOW_SYN_SENT;
+        f->fin_rcvd = f->need_ack = f->fin_sent = 0;
+        f->requests = 0;
+        f->template = flows_started % num_templates;
+        bench_resp_reset(&f->resp);
+        flows_started++;
+        flow_send(f, syn, NULL, 0);
+}
+
+static void flow_finish(flow_t *f)
+{
+        port_owner[f->port] = -1;
+        f->state = FLOW_IDLE;
+        flows_done++;
+}
+
+/* 奇数端口的流把 FIN 和最后一个请求放在同一个段里发出，服务器要在半关闭的连接上回完响应再关闭 */
+static void flow_send_request(flow_t *f)
+{
+        static const tcp_flags_t psh = {.ack = 1, .psh = 1}, psh_fin = {.ack = 1, .psh = 1, .fin = 1};
+        f->sent_at = now_us();
+        f->fin_sent = (f->port & 1) && f->requests + 1 == reqs_per_flow;
+        flow_send(f, f->fin_sent ? psh_fin : psh, templates[f->template], template_len[f->template]);
+        f->template = (f->template + 1) % num_templates;
+}
+
+/* 一个响应收完：记下延迟，接着发下一个请求，或者发 FIN 结束这个流 */
+static void flow_response_done(flow_t *f)
+{
+        static const tcp_flags_t fin = {.ack = 1, .fin = 1};
+        latency[requests_done++] = now_us() - f->sent_at;
+        if (++f->requests < reqs_per_flow)
+        {
+                flow_send_request(f);
+        }
+        else
+        {
+                if (!f->fin_sent)
+                        flow_send(f, fin, NULL, 0);
+                f->state = FLOW_FIN_SENT;
+        }
+}
+
+/* 解析响应流：收齐报头时按状态码计数，收完一个响应就接着发下一个请求 */
+static void flow_recv_data(flow_t *f, const uint8_t *data, size_t len)
+{
+        while (len && f->state == FLOW_OPEN)
+        {
+                int ev = bench_resp_feed(&f->resp, &data, &len);
+                if (ev < 0)
+                {
+                        bad_responses++;
+                        return;
+                }
+                if (ev & BENCH_RESP_HEAD)
+                {
+                        int status = f->resp.status;
+                        if (status == 0 || (f->resp.content_length < 0 && status != 304))
+                                bad_responses++;
+                        if (status >= 200 && status < 300)
+                                status_2xx++;
+                        else
+                                status_other++;
+                }
+                if (ev & BENCH_RESP_DONE)
+                        flow_response_done(f);
+        }
+}
+
+/* 处理协议栈发出的一个帧 */
+static void client_recv(const uint8_t *data, size_t len, void *arg)
+{
+        static const tcp_flags_t ack = {.ack = 1};
+        const ether_hdr_t *eth = (const ether_hdr_t *)data;
+        if (len < sizeof(ether_hdr_t) + sizeof(ip_hdr_t) + sizeof(tcp_hdr_t) || swap16(eth->protocol16) != NET_PROTOCOL_IP)
+                return; // ARP 应答等
+        const ip_hdr_t *ip = (const ip_hdr_t *)(eth + 1);
+        if (ip->protocol != NET_PROTOCOL_TCP)
+                return;
+        const tcp_hdr_t *hdr = (const tcp_hdr_t *)(ip + 1);
+        size_t seg_len = swap16(ip->total_len16) - sizeof(ip_hdr_t) - hdr->data_offset * 4;
+        int32_t idx = port_owner[swap16(hdr->dst_port16)];
+        if (idx < 0)
+                return; // 已经结束的流
+        flow_t *f = &flows[idx];
+        uint32_t seq = swap32(hdr->seq_number32);
+        if (hdr->flags.rst)
+        {
+                resets++;
+                flow_finish(f);
+                return;
+        }
+        if (f->state == FLOW_SYN_SENT)
+        {
+                if (!hdr->flags.syn || !hdr->flags.ack)
+                        return;
+                f->rcv_nxt = seq + 1;
+                f->state = FLOW_OPEN;
+                flow_send(f, ack, NULL, 0);
+                flow_send_request(f);
+                return;
+        }
+        if (seq != f->rcv_nxt) // 回环上不会乱序，只可能是重复的段
+                return;
+        f->rcv_nxt += seg_len;
+        if (seg_len && !f->need_ack)
+        {
+                f->need_ack = 1;
+                ack_list[ack_count++] = idx;
+        }
+        flow_recv_data(f, (const uint8_t *)hdr + hdr->data_offset * 4, seg_len);
+        if (hdr->flags.fin)
+        {
+                f->rcv_nxt++;
+                f->fin_rcvd = 1;
+                if (!f->need_ack)
+                {
+                        f->need_ack = 1;
+                        ack_list[ack_count++] = idx;
+                }
+        }
+}
+
+/* 这一轮收到数据的流统一回一个 ACK，对端 FIN 已经收到的流到此结束 */
+static void client_ack()
+{
+        static const tcp_flags_t ack = {.ack = 1};
+        for (size_t i = 0; i < ack_count; i++)
+        {
+                flow_t *f = &flows[ack_list[i]];
+                if (f->need_ack && f->state != FLOW_IDLE)
+                        flow_send(f, ack, NULL, 0);
+                f->need_ack = 0;
+                if (f->fin_rcvd && f->state != FLOW_IDLE)
+                {
+                        if (f->state != FLOW_FIN_SENT) // 服务器先关闭了连接
+                                bad_responses++;
+                        flow_finish(f);
+                }
+        }
+        ack_count = 0;
+}
+
+/* 从 pcap 中取出浏览器发往 HTTP 服务器的请求，作为请求模板 */
+static void load_templates(const char *path)
+{
+        char errbuf[PCAP_ERRBUF_SIZE];
+        FILE *fp = fopen(path, "rb");
+        pcap_t *pcap = fp ? pcap_fopen_offline(fp, errbuf) : NULL;
+        struct pcap_pkthdr *pkt_hdr;
+        const uint8_t *pkt;
+        while (pcap && num_templates < MAX_TEMPLATES && pcap_next_ex(pcap, &pkt_hdr, &pkt) == 1)
+        {
+                if (pkt_hdr->caplen < sizeof(ether_hdr_t) + sizeof(ip_hdr_t) + sizeof(tcp_hdr_t))
+                        continue;
+                const ip_hdr_t *ip = (const ip_hdr_t *)(pkt + sizeof(ether_hdr_t));
+                if (ip->protocol != NET_PROTOCOL_TCP)
+                        continue;
+                const tcp_hdr_t *hdr = (const tcp_hdr_t *)((const uint8_t *)ip + ip->hdr_len * IP_HDR_LEN_PER_BYTE);
+                const char *data = (const char *)hdr + hdr->data_offset * 4;
+                size_t len = (const char *)pkt + pkt_hdr->caplen - data;
+                if (len > 4 && len < REQUEST_MAX && !memcmp(data, "GET ", 4))
+                {
+                        memcpy(templates[num_templates], data, len);
+                        template_len[num_templates++] = len;
+                }
+        }
+        if (pcap)
+                pcap_close(pcap);
+        else if (fp)
+                fclose(fp);
+        if (num_templates == 0)
+        {
+                fprintf(stderr, "no requests in %s, using a built-in request\n", path);
+                template_len[0] = sprintf(templates[0], "GET /index.html HTTP/1.1\r\nHost: bench\r\nAccept-Encoding: gzip, deflate\r\n\r\n");
+                num_templates = 1;
+        }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+        uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+        return x < y ? -1 : x > y;
+}
+
+/* 分片里运行的 HTTP 服务器 */
+static int shard_server_init(int shard, void *arg)
+{
+        return http_server_open(SERVER_PORT);
+}
+
+static void shard_server_run(int shard, void *arg)
+{
+        http_server_run();
+}
+
+static void shard_server_fini(int shard, void *arg)
+{
+        tcp_get_stat(&shard_tcp[shard]);
+        http_get_stat(&shard_http[shard]);
+}
+
+typedef struct app_conn // 应用线程上的一个连接，RECV 始终在途，请求收齐后另用一个命令回响应
+{
+        sock_cmd_t rx_cmd;    // RECV
+        sock_cmd_t tx_cmd;    // SEND_FIXED
+        sock_cmd_t close_cmd; // CLOSE
+        int fd;
+        int open;             // 还没有提交关闭
+        int inflight;         // 在途的命令数，关闭后减到 0 才放回空闲链表
+        int sending;          // tx_cmd 在途
+        size_t queued;        // 已经收齐、还没有回响应的请求数
+        size_t len;           // buf 中还没处理的字节数
+        char buf[REQUEST_MAX];
+        struct app_conn *next_free;
+} app_conn_t;
+
+typedef struct app // 一个应用线程
+{
+        int id;
+        pthread_t thread;
+        size_t connections, requests, errors;
+} app_t;
+
+static app_t apps[APP_MAX];
+static net_stack_t *app_stack;           // 协议栈实例，运行在本线程
+static _Atomic int app_listen_fd;        // 0 号应用线程打开的监听套接字
+static _Atomic int app_stop, app_running;
+static char app_response[256 + APP_BODY_LEN];
+static size_t app_response_len;
+static int coro_mode;                    // 每个连接一个协程，不启动 HTTP 服务器
+static size_t coro_conns, coro_requests, coro_errors;
+
+static void app_submit(sock_ctx_t *ctx, sock_cmd_t *cmd)
+{
+        while (sock_submit(ctx, &cmd, 1) == 0)
+                sched_yield();
+}
+
+/* 请求报头结束的位置，报头还不完整时为 0 */
+static size_t app_request_end(const char *buf, size_t len)
+{
+        for (size_t i = 3; i < len; i++)
+                if (!memcmp(buf + i - 3, "\r\n\r\n", 4))
+                        return i + 1;
+        return 0;
+}
+
+static void app_post(sock_ctx_t *ctx, app_conn_t *c, sock_cmd_t *cmd)
+{
+        c->inflight++;
+        app_submit(ctx, cmd);
+}
+
+static void app_close(sock_ctx_t *ctx, app_conn_t *c)
+{
+        c->open = 0;
+        c->close_cmd = (sock_cmd_t){.op = SOCK_OP_CLOSE, .fd = c->fd, .user = c};
+        app_post(ctx, c, &c->close_cmd);
+}
+
+/* 没有响应在途时回下一个收齐的请求 */
+static void app_send(sock_ctx_t *ctx, app_t *app, app_conn_t *c)
+{
+        if (c->sending || c->queued == 0)
+                return;
+        c->queued--;
+        c->sending = 1;
+        app->requests++;
+        c->tx_cmd = (sock_cmd_t){.op = SOCK_OP_SEND_FIXED, .fd = c->fd, .buf_index = 0,
+                                 .data = (uint8_t *)app_response, .len = app_response_len, .user = c};
+        app_post(ctx, c, &c->tx_cmd);
+}
+
+/* 取出收齐的请求，再投递下一个 RECV，请求超过缓冲区时关闭连接 */
+static void app_recv(sock_ctx_t *ctx, app_t *app, app_conn_t *c)
+{
+        size_t end;
+        while ((end = app_request_end(c->buf, c->len)) != 0)
+        {
+                memmove(c->buf, c->buf + end, c->len - end);
+                c->len -= end;
+                c->queued++;
+        }
+        app_send(ctx, app, c);
+        if (c->len == sizeof(c->buf))
+        {
+                app->errors++;
+                app_close(ctx, c);
+                return;
+        }
+        c->rx_cmd = (sock_cmd_t){.op = SOCK_OP_RECV, .fd = c->fd, .data = (uint8_t *)c->buf + c->len,
+                                 .len = sizeof(c->buf) - c->len, .user = c};
+        app_post(ctx, c, &c->rx_cmd);
+}
+
+/* 应用线程：保持 APP_ACCEPTS 个 ACCEPT 在途，每个连接上收一个请求回一个响应，对端关闭后关掉。
+   RECV 在回响应时也在途，下一个请求直接收进连接的缓冲区 */
+static void *app_main(void *arg)
+{
+        app_t *app = arg;
+        sock_ctx_t *ctx = sock_ctx_create(app_stack);
+        app_conn_t *conns = calloc(APP_CONNS, sizeof(app_conn_t)), *free_conns = NULL;
+        sock_cmd_t accept_cmds[APP_ACCEPTS], *accept_idle[APP_ACCEPTS], listen_close = {.op = SOCK_OP_CLOSE};
+        int listen_fd, idle = 0, stopping = 0, nfree = APP_CONNS;
+        if (ctx == NULL || conns == NULL)
+        {
+                if (app->id == 0)
+                        app_listen_fd = SOCK_ENOMEM;
+                app->errors++;
+                goto out;
+        }
+        for (int i = APP_CONNS - 1; i >= 0; i--)
+        {
+                conns[i].next_free = free_conns;
+                free_conns = &conns[i];
+        }
+        for (; idle < APP_ACCEPTS; idle++)
+                accept_idle[idle] = &accept_cmds[idle];
+        sock_buf_t buf = {.base = (uint8_t *)app_response, .len = app_response_len};
+        sock_register_buffers(ctx, &buf, 1);
+        if (app->id == 0)
+        {
+                // 指向登记的缓冲区之外的 SEND_FIXED 要在找套接字之前就被拒绝，不能让 TCP 引用没登记的内存
+                if (sock_send_fixed(ctx, 0, 0, app_response + app_response_len + 1, 1) != SOCK_EINVAL ||
+                    sock_send_fixed(ctx, 0, 0, app_response + app_response_len + 4096, 0) != SOCK_EINVAL ||
+                    sock_send_fixed(ctx, 0, 0, app_response + app_response_len - 1, 2) != SOCK_EINVAL)
+                {
+                        fprintf(stderr, "SEND_FIXED outside the registered buffer was not rejected\n");
+                        app->errors++;
+                }
+                app_listen_fd = sock_listen(ctx, SERVER_PORT);
+        }
+        while ((listen_fd = app_listen_fd) == APP_FD_PENDING)
+                sched_yield();
+        if (listen_fd < 0)
+                goto out;
+
+        while (!stopping || ctx->inflight)
+        {
+                while (idle && !stopping && nfree > APP_ACCEPTS - idle) // 每个在途的 ACCEPT 完成时都有空闲的连接可用
+                {
+                        sock_cmd_t *cmd = accept_idle[--idle];
+                        *cmd = (sock_cmd_t){.op = SOCK_OP_ACCEPT, .fd = listen_fd};
+                        app_submit(ctx, cmd);
+                }
+                if (!stopping && app_stop) // 关掉还开着的连接，0 号线程关掉监听套接字，其他线程在途的 ACCEPT 随之完成
+                {
+                        stopping = 1;
+                        for (int i = 0; i < APP_CONNS; i++)
+                                if (conns[i].open)
+                                        app_close(ctx, &conns[i]);
+                        if (app->id == 0)
+                        {
+                                listen_close.fd = listen_fd;
+                                app_submit(ctx, &listen_close);
+                        }
+                }
+                sock_cmd_t *done[APP_REAP_BATCH];
+                unsigned n = sock_reap(ctx, done, APP_REAP_BATCH);
+                if (n == 0)
+                        sched_yield();
+                for (unsigned i = 0; i < n; i++)
+                {
+                        sock_cmd_t *cmd = done[i];
+                        app_conn_t *c = cmd->user;
+                        if (cmd->op == SOCK_OP_ACCEPT)
+                        {
+                                accept_idle[idle++] = cmd;
+                                if (cmd->result < 0)
+                                {
+                                        app->errors += !stopping;
+                                        continue;
+                                }
+                                c = free_conns;
+                                free_conns = c->next_free;
+                                nfree--;
+                                *c = (app_conn_t){.fd = cmd->result, .open = 1};
+                                app->connections++;
+                                app_recv(ctx, app, c);
+                                continue;
+                        }
+                        if (cmd == &listen_close)
+                        {
+                                app->errors += cmd->result != 0;
+                                continue;
+                        }
+                        c->inflight--;
+                        if (cmd == &c->close_cmd)
+                                app->errors += cmd->result != 0;
+                        else if (!c->open) // 已经提交了关闭，挂着的命令以 SOCK_ECLOSED 完成
+                                ;
+                        else if (cmd->result < 0 || (cmd == &c->rx_cmd && cmd->result == 0))
+                        {
+                                app->errors += cmd->result < 0;
+                                app_close(ctx, c);
+                        }
+                        else if (cmd == &c->tx_cmd)
+                        {
+                                c->sending = 0;
+                                app_send(ctx, app, c);
+                        }
+                        else
+                        {
+                                c->len += cmd->result;
+                                app_recv(ctx, app, c);
+                        }
+                        if (!c->open && c->inflight == 0) // 连接关闭，放回空闲链表
+                        {
+                                c->next_free = free_conns;
+                                free_conns = c;
+                                nfree++;
+                        }
+                }
+        }
+out:
+        sock_ctx_destroy(ctx);
+        free(conns);
+        app_running--;
+        return NULL;
+}
+
+/**
+ * @brief 启用套接字层，启动应用线程，等 0 号线程打开监听套接字
+ *
+ * @param n 应用线程数
+ * @return int 成功为 0，失败为 -1
+ */
+static void app_response_init()
+{
+        int body = APP_BODY_LEN;
+        app_response_len = sprintf(app_response, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: text/plain\r\n\r\n", body);
+        memset(app_response + app_response_len, 'x', body);
+        app_response_len += body;
+}
+
+static int app_start(int n)
+{
+        app_response_init();
+        if (sock_init() != 0)
+                return -1;
+        app_stack = net_stack();
+        app_listen_fd = APP_FD_PENDING;
+        app_stop = 0;
+        app_running = n;
+        for (int i = 0; i < n; i++)
+        {
+                apps[i] = (app_t){.id = i};
+                pthread_create(&apps[i].thread, NULL, app_main, &apps[i]);
+        }
+        while (app_listen_fd == APP_FD_PENDING)
+        {
+                sock_poll();
+                sched_yield();
+        }
+        return app_listen_fd < 0 ? -1 : 0;
+}
+
+/* 让应用线程关掉套接字退出，期间协议栈继续运行 */
+static void app_join(int n)
+{
+        app_stop = 1;
+        while (app_running)
+        {
+                net_poll();
+                sock_poll();
+                loopback_drain(client_recv, NULL);
+                sched_yield();
+        }
+        for (int i = 0; i < n; i++)
+                pthread_join(apps[i].thread, NULL);
+        sock_free();
+}
+
+#ifndef _WIN32
+/* 一个连接上的协程：顺序地收齐一个请求、回一个响应，对端关闭时返回 */
+static void coro_serve(coro_t *co, void *arg)
+{
+        char buf[REQUEST_MAX];
+        size_t len = 0, end;
+        coro_conns++;
+        while (1)
+        {
+                int64_t n = coro_read(co, buf + len, sizeof(buf) - len);
+                if (n == 0)
+                {
+                        if (len) // 请求只收到一半连接就关了
+                                coro_errors++;
+                        return;
+                }
+                len += n;
+                while ((end = app_request_end(buf, len)) != 0)
+                {
+                        memmove(buf, buf + end, len - end);
+                        len -= end;
+                        if (coro_write(co, app_response, app_response_len) < 0)
+                        {
+                                coro_errors++;
+                                return;
+                        }
+                        coro_requests++;
+                }
+                if (len == sizeof(buf))
+                {
+                        coro_errors++;
+                        return;
+                }
+        }
+}
+
+static int coro_start()
+{
+        app_response_init();
+        coro_conns = coro_requests = coro_errors = 0;
+        return coro_init() == 0 && coro_listen(SERVER_PORT, coro_serve, NULL) == 0 ? 0 : -1;
+}
+
+static void coro_server_run()
+{
+        coro_run();
+}
+
+static void coro_report()
+{
+        coro_stat_t stat;
+        coro_get_stat(&stat);
+        fprintf(stderr, "coro:             %zu connections, %zu requests, %zu errors, %zu switches, %zu waits, %zu stacks, %zu live\n",
+                coro_conns, coro_requests, coro_errors, stat.switches, stat.waits, stat.pooled, stat.live);
+        if (stat.live)
+                coro_errors++;
+        coro_free();
+}
+#else
+static int coro_start()
+{
+        fprintf(stderr, "coroutines need ucontext, which is not available on Windows\n");
+        return -1;
+}
+
+static void coro_server_run() {}
+static void coro_report() {}
+#endif
+
+/* RSS 规范中的测试向量：66.9.149.187:2794 -> 161.142.100.80:1766 */
+static int check_toeplitz()
+{
+        static const uint8_t input[12] = {66, 9, 149, 187, 161, 142, 100, 80, 2794 >> 8, 2794 & 0xFF, 1766 >> 8, 1766 & 0xFF};
+        return shard_toeplitz(input, 12) == 0x51ccc178 && shard_toeplitz(input, 8) == 0x323e8fc2 ? 0 : -1;
+}
+
+static void flood_reset(size_t concurrency)
+{
+        memset(flows, 0, concurrency * sizeof(flow_t));
+        memset(port_owner, -1, sizeof(port_owner));
+        next_port = CLIENT_PORT_MIN;
+        ack_count = flows_started = flows_done = 0;
+        requests_done = bad_responses = resets = status_2xx = status_other = 0;
+}
+
+/* 单线程：收一批帧就让服务器处理一次，server_run 为 http_server_run 或 coro_run */
+static size_t flood_single(size_t concurrency, void (*server_run)(void))
+{
+        size_t rounds = 0, frames = 0;
+        while (flows_done < flows_total && rounds < flows_total * 1000)
+        {
+                rounds++;
+                for (size_t i = 0; i < concurrency && flows_started < flows_total; i++)
+                        if (flows[i].state == FLOW_IDLE)
+                                flow_start(i);
+                do // 像主循环一样收一批帧就让服务器处理一次，accept 队列才不会被一轮的 SYN 撑满
+                {
+                        for (int i = 0; i < POLL_BATCH && loopback_pending(); i++)
+                                net_poll();
+                        server_run();
+                } while (loopback_pending());
+                tcp_poll();
+                frames += loopback_drain(client_recv, NULL);
+                client_ack();
+        }
+        return frames;
+}
+
+/* 分片模式：本线程分发帧、处理客户端，服务器在分片线程里运行 */
+static size_t flood_sharded(size_t concurrency)
+{
+        size_t frames = 0;
+        uint64_t last_progress = now_us();
+        while (flows_done < flows_total && now_us() - last_progress < STALL_TIMEOUT_US)
+        {
+                for (size_t i = 0; i < concurrency && flows_started < flows_total; i++)
+                        if (flows[i].state == FLOW_IDLE)
+                                flow_start(i);
+                int moved = shard_poll();
+                size_t n = loopback_drain(client_recv, NULL);
+                frames += n;
+                client_ack();
+                if (moved || n)
+                        last_progress = now_us();
+                else
+                        sched_yield();
+        }
+        return frames;
+}
+
+/* 套接字模式：本线程运行协议栈和客户端，应用线程经命令环收发 */
+static size_t flood_sock(size_t concurrency)
+{
+        size_t frames = 0;
+        uint64_t last_progress = now_us();
+        while (flows_done < flows_total && now_us() - last_progress < STALL_TIMEOUT_US)
+        {
+                for (size_t i = 0; i < concurrency && flows_started < flows_total; i++)
+                        if (flows[i].state == FLOW_IDLE)
+                                flow_start(i);
+                do
+                {
+                        for (int i = 0; i < POLL_BATCH && loopback_pending(); i++)
+                                net_poll();
+                        sock_poll();
+                } while (loopback_pending());
+                tcp_poll();
+                size_t n = loopback_drain(client_recv, NULL);
+                frames += n;
+                client_ack();
+                if (n)
+                        last_progress = now_us();
+                else // 等应用线程提交命令
+                        sched_yield();
+        }
+        return frames;
+}
+
+/**
+ * @brief 跑一轮压测并打印结果
+ *
+ * @param shards 分片数，0 为单线程
+ * @param napps 应用线程数，大于 0 时分片数必须为 0
+ * @param concurrency 并发流数
+ * @param rate 出口参数，每秒完成的请求数
+ * @return int 成功为 0，失败为 1
+ */
+static int flood_run(int shards, int napps, size_t concurrency, double *rate)
+{
+        static const shard_app_t app = {.init = shard_server_init, .run = shard_server_run, .fini = shard_server_fini};
+        tcp_stat_t tstat = {0};
+        http_stat_t hstat = {0};
+        stats_snapshot_t before, after;
+        flood_reset(concurrency);
+        stats_snapshot(&before);
+        int started;
+        if (shards)
+                started = shard_start(shards, &app, NULL) == 0;
+        else
+                started = net_init() == 0 && (napps ? app_start(napps) : coro_mode ? coro_start() : http_server_open(SERVER_PORT)) == 0;
+        if (!started)
+        {
+                fprintf(stderr, "failed to start the server\n");
+                return 1;
+        }
+        for (int h = 0; h < CLIENT_HOSTS; h++)
+                client_arp(h);
+
+        uint64_t start = now_us();
+        size_t frames = shards ? flood_sharded(concurrency) : napps ? flood_sock(concurrency)
+                                                           : flood_single(concurrency, coro_mode ? coro_server_run : http_server_run);
+        uint64_t elapsed = now_us() - start;
+        size_t conn_min = SIZE_MAX, conn_max = 0, stalls = 0, app_conns = 0, app_requests = 0, app_errors = 0;
+        if (napps)
+        {
+                app_join(napps);
+                for (int i = 0; i < napps; i++)
+                {
+                        app_conns += apps[i].connections;
+                        app_requests += apps[i].requests;
+                        app_errors += apps[i].errors;
+                }
+        }
+        if (shards == 0)
+        {
+                driver_close();
+                tcp_get_stat(&tstat);
+                if (napps == 0 && !coro_mode)
+                        http_get_stat(&hstat);
+        }
+        else
+        {
+                shard_stop();
+                for (int i = 0; i < shards; i++) // 各分片的计数相加，顺便看看连接分布是否均匀
+                {
+                        shard_stat_t sstat;
+                        shard_get_stat(i, &sstat);
+                        stalls += sstat.rx_stalls + sstat.tx_stalls;
+                        tstat.tx_copied += shard_tcp[i].tx_copied;
+                        tstat.tx_referenced += shard_tcp[i].tx_referenced;
+                        hstat.connections += shard_http[i].connections;
+                        hstat.reused += shard_http[i].reused;
+                        hstat.bytes_sent += shard_http[i].bytes_sent;
+                        conn_min = shard_http[i].connections < conn_min ? shard_http[i].connections : conn_min;
+                        conn_max = shard_http[i].connections > conn_max ? shard_http[i].connections : conn_max;
+                }
+        }
+
+        stats_snapshot(&after); // 分片的实例已经释放，计数留在总数里
+        for (int i = 0; i < STATS_MAX; i++)
+                after.counter[i] -= before.counter[i];
+        size_t stats_errors = after.counter[STATS_IP_IN_CSUM_ERRORS] + after.counter[STATS_TCP_IN_CSUM_ERRORS] +
+                              after.counter[STATS_TCP_IN_ERRS] + after.counter[STATS_ETH_IN_UNKNOWN_PROTOS];
+        if (after.counter[STATS_TCP_IN_SEGS] == 0)
+                stats_errors++;
+#ifdef NET_LATENCY
+        for (int i = 0; i < LATENCY_MAX; i++)
+                latency_diff(&after.latency[i], &before.latency[i]);
+        if (latency_count(&after.latency[LATENCY_TCP_IN]) == 0 || latency_count(&after.latency[LATENCY_HANDLER]) == 0 ||
+            latency_count(&after.latency[LATENCY_DRIVER_SEND]) == 0)
+                stats_errors++;
+#endif
+
+        qsort(latency, requests_done, sizeof(uint32_t), cmp_u32);
+        double reqs = requests_done ? (double)requests_done : 1.0;
+        size_t stack_copied = tstat.tx_copied * 2 + tstat.tx_referenced; // 拷进 tx_buf，再拷进段
+        *rate = elapsed ? requests_done * 1e6 / elapsed : 0.0;
+        if (napps)
+                fprintf(stderr, "shards:           none, stack runs on the client thread, %d app threads over the socket API\n", napps);
+        else if (coro_mode)
+                fprintf(stderr, "shards:           none, stack and one coroutine per connection run on the client thread\n");
+        else if (shards == 0)
+                fprintf(stderr, "shards:           none, stack runs on the client thread\n");
+        else
+                fprintf(stderr, "shards:           %d, %zu to %zu connections per shard, %zu ring stalls\n",
+                        shards, conn_min, conn_max, stalls);
+        fprintf(stderr, "flows:            %zu done of %zu, %zu concurrent, %zu requests each, %zu request templates\n",
+                flows_done, flows_total, concurrency, reqs_per_flow, num_templates);
+        fprintf(stderr, "requests:         %zu (%.0f req/s), %zu 2xx, %zu other, %zu bad, %zu resets\n",
+                requests_done, *rate, status_2xx, status_other, bad_responses, resets);
+        fprintf(stderr, "latency:          p50 %u us, p99 %u us, max %u us\n",
+                requests_done ? latency[requests_done / 2] : 0, requests_done ? latency[requests_done * 99 / 100] : 0,
+                requests_done ? latency[requests_done - 1] : 0);
+        fprintf(stderr, "bytes copied:     %.0f per request in the stack, %.0f in the driver\n",
+                stack_copied / reqs, loopback_copied() / reqs);
+        if (napps)
+                fprintf(stderr, "rx direct:        %.0f bytes per request landed in app buffers without rx_buf\n",
+                        tstat.rx_direct / reqs);
+        fprintf(stderr, "frames:           %.1f per request (server to client)\n", frames / reqs);
+        if (napps)
+                fprintf(stderr, "sock apps:        %zu connections, %zu requests, %zu errors\n",
+                        app_conns, app_requests, app_errors);
+        else if (coro_mode)
+                coro_report();
+        else
+                fprintf(stderr, "http:             %zu connections, %zu reused, %zu bytes sent\n",
+                        hstat.connections, hstat.reused, hstat.bytes_sent);
+
+        char dump[4096];
+        stats_dump(&after, dump, sizeof(dump));
+        fprintf(stderr, "%s", dump);
+#ifdef NET_LATENCY
+        latency_dump(after.latency, dump, sizeof(dump));
+        fprintf(stderr, "%s", dump);
+#endif
+        FILE *sink = tmpfile();
+        if (sink)
+        {
+                fprintf(stderr, "trace:            %zu records in the rings\n", trace_decode(NULL, 0, sink));
+                fclose(sink);
+        }
+
+        if (flows_done != flows_total || requests_done != flows_total * reqs_per_flow || bad_responses || resets || app_errors || coro_errors ||
+            stats_errors)
+        {
+                fprintf(stderr, "FAILED\n");
+                return 1;
+        }
+        return 0;
+}
+
+int main(int argc, char *argv[])
+{
+        flows_total = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+        size_t concurrency = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+        reqs_per_flow = argc > 3 ? strtoul(argv[3], NULL, 10) : 4;
+        const char *pcap_path = argc > 4 ? argv[4] : "data/http.pcap";
+        char *end;
+        int shards_min = argc > 5 ? strtol(argv[5], &end, 10) : 0;
+        int shards_max = argc > 5 && *end == '-' ? strtol(end + 1, NULL, 10) : shards_min;
+        coro_mode = argc > 6 && !strcmp(argv[6], "coro");
+        int napps = argc > 6 && !coro_mode ? atoi(argv[6]) : 0;
+        if (concurrency < 1 || concurrency > CLIENT_PORT_MAX - CLIENT_PORT_MIN)
+                concurrency = 256;
+        if (reqs_per_flow < 1 || reqs_per_flow > HTTP_KEEPALIVE_MAX)
+                reqs_per_flow = 4;
+        if (shards_min < 0 || shards_max > SHARD_MAX || shards_min > shards_max)
+        {
+                fprintf(stderr, "shard count must be within 0-%d\n", SHARD_MAX);
+                return 1;
+        }
+        if (napps < 0 || napps > APP_MAX || ((napps || coro_mode) && shards_max))
+        {
+                fprintf(stderr, "app thread count must be within 0-%d, and the shard count must be 0 with app threads or coro\n", APP_MAX);
+                return 1;
+        }
+        if (shards_max > 0 && check_toeplitz() != 0)
+        {
+                fprintf(stderr, "toeplitz hash does not match the RSS test vector\nFAILED\n");
+                return 1;
+        }
+        trace_init(NULL); // 跟踪环只在内存里，每轮结束后解码一遍，检查读的一方能和协议栈并行
+        load_templates(pcap_path);
+        flows = calloc(concurrency, sizeof(flow_t));
+        ack_list = calloc(concurrency, sizeof(size_t));
+        latency = calloc(flows_total * reqs_per_flow + 1, sizeof(uint32_t));
+
+        // 单线程模式的协议栈只能初始化一次，所以范围里的 0 只会出现在第一轮
+        double rate[SHARD_MAX + 1];
+        int failed = 0;
+        for (int n = shards_min; n <= shards_max; n++)
+        {
+                if (n > shards_min)
+                        fprintf(stderr, "\n");
+                failed |= flood_run(n, napps, concurrency, &rate[n]);
+        }
+        if (shards_max > shards_min)
+        {
+                fprintf(stderr, "\nscaling:\n");
+                for (int n = shards_min; n <= shards_max; n++)
+                        fprintf(stderr, "  %d shard%s  %8.0f req/s  %.2fx\n", n, n == 1 ? " " : "s", rate[n],
+                                rate[shards_min] ? rate[n] / rate[shards_min] : 0.0);
+        }
+        return failed;
+}
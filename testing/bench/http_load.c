@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcp.h"
+#include "http.h"
+#include "http_cache.h"
+#include "utils.h"
+#include "bench.h"
+
+/*
+ * HTTP 负载测试：直接调用 tcp_in / http_server_run，不经过 ethernet/ip/pcap。
+ * 每个客户端是一个极简的 TCP 状态机，反复浏览 page1.html（页面本身加六张图片，共 7 个请求），
+ * 统计每次页面浏览需要的握手数和段数。
+ *
+ * 四种模式：
+ *   keepalive  每次浏览一个 HTTP/1.1 持久连接，7 个请求一次性流水线发出
+ *   close      每个请求一个连接（Connection: close），即原来 HTTP/1.0 的行为
+ *   revisit    同 keepalive，但客户端记住每个文件的 ETag，之后的浏览用 If-None-Match 条件请求
+ *   identity   同 keepalive，但不带 Accept-Encoding，用来和压缩后的线上字节数对比
+ * 除 identity 外，请求都像浏览器一样带 Accept-Encoding: gzip, deflate, br。
+ *
+ * 用法：http_load [keepalive|close|revisit|identity] [页面浏览次数] [并发客户端数]
+ * 需要在 testing 目录下运行，服务器从 ../htmldocs 读取页面。
+ */
+
+#define SERVER_PORT 80
+#define MAX_CLIENTS 64
+
+static const char *page[] = {"/page1.html", "/img1.jpg", "/img2.jpg", "/img3.jpg", "/img4.jpg", "/img5.jpg", "/img6.jpg"};
+#define PAGE_REQUESTS (sizeof(page) / sizeof(page[0]))
+
+static net_stack_t stack = {.if_ip = NET_IF_IP}; // 不链接 net.c，自己提供协议栈实例
+_Thread_local net_stack_t *net_stack_current = &stack;
+
+void net_add_protocol(uint16_t protocol, net_handler_t handler) {}
+void net_add_fini(net_fini_t fini) {}
+
+/* 服务器发出的段先排进队列，每轮统一交给客户端 */
+typedef struct pkt
+{
+        uint8_t ip[NET_IP_LEN];
+        size_t len;
+        uint8_t *data;
+} pkt_t;
+
+static pkt_t *out_q;
+static size_t out_len, out_cap;
+static size_t server_segs, wire_bytes;
+
+void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+{
+        if (out_len == out_cap)
+        {
+                out_cap = out_cap ? out_cap * 2 : 256;
+                out_q = realloc(out_q, out_cap * sizeof(pkt_t));
+        }
+        pkt_t *pkt = &out_q[out_len++];
+        memcpy(pkt->ip, ip, NET_IP_LEN);
+        pkt->len = buf->len;
+        pkt->data = malloc(buf->len);
+        memcpy(pkt->data, buf->data, buf->len);
+        server_segs++;
+        wire_bytes += buf->len + 20 + 14; // 加上 IP 首部和以太网首部
+}
+
+typedef enum client_state
+{
+        CLIENT_IDLE,     // 准备开始下一个连接
+        CLIENT_SYN_SENT, // 等待 SYN + ACK
+        CLIENT_OPEN,     // 发请求、收响应
+        CLIENT_FIN_SENT, // 已经发出 FIN，等待服务器的 FIN
+} client_state_t;
+
+typedef struct client
+{
+        uint8_t ip[NET_IP_LEN];
+        uint16_t port;
+        client_state_t state;
+        uint32_t snd_nxt, rcv_nxt;
+        uint8_t need_ack, fin_rcvd;
+        size_t sent;      // 这次浏览已经发出的请求数
+        size_t responses; // 这次浏览已经收完的响应数
+        size_t conn_responses; // 当前连接上收完的响应数
+        bench_resp_t resp; // 响应流的解析状态
+        char etag[PAGE_REQUESTS][32]; // revisit 模式下记住的每个文件的 ETag
+} client_t;
+
+static client_t clients[MAX_CLIENTS];
+static int keepalive = 1, revisit = 0, identity = 0;
+static size_t rx_bytes, not_modified, encoded;
+static size_t handshakes, views_done, views_started, views_total, bad_responses;
+static buf_t seg;
+
+static void client_send(client_t *c, tcp_flags_t flags, const char *data, size_t len)
+{
+        buf_init(&seg, bench_tcp_len(flags, len));
+        bench_tcp_seg(seg.data, c->ip, c->port, SERVER_PORT, c->snd_nxt, flags.ack ? c->rcv_nxt : 0, flags, data, len);
+        c->snd_nxt += len + flags.syn + flags.fin;
+        c->need_ack = 0;
+        tcp_in(&seg, c->ip);
+}
+
+static void client_connect(client_t *c)
+{
+        static const tcp_flags_t syn = {.syn = 1};
+        c->port = c->port < 10000 ? 10000 : c->port + 1; // 每个连接换一个端口，避开 TIME_WAIT
+        c->snd_nxt += 100000;
+        c->state = CLIENT_SYN_SENT;
+        c->fin_rcvd = 0;
+        c->conn_responses = 0;
+        bench_resp_reset(&c->resp);
+        handshakes++;
+        client_send(c, syn, NULL, 0);
+}
+
+static void client_send_requests(client_t *c)
+{
+        static const tcp_flags_t psh = {.ack = 1, .psh = 1};
+        char req[2048];
+        size_t len = 0;
+        size_t n = keepalive ? PAGE_REQUESTS : 1; // 持久连接一次发出全部请求
+        for (size_t i = 0; i < n; i++, c->sent++)
+        {
+                // 持久连接上最后一个请求自称 HTTP/1.9，响应仍然要是 HTTP/1.1
+                len += sprintf(req + len, "GET %s HTTP/1.%d\r\nHost: bench\r\n%s%s", page[c->sent],
+                               keepalive && c->sent == PAGE_REQUESTS - 1 ? 9 : 1,
+                               keepalive ? "" : "Connection: close\r\n",
+                               identity ? "" : "Accept-Encoding: gzip, deflate, br\r\n");
+                if (c->etag[c->sent][0])
+                        len += sprintf(req + len, "If-None-Match: %s\r\n", c->etag[c->sent]);
+                len += sprintf(req + len, "\r\n");
+        }
+        client_send(c, psh, req, len);
+}
+
+/* 解析响应流：收齐报头时检查状态码，revisit 模式下记住 ETag */
+static void client_recv_data(client_t *c, const uint8_t *data, size_t len)
+{
+        while (len)
+        {
+                int ev = bench_resp_feed(&c->resp, &data, &len);
+                if (ev < 0)
+                {
+                        bad_responses++;
+                        return;
+                }
+                if (ev & BENCH_RESP_HEAD)
+                {
+                        const char *head = c->resp.head;
+                        const char *etag = strstr(head, "ETag: ");
+                        encoded += strstr(head, "Content-Encoding: ") != NULL;
+                        if (!strncmp(head, "HTTP/1.1 304 ", 13) && c->etag[c->responses][0])
+                                not_modified++; // 304 没有正文
+                        else if (strncmp(head, "HTTP/1.1 200 ", 13) || c->resp.content_length < 0)
+                                bad_responses++;
+                        else if (revisit && etag && c->responses < PAGE_REQUESTS)
+                                sscanf(etag + 6, "%31[^\r]", c->etag[c->responses]);
+                }
+                if (ev & BENCH_RESP_DONE)
+                {
+                        c->responses++;
+                        c->conn_responses++;
+                }
+        }
+}
+
+static client_t *find_client(const uint8_t *ip, uint16_t port)
+{
+        for (int i = 0; i < MAX_CLIENTS; i++)
+                if (!memcmp(clients[i].ip, ip, NET_IP_LEN) && clients[i].port == port)
+                        return &clients[i];
+        return NULL;
+}
+
+static void client_recv(pkt_t *pkt)
+{
+        static const tcp_flags_t ack = {.ack = 1};
+        tcp_hdr_t *hdr = (tcp_hdr_t *)pkt->data;
+        client_t *c = find_client(pkt->ip, swap16(hdr->dst_port16));
+        if (c == NULL || c->state == CLIENT_IDLE)
+                return; // 已经结束的连接
+        uint32_t seq = swap32(hdr->seq_number32);
+        size_t hdr_len = hdr->data_offset * 4;
+        if (hdr->flags.rst)
+        {
+                bad_responses++;
+                c->state = CLIENT_IDLE;
+                return;
+        }
+        if (c->state == CLIENT_SYN_SENT)
+        {
+                if (!hdr->flags.syn)
+                        return;
+                c->rcv_nxt = seq + 1;
+                c->state = CLIENT_OPEN;
+                client_send(c, ack, NULL, 0);
+                client_send_requests(c);
+                return;
+        }
+        if (seq != c->rcv_nxt) // 回环上不会乱序，只可能是重复的段
+                return;
+        client_recv_data(c, pkt->data + hdr_len, pkt->len - hdr_len);
+        rx_bytes += pkt->len - hdr_len;
+        c->rcv_nxt += pkt->len - hdr_len;
+        c->need_ack = pkt->len > hdr_len;
+        if (hdr->flags.fin)
+        {
+                c->rcv_nxt++;
+                c->fin_rcvd = 1;
+                c->need_ack = 1;
+        }
+}
+
+/* 处理完这一轮收到的段之后，推进客户端的状态 */
+static void client_step(client_t *c)
+{
+        static const tcp_flags_t ack = {.ack = 1};
+        static const tcp_flags_t fin = {.ack = 1, .fin = 1};
+        if (c->state == CLIENT_IDLE)
+        {
+                if (c->sent == 0 && views_started == views_total)
+                        return;
+                if (c->sent == 0)
+                        views_started++;
+                client_connect(c);
+                return;
+        }
+        if (c->state == CLIENT_OPEN && (c->fin_rcvd || c->conn_responses == (keepalive ? PAGE_REQUESTS : 1)))
+        {
+                client_send(c, fin, NULL, 0); // 顺带确认收到的数据和 FIN
+                c->state = CLIENT_FIN_SENT;
+        }
+        else if (c->need_ack)
+        {
+                client_send(c, ack, NULL, 0);
+        }
+        if (c->state == CLIENT_FIN_SENT && c->fin_rcvd)
+        {
+                if (c->need_ack)
+                        client_send(c, ack, NULL, 0);
+                c->state = CLIENT_IDLE;
+                if (c->responses == PAGE_REQUESTS || c->sent == PAGE_REQUESTS)
+                {
+                        if (c->responses != PAGE_REQUESTS)
+                                bad_responses++;
+                        views_done++;
+                        c->sent = c->responses = 0;
+                }
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        keepalive = argc > 1 ? strcmp(argv[1], "close") != 0 : 1;
+        revisit = argc > 1 && strcmp(argv[1], "revisit") == 0;
+        identity = argc > 1 && strcmp(argv[1], "identity") == 0;
+        views_total = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+        int nclients = argc > 3 ? atoi(argv[3]) : 8;
+        if (nclients < 1 || nclients > MAX_CLIENTS)
+                nclients = MAX_CLIENTS;
+        tcp_init();
+        if (http_server_open(SERVER_PORT) != 0)
+        {
+                fprintf(stderr, "http_server_open failed\n");
+                return 1;
+        }
+        for (int i = 0; i < nclients; i++)
+        {
+                uint8_t ip[NET_IP_LEN] = {10, 0, i >> 8, i + 1};
+                memcpy(clients[i].ip, ip, NET_IP_LEN);
+        }
+
+        uint64_t start = time_ms();
+        size_t rounds = 0;
+        while (views_done < views_total && rounds < views_total * 1000)
+        {
+                rounds++;
+                for (int i = 0; i < nclients; i++)
+                        client_step(&clients[i]);
+                http_server_run();
+                tcp_poll();
+
+                pkt_t *q = out_q;
+                size_t n = out_len;
+                out_q = NULL;
+                out_len = out_cap = 0;
+                for (size_t i = 0; i < n; i++)
+                {
+                        client_recv(&q[i]);
+                        free(q[i].data);
+                }
+                free(q);
+        }
+        uint64_t elapsed = time_ms() - start;
+
+        http_stat_t hstat;
+        http_get_stat(&hstat);
+        http_cache_stat_t cstat;
+        http_cache_get_stat(&cstat);
+        tcp_stat_t tstat;
+        tcp_get_stat(&tstat);
+        double views = views_done ? (double)views_done : 1.0;
+        double requests = hstat.requests ? (double)hstat.requests : 1.0;
+        size_t payload = tstat.tx_copied + tstat.tx_referenced;
+        size_t copied = tstat.tx_copied + payload; // 拷进 tx_buf 的字节，加上每个字节组装成段时的一次拷贝
+        fprintf(stderr, "mode:                %s, %d clients\n", revisit ? "keep-alive + conditional revisits" : identity ? "keep-alive, no Accept-Encoding" : keepalive ? "keep-alive + pipelining" : "connection per request", nclients);
+        fprintf(stderr, "page views:          %zu (%.0f views/s)\n", views_done, elapsed ? views_done * 1000.0 / elapsed : 0.0);
+        fprintf(stderr, "handshakes per view: %.2f\n", handshakes / views);
+        fprintf(stderr, "segments per view:   %.1f (server to client)\n", server_segs / views);
+        fprintf(stderr, "bytes per view:      %.0f (server to client payload), %zu not modified\n", rx_bytes / views, not_modified);
+        fprintf(stderr, "wire bytes per view: %.0f (with TCP/IP/Ethernet headers), %zu compressed responses\n", wire_bytes / views, encoded);
+        fprintf(stderr, "requests:            %zu, reused %zu, pipelined %zu, bad %zu\n",
+                hstat.requests, hstat.reused, hstat.pipelined, bad_responses);
+        fprintf(stderr, "file cache:          %.1f%% hits, %zu files, %zu bytes, %zu revalidations, %zu precompressed (-%zu bytes)\n",
+                cstat.lookups ? cstat.hits * 100.0 / cstat.lookups : 0.0, cstat.files, cstat.bytes, cstat.revalidations,
+                cstat.compressed, cstat.compressed_saved);
+        fprintf(stderr, "payload copies:      %.2f per byte, %.0f bytes copied per request (%.0f into tx_buf, %.0f by reference)\n",
+                payload ? (double)copied / payload : 0.0, copied / requests, tstat.tx_copied / requests, tstat.tx_referenced / requests);
+
+        // revisit 模式下每个客户端只有第一次浏览需要完整下载，之后全是 304
+        if (views_done != views_total || bad_responses || (keepalive && handshakes != views_done) ||
+            (revisit && views_total > (size_t)nclients && not_modified < (views_total - nclients) * PAGE_REQUESTS))
+        {
+                fprintf(stderr, "FAILED\n");
+                return 1;
+        }
+#if defined(HTTP_GZIP) || defined(HTTP_BROTLI)
+        // 编译了压缩支持时，带 Accept-Encoding 的完整下载里 page1.html 应该是压缩过的
+        if (!identity && !revisit && encoded < views_done)
+        {
+                fprintf(stderr, "FAILED\n");
+                return 1;
+        }
+#endif
+        return 0;
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http_parser.h"
+#include "utils.h"
+
+/*
+ * HTTP 请求解析的微基准：先检查几个典型请求的解析结果，
+ * 再反复解析一个浏览器风格的请求，分别测一次收全和逐段到达两种情况的每秒请求数。
+ *
+ * 用法：http_parser_bench [解析次数]
+ */
+
+static const char browser_req[] =
+        "GET /img1.jpg HTTP/1.1\r\n"
+        "Host: 192.168.163.103:62000\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Referer: http://192.168.163.103:62000/\r\n"
+        "Accept-Encoding: gzip, deflate\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "\r\n";
+
+static int failed;
+
+#define STR(s) ((http_str_t){s, sizeof(s) - 1})
+
+#define CHECK(cond)                                                  \
+        do                                                           \
+        {                                                            \
+                if (!(cond))                                         \
+                {                                                    \
+                        fprintf(stderr, "check failed: %s\n", #cond); \
+                        failed = 1;                                  \
+                }                                                    \
+        } while (0)
+
+static int str_eq(http_str_t s, const char *c)
+{
+        return s.len == strlen(c) && !memcmp(s.p, c, s.len);
+}
+
+static void check_parse()
+{
+        http_parser_t parser;
+        http_request_t req;
+
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, browser_req, sizeof(browser_req) - 1, &req) == sizeof(browser_req) - 1);
+        CHECK(req.method == HTTP_METHOD_GET);
+        CHECK(str_eq(req.path, "/img1.jpg"));
+        CHECK(req.version_minor == 1 && req.keep_alive);
+        CHECK(req.num_headers == 7);
+        const http_str_t *host = http_request_header(&req, "host");
+        CHECK(host && str_eq(*host, "192.168.163.103:62000"));
+
+        // 逐字节到达：每次都用同一个 parser 从头调用，最后一个字节之前都应该返回 0
+        http_parser_init(&parser);
+        for (size_t i = 1; i < sizeof(browser_req) - 1; i++)
+                CHECK(http_parse_request(&parser, browser_req, i, &req) == 0);
+        CHECK(http_parse_request(&parser, browser_req, sizeof(browser_req) - 1, &req) == sizeof(browser_req) - 1);
+
+        const char post[] = "POST /form HTTP/1.0\r\nContent-Length: 12\r\nConnection: Keep-Alive\r\n\r\nhello=world!";
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, post, sizeof(post) - 1, &req) == sizeof(post) - 1 - 12);
+        CHECK(req.method == HTTP_METHOD_POST && req.has_body_length && req.content_length == 12);
+        CHECK(req.version_minor == 0 && req.keep_alive);
+
+        const char close[] = "GET / HTTP/1.1\nconnection: close\n\n";
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, close, sizeof(close) - 1, &req) == sizeof(close) - 1);
+        CHECK(str_eq(req.path, "/") && !req.keep_alive);
+
+        const char bad[] = "GET / HTTP/2.0\r\n\r\n";
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, bad, sizeof(bad) - 1, &req) == -1);
+
+        const char bad_len[] = "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n";
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, bad_len, sizeof(bad_len) - 1, &req) == -1);
+
+        const char huge_len[] = "POST / HTTP/1.1\r\nContent-Length: 18446744073709551617\r\n\r\n"; // 2^64 + 1，回绕后是 1
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, huge_len, sizeof(huge_len) - 1, &req) == -1);
+
+        const char dup_len[] = "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 7\r\n\r\n";
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, dup_len, sizeof(dup_len) - 1, &req) == -1);
+
+        const char same_len[] = "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n";
+        http_parser_init(&parser);
+        CHECK(http_parse_request(&parser, same_len, sizeof(same_len) - 1, &req) == sizeof(same_len) - 1);
+        CHECK(req.has_body_length && req.content_length == 5);
+
+        // 条件请求和 Range 用到的几个值的解析
+        time_t t;
+        CHECK(http_parse_date(STR("Sun, 06 Nov 1994 08:49:37 GMT"), &t) == 0 && t == 784111777);
+        CHECK(http_parse_date(STR("Sunday, 06-Nov-94 08:49:37 GMT"), &t) == -1);
+        size_t first, last;
+        CHECK(http_parse_range(STR("bytes=0-499"), 1000, &first, &last) == 1 && first == 0 && last == 499);
+        CHECK(http_parse_range(STR("bytes=500-"), 1000, &first, &last) == 1 && first == 500 && last == 999);
+        CHECK(http_parse_range(STR("bytes=-300"), 1000, &first, &last) == 1 && first == 700 && last == 999);
+        CHECK(http_parse_range(STR("bytes=900-2000"), 1000, &first, &last) == 1 && last == 999);
+        CHECK(http_parse_range(STR("bytes=1000-"), 1000, &first, &last) == 0);
+        CHECK(http_parse_range(STR("bytes=0-1,5-6"), 1000, &first, &last) == -1);
+        CHECK(http_parse_range(STR("items=0-1"), 1000, &first, &last) == -1);
+        CHECK(http_etag_match(STR("\"a\", W/\"1f-5\""), "\"1f-5\""));
+        CHECK(!http_etag_match(STR("\"1f-6\""), "\"1f-5\""));
+        CHECK(http_etag_match(STR("*"), "\"1f-5\""));
+        CHECK(http_parse_accept_encoding(STR("gzip, deflate, br")) == (HTTP_ACCEPT_GZIP | HTTP_ACCEPT_BR));
+        CHECK(http_parse_accept_encoding(STR("br;q=0, *;q=0.5")) == HTTP_ACCEPT_GZIP);
+        CHECK(http_parse_accept_encoding(STR("identity, GZIP;q=0.000")) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+        size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+        http_parser_t parser;
+        http_request_t req;
+        size_t len = sizeof(browser_req) - 1;
+        size_t bytes = 0;
+
+        check_parse();
+
+        uint64_t start = time_ms();
+        for (size_t i = 0; i < rounds; i++)
+        {
+                http_parser_init(&parser);
+                bytes += http_parse_request(&parser, browser_req, len, &req);
+        }
+        uint64_t whole = time_ms() - start;
+
+        // 请求分成 MSS 大小不等的三段到达
+        start = time_ms();
+        for (size_t i = 0; i < rounds; i++)
+        {
+                http_parser_init(&parser);
+                http_parse_request(&parser, browser_req, len / 3, &req);
+                http_parse_request(&parser, browser_req, len * 2 / 3, &req);
+                bytes += http_parse_request(&parser, browser_req, len, &req);
+        }
+        uint64_t split = time_ms() - start;
+
+        fprintf(stderr, "request size:  %zu bytes, %zu headers\n", len, req.num_headers);
+        fprintf(stderr, "whole request: %.0f req/s\n", whole ? rounds * 1000.0 / whole : 0.0);
+        fprintf(stderr, "3 segments:    %.0f req/s\n", split ? rounds * 1000.0 / split : 0.0);
+        if (bytes != 2 * rounds * len)
+                failed = 1;
+        if (failed)
+                fprintf(stderr, "FAILED\n");
+        return failed;
+}
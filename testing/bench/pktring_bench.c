@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "pktring.h"
+
+/*
+ * 包环和包池的微基准：
+ * 1 单线程入队再出队，只测每个句柄的指令开销；
+ * 2 单生产者单消费者跨线程传递，批量分别为 1、8、32；
+ * 3 多生产者单消费者，2 个和 4 个生产者；
+ * 4 包池跨线程循环：一个线程分配包经环交给另一个线程，另一个线程放回包池。
+ * 跨线程的场景里消费者检查每个生产者的序号严格递增，句柄没有丢失、重复或乱序。
+ *
+ * 用法：pktring_bench [每个场景传递的句柄数] [环容量]
+ */
+
+#define MAX_PRODUCERS 4
+#define MAX_BURST 32
+
+typedef struct producer_arg
+{
+        pktring_t *ring;
+        int id;
+        int mp;
+        unsigned burst;
+        size_t count;
+} producer_arg_t;
+
+static int failed;
+
+static uint64_t now_ns()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, size_t count, uint64_t ns)
+{
+        fprintf(stderr, "%-28s %8.1f Mhandles/s  %6.2f ns/handle\n", name,
+                ns ? count * 1e3 / ns : 0.0, count ? (double)ns / count : 0.0);
+}
+
+/* 句柄编码为 (序号 << 2 | 生产者号) + 1，不会是 NULL */
+static void *encode(size_t seq, int id)
+{
+        return (void *)(uintptr_t)((seq << 2 | id) + 1);
+}
+
+static void *run_producer(void *arg)
+{
+        producer_arg_t *p = arg;
+        void *objs[MAX_BURST];
+        size_t seq = 0;
+        while (seq < p->count)
+        {
+                unsigned n = p->count - seq < p->burst ? p->count - seq : p->burst;
+                for (unsigned i = 0; i < n; i++)
+                        objs[i] = encode(seq + i, p->id);
+                unsigned done = 0;
+                while (done < n) // 环满时让出 CPU，单核机器上消费者才能运行
+                {
+                        unsigned k = p->mp ? pktring_mp_enqueue(p->ring, objs + done, n - done)
+                                           : pktring_sp_enqueue(p->ring, objs + done, n - done);
+                        done += k;
+                        if (k == 0)
+                                sched_yield();
+                }
+                seq += n;
+        }
+        return NULL;
+}
+
+/* 在本线程消费，检查每个生产者的序号 */
+static void consume(pktring_t *ring, int producers, unsigned burst, size_t count)
+{
+        size_t next[MAX_PRODUCERS] = {0};
+        size_t total = count * producers, received = 0;
+        void *objs[MAX_BURST];
+        while (received < total)
+        {
+                unsigned n = pktring_sc_dequeue(ring, objs, burst);
+                if (n == 0)
+                {
+                        sched_yield();
+                        continue;
+                }
+                for (unsigned i = 0; i < n; i++)
+                {
+                        uintptr_t v = (uintptr_t)objs[i] - 1;
+                        int id = v & 3;
+                        if (id >= producers || (v >> 2) != next[id])
+                        {
+                                fprintf(stderr, "handle out of order: producer %d, seq %zu, expected %zu\n",
+                                        id, (size_t)(v >> 2), id < producers ? next[id] : 0);
+                                failed = 1;
+                                return;
+                        }
+                        next[id]++;
+                }
+                received += n;
+        }
+}
+
+static void bench_single(uint32_t size, unsigned burst, size_t count)
+{
+        pktring_t ring;
+        void *objs[MAX_BURST];
+        char name[64];
+        pktring_init(&ring, size);
+        for (unsigned i = 0; i < burst; i++)
+                objs[i] = encode(i, 0);
+        uint64_t start = now_ns();
+        for (size_t done = 0; done < count; done += burst)
+        {
+                pktring_sp_enqueue(&ring, objs, burst);
+                if (pktring_sc_dequeue(&ring, objs, burst) != burst)
+                        failed = 1;
+        }
+        uint64_t elapsed = now_ns() - start;
+        snprintf(name, sizeof(name), "single thread, burst %u", burst);
+        report(name, count, elapsed);
+        pktring_free(&ring);
+}
+
+static void bench_threads(uint32_t size, int producers, int mp, unsigned burst, size_t count)
+{
+        pktring_t ring;
+        pthread_t threads[MAX_PRODUCERS];
+        producer_arg_t args[MAX_PRODUCERS];
+        char name[64];
+        pktring_init(&ring, size);
+        uint64_t start = now_ns();
+        for (int i = 0; i < producers; i++)
+        {
+                args[i] = (producer_arg_t){.ring = &ring, .id = i, .mp = mp, .burst = burst, .count = count};
+                pthread_create(&threads[i], NULL, run_producer, &args[i]);
+        }
+        consume(&ring, producers, burst, count);
+        for (int i = 0; i < producers; i++)
+                pthread_join(threads[i], NULL);
+        uint64_t elapsed = now_ns() - start;
+        if (mp)
+                snprintf(name, sizeof(name), "mpsc %d producers, burst %u", producers, burst);
+        else
+                snprintf(name, sizeof(name), "spsc, burst %u", burst);
+        report(name, count * producers, elapsed);
+        pktring_free(&ring);
+}
+
+typedef struct pool_arg
+{
+        pktring_t *ring;
+        size_t count;
+} pool_arg_t;
+
+/* 另一个线程：取出包，检查内容，放回包池 */
+static void *run_releaser(void *arg)
+{
+        pool_arg_t *p = arg;
+        pkt_t *pkts[MAX_BURST];
+        size_t received = 0;
+        while (received < p->count)
+        {
+                unsigned n = pktring_sc_dequeue(p->ring, (void **)pkts, MAX_BURST);
+                if (n == 0)
+                {
+                        sched_yield();
+                        continue;
+                }
+                for (unsigned i = 0; i < n; i++)
+                        if (pkts[i]->len != 60 || pkts[i]->data[0] != (uint8_t)(received + i))
+                                failed = 1;
+                pkt_free(pkts, n);
+                received += n;
+        }
+        return NULL;
+}
+
+static void bench_pool(uint32_t size, size_t count)
+{
+        pktring_t ring;
+        pool_arg_t arg = {.ring = &ring, .count = count};
+        pthread_t thread;
+        pkt_t *pkts[MAX_BURST];
+        pktpool_t *pool = pktpool_create(size);
+        pktring_init(&ring, size);
+        uint64_t start = now_ns();
+        pthread_create(&thread, NULL, run_releaser, &arg);
+        for (size_t sent = 0; sent < count;)
+        {
+                unsigned want = count - sent < MAX_BURST ? count - sent : MAX_BURST;
+                unsigned n = pkt_alloc(pool, pkts, want);
+                if (n == 0)
+                {
+                        sched_yield();
+                        continue;
+                }
+                for (unsigned i = 0; i < n; i++)
+                {
+                        pkts[i]->len = 60;
+                        pkts[i]->data[0] = sent + i;
+                }
+                unsigned done = 0;
+                while (done < n) // 环容量等于包数，这里不会满，保险起见还是重试
+                        done += pktring_sp_enqueue(&ring, (void *const *)pkts + done, n - done);
+                sent += n;
+        }
+        pthread_join(thread, NULL);
+        uint64_t elapsed = now_ns() - start;
+        report("pool alloc/handoff/free", count, elapsed);
+        // 所有包都应该回到了包池
+        if (pkt_alloc(pool, pkts, 1) != 1 || pktring_count(&pool->free) != pool->count - 1)
+                failed = 1;
+        pkt_free(pkts, 1);
+        pktring_free(&ring);
+        pktpool_destroy(pool);
+}
+
+int main(int argc, char *argv[])
+{
+        size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+        uint32_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+        pktring_t ring;
+        if (pktring_init(&ring, size) != 0)
+        {
+                fprintf(stderr, "ring size must be a power of two\n");
+                return 1;
+        }
+        pktring_free(&ring);
+        count = count / MAX_BURST * MAX_BURST; // 单线程场景按整批进行
+
+        bench_single(size, 1, count);
+        bench_single(size, 8, count);
+        bench_single(size, 32, count);
+        bench_threads(size, 1, 0, 1, count);
+        bench_threads(size, 1, 0, 8, count);
+        bench_threads(size, 1, 0, 32, count);
+        bench_threads(size, 2, 1, 8, count / 2);
+        bench_threads(size, 4, 1, 8, count / 4);
+        bench_pool(size, count);
+
+        if (failed)
+        {
+                fprintf(stderr, "FAILED\n");
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcp.h"
+#include "utils.h"
+#include "bench.h"
+
+/*
+ * SYN 洪泛测试：直接调用 tcp_in，不经过 ethernet/ip/pcap。
+ * 伪造源地址的 SYN 不断涌入，其间穿插完整三次握手的正常客户端，
+ * 正常客户端完成握手后从 accept 队列取出，统计正常客户端的接入率、处理速度，以及 TCP 占用的内存是否有界。
+ *
+ * 用法：syn_flood [洪泛 SYN 数] [每个正常客户端之间的洪泛 SYN 数]
+ */
+
+static net_stack_t stack = {.if_ip = NET_IF_IP}; // 不链接 net.c，自己提供协议栈实例
+_Thread_local net_stack_t *net_stack_current = &stack;
+
+static buf_t seg;
+static const tcp_flags_t flags_syn = {.syn = 1};
+static const tcp_flags_t flags_rst = {.rst = 1};
+
+static struct
+{
+        uint8_t ip[NET_IP_LEN];
+        uint16_t port;
+        uint32_t seq, ack;
+        tcp_flags_t flags;
+        size_t count;
+} last_out; // 最近一个发出的报文
+
+static size_t connected;
+
+void net_add_protocol(uint16_t protocol, net_handler_t handler) {}
+void net_add_fini(net_fini_t fini) {}
+
+void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+{
+        tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+        memcpy(last_out.ip, ip, NET_IP_LEN);
+        last_out.port = swap16(hdr->dst_port16);
+        last_out.seq = swap32(hdr->seq_number32);
+        last_out.ack = swap32(hdr->ack_number32);
+        last_out.flags = hdr->flags;
+        last_out.count++;
+}
+
+static void handler(tcp_connect_t *connect, connect_state_t state)
+{
+        if (state == TCP_CONN_CONNECTED)
+                connected++;
+}
+
+static void send_seg(uint8_t *ip, uint16_t port, uint32_t seq, uint32_t ack, tcp_flags_t flags)
+{
+        buf_init(&seg, bench_tcp_len(flags, 0));
+        bench_tcp_seg(seg.data, ip, port, 80, seq, ack, flags, NULL, 0);
+        tcp_in(&seg, ip);
+}
+
+int main(int argc, char *argv[])
+{
+        size_t floods = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+        size_t ratio = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+        if (ratio == 0)
+                ratio = 1;
+        tcp_init();
+        tcp_listen(80, handler, TCP_ACCEPT_BACKLOG);
+        srand(1);
+
+        // 还没发过 cookie 时，没有连接的 ACK 直接复位，不做 cookie 校验
+        uint8_t stray_ip[NET_IP_LEN] = {10, 1, 0, 1};
+        tcp_stat_t stat;
+        send_seg(stray_ip, 30000, 1000, 12345, tcp_flags_ack);
+        tcp_get_stat(&stat);
+        int stray_ok = last_out.flags.rst && stat.syncookies_failed == 0;
+
+        size_t clients = 0, accepted = 0, max_half_open = 0, max_bytes = 0;
+        uint64_t start = time_ms();
+        for (size_t i = 1; i <= floods; i++)
+        {
+                uint8_t ip[NET_IP_LEN] = {172, 16 + (rand() & 0xF), rand() & 0xFF, rand() & 0xFF};
+                send_seg(ip, 1024 + (rand() & 0x7FFF), rand(), 0, flags_syn);
+                if (i % ratio)
+                        continue;
+
+                // 正常客户端：SYN -> SYN + ACK -> ACK，接入后发 RST 释放连接
+                uint8_t cip[NET_IP_LEN] = {10, 0, (clients >> 8) & 0xFF, clients & 0xFF};
+                uint16_t cport = 40000 + (clients & 0x3FFF);
+                uint32_t isn = rand();
+                size_t before = connected;
+                clients++;
+                send_seg(cip, cport, isn, 0, flags_syn);
+                if (!last_out.flags.syn || memcmp(last_out.ip, cip, NET_IP_LEN) || last_out.port != cport)
+                        continue;
+                send_seg(cip, cport, isn + 1, last_out.seq + 1, tcp_flags_ack);
+                if (connected == before || tcp_accept(80) == NULL)
+                        continue;
+                accepted++;
+                tcp_get_stat(&stat);
+                if (stat.half_open > max_half_open)
+                        max_half_open = stat.half_open;
+                if (stat.bytes > max_bytes)
+                        max_bytes = stat.bytes;
+                send_seg(cip, cport, isn + 1, 0, flags_rst);
+        }
+        uint64_t elapsed = time_ms() - start;
+        tcp_get_stat(&stat);
+        tcp_listen_stat_t lstat;
+        tcp_listen_stat(80, &lstat);
+
+        fprintf(stderr, "flood SYNs:        %zu (%.0f pkt/s)\n", floods,
+                elapsed ? floods * 1000.0 / elapsed : 0.0);
+        fprintf(stderr, "clients accepted:  %zu / %zu (%.1f%%)\n", accepted, clients,
+                clients ? accepted * 100.0 / clients : 100.0);
+        fprintf(stderr, "half-open:         %zu (max %zu, backlog %d)\n", stat.half_open, max_half_open, TCP_SYN_BACKLOG);
+        fprintf(stderr, "syncookies:        sent %zu, ok %zu, failed %zu\n",
+                stat.syncookies_sent, stat.syncookies_ok, stat.syncookies_failed);
+        fprintf(stderr, "accept queue:      queued %zu, accepted %zu, overflow %zu\n",
+                lstat.queued, lstat.accepted, lstat.overflow);
+        fprintf(stderr, "memory:            %zu bytes (max %zu), %zu connects\n", stat.bytes, max_bytes, stat.connects);
+
+        if (!stray_ok)
+                fprintf(stderr, "stray ACK before any cookie was not reset, or was checked as a cookie\n");
+        if (accepted != clients || max_half_open > TCP_SYN_BACKLOG || !stray_ok)
+        {
+                fprintf(stderr, "FAILED\n");
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "net.h"
+#include "driver.h"
+#include "udp.h"
+#include "utils.h"
+#include "vlink.h"
+
+/*
+ * 虚拟链路上的端到端基准：同一个进程里的两个协议栈实例各在一个线程里运行，通过 vlink 连在同一个网段上。
+ * 实例 A 向实例 B 的 UDP 回显端口发数据报，最多 window 个在途，经过 ARP 解析、IP、UDP 往返，
+ * 统计往返时延、丢包、乱序和吞吐量，并检查它们与链路配置的损伤一致。
+ *
+ * 用法：vlink_bench [数据报数] [数据报大小] [在途窗口] [单向时延 us] [丢包率] [乱序率] [带宽 Mbit/s]
+ */
+
+#define ECHO_PORT 7
+#define CLIENT_PORT 5000
+#define WARMUP_TIMEOUT_US 5000000 // 等待 ARP 解析和第一个回显的时间
+#define PROBE_INTERVAL_US 100000  // 预热期间重发探测数据报的间隔
+
+typedef struct probe
+{
+        uint32_t seq;
+        uint64_t sent_us;
+} probe_t;
+
+enum
+{
+        PENDING,
+        RECEIVED,
+        LOST,
+};
+
+static uint8_t mac_a[NET_MAC_LEN] = {0x02, 0, 0, 0, 0, 0x01};
+static uint8_t mac_b[NET_MAC_LEN] = {0x02, 0, 0, 0, 0, 0x02};
+static uint8_t ip_a[NET_IP_LEN] = {10, 0, 0, 1};
+static uint8_t ip_b[NET_IP_LEN] = {10, 0, 0, 2};
+
+static size_t count;
+static uint8_t *state;
+static uint64_t *sent_at;
+static uint32_t *rtt; // 收到的数据报的往返时延（微秒）
+static size_t received, late, reordered, warm;
+static uint32_t highest;
+static uint8_t payload[ETHERNET_MAX_TRANSPORT_UNIT];
+static atomic_int echo_ready; // 回显实例启动成功为 1，失败为 -1
+static atomic_int stop;
+
+/* 实例 B：原样回显 */
+static void echo_handler(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port)
+{
+        udp_send(data, len, ECHO_PORT, src_ip, src_port);
+}
+
+static void echo_reply(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port)
+{
+        probe_t probe;
+        if (len < sizeof(probe))
+                return;
+        memcpy(&probe, data, sizeof(probe));
+        if (probe.seq == UINT32_MAX) // 预热探测
+        {
+                warm = 1;
+                return;
+        }
+        if (probe.seq >= count)
+                return;
+        if (state[probe.seq] == LOST)
+        {
+                late++;
+                return;
+        }
+        if (state[probe.seq] != PENDING)
+                return;
+        state[probe.seq] = RECEIVED;
+        rtt[received++] = vlink_now_us() - probe.sent_us;
+        if (probe.seq < highest)
+                reordered++;
+        else
+                highest = probe.seq;
+}
+
+static void send_probe(uint32_t seq, size_t size)
+{
+        probe_t probe = {.seq = seq, .sent_us = vlink_now_us()};
+        memcpy(payload, &probe, sizeof(probe));
+        udp_send(payload, size, CLIENT_PORT, ip_b, ECHO_PORT);
+}
+
+/* 轮询一次协议栈，没有到期的帧时让出 CPU，单核机器上两个实例才能交替运行 */
+static void poll_once()
+{
+        if (vlink_ready())
+                net_poll();
+        else
+                sched_yield();
+}
+
+/* 实例 B 的线程：自己的协议栈实例，连到链路的 1 号端口 */
+static void *run_echo(void *arg)
+{
+        net_stack_t *stack = net_stack_create(mac_b, ip_b);
+        if (stack == NULL)
+        {
+                atomic_store(&echo_ready, -1);
+                return NULL;
+        }
+        net_stack_bind(stack);
+        if (vlink_attach(arg, 1, mac_b) != 0 || net_init() != 0)
+        {
+                atomic_store(&echo_ready, -1);
+                return NULL;
+        }
+        udp_open(ECHO_PORT, echo_handler);
+        atomic_store(&echo_ready, 1);
+        while (!atomic_load(&stop))
+                poll_once();
+        driver_close();
+        net_stack_destroy(stack);
+        return NULL;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+        uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+        return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+        count = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+        size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : 512;
+        size_t window = argc > 3 ? strtoul(argv[3], NULL, 10) : 32;
+        vlink_config_t config = {
+            .latency_us = argc > 4 ? strtoul(argv[4], NULL, 10) : 1000,
+            .loss = argc > 5 ? atof(argv[5]) : 0,
+            .reorder = argc > 6 ? atof(argv[6]) : 0,
+            .bandwidth_bps = argc > 7 ? strtoull(argv[7], NULL, 10) * 1000000 : 0,
+            .seed = 1,
+        };
+        config.reorder_delay_us = config.latency_us > 500 ? config.latency_us : 500;
+        if (size < sizeof(probe_t) || size > ETHERNET_MAX_TRANSPORT_UNIT - 28)
+                size = 512;
+        if (window < 1)
+                window = 1;
+
+        vlink_t *link = vlink_create(&config, 2);
+        if (link == NULL)
+        {
+                fprintf(stderr, "vlink_create failed\n");
+                return 1;
+        }
+        pthread_t echo;
+        net_stack_t *stack = net_stack_create(mac_a, ip_a);
+        if (stack == NULL || pthread_create(&echo, NULL, run_echo, link) != 0)
+        {
+                fprintf(stderr, "failed to start the stacks\n");
+                return 1;
+        }
+        net_stack_bind(stack);
+        while (atomic_load(&echo_ready) == 0)
+                sched_yield();
+        if (atomic_load(&echo_ready) < 0 || vlink_attach(link, 0, mac_a) != 0 || net_init() != 0)
+        {
+                fprintf(stderr, "failed to start the stacks\n");
+                return 1;
+        }
+        udp_open(CLIENT_PORT, echo_reply);
+        state = calloc(count, 1);
+        sent_at = calloc(count, sizeof(uint64_t));
+        rtt = calloc(count + 1, sizeof(uint32_t));
+
+        // 1 预热：ARP 解析完成、第一个回显回来之前不计时，ARP 请求或探测丢了就重发
+        uint64_t start = vlink_now_us(), last_probe = 0;
+        while (!warm && vlink_now_us() - start < WARMUP_TIMEOUT_US)
+        {
+                if (vlink_now_us() - last_probe > PROBE_INTERVAL_US)
+                {
+                        send_probe(UINT32_MAX, size);
+                        last_probe = vlink_now_us();
+                }
+                poll_once();
+        }
+
+        // 2 保持 window 个在途，超过超时时间还没回来的算丢失
+        uint64_t timeout = 2 * (config.latency_us + config.reorder_delay_us) + 100000;
+        size_t sent = 0, oldest = 0, outstanding = 0;
+        start = vlink_now_us();
+        while (warm && oldest < count)
+        {
+                while (sent < count && outstanding < window)
+                {
+                        sent_at[sent] = vlink_now_us();
+                        send_probe(sent++, size);
+                        outstanding++;
+                }
+                poll_once();
+                uint64_t now = vlink_now_us();
+                for (size_t i = oldest; i < sent; i++) // 找出超时的，收到的也从在途中去掉
+                {
+                        if (state[i] == PENDING && now - sent_at[i] > timeout)
+                                state[i] = LOST;
+                        else if (state[i] == PENDING)
+                                continue;
+                        if (i == oldest)
+                                oldest++;
+                }
+                outstanding = 0;
+                for (size_t i = oldest; i < sent; i++)
+                        outstanding += state[i] == PENDING;
+        }
+        uint64_t elapsed = vlink_now_us() - start;
+        atomic_store(&stop, 1);
+        pthread_join(echo, NULL);
+        driver_close();
+        net_stack_destroy(stack);
+
+        vlink_stat_t sa, sb;
+        vlink_get_stat(link, 0, &sa);
+        vlink_get_stat(link, 1, &sb);
+        qsort(rtt, received, sizeof(uint32_t), cmp_u32);
+        size_t lost = count - received;
+        double expected_loss = 1 - (1 - config.loss) * (1 - config.loss);
+        fprintf(stderr, "link:        latency %u us, loss %.3f, reorder %.3f, bandwidth %llu bit/s\n",
+                config.latency_us, config.loss, config.reorder, (unsigned long long)config.bandwidth_bps);
+        fprintf(stderr, "datagrams:   %zu sent, %zu echoed, %zu lost (%.2f%%, expected %.2f%%), %zu late, %zu reordered\n",
+                count, received, lost, count ? 100.0 * lost / count : 0, 100 * expected_loss, late, reordered);
+        fprintf(stderr, "rtt:         min %u us, p50 %u us, p99 %u us\n",
+                received ? rtt[0] : 0, received ? rtt[received / 2] : 0, received ? rtt[received * 99 / 100] : 0);
+        fprintf(stderr, "throughput:  %.0f datagrams/s, %.2f Mbit/s echoed\n",
+                elapsed ? received * 1e6 / elapsed : 0.0, elapsed ? received * size * 8.0 / elapsed : 0.0);
+        fprintf(stderr, "vlink A->B:  %zu frames, %zu lost, %zu delayed, %zu queue drops\n", sa.tx_frames, sa.lost, sa.reordered, sa.queue_drops);
+        fprintf(stderr, "vlink B->A:  %zu frames, %zu lost, %zu delayed, %zu queue drops\n", sb.tx_frames, sb.lost, sb.reordered, sb.queue_drops);
+        vlink_destroy(link);
+
+        // 3 检查测到的结果与链路配置一致
+        int failed = !warm;
+        if (received && rtt[0] < 2 * config.latency_us)
+                failed = 1; // 往返时延不可能小于两倍单向时延
+        if (config.loss == 0 && lost > sa.queue_drops + sb.queue_drops)
+                failed = 1; // 没有配置丢包时只能因为队列满而丢
+        if (config.loss > 0 && (lost < count * expected_loss / 3 || lost > count * expected_loss * 3 + 10))
+                failed = 1;
+        if (config.reorder == 0 && reordered)
+                failed = 1;
+        if (config.reorder > 0 && count >= 100 && reordered == 0)
+                failed = 1;
+        if (failed)
+        {
+                fprintf(stderr, "FAILED\n");
+                return 1;
+        }
+        return 0;
+}
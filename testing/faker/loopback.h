@@ -0,0 +1,20 @@
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 进程内的回环驱动，代替 driver.c 里的 pcap：
+ * 测试程序用 loopback_inject 把以太网帧交给协议栈（driver_recv 取走），
+ * 协议栈 driver_send 发出的帧排在另一个队列里，由 loopback_drain 交还给测试程序。
+ */
+
+typedef void (*loopback_frame_fn)(const uint8_t *frame, size_t len, void *arg);
+
+void loopback_inject(const uint8_t *frame, size_t len);
+size_t loopback_pending(void);
+size_t loopback_drain(loopback_frame_fn fn, void *arg);
+size_t loopback_copied(void);
+
+#endif
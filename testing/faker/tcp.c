@@ -4,3 +4,4 @@ void tcp_init() {}
 int tcp_open(uint16_t port, tcp_handler_t handler) {
     return 0;
 }
+void tcp_poll() {}
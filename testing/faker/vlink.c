@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "driver.h"
+#include "vlink.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#define VLINK_FRAME_MAX (ETHERNET_MAX_TRANSPORT_UNIT + 14) // 以太网帧的最大长度
+
+typedef struct vlink_slot
+{
+        uint64_t deliver_us; // 到达接收方的时间
+        uint16_t len;
+        uint8_t delayed;  // 被额外延迟，后面的帧可能比它先到
+        uint8_t consumed; // 接收方已经取走，只由接收方写
+        uint8_t data[VLINK_FRAME_MAX];
+} vlink_slot_t;
+
+typedef struct vlink_ring // 单生产者单消费者环，head 只由接收方推进，tail 只由发送方推进
+{
+        _Atomic uint32_t head;
+        _Atomic uint32_t tail;
+        vlink_slot_t slots[VLINK_RING_SLOTS];
+} vlink_ring_t;
+
+enum
+{
+        VLINK_PORT_FREE,     // 没有协议栈连接
+        VLINK_PORT_CLAIMED,  // vlink_attach 占住了端口，MAC 还没写好，转发时不看它
+        VLINK_PORT_ATTACHED, // MAC 已经写好，以 release 语义发布
+};
+
+typedef struct vlink_port
+{
+        uint8_t mac[NET_MAC_LEN];
+        _Atomic int attached;             // VLINK_PORT_FREE、CLAIMED 或 ATTACHED
+        uint64_t busy_until;              // 发送方向的线路空闲时刻，只由本端口写
+        uint32_t rand;                    // 丢包和乱序的随机数状态，只由本端口写
+        vlink_stat_t stat;
+        vlink_ring_t rx[VLINK_MAX_PORTS]; // rx[i] 是从端口 i 发来的帧
+} vlink_port_t;
+
+struct vlink
+{
+        vlink_config_t config;
+        int ports;
+        vlink_port_t port[VLINK_MAX_PORTS];
+};
+
+typedef struct vlink_endpoint // 协议栈实例连接的链路和端口，放在 net_stack()->driver
+{
+        vlink_t *link;
+        int port;
+} vlink_endpoint_t;
+
+/**
+ * @brief 单调时钟，所有进程共用同一个时间基准
+ */
+uint64_t vlink_now_us(void)
+{
+#ifdef _WIN32
+        LARGE_INTEGER freq, count;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&count);
+        return count.QuadPart * 1000000 / freq.QuadPart;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/**
+ * @brief xorshift32，返回 [0, 1) 之间的随机数
+ */
+static double vlink_random(vlink_port_t *port)
+{
+        uint32_t x = port->rand;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        port->rand = x;
+        return x / 4294967296.0;
+}
+
+/**
+ * @brief 创建一条链路。链路放在共享内存里，创建之后 fork 出的子进程可以连接到其他端口
+ *
+ * @param config 链路的损伤参数
+ * @param ports 端口数，不超过 VLINK_MAX_PORTS
+ * @return vlink_t* 失败为 NULL
+ */
+vlink_t *vlink_create(const vlink_config_t *config, int ports)
+{
+        if (ports < 1 || ports > VLINK_MAX_PORTS)
+                return NULL;
+#ifdef _WIN32
+        vlink_t *link = calloc(1, sizeof(vlink_t)); // 没有 fork，只能在线程之间共享
+        if (link == NULL)
+                return NULL;
+#else
+        vlink_t *link = mmap(NULL, sizeof(vlink_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (link == MAP_FAILED)
+                return NULL;
+#endif
+        link->config = *config;
+        link->ports = ports;
+        for (int i = 0; i < ports; i++)
+                link->port[i].rand = (config->seed ? config->seed : 1) * 2654435761u + i * 40503u + 1;
+        return link;
+}
+
+void vlink_destroy(vlink_t *link)
+{
+#ifdef _WIN32
+        free(link);
+#else
+        munmap(link, sizeof(vlink_t));
+#endif
+}
+
+/**
+ * @brief 端口上是否连着协议栈，acquire 读，和 vlink_attach 里发布 MAC 的 release 写配对
+ */
+static int vlink_port_attached(vlink_port_t *port)
+{
+        return atomic_load_explicit(&port->attached, memory_order_acquire) == VLINK_PORT_ATTACHED;
+}
+
+/**
+ * @brief 把当前协议栈实例的 driver_* 连接到链路的一个端口，之后调用 net_init 打开驱动
+ *
+ * @param link 链路
+ * @param port 端口号
+ * @param mac 这个端口上协议栈的 MAC 地址，用来按目的 MAC 转发
+ * @return int 成功为 0，端口不存在或已被占用为 -1
+ */
+int vlink_attach(vlink_t *link, int port, const uint8_t *mac)
+{
+        int expected = VLINK_PORT_FREE;
+        if (port < 0 || port >= link->ports)
+                return -1;
+        vlink_endpoint_t *self = malloc(sizeof(vlink_endpoint_t));
+        if (self == NULL)
+                return -1;
+        if (!atomic_compare_exchange_strong(&link->port[port].attached, &expected, VLINK_PORT_CLAIMED))
+        {
+                free(self);
+                return -1;
+        }
+        // 先写 MAC 再发布，别的端口看到 ATTACHED 时一定能看到这里写的 MAC
+        memcpy(link->port[port].mac, mac, NET_MAC_LEN);
+        atomic_store_explicit(&link->port[port].attached, VLINK_PORT_ATTACHED, memory_order_release);
+        self->link = link;
+        self->port = port;
+        net_stack()->driver = self;
+        return 0;
+}
+
+/**
+ * @brief 读取一个端口的收发计数
+ */
+void vlink_get_stat(vlink_t *link, int port, vlink_stat_t *stat)
+{
+        *stat = link->port[port].stat;
+}
+
+int driver_open()
+{
+        if (net_stack()->driver == NULL)
+        {
+                fprintf(stderr, "vlink: no port attached to this stack\n");
+                return -1;
+        }
+        return 0;
+}
+
+/**
+ * @brief 在一个环里找第一个已经到期、还没取走的帧
+ *
+ * 没被额外延迟的帧按发送顺序到期，遇到一个没到期的就可以停下；被额外延迟的帧要跳过去继续找。
+ */
+static vlink_slot_t *vlink_ring_due(vlink_ring_t *ring, uint64_t now)
+{
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        for (uint32_t i = head; i != tail; i++)
+        {
+                vlink_slot_t *slot = &ring->slots[i & (VLINK_RING_SLOTS - 1)];
+                if (slot->consumed)
+                        continue;
+                if (slot->deliver_us <= now)
+                        return slot;
+                if (!slot->delayed)
+                        break;
+        }
+        return NULL;
+}
+
+/**
+ * @brief 跳过环头部已经取走的帧，把空间还给发送方
+ */
+static void vlink_ring_release(vlink_ring_t *ring)
+{
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        while (head != tail && ring->slots[head & (VLINK_RING_SLOTS - 1)].consumed)
+                head++;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+}
+
+/**
+ * @brief 当前端口是否有已经到期的帧
+ */
+int vlink_ready(void)
+{
+        vlink_endpoint_t *self = net_stack()->driver;
+        vlink_port_t *port = &self->link->port[self->port];
+        uint64_t now = vlink_now_us();
+        for (int i = 0; i < self->link->ports; i++)
+                if (i != self->port && vlink_ring_due(&port->rx[i], now))
+                        return 1;
+        return 0;
+}
+
+int driver_recv(buf_t *buf)
+{
+        vlink_endpoint_t *self = net_stack()->driver;
+        vlink_port_t *port = &self->link->port[self->port];
+        uint64_t now = vlink_now_us();
+        for (int i = 0; i < self->link->ports; i++)
+        {
+                if (i == self->port)
+                        continue;
+                vlink_slot_t *slot = vlink_ring_due(&port->rx[i], now);
+                if (slot == NULL)
+                        continue;
+                buf_init(buf, slot->len);
+                memcpy(buf->data, slot->data, slot->len);
+                slot->consumed = 1;
+                vlink_ring_release(&port->rx[i]);
+                port->stat.rx_frames++;
+                port->stat.rx_bytes += buf->len;
+                return buf->len;
+        }
+        return 0;
+}
+
+/**
+ * @brief 把一帧放进目的端口的环，到达时间由发送方算好
+ */
+static void vlink_deliver(vlink_port_t *src, int src_port, vlink_port_t *dst, buf_t *buf, uint64_t deliver_us, int delayed)
+{
+        vlink_ring_t *ring = &dst->rx[src_port];
+        uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == VLINK_RING_SLOTS)
+        {
+                src->stat.queue_drops++;
+                return;
+        }
+        vlink_slot_t *slot = &ring->slots[tail & (VLINK_RING_SLOTS - 1)];
+        slot->deliver_us = deliver_us;
+        slot->len = buf->len;
+        slot->delayed = delayed;
+        slot->consumed = 0;
+        memcpy(slot->data, buf->data, buf->len);
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+int driver_send(buf_t *buf)
+{
+        vlink_endpoint_t *self = net_stack()->driver;
+        vlink_t *link = self->link;
+        vlink_port_t *port = &link->port[self->port];
+        const vlink_config_t *config = &link->config;
+        if (buf->len > VLINK_FRAME_MAX)
+                return -1;
+        port->stat.tx_frames++;
+        port->stat.tx_bytes += buf->len;
+
+        // 1 带宽：帧在发送队列里排在前一帧之后，按线路速率串行化，丢掉的帧也占用线路
+        uint64_t now = vlink_now_us();
+        uint64_t sent = now;
+        if (config->bandwidth_bps)
+        {
+                uint64_t start = port->busy_until > now ? port->busy_until : now;
+                port->busy_until = start + (buf->len + VLINK_WIRE_OVERHEAD) * 8 * 1000000ULL / config->bandwidth_bps;
+                sent = port->busy_until;
+        }
+
+        // 2 丢包
+        if (config->loss > 0 && vlink_random(port) < config->loss)
+        {
+                port->stat.lost++;
+                return 0;
+        }
+
+        // 3 传播时延，部分帧额外延迟造成乱序
+        uint64_t deliver_us = sent + config->latency_us;
+        int delayed = config->reorder > 0 && vlink_random(port) < config->reorder;
+        if (delayed)
+        {
+                deliver_us += config->reorder_delay_us;
+                port->stat.reordered++;
+        }
+
+        // 4 按目的 MAC 转发，广播、组播和找不到的单播发给其他所有端口
+        const uint8_t *dst_mac = buf->data;
+        int flood = dst_mac[0] & 1;
+        if (!flood)
+        {
+                flood = 1;
+                for (int i = 0; i < link->ports; i++)
+                {
+                        if (i != self->port && vlink_port_attached(&link->port[i]) && !memcmp(link->port[i].mac, dst_mac, NET_MAC_LEN))
+                        {
+                                vlink_deliver(port, self->port, &link->port[i], buf, deliver_us, delayed);
+                                flood = 0;
+                                break;
+                        }
+                }
+        }
+        if (flood)
+        {
+                for (int i = 0; i < link->ports; i++)
+                        if (i != self->port && vlink_port_attached(&link->port[i]))
+                                vlink_deliver(port, self->port, &link->port[i], buf, deliver_us, delayed);
+        }
+        return 0;
+}
+
+void driver_close()
+{
+        vlink_endpoint_t *self = net_stack()->driver;
+        if (self == NULL)
+                return;
+        atomic_store(&self->link->port[self->port].attached, VLINK_PORT_FREE);
+        free(self);
+        net_stack()->driver = NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef VLINK_H
+#define VLINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+/*
+ * 共享内存上的虚拟链路，代替 driver.c 里的 pcap，把多个协议栈实例连在同一个二层网段上。
+ * 链路像交换机一样按目的 MAC 转发，广播和未知单播发给其他所有端口；
+ * 每个方向一个无锁的单生产者单消费者环，放在 MAP_SHARED 内存里，fork 出的进程和线程都能用。
+ * 发送时按配置模拟丢包、带宽（串行化排队）、传播时延和乱序，接收方只取已经到期的帧。
+ *
+ * 协议栈的 driver_* 作用于当前协议栈实例（net_stack()）vlink_attach 的端口，
+ * 同一个进程里的多个实例可以各自连到一个端口，在各自的线程里运行。
+ */
+
+#define VLINK_MAX_PORTS 4       // 一条链路最多连接的协议栈实例数
+#define VLINK_RING_SLOTS 256    // 每个方向的环能排队的帧数，必须是 2 的幂，满了之后尾部丢弃
+#define VLINK_WIRE_OVERHEAD 24  // 每帧在线路上额外占用的字节数：前导码、帧间隙和 FCS
+
+typedef struct vlink vlink_t;
+
+typedef struct vlink_config
+{
+        uint32_t latency_us;       // 单向传播时延（微秒）
+        uint64_t bandwidth_bps;    // 每个端口的发送带宽（比特/秒），为 0 表示不限速
+        double loss;               // 丢包概率
+        double reorder;            // 一帧被额外延迟、让后面的帧超过它的概率
+        uint32_t reorder_delay_us; // 被乱序的帧额外延迟的时间（微秒）
+        uint32_t seed;             // 丢包和乱序的随机数种子，相同的种子得到相同的丢包序列
+} vlink_config_t;
+
+typedef struct vlink_stat // 一个端口的收发计数
+{
+        size_t tx_frames;   // 发出的帧数
+        size_t tx_bytes;    // 发出的字节数
+        size_t lost;        // 模拟丢掉的帧数
+        size_t queue_drops; // 对端的环满而丢掉的帧数
+        size_t reordered;   // 被额外延迟的帧数
+        size_t rx_frames;   // 收到的帧数
+        size_t rx_bytes;    // 收到的字节数
+} vlink_stat_t;
+
+vlink_t *vlink_create(const vlink_config_t *config, int ports);
+void vlink_destroy(vlink_t *link);
+int vlink_attach(vlink_t *link, int port, const uint8_t *mac);
+int vlink_ready(void);
+void vlink_get_stat(vlink_t *link, int port, vlink_stat_t *stat);
+uint64_t vlink_now_us(void);
+
+#endif
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <pcap.h>
 #include "map.h"
+#include "net.h"
 #include "arp.h"
 #include "utils.h"
 
@@ -29,9 +30,6 @@ FILE *udp_fout;
 FILE *out_log;
 FILE *demo_log;
 
-extern map_t arp_table;
-extern map_t arp_buf;
-
 // char* state[16] = {
 //         [ARP_PENDING] "pending",
 //         [ARP_VALID]   "valid  ",
@@ -148,23 +146,25 @@ static inline int map_entry_valid(map_t *map, const void *entry)
 }
 
 void log_tab_buf(){
+        map_t *arp_table = &net_stack()->arp_table;
+        map_t *arp_buf = &net_stack()->arp_buf;
         fprintf(arp_log_f, "<====== arp table =======>\n");
-        for (size_t i = 0; i < arp_table.max_size; i++)
+        for (size_t i = 0; i < arp_table->max_size; i++)
         {
-                uint8_t *entry = (uint8_t*) map_entry_get(&arp_table, i);
-                if (map_entry_valid(&arp_table, entry))
+                uint8_t *entry = (uint8_t*) map_entry_get(arp_table, i);
+                if (map_entry_valid(arp_table, entry))
                         fprintf(arp_log_f, "%s -> %s\n",
                                 print_ip(entry),
-                                print_mac(entry + arp_table.key_len));
+                                print_mac(entry + arp_table->key_len));
         }
 
         fprintf(arp_log_f, "<====== arp buf =======>\n");
-        for (size_t i = 0; i < arp_buf.max_size; i++)
+        for (size_t i = 0; i < arp_buf->max_size; i++)
         {
-                uint8_t *entry = (uint8_t*) map_entry_get(&arp_buf, i);
-                if (map_entry_valid(&arp_buf, entry)) {
+                uint8_t *entry = (uint8_t*) map_entry_get(arp_buf, i);
+                if (map_entry_valid(arp_buf, entry)) {
                         fprintf(arp_log_f, "%s -> ", print_ip(entry));
-                        buf_t * buf = (buf_t*) (entry + arp_buf.key_len);
+                        buf_t * buf = (buf_t*) (entry + arp_buf->key_len);
                         for(int i = 0; i < buf->len; i++){
                                 fprintf(arp_log_f," %02x",buf->data[i]);
                         }
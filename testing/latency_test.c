@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "latency.h"
+
+/*
+ * 时延直方图的测试：
+ * 1 分桶：桶的下界不超过落进来的值，相对误差不超过 1 / LATENCY_SUB_BUCKETS，桶号随值单调；
+ * 2 分位数、平均值、两次快照相减和输出；
+ * 3 TSC 校准：睡 20 毫秒，换算出的纳秒数和单调时钟对得上；
+ * 4 很慢的计数器（每周期几十纳秒）换算一小时的周期数也不溢出。
+ */
+
+static int failed;
+
+static void check(int ok, const char *what)
+{
+        if (!ok)
+        {
+                fprintf(stderr, "check failed: %s\n", what);
+                failed = 1;
+        }
+}
+
+static void test_buckets()
+{
+        int ok = 1, prev = -1;
+        for (uint64_t v = 0; v < (1ull << (LATENCY_MAX_BITS + 2)); v = v < 4096 ? v + 1 : v + v / 97)
+        {
+                int i = latency_index(v);
+                ok &= i >= prev && i < LATENCY_BUCKETS;
+                prev = i;
+                if (v >> LATENCY_MAX_BITS)
+                        continue;
+                uint64_t low = latency_value(i);
+                ok &= low <= v && (v - low) * LATENCY_SUB_BUCKETS <= v;
+                ok &= i == LATENCY_BUCKETS - 1 || latency_value(i + 1) > v;
+        }
+        check(ok, "bucket bounds and monotonic index");
+        check(latency_index(LATENCY_SUB_BUCKETS - 1) == LATENCY_SUB_BUCKETS - 1, "exact below the sub-buckets");
+        check(latency_index(~0ull) == LATENCY_BUCKETS - 1, "overflow into the last bucket");
+}
+
+static void snap_of(latency_hist_t *hist, latency_snap_t *snap)
+{
+        snap->sum = hist->sum;
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+                snap->bucket[i] = hist->bucket[i];
+}
+
+static int near(uint64_t got, uint64_t want)
+{
+        return got <= want && (want - got) * LATENCY_SUB_BUCKETS <= want;
+}
+
+static void test_percentiles()
+{
+        static latency_hist_t hist;
+        static latency_snap_t base, snap[LATENCY_MAX];
+        for (uint64_t v = 1; v <= 1000; v++)
+                latency_record(&hist, v * 1000);
+        snap_of(&hist, &base);
+        for (int i = 0; i < 100; i++)
+                latency_record(&hist, 5000000);
+        snap_of(&hist, &snap[LATENCY_TCP_IN]);
+
+        check(latency_count(&base) == 1000 && base.sum == 500500000, "count and sum");
+        check(near(latency_percentile(&base, 50), 500000), "p50");
+        check(near(latency_percentile(&base, 99), 990000), "p99");
+        check(near(latency_percentile(&base, 100), 1000000), "max");
+        check(near(latency_percentile(&snap[LATENCY_TCP_IN], 95), 5000000), "p95 in the tail");
+        check(latency_percentile(&snap[LATENCY_UDP_IN], 50) == 0, "empty histogram");
+
+        latency_diff(&snap[LATENCY_TCP_IN], &base);
+        check(latency_count(&snap[LATENCY_TCP_IN]) == 100 && snap[LATENCY_TCP_IN].sum == 500000000, "diff of snapshots");
+        check(near(latency_percentile(&snap[LATENCY_TCP_IN], 1), 5000000), "diff keeps only the new records");
+
+        char buf[2048];
+        size_t len = latency_dump(snap, buf, sizeof(buf));
+        check(len == strlen(buf) && strstr(buf, "tcp_in              100   5000000") != NULL, "dump line");
+        check(latency_dump(snap, buf, 16) == len && strlen(buf) == 15, "dump truncates to the buffer");
+}
+
+static void test_calibrate()
+{
+        latency_calibrate();
+        latency_calibrate(); // 只测一次
+        uint64_t tsc = latency_tsc();
+        struct timespec nap = {0, 20000000};
+        nanosleep(&nap, NULL);
+        uint64_t ns = latency_ns(latency_tsc() - tsc);
+        check(ns >= 19000000 && ns < 200000000, "tsc converted to nanoseconds");
+        fprintf(stderr, "slept 20 ms, tsc says %.3f ms (%.4f ns per tick)\n", ns / 1e6,
+                (double)latency_tsc_mult / (1ull << latency_tsc_shift));
+}
+
+static void test_slow_counter()
+{
+        // aarch64 上 24 MHz 的计数器，每周期 41.67 纳秒，一小时的周期数换算后不能溢出
+        uint64_t mult = latency_tsc_mult;
+        int shift = latency_tsc_shift;
+        latency_tsc_shift = 26;
+        latency_tsc_mult = (1000000000ull << 26) / 24000000;
+        uint64_t ns = latency_ns(24000000ull * 3600);
+        check(ns <= 3600000000000ull && ns > 3599990000000ull, "slow counter over an hour");
+        check(latency_ns(24) == 999, "slow counter, one microsecond");
+        latency_tsc_mult = mult;
+        latency_tsc_shift = shift;
+}
+
+int main()
+{
+        test_buckets();
+        test_percentiles();
+        test_calibrate();
+        test_slow_counter();
+        fprintf(stderr, failed ? "FAILED\n" : "all passed\n");
+        return failed;
+}
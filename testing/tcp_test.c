@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tcp.h"
+#include "utils.h"
+#include "bench.h"
+
+/*
+ * TCP 状态机的测试：和 syn_flood 一样直接调用 tcp_in，截获 ip_out 发出的报文。
+ * 链接时用 --wrap=time_ms 换掉时钟，测试自己推进时间，不用真的等 2MSL。
+ * 1 TIME_WAIT：主动关闭后对端重传的 FIN 得到 ACK 而不是 RST；同一四元组更大序号的 SYN 可以复用；
+ *   2MSL 之后记录被删除；
+ * 2 延迟 ACK：单个数据段不立即确认，攒够 TCP_DELACK_SEGS 个段或到 TCP_DELACK_MS 时确认，
+ *   有数据要发时 ACK 捎带在数据段上，acks_delayed 记下省掉的纯 ACK；
+ * 3 Nagle、cork、flush 与 nodelay 各自发出的段数（segs_out）和长度；
+ * 4 发送缓存回绕：跨过 tx_buf 末尾的段内容和校验和都正确；
+ * 5 序号回绕：发送序号越过 2^32 后，对端的 ACK 仍然能确认数据。
+ */
+
+static net_stack_t stack = {.if_ip = NET_IF_IP}; // 不链接 net.c，自己提供协议栈实例
+_Thread_local net_stack_t *net_stack_current = &stack;
+
+static buf_t seg;
+static const tcp_flags_t flags_syn = {.syn = 1};
+static const tcp_flags_t flags_rst = {.rst = 1};
+static uint8_t peer_ip[NET_IP_LEN] = {10, 0, 0, 1};
+
+static struct
+{
+        uint16_t port;
+        uint32_t seq, ack;
+        tcp_flags_t flags;
+        size_t len; // 负载字节数
+        size_t count;
+        int bad_checksum;
+} last_out; // 最近一个发出的报文
+
+static uint8_t *sink;   // 不为 NULL 时，发出的负载按序号拷到这里
+static uint32_t sink_seq; // sink[0] 对应的序号
+
+static tcp_connect_t *conn; // 最近建立的连接
+static uint64_t now_ms = 1000000;
+static int failed;
+
+void net_add_protocol(uint16_t protocol, net_handler_t handler) {}
+void net_add_fini(net_fini_t fini) {}
+
+uint64_t __wrap_time_ms()
+{
+        return now_ms;
+}
+
+void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+{
+        tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+        tcp_peso_hdr_t peso;
+        memcpy(peso.src_ip, net_stack()->if_ip, NET_IP_LEN);
+        memcpy(peso.dst_ip, ip, NET_IP_LEN);
+        peso.placeholder = 0;
+        peso.protocol = NET_PROTOCOL_TCP;
+        peso.total_len16 = swap16(buf->len);
+        uint32_t sum = checksum_add(0, &peso, sizeof(peso));
+        last_out.bad_checksum |= checksum_fold(checksum_add(sum, buf->data, buf->len)) != 0;
+        last_out.port = swap16(hdr->dst_port16);
+        last_out.seq = swap32(hdr->seq_number32);
+        last_out.ack = swap32(hdr->ack_number32);
+        last_out.flags = hdr->flags;
+        last_out.len = buf->len - hdr->data_offset * 4;
+        last_out.count++;
+        if (sink && last_out.len)
+                memcpy(sink + (last_out.seq - sink_seq), buf->data + hdr->data_offset * 4, last_out.len);
+}
+
+static void handler(tcp_connect_t *connect, connect_state_t state)
+{
+        if (state == TCP_CONN_CONNECTED)
+                conn = connect;
+}
+
+static void check(int ok, const char *what)
+{
+        if (!ok)
+        {
+                fprintf(stderr, "check failed: %s\n", what);
+                failed = 1;
+        }
+}
+
+static void send_data(uint16_t port, uint32_t seq, uint32_t ack, tcp_flags_t flags, const uint8_t *data, size_t len)
+{
+        buf_init(&seg, bench_tcp_len(flags, len));
+        bench_tcp_seg(seg.data, peer_ip, port, 80, seq, ack, flags, data, len);
+        tcp_in(&seg, peer_ip);
+}
+
+static void send_seg(uint16_t port, uint32_t seq, uint32_t ack, tcp_flags_t flags)
+{
+        send_data(port, seq, ack, flags, NULL, 0);
+}
+
+/**
+ * @brief 推进时钟并运行一次定时器
+ *
+ * @param ms 毫秒数
+ */
+static void advance(uint64_t ms)
+{
+        now_ms += ms;
+        tcp_poll();
+}
+
+/**
+ * @brief 从 port 完成三次握手
+ *
+ * @param port 对端端口
+ * @param isn 对端初始序号
+ * @return uint32_t 本端的初始序号 + 1，握手失败时 conn 为 NULL
+ */
+static uint32_t handshake(uint16_t port, uint32_t isn)
+{
+        conn = NULL;
+        send_seg(port, isn, 0, flags_syn);
+        if (!last_out.flags.syn || !last_out.flags.ack || last_out.port != port || last_out.ack != isn + 1)
+                return 0;
+        uint32_t iss = last_out.seq + 1;
+        send_seg(port, isn + 1, iss, tcp_flags_ack);
+        return iss;
+}
+
+/**
+ * @brief 本端主动关闭 port 上的连接，对端确认并同时发 FIN，连接进入 TIME_WAIT
+ *
+ * @return int 成功为 1
+ */
+static int active_close(uint16_t port, uint32_t isn, uint32_t iss)
+{
+        tcp_connect_close(conn);
+        if (!last_out.flags.fin || last_out.seq != iss)
+                return 0;
+        send_seg(port, isn + 1, iss + 1, tcp_flags_ack_fin);
+        return last_out.flags.ack && !last_out.flags.fin && last_out.ack == isn + 2;
+}
+
+static void test_timewait()
+{
+        tcp_stat_t stat;
+        uint32_t isn = 1000;
+        uint32_t iss = handshake(40000, isn);
+        check(conn != NULL, "handshake");
+        check(active_close(40000, isn, iss), "active close acks the peer's FIN");
+        tcp_get_stat(&stat);
+        check(stat.timewait == 1 && stat.connects == 0, "connection moved into TIME_WAIT");
+
+        // 对端没收到我们的 ACK，重传 FIN：回复 ACK，不能复位
+        size_t count = last_out.count;
+        send_seg(40000, isn + 1, iss + 1, tcp_flags_ack_fin);
+        check(last_out.count == count + 1 && last_out.flags.ack && !last_out.flags.rst, "retransmitted FIN is acked");
+        check(last_out.seq == iss + 1 && last_out.ack == isn + 2, "ACK carries the old sequence numbers");
+        send_seg(40000, isn + 1, iss + 1, flags_rst);
+        tcp_get_stat(&stat);
+        check(stat.timewait == 1, "RST does not end TIME_WAIT");
+
+        // 同一四元组更大序号的 SYN：删除记录，新连接的初始序号大于旧连接
+        send_seg(40000, isn + 100000, 0, flags_syn);
+        tcp_get_stat(&stat);
+        check(last_out.flags.syn && last_out.flags.ack && last_out.ack == isn + 100001, "SYN with a higher ISN reuses the 4-tuple");
+        check((int32_t)(last_out.seq - (iss + 1)) > 0, "new ISN is above the old connection's");
+        check(stat.timewait == 0 && stat.half_open == 1, "TIME_WAIT record replaced by a half-open connection");
+        send_seg(40000, isn + 100001, 0, flags_rst);
+
+        // 2MSL 之后记录到期
+        isn = 5000;
+        iss = handshake(40001, isn);
+        check(conn != NULL && active_close(40001, isn, iss), "second connection into TIME_WAIT");
+        advance((2 * TCP_MSL_SEC - 2) * 1000);
+        tcp_get_stat(&stat);
+        check(stat.timewait == 1, "TIME_WAIT kept before 2MSL");
+        advance(3000);
+        tcp_get_stat(&stat);
+        check(stat.timewait == 0, "TIME_WAIT expires after 2MSL");
+
+        // 记录删除后的 FIN 按没有连接处理，复位
+        send_seg(40001, isn + 1, iss + 1, tcp_flags_ack_fin);
+        check(last_out.flags.rst, "FIN after 2MSL is reset");
+}
+
+static void test_delayed_ack()
+{
+        static uint8_t data[100];
+        uint32_t isn = 20000, seq = isn + 1;
+        uint32_t iss = handshake(40010, isn);
+        check(conn != NULL, "handshake");
+
+        // 第一个段等待，第二个段攒够 TCP_DELACK_SEGS，立即发一个 ACK 确认两个段
+        size_t count = last_out.count;
+        send_data(40010, seq, iss, tcp_flags_ack, data, sizeof(data));
+        seq += sizeof(data);
+        check(last_out.count == count && conn->ack_pending == 1, "single segment is not acked at once");
+        send_data(40010, seq, iss, tcp_flags_ack, data, sizeof(data));
+        seq += sizeof(data);
+        check(last_out.count == count + 1 && last_out.len == 0 && last_out.ack == seq, "second segment acked at once");
+        check(conn->acks_delayed == 1 && conn->ack_pending == 0, "two segments share one ACK");
+
+        // 只有一个段时由定时器在 TCP_DELACK_MS 后确认，这个 ACK 没有省掉什么
+        count = last_out.count;
+        send_data(40010, seq, iss, tcp_flags_ack, data, sizeof(data));
+        seq += sizeof(data);
+        advance(TCP_DELACK_MS / 2);
+        check(last_out.count == count, "ACK held before the deadline");
+        advance(TCP_DELACK_MS);
+        check(last_out.count == count + 1 && last_out.ack == seq, "ACK sent by the timer");
+        check(conn->acks_delayed == 1, "timer ACK saves nothing");
+
+        // 等待期间应用层回复，ACK 捎带在数据段上
+        send_data(40010, seq, iss, tcp_flags_ack, data, sizeof(data));
+        seq += sizeof(data);
+        count = last_out.count;
+        tcp_connect_write(conn, data, 10);
+        check(last_out.count == count + 1 && last_out.len == 10 && last_out.ack == seq, "ACK piggybacked on the reply");
+        check(conn->acks_delayed == 2 && conn->ack_pending == 0, "piggybacked ACK counted as delayed");
+        send_seg(40010, seq, 0, flags_rst);
+}
+
+static void test_nagle()
+{
+        static uint8_t data[2 * 1460];
+        uint32_t isn = 30000, seq = isn + 1;
+        uint32_t iss = handshake(40020, isn);
+        check(conn != NULL && conn->remote_mss == 1460, "handshake");
+
+        // Nagle：没有在途数据时小段立即发出，有在途数据时攒着，ACK 回来后合并成一个段
+        tcp_connect_write(conn, data, 100);
+        check(conn->segs_out == 1 && last_out.len == 100 && last_out.flags.psh, "small write sent when nothing is in flight");
+        tcp_connect_write(conn, data, 100);
+        tcp_connect_write(conn, data, 100);
+        check(conn->segs_out == 1, "small writes held while data is in flight");
+        send_seg(40020, seq, iss + 100, tcp_flags_ack);
+        check(conn->segs_out == 2 && last_out.seq == iss + 100 && last_out.len == 200, "held writes coalesced after the ACK");
+        send_seg(40020, seq, iss + 300, tcp_flags_ack);
+
+        // cork：只发满 MSS 的段，取消 cork 时发出剩下的尾巴
+        tcp_connect_cork(conn, 1);
+        tcp_connect_write(conn, data, 100);
+        check(conn->segs_out == 2, "corked small write held");
+        tcp_connect_write(conn, data, sizeof(data));
+        check(conn->segs_out == 4 && last_out.len == 1460 && !last_out.flags.psh, "full segments sent while corked");
+        tcp_connect_cork(conn, 0);
+        check(conn->segs_out == 5 && last_out.len == 100 && last_out.flags.psh, "uncork sends the tail");
+        send_seg(40020, seq, iss + 3320, tcp_flags_ack);
+
+        // flush 不管 Nagle，立即发出攒着的数据
+        tcp_connect_write(conn, data, 10);
+        tcp_connect_write(conn, data, 10);
+        check(conn->segs_out == 6, "second small write held by Nagle");
+        tcp_connect_flush(conn);
+        check(conn->segs_out == 7 && last_out.seq == iss + 3330 && last_out.len == 10, "flush sends held data");
+        send_seg(40020, seq, iss + 3340, tcp_flags_ack);
+
+        // nodelay：每次小段写入都立即发出
+        tcp_connect_set_nodelay(conn, 1);
+        tcp_connect_write(conn, data, 10);
+        tcp_connect_write(conn, data, 10);
+        check(conn->segs_out == 9, "nodelay sends every small write");
+        send_seg(40020, seq, 0, flags_rst);
+}
+
+static void test_ring_wrap()
+{
+        enum { ROUNDS = 25, CHUNK = 3001 }; // 奇数长度，让回绕点落在段中间的奇数偏移上
+        static uint8_t data[ROUNDS * CHUNK], out[ROUNDS * CHUNK];
+        for (size_t i = 0; i < sizeof(data); i++)
+                data[i] = i % 251;
+        uint32_t isn = 40000, seq = isn + 1;
+        uint32_t iss = handshake(40030, isn);
+        check(conn != NULL, "handshake");
+
+        // 每轮写一块并等对端确认，累计写入超过 tx_buf 的大小，写入位置回绕
+        sink = out;
+        sink_seq = iss;
+        size_t written = 0;
+        for (int i = 0; i < ROUNDS; i++)
+        {
+                written += tcp_connect_write(conn, data + i * CHUNK, CHUNK);
+                tcp_connect_flush(conn);
+                send_seg(40030, seq, iss + written, tcp_flags_ack);
+        }
+        sink = NULL;
+        check(written == sizeof(data) && sizeof(data) > TCP_TX_BUF_SIZE, "writes wrap around tx_buf");
+        check(conn->segs_out == ROUNDS * 3, "each chunk sent as three segments");
+        check(memcmp(out, data, sizeof(data)) == 0, "payload across the wrap");
+        send_seg(40030, seq, 0, flags_rst);
+}
+
+static void test_seq_wrap()
+{
+        static uint8_t data[1000];
+        uint32_t isn = 50000, seq = isn + 1;
+        check(handshake(40040, isn) && conn != NULL, "handshake");
+
+        // 初始序号是随机的，这里直接把还没发过数据的连接挪到 2^32 之前，让这次发送越过回绕点
+        uint32_t iss = 0xFFFFFF00, end = iss + sizeof(data);
+        conn->unack_seq = conn->next_seq = iss;
+        tcp_connect_write(conn, data, sizeof(data));
+        check(last_out.seq == iss && last_out.len == sizeof(data), "segment sent across the wrap");
+        send_seg(40040, seq, end, tcp_flags_ack);
+        check(conn->unack_seq == end && conn->tx_len == 0, "ACK past the wrap acknowledges the data");
+        tcp_connect_write(conn, data, 10);
+        check(conn->segs_out == 2 && last_out.seq == end, "next write not held by Nagle");
+        send_seg(40040, seq, 0, flags_rst);
+}
+
+int main()
+{
+        tcp_init();
+        tcp_open(80, handler);
+        test_timewait();
+        test_delayed_ack();
+        test_nagle();
+        test_ring_wrap();
+        test_seq_wrap();
+        check(!last_out.bad_checksum, "checksum of every segment sent");
+        tcp_fini();
+        fprintf(stderr, failed ? "FAILED\n" : "all passed\n");
+        return failed;
+}
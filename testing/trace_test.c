@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "trace.h"
+
+/*
+ * 跟踪环的测试：
+ * 1 子进程把跟踪区映射在文件上，用两个环（相当于两个协议栈实例）记录事件，其中一个环绕了好几圈，
+ *   然后 abort 模拟崩溃；父进程映射这个文件解码，检查每个环最后的记录都在、按时间排序、文本事件能还原；
+ * 2 内存里的跟踪区：归还的环可以被再次领取，领完之后的记录被丢弃而不是写坏别的环。
+ *
+ * 用法：trace_test [跟踪文件]
+ */
+
+#define WRAP_EVENTS (TRACE_RING_SIZE * 3 + 7) // 第一个环写的事件数，只留下最后 TRACE_RING_SIZE 条
+#define SIDE_EVENTS 10                        // 第二个环写的事件数
+
+static int failed;
+
+static void check(int ok, const char *what)
+{
+        if (!ok)
+        {
+                fprintf(stderr, "check failed: %s\n", what);
+                failed = 1;
+        }
+}
+
+static void child_crash(const char *path)
+{
+        struct rlimit no_core = {0, 0};
+        setrlimit(RLIMIT_CORE, &no_core);
+        if (trace_init(path) != 0)
+                _exit(2);
+        trace_ring_t *busy = NULL, *side = NULL;
+        for (uint32_t i = 0; i < WRAP_EVENTS; i++)
+        {
+                trace_emit(&busy, TRACE_TCP_IN, 1000, 80, i, 0, 0x12);
+                if (i % (WRAP_EVENTS / SIDE_EVENTS) == 0 && i / (WRAP_EVENTS / SIDE_EVENTS) < SIDE_EVENTS - 1)
+                        trace_emit(&side, TRACE_HTTP_CONNECTED, i, 0, 0, 0, 0);
+        }
+        trace_emit_text(&side, TRACE_HTTP_REQUEST, 4321, "/index.html?with-a-long-query", 29);
+        abort();
+}
+
+/* 崩溃后解码跟踪文件 */
+static void test_crash(const char *path)
+{
+        pid_t pid = fork();
+        if (pid == 0)
+                child_crash(path);
+        int status;
+        waitpid(pid, &status, 0);
+        check(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, "child crashed with SIGABRT");
+
+        size_t size;
+        const trace_area_t *area = trace_map_file(path, &size);
+        check(area != NULL && size == sizeof(trace_area_t), "trace file mapped");
+        if (area == NULL)
+                return;
+        check(area->ring[0].head == WRAP_EVENTS && area->ring[1].head == SIDE_EVENTS, "ring heads survive the crash");
+
+        char *text = NULL;
+        size_t text_len = 0;
+        FILE *out = open_memstream(&text, &text_len);
+        size_t n = trace_decode(area, size, out);
+        fclose(out);
+        check(n == TRACE_RING_SIZE + SIDE_EVENTS, "decoded records = ring size + side events");
+        check(strstr(text, "http request from port 4321: /index.html?with\n") != NULL, "text event truncated to 16 bytes");
+        char last[64];
+        snprintf(last, sizeof(last), "tcp in 1000 -> 80 seq %u ack 0 flags 12\n", WRAP_EVENTS - 1);
+        check(strstr(text, last) != NULL, "newest record of the wrapped ring");
+        snprintf(last, sizeof(last), "seq %u ack", WRAP_EVENTS - TRACE_RING_SIZE - 1);
+        check(strstr(text, last) == NULL, "overwritten records are gone");
+
+        double prev = -1, ts;
+        int sorted = 1;
+        for (char *line = strchr(text, '\n'); line && sscanf(line + 1, "%lf", &ts) == 1; line = strchr(line + 1, '\n'))
+        {
+                sorted &= ts >= prev;
+                prev = ts;
+        }
+        check(sorted, "records sorted by time");
+        free(text);
+}
+
+/* 内存里的跟踪区：领取、归还和领完 */
+static void test_rings()
+{
+        check(trace_init(NULL) == 0, "in-memory trace area");
+        trace_ring_t *rings[TRACE_RINGS + 1] = {0};
+        for (int i = 0; i <= TRACE_RINGS; i++)
+                trace_emit(&rings[i], TRACE_TCP_LISTEN, i, 128, 0, 0, 0);
+        check(rings[TRACE_RINGS - 1] != NULL && rings[TRACE_RINGS] == NULL, "one ring per instance until they run out");
+
+        trace_ring_t *released = rings[3];
+        trace_release(released);
+        trace_emit(&rings[TRACE_RINGS], TRACE_TCP_LISTEN, 99, 128, 0, 0, 0);
+        check(rings[TRACE_RINGS] == released, "released ring is claimed again");
+
+        FILE *out = fopen("/dev/null", "w");
+        check(trace_decode(NULL, 0, out) == TRACE_RINGS + 1, "live decode sees every committed record");
+        fclose(out);
+
+        trace_rec_t rec = {.event = TRACE_TCP_RESET, .arg = {5000, 80, 7}};
+        char line[128];
+        trace_format(&rec, line, sizeof(line));
+        check(!strcmp(line, "tcp reset 5000 -> 80 seq 7"), "format of a plain event");
+        rec.event = TRACE_MAX + 3;
+        check(trace_format(&rec, line, sizeof(line)) == -1 && !strncmp(line, "event ", 6), "unknown event");
+        check(trace_format(&(trace_rec_t){.event = TRACE_TCP_RESET, .arg = {5000, 80, 7}}, line, 8) == 0 &&
+                  !strcmp(line, "tcp res"),
+              "format truncates to the buffer");
+        trace_close();
+}
+
+int main(int argc, char *argv[])
+{
+        const char *path = argc > 1 ? argv[1] : "trace_test.trace";
+        test_crash(path);
+        test_rings();
+        unlink(path);
+        fprintf(stderr, failed ? "FAILED\n" : "all passed\n");
+        return failed;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include "config.h"
+#include "trace.h"
+
+/*
+ * 解码跟踪文件：把协议栈写在跟踪文件（config.h 的 NET_TRACE_FILE）里的二进制记录按时间顺序格式化输出。
+ * 进程崩溃或被杀掉之后，文件里仍然是每个协议栈实例最后 TRACE_RING_SIZE 条记录。
+ *
+ * 用法：trace_decode [跟踪文件]
+ */
+
+int main(int argc, char *argv[])
+{
+        const char *path = argc > 1 ? argv[1] : NET_TRACE_FILE;
+        size_t size;
+        const trace_area_t *area = trace_map_file(path, &size);
+        if (area == NULL)
+        {
+                fprintf(stderr, "cannot map %s\n", path);
+                return 1;
+        }
+        if (size < sizeof(trace_area_t) || area->magic != TRACE_MAGIC)
+        {
+                fprintf(stderr, "%s is not a trace file\n", path);
+                return 1;
+        }
+        if (area->version != TRACE_VERSION || area->rings != TRACE_RINGS || area->ring_size != TRACE_RING_SIZE)
+        {
+                fprintf(stderr, "%s has layout version %u with %u rings of %u records, this decoder expects %d, %d, %d\n",
+                        path, area->version, area->rings, area->ring_size, TRACE_VERSION, TRACE_RINGS, TRACE_RING_SIZE);
+                return 1;
+        }
+        size_t n = trace_decode(area, size, stdout);
+        fprintf(stderr, "%zu records\n", n);
+        return 0;
+}